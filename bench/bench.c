@@ -0,0 +1,381 @@
+#define _GNU_SOURCE /* for mkdtemp, nftw */
+#include <pndman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "bench.h"
+
+/* \brief timings of single benchmark */
+typedef struct bench_result
+{
+   const char *name;
+   unsigned int runs;
+   double min, max, sum;
+} bench_result;
+
+enum {
+   BENCH_SYNC,
+   BENCH_INSTALL,
+   BENCH_COMMIT,
+   BENCH_READ_DB,
+   BENCH_CRAWL,
+   BENCH_CHECK_UPDATES,
+   BENCH_UPGRADE,
+   BENCH_COUNT
+};
+
+static bench_result bench_results[BENCH_COUNT] = {
+   { "sync",          0, 0, 0, 0 },
+   { "install",       0, 0, 0, 0 },
+   { "commit",        0, 0, 0, 0 },
+   { "read_db",       0, 0, 0, 0 },
+   { "crawl",         0, 0, 0, 0 },
+   { "check_updates", 0, 0, 0, 0 },
+   { "upgrade",       0, 0, 0, 0 },
+};
+
+static int bench_failed = 0;
+
+/* \brief wall clock in seconds */
+static double bench_now(void)
+{
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* \brief record run of benchmark */
+static void bench_record(int bench, double start)
+{
+   double t = bench_now() - start;
+   bench_result *r = &bench_results[bench];
+   if (!r->runs || t < r->min) r->min = t;
+   if (t > r->max) r->max = t;
+   r->sum += t;
+   r->runs++;
+}
+
+/* \brief error out */
+static void bench_err(const char *str)
+{
+   fprintf(stderr, "pndman-bench: %s\n", str);
+   exit(EXIT_FAILURE);
+}
+
+/* \brief nftw callback for removing work directory */
+static int bench_rm(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+   (void)st; (void)flag; (void)ftw;
+   return remove(path);
+}
+
+/* \brief generate PNDs and master list of set->release to work directory */
+static void bench_publish(const char *work, const char *base, const bench_set *set, int bzip)
+{
+   char path[2048], *json, *bz;
+   size_t len, bzlen;
+
+   snprintf(path, sizeof(path), "%s/www/pnd", work);
+   if (bench_generate_pnds(path, set) != 0)
+      bench_err("failed to generate PNDs");
+   if (!(json = bench_generate_masterlist(path, base, set, set->release, &len)))
+      bench_err("failed to generate master list");
+
+   snprintf(path, sizeof(path), "%s/www/masterlist.json", work);
+   if (bench_write_file(path, json, len) != 0)
+      bench_err("failed to write master list");
+   if (bzip) {
+      if (!(bz = bench_bzip2(json, len, &bzlen)))
+         bench_err("failed to compress master list");
+      snprintf(path, sizeof(path), "%s/www/masterlist.json.bz2", work);
+      if (bench_write_file(path, bz, bzlen) != 0)
+         bench_err("failed to write master list");
+      free(bz);
+   }
+   free(json);
+}
+
+/* \brief sync and install callbacks */
+static void bench_sync_cb(pndman_curl_code code, pndman_sync_handle *handle)
+{
+   if (code == PNDMAN_CURL_FAIL) {
+      fprintf(stderr, "sync failed: %s\n", handle->error);
+      bench_failed++;
+   }
+}
+
+static void bench_install_cb(pndman_curl_code code, pndman_package_handle *handle)
+{
+   if (code == PNDMAN_CURL_FAIL) {
+      fprintf(stderr, "install of %s failed: %s\n", handle->name, handle->error);
+      bench_failed++;
+   }
+}
+
+/* \brief full sync of repository, timed if record */
+static void bench_sync(pndman_repository *repo, int record)
+{
+   pndman_sync_handle handle;
+   double start = bench_now();
+
+   pndman_repository_clear(repo);
+   pndman_sync_handle_init(&handle);
+   handle.repository = repo;
+   handle.flags      = PNDMAN_SYNC_FULL;
+   handle.callback   = bench_sync_cb;
+   if (pndman_sync_handle_perform(&handle) != 0)
+      bench_err("sync perform failed");
+   while (pndman_curl_process(0, 1000) > 0);
+   pndman_sync_handle_free(&handle);
+   if (record) bench_record(BENCH_SYNC, start);
+}
+
+/* \brief install every served package to device */
+static void bench_install(pndman_repository *list, pndman_device *device, unsigned int count)
+{
+   pndman_package *pnd;
+   pndman_package_handle *handle;
+   unsigned int i, n = 0;
+   double start = bench_now();
+
+   if (!(handle = calloc(count, sizeof(pndman_package_handle))))
+      bench_err("out of memory");
+
+   for (pnd = list->next->pnd; pnd && n != count; pnd = pnd->next, ++n) {
+      pndman_package_handle_init(pnd->id, &handle[n]);
+      handle[n].pnd      = pnd;
+      handle[n].device   = device;
+      handle[n].flags    = PNDMAN_PACKAGE_INSTALL | PNDMAN_PACKAGE_INSTALL_MENU;
+      handle[n].callback = bench_install_cb;
+      if (pndman_package_handle_perform(&handle[n]) != 0)
+         bench_err("install perform failed");
+   }
+
+   while (pndman_curl_process(0, 1000) > 0);
+
+   for (i = 0; i != n; ++i) {
+      if (handle[i].progress.done && !handle[i].error &&
+          pndman_package_handle_commit(&handle[i], list) != 0)
+         bench_failed++;
+      pndman_package_handle_free(&handle[i]);
+   }
+   free(handle);
+   bench_record(BENCH_INSTALL, start);
+}
+
+/* \brief upgrade every package that has update, as one transaction */
+static void bench_upgrade(pndman_repository *list, pndman_device *device)
+{
+   pndman_transaction *transaction;
+   pndman_package_handle *handle;
+   pndman_package *pnd;
+   double start = bench_now();
+
+   if (!(transaction = pndman_transaction_new(list, device)))
+      bench_err("out of memory");
+
+   for (pnd = list->pnd; pnd; pnd = pnd->next) {
+      if (!pnd->update) continue;
+      if (!(handle = pndman_transaction_add(transaction, pnd->update, device, PNDMAN_PACKAGE_INSTALL)))
+         bench_err("failed to add upgrade to transaction");
+      handle->callback = bench_install_cb;
+   }
+
+   if (pndman_transaction_perform(transaction) != 0)
+      bench_err("upgrade perform failed");
+   while (pndman_curl_process(0, 1000) > 0);
+   if (pndman_transaction_commit(transaction) != 0)
+      bench_failed++;
+   pndman_transaction_free(transaction);
+   bench_record(BENCH_UPGRADE, start);
+}
+
+/* \brief forget updates found by previous check */
+static void bench_clear_updates(pndman_repository *list)
+{
+   pndman_repository *r;
+   pndman_package *p;
+   for (r = list; r; r = r->next)
+      for (p = r->pnd; p; p = p->next) p->update = NULL;
+}
+
+/* \brief read database back from device */
+static void bench_read_db(const char *url, pndman_device *device)
+{
+   pndman_repository *list;
+   double start = bench_now();
+
+   list = pndman_repository_init();
+   pndman_repository_add(url, list);
+   pndman_device_read_repository(list, device);
+   pndman_repository_free_all(list);
+   bench_record(BENCH_READ_DB, start);
+}
+
+/* \brief print results as JSON */
+static void bench_print(FILE *f, const bench_set *set, unsigned int delay, int bzip,
+      unsigned int runs, int updates, unsigned int requests)
+{
+   pndman_metric_value v;
+   bench_result *r;
+   int i;
+
+   fprintf(f, "{\n  \"libpndman\": \"%s\",\n", pndman_git_head());
+   fprintf(f, "  \"config\": {\"pnds\": %u, \"pnd_size\": %zu, \"packages\": %u, "
+         "\"delay_ms\": %u, \"bzip\": %s, \"runs\": %u},\n",
+         set->pnds, set->pnd_size, set->packages, delay, (bzip ? "true" : "false"), runs);
+   fprintf(f, "  \"results\": {\n");
+   for (i = 0; i != BENCH_COUNT; ++i) {
+      r = &bench_results[i];
+      fprintf(f, "    \"%s\": {\"runs\": %u, \"min\": %.6f, \"mean\": %.6f, \"max\": %.6f}%s\n",
+            r->name, r->runs, r->min, (r->runs ? r->sum / r->runs : 0), r->max,
+            (i + 1 != BENCH_COUNT ? "," : ""));
+   }
+   fprintf(f, "  },\n  \"updates_found\": %d,\n  \"requests\": %u,\n  \"failures\": %d,\n",
+         updates, requests, bench_failed);
+   fprintf(f, "  \"metrics\": {\n");
+   for (i = 0; i != PNDMAN_METRIC_COUNT; ++i) {
+      pndman_metrics_get(i, &v);
+      fprintf(f, "    \"%s\": {\"count\": %llu, \"sum\": %llu, \"min\": %llu, \"max\": %llu}%s\n",
+            v.name, (unsigned long long)v.count, (unsigned long long)v.sum,
+            (unsigned long long)v.min, (unsigned long long)v.max,
+            (i + 1 != PNDMAN_METRIC_COUNT ? "," : ""));
+   }
+   fprintf(f, "  }\n}\n");
+}
+
+static void usage(const char *name)
+{
+   fprintf(stderr,
+         "usage: %s [options]\n"
+         "  -n <count>   PND files to generate and install (default 50)\n"
+         "  -s <bytes>   payload size of generated PND (default 262144)\n"
+         "  -m <count>   packages in master list (default 2000)\n"
+         "  -r <runs>    runs of repeatable benchmarks (default 5)\n"
+         "  -d <ms>      delay of every HTTP response (default 0)\n"
+         "  -z           serve bzip2 compressed master list\n"
+         "  -w <dir>     work directory (default temporary, removed afterwards)\n"
+         "  -o <file>    write results to file instead of stdout\n", name);
+   exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+   bench_set set;
+   bench_server *server;
+   pndman_repository *list, *repo;
+   pndman_device *device;
+   char work[1024], path[2048], url[256], base[128];
+   const char *output = NULL;
+   unsigned int runs = 5, delay = 0, i;
+   int bzip = 0, keep = 0, updates = 0, opt;
+   double start;
+   FILE *f;
+
+   memset(&set, 0, sizeof(set));
+   set.pnds     = 50;
+   set.pnd_size = 256 * 1024;
+   set.packages = 2000;
+   set.release  = 1;
+   snprintf(work, sizeof(work), "/tmp/pndman-bench-XXXXXX");
+
+   while ((opt = getopt(argc, argv, "n:s:m:r:d:zw:o:h")) != -1) {
+      switch (opt) {
+         case 'n': set.pnds     = strtoul(optarg, NULL, 10); break;
+         case 's': set.pnd_size = strtoul(optarg, NULL, 10); break;
+         case 'm': set.packages = strtoul(optarg, NULL, 10); break;
+         case 'r': runs         = strtoul(optarg, NULL, 10); break;
+         case 'd': delay        = strtoul(optarg, NULL, 10); break;
+         case 'z': bzip = 1; break;
+         case 'w': snprintf(work, sizeof(work), "%s", optarg); keep = 1; break;
+         case 'o': output = optarg; break;
+         default: usage(argv[0]);
+      }
+   }
+   if (set.packages < set.pnds) set.packages = set.pnds;
+   if (!runs) runs = 1;
+
+   /* work directory layout:
+    * www/masterlist.json(.bz2), www/pnd/<id>.pnd, device/ */
+   if (keep) mkdir(work, 0755);
+   else if (!mkdtemp(work)) bench_err("can't create work directory");
+   snprintf(path, sizeof(path), "%s/www", work);      mkdir(path, 0755);
+   snprintf(path, sizeof(path), "%s/www/pnd", work);  mkdir(path, 0755);
+   snprintf(path, sizeof(path), "%s/device", work);   mkdir(path, 0755);
+
+   /* release 1 is what gets installed */
+   fprintf(stderr, "generating %u PNDs and master list of %u packages to %s\n", set.pnds, set.packages, work);
+   if (!(server = bench_server_start((snprintf(path, sizeof(path), "%s/www", work), path), delay)))
+      bench_err("failed to start server");
+   snprintf(base, sizeof(base), "http://127.0.0.1:%u", bench_server_port(server));
+   snprintf(url, sizeof(url), "%s/masterlist.json%s", base, (bzip ? "?bzip=true" : ""));
+   bench_publish(work, base, &set, bzip);
+
+   /* benchmark */
+   pndman_metrics_enable(1);
+   snprintf(path, sizeof(path), "%s/device", work);
+   if (!(device = pndman_device_add(path, NULL)))
+      bench_err("failed to add device");
+   list = pndman_repository_init();
+   if (!(repo = pndman_repository_add(url, list)))
+      bench_err("failed to add repository");
+
+   fprintf(stderr, "sync\n");
+   for (i = 0; i != runs; ++i) bench_sync(repo, 1);
+
+   fprintf(stderr, "install\n");
+   bench_install(list, device, set.pnds);
+
+   fprintf(stderr, "commit\n");
+   for (i = 0; i != runs; ++i) {
+      repo->commited = 0; /* force repo.db write too */
+      start = bench_now();
+      if (pndman_repository_commit_all(list, device) != 0) bench_failed++;
+      bench_record(BENCH_COMMIT, start);
+   }
+
+   fprintf(stderr, "read database\n");
+   for (i = 0; i != runs; ++i) bench_read_db(url, device);
+
+   fprintf(stderr, "crawl\n");
+   for (i = 0; i != runs; ++i) {
+      start = bench_now();
+      if (pndman_package_crawl(0, device, list) < 0) bench_failed++;
+      bench_record(BENCH_CRAWL, start);
+   }
+
+   /* publish release 2 of every package */
+   fprintf(stderr, "check updates\n");
+   set.release++;
+   bench_publish(work, base, &set, bzip);
+   bench_sync(repo, 0);
+   for (i = 0; i != runs; ++i) {
+      bench_clear_updates(list);
+      start = bench_now();
+      updates = pndman_repository_check_updates(list);
+      bench_record(BENCH_CHECK_UPDATES, start);
+   }
+
+   fprintf(stderr, "upgrade\n");
+   bench_upgrade(list, device);
+
+   /* results */
+   f = stdout;
+   if (output && !(f = fopen(output, "w")))
+      bench_err("can't open output file");
+   bench_print(f, &set, delay, bzip, runs, updates, bench_server_requests(server));
+   if (f != stdout) fclose(f);
+
+   pndman_repository_free_all(list);
+   pndman_device_free_all(device);
+   bench_server_stop(server);
+   if (!keep) nftw(work, bench_rm, 16, FTW_DEPTH | FTW_PHYS);
+   return (bench_failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,55 @@
+#ifndef __bench_h__
+#define __bench_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* \brief generated package set */
+typedef struct bench_set
+{
+   unsigned int pnds;     /* PND files generated */
+   unsigned int packages; /* packages listed in master list */
+   size_t pnd_size;       /* payload size of single PND */
+   int release;           /* version release of generated PNDs */
+} bench_set;
+
+/* \brief local repository stand-in */
+typedef struct bench_server bench_server;
+
+/* \brief generate synthetic PND with PXML and PNG trailers,
+ * payload is deterministic for index. */
+int bench_generate_pnd(const char *path, unsigned int index, size_t size, int release);
+
+/* \brief generate set->pnds PND files to directory */
+int bench_generate_pnds(const char *dir, const bench_set *set);
+
+/* \brief generate master list JSON of set->packages packages,
+ * first set->pnds of them point to generated files in pnd_dir.
+ * release is the version listed in repository. Remember to free result. */
+char* bench_generate_masterlist(const char *pnd_dir, const char *base_url,
+      const bench_set *set, int release, size_t *len);
+
+/* \brief bzip2 compress buffer, remember to free result */
+char* bench_bzip2(const char *data, size_t len, size_t *out_len);
+
+/* \brief write buffer to file */
+int bench_write_file(const char *path, const char *data, size_t len);
+
+/* \brief start HTTP server serving files from root,
+ * every response is delayed by delay_ms.
+ * Supports single byte ranges and If-Modified-Since,
+ * ?bzip=true query serves <file>.bz2 instead. */
+bench_server* bench_server_start(const char *root, unsigned int delay_ms);
+
+/* \brief port server listens on */
+unsigned short bench_server_port(bench_server *server);
+
+/* \brief number of requests served */
+unsigned int bench_server_requests(bench_server *server);
+
+/* \brief stop server */
+void bench_server_stop(bench_server *server);
+
+#endif /* __bench_h__ */
+
+/* vim: set ts=8 sw=3 tw=0 :*/
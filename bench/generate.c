@@ -0,0 +1,241 @@
+#include <pndman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <bzlib.h>
+#include <sys/stat.h>
+#include "bench.h"
+
+#define BENCH_PXML \
+   "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" \
+   "<PXML xmlns=\"http://openpandora.org/namespaces/PXML\">\n" \
+   "  <package id=\"bench-%05u\">\n" \
+   "    <author name=\"Bench Author %u\" website=\"http://example.org/%u\" email=\"bench@example.org\"/>\n" \
+   "    <version major=\"1\" minor=\"0\" release=\"%d\" build=\"%u\" type=\"release\"/>\n" \
+   "    <titles>\n" \
+   "      <title lang=\"en_US\">Bench Package %u</title>\n" \
+   "      <title lang=\"fi_FI\">Testipaketti %u</title>\n" \
+   "    </titles>\n" \
+   "    <descriptions>\n" \
+   "      <description lang=\"en_US\">Synthetic package %u generated for libpndman benchmarks. " \
+   "It has no real content, but its metadata looks like what the repository serves.</description>\n" \
+   "    </descriptions>\n" \
+   "    <icon src=\"icon.png\"/>\n" \
+   "  </package>\n" \
+   "  <application id=\"bench-%05u-app\" appdata=\"bench%05u\">\n" \
+   "    <exec command=\"run.sh\" background=\"true\" standalone=\"true\" x11=\"req\"/>\n" \
+   "    <author name=\"Bench Author %u\" website=\"http://example.org/%u\"/>\n" \
+   "    <version major=\"1\" minor=\"0\" release=\"%d\" build=\"%u\"/>\n" \
+   "    <osversion major=\"1\" minor=\"0\" release=\"0\" build=\"0\"/>\n" \
+   "    <titles><title lang=\"en_US\">Bench Application %u</title></titles>\n" \
+   "    <descriptions><description lang=\"en_US\">Application of bench package %u.</description></descriptions>\n" \
+   "    <icon src=\"icon.png\"/>\n" \
+   "    <previewpics><pic src=\"preview.png\"/></previewpics>\n" \
+   "    <info name=\"Readme\" type=\"text/plain\" src=\"readme.txt\"/>\n" \
+   "    <licenses><license name=\"GPLv2+\" url=\"http://www.gnu.org/licenses/gpl-2.0.html\" sourcecodeurl=\"http://example.org/src\"/></licenses>\n" \
+   "    <categories>\n" \
+   "      <category name=\"%s\"><subcategory name=\"%s\"/></category>\n" \
+   "    </categories>\n" \
+   "    <clockspeed frequency=\"600\"/>\n" \
+   "  </application>\n" \
+   "</PXML>\n"
+
+/* \brief smallest valid PNG, 1x1 transparent pixel */
+static const unsigned char bench_png[] = {
+   0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d,
+   0x49, 0x48, 0x44, 0x52, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+   0x08, 0x06, 0x00, 0x00, 0x00, 0x1f, 0x15, 0xc4, 0x89, 0x00, 0x00, 0x00,
+   0x0d, 0x49, 0x44, 0x41, 0x54, 0x78, 0x9c, 0x63, 0x60, 0x00, 0x02, 0x00,
+   0x00, 0x05, 0x00, 0x01, 0xe9, 0xfa, 0xdc, 0xd8, 0x00, 0x00, 0x00, 0x00,
+   0x49, 0x45, 0x4e, 0x44, 0xae, 0x42, 0x60, 0x82
+};
+
+/* \brief categories used by packages */
+static const char *bench_category[][2] = {
+   { "Game",    "ArcadeGame"  },
+   { "Game",    "Emulator"    },
+   { "Utility", "FileManager" },
+   { "Network", "WebBrowser"  },
+   { "Office",  "TextEditor"  },
+};
+#define BENCH_CATEGORIES (sizeof(bench_category) / sizeof(bench_category[0]))
+
+/* \brief growing string buffer */
+typedef struct bench_buffer
+{
+   char *data;
+   size_t len, size;
+} bench_buffer;
+
+/* \brief append formatted string to buffer */
+static int bench_appendf(bench_buffer *b, const char *fmt, ...)
+{
+   va_list args;
+   int len;
+   char *tmp;
+
+   va_start(args, fmt);
+   len = vsnprintf(NULL, 0, fmt, args);
+   va_end(args);
+
+   if (b->len + len + 1 > b->size) {
+      size_t size = (b->size ? b->size * 2 : 4096);
+      while (size < b->len + len + 1) size *= 2;
+      if (!(tmp = realloc(b->data, size))) return -1;
+      b->data = tmp;
+      b->size = size;
+   }
+
+   va_start(args, fmt);
+   vsnprintf(b->data + b->len, len + 1, fmt, args);
+   va_end(args);
+   b->len += len;
+   return 0;
+}
+
+/* \brief generate synthetic PND */
+int bench_generate_pnd(const char *path, unsigned int index, size_t size, int release)
+{
+   FILE *f;
+   char buffer[4096];
+   size_t i, w;
+   uint32_t seed = 2166136261u ^ index;
+   const char **cat = bench_category[index % BENCH_CATEGORIES];
+
+   if (!(f = fopen(path, "wb")))
+      return -1;
+
+   /* payload, stands in for the squashfs image */
+   for (i = 0; i < size; i += w) {
+      size_t b;
+      w = (size - i < sizeof(buffer) ? size - i : sizeof(buffer));
+      for (b = 0; b != w; ++b) {
+         seed = seed * 1664525u + 1013904223u;
+         buffer[b] = (char)(seed >> 24);
+      }
+      if (fwrite(buffer, 1, w, f) != w) goto fail;
+   }
+
+   fprintf(f, BENCH_PXML,
+         index, index, index, release, index, index, index, index,
+         index, index, index, index, release, index, index, index,
+         cat[0], cat[1]);
+   if (fwrite(bench_png, 1, sizeof(bench_png), f) != sizeof(bench_png))
+      goto fail;
+
+   return fclose(f);
+
+fail:
+   fclose(f);
+   return -1;
+}
+
+/* \brief generate PND files to directory */
+int bench_generate_pnds(const char *dir, const bench_set *set)
+{
+   char path[4096];
+   unsigned int i;
+
+   for (i = 0; i != set->pnds; ++i) {
+      snprintf(path, sizeof(path), "%s/bench-%05u.pnd", dir, i);
+      if (bench_generate_pnd(path, i, set->pnd_size, set->release) != 0)
+         return -1;
+   }
+   return 0;
+}
+
+/* \brief generate master list JSON */
+char* bench_generate_masterlist(const char *pnd_dir, const char *base_url,
+      const bench_set *set, int release, size_t *len)
+{
+   bench_buffer b;
+   unsigned int i;
+   char file[64], md5[33], path[4096];
+   size_t size;
+   struct stat st;
+   pndman_package pnd;
+   const char **cat;
+
+   memset(&b, 0, sizeof(b));
+   bench_appendf(&b, "{\"repository\":{\"name\":\"bench\",\"version\":\"2.0\","
+         "\"timestamp\":%u},\n\"packages\":[\n", 1000000000u + release);
+
+   for (i = 0; i != set->packages; ++i) {
+      cat = bench_category[i % BENCH_CATEGORIES];
+      snprintf(file, sizeof(file), "bench-%05u.pnd", i);
+
+      /* real md5 and size for files we serve */
+      snprintf(md5, sizeof(md5), "%032x", i);
+      size = set->pnd_size;
+      if (i < set->pnds) {
+         snprintf(path, sizeof(path), "%s/%s", pnd_dir, file);
+         if (stat(path, &st) == 0) size = st.st_size;
+         memset(&pnd, 0, sizeof(pnd));
+         pnd.mount = (char*)pnd_dir;
+         pnd.path  = file;
+         if (pndman_package_fill_md5(&pnd)) {
+            snprintf(md5, sizeof(md5), "%s", pnd.md5);
+            free(pnd.md5);
+         }
+      }
+
+      bench_appendf(&b,
+            "%s{\"id\":\"bench-%05u\",\"version\":{\"major\":\"1\",\"minor\":\"0\","
+            "\"release\":\"%d\",\"build\":\"%u\",\"type\":\"release\"},"
+            "\"uri\":\"%s/pnd/%s\",\"md5\":\"%s\",\"size\":%zu,"
+            "\"modified-time\":%u,\"rating\":%u,"
+            "\"localizations\":{\"en_US\":{\"title\":\"Bench Package %u\","
+            "\"description\":\"Synthetic package %u generated for libpndman benchmarks.\"},"
+            "\"fi_FI\":{\"title\":\"Testipaketti %u\",\"description\":\"Testipaketti.\"}},"
+            "\"author\":{\"name\":\"Bench Author %u\",\"website\":\"http://example.org/%u\"},"
+            "\"vendor\":\"bench\",\"icon\":\"%s/icon/%u.png\","
+            "\"previewpics\":[\"%s/preview/%u.png\"],"
+            "\"licenses\":[\"GPLv2+\"],\"source\":[\"http://example.org/src/%u\"],"
+            "\"categories\":[\"%s\",\"%s\"]}\n",
+            (i ? "," : ""), i, release, i, base_url, file, md5,
+            size, 1000000000u + release * 1000000u + i, i % 100,
+            i, i, i, i, i, base_url, i, base_url, i, i, cat[0], cat[1]);
+   }
+
+   if (bench_appendf(&b, "]}\n") != 0) {
+      free(b.data);
+      return NULL;
+   }
+
+   if (len) *len = b.len;
+   return b.data;
+}
+
+/* \brief bzip2 compress buffer */
+char* bench_bzip2(const char *data, size_t len, size_t *out_len)
+{
+   char *out;
+   unsigned int size = len + len / 100 + 600;
+
+   if (!(out = malloc(size)))
+      return NULL;
+
+   if (BZ2_bzBuffToBuffCompress(out, &size, (char*)data, len, 9, 0, 0) != BZ_OK) {
+      free(out);
+      return NULL;
+   }
+
+   *out_len = size;
+   return out;
+}
+
+/* \brief write buffer to file */
+int bench_write_file(const char *path, const char *data, size_t len)
+{
+   FILE *f;
+   if (!(f = fopen(path, "wb")))
+      return -1;
+   if (fwrite(data, 1, len, f) != len) {
+      fclose(f);
+      return -1;
+   }
+   return fclose(f);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,306 @@
+#define _GNU_SOURCE /* for strptime, timegm */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "bench.h"
+
+#define BENCH_REQUEST_MAX 8192
+
+/* \brief local repository stand-in */
+struct bench_server
+{
+   char *root;
+   int fd;
+   unsigned short port;
+   unsigned int delay_ms;
+   unsigned int requests;
+   unsigned int active; /* connections being served */
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   pthread_cond_t done;
+};
+
+/* \brief single connection */
+typedef struct bench_connection
+{
+   bench_server *server;
+   int fd;
+} bench_connection;
+
+/* \brief write all of buffer to socket */
+static int bench_send(int fd, const char *data, size_t len)
+{
+   ssize_t w;
+   while (len) {
+      if ((w = send(fd, data, len, MSG_NOSIGNAL)) <= 0) return -1;
+      data += w; len -= w;
+   }
+   return 0;
+}
+
+/* \brief get value of request header */
+static int bench_header(const char *request, const char *name, char *value, size_t size)
+{
+   const char *p = request;
+   size_t len = strlen(name), i;
+
+   while ((p = strchr(p, '\n'))) {
+      ++p;
+      if (strncasecmp(p, name, len) || p[len] != ':') continue;
+      for (p += len + 1; *p == ' '; ++p);
+      for (i = 0; i + 1 < size && p[i] && p[i] != '\r' && p[i] != '\n'; ++i)
+         value[i] = p[i];
+      value[i] = 0;
+      return 1;
+   }
+   return 0;
+}
+
+/* \brief send response without body */
+static void bench_status(int fd, const char *status)
+{
+   char header[256];
+   int len = snprintf(header, sizeof(header),
+         "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+   bench_send(fd, header, len);
+}
+
+/* \brief serve single request */
+static void bench_serve(bench_server *server, int fd)
+{
+   char request[BENCH_REQUEST_MAX], method[16], uri[2048], value[256];
+   char path[4096], header[512], buffer[65536], *query;
+   size_t len = 0, start, end;
+   ssize_t r;
+   struct stat st;
+   struct tm tm;
+   int file = -1, partial = 0;
+
+   /* read headers */
+   while (len + 1 < sizeof(request)) {
+      if ((r = recv(fd, request + len, sizeof(request) - len - 1, 0)) <= 0) return;
+      len += r;
+      request[len] = 0;
+      if (strstr(request, "\r\n\r\n")) break;
+   }
+
+   if (sscanf(request, "%15s %2047s", method, uri) != 2)
+      return;
+
+   pthread_mutex_lock(&server->mutex);
+   server->requests++;
+   pthread_mutex_unlock(&server->mutex);
+
+   if (server->delay_ms)
+      usleep(server->delay_ms * 1000);
+
+   if (strcmp(method, "GET") && strcmp(method, "POST") && strcmp(method, "HEAD")) {
+      bench_status(fd, "405 Method Not Allowed");
+      return;
+   }
+
+   /* ?bzip=true gets the compressed variant */
+   if ((query = strchr(uri, '?'))) *query++ = 0;
+   if (strstr(uri, "..")) {
+      bench_status(fd, "403 Forbidden");
+      return;
+   }
+   snprintf(path, sizeof(path), "%s%s%s", server->root, uri,
+         (query && strstr(query, "bzip=true") ? ".bz2" : ""));
+
+   if ((file = open(path, O_RDONLY)) == -1 || fstat(file, &st) != 0 || !S_ISREG(st.st_mode)) {
+      bench_status(fd, "404 Not Found");
+      goto out;
+   }
+
+   /* If-Modified-Since */
+   if (bench_header(request, "If-Modified-Since", value, sizeof(value))) {
+      memset(&tm, 0, sizeof(tm));
+      if (strptime(value, "%a, %d %b %Y %H:%M:%S", &tm) && st.st_mtime <= timegm(&tm)) {
+         bench_status(fd, "304 Not Modified");
+         goto out;
+      }
+   }
+
+   /* single byte range, bytes=start-[end] */
+   start = 0; end = st.st_size ? st.st_size - 1 : 0;
+   if (bench_header(request, "Range", value, sizeof(value))) {
+      unsigned long long s = 0, e = 0;
+      int n = sscanf(value, "bytes=%llu-%llu", &s, &e);
+      if (n < 1 || s >= (unsigned long long)st.st_size) {
+         len = snprintf(header, sizeof(header),
+               "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%llu\r\n"
+               "Content-Length: 0\r\nConnection: close\r\n\r\n", (unsigned long long)st.st_size);
+         bench_send(fd, header, len);
+         goto out;
+      }
+      start = s;
+      if (n == 2 && e < end) end = e;
+      partial = 1;
+   }
+
+   strftime(value, sizeof(value), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&st.st_mtime, &tm));
+   if (partial) {
+      len = snprintf(header, sizeof(header),
+            "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %zu-%zu/%llu\r\n"
+            "Content-Length: %zu\r\nLast-Modified: %s\r\nConnection: close\r\n\r\n",
+            start, end, (unsigned long long)st.st_size, end - start + 1, value);
+   } else {
+      len = snprintf(header, sizeof(header),
+            "HTTP/1.1 200 OK\r\nContent-Length: %llu\r\nAccept-Ranges: bytes\r\n"
+            "Last-Modified: %s\r\nConnection: close\r\n\r\n",
+            (unsigned long long)st.st_size, value);
+   }
+   if (bench_send(fd, header, len) != 0 || !strcmp(method, "HEAD") || !st.st_size)
+      goto out;
+
+   /* body */
+   lseek(file, start, SEEK_SET);
+   for (len = end - start + 1; len; len -= r) {
+      if ((r = read(file, buffer, (len < sizeof(buffer) ? len : sizeof(buffer)))) <= 0) break;
+      if (bench_send(fd, buffer, r) != 0) break;
+   }
+
+out:
+   if (file != -1) close(file);
+}
+
+/* \brief connection thread */
+static void* bench_connection_thread(void *arg)
+{
+   bench_connection *c = arg;
+   bench_server *server = c->server;
+   bench_serve(server, c->fd);
+   shutdown(c->fd, SHUT_RDWR);
+   close(c->fd);
+   free(c);
+
+   pthread_mutex_lock(&server->mutex);
+   if (!--server->active) pthread_cond_signal(&server->done);
+   pthread_mutex_unlock(&server->mutex);
+   return NULL;
+}
+
+/* \brief accept thread */
+static void* bench_accept_thread(void *arg)
+{
+   bench_server *server = arg;
+   bench_connection *c;
+   pthread_t thread;
+   int fd;
+
+   while ((fd = accept(server->fd, NULL, NULL)) != -1) {
+      if (!(c = malloc(sizeof(bench_connection)))) {
+         close(fd);
+         continue;
+      }
+      c->server = server;
+      c->fd = fd;
+      pthread_mutex_lock(&server->mutex);
+      server->active++;
+      pthread_mutex_unlock(&server->mutex);
+      if (pthread_create(&thread, NULL, bench_connection_thread, c) != 0) {
+         pthread_mutex_lock(&server->mutex);
+         server->active--;
+         pthread_mutex_unlock(&server->mutex);
+         close(fd);
+         free(c);
+         continue;
+      }
+      pthread_detach(thread);
+   }
+   return NULL;
+}
+
+/* \brief start HTTP server */
+bench_server* bench_server_start(const char *root, unsigned int delay_ms)
+{
+   bench_server *server;
+   struct sockaddr_in addr;
+   socklen_t len = sizeof(addr);
+   int one = 1;
+
+   if (!(server = calloc(1, sizeof(bench_server))))
+      return NULL;
+
+   server->fd = -1;
+   server->delay_ms = delay_ms;
+   pthread_mutex_init(&server->mutex, NULL);
+   pthread_cond_init(&server->done, NULL);
+   if (!(server->root = strdup(root)))
+      goto fail;
+
+   if ((server->fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+      goto fail;
+   setsockopt(server->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr.sin_port = 0;
+   if (bind(server->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+       listen(server->fd, 64) != 0 ||
+       getsockname(server->fd, (struct sockaddr*)&addr, &len) != 0)
+      goto fail;
+   server->port = ntohs(addr.sin_port);
+
+   if (pthread_create(&server->thread, NULL, bench_accept_thread, server) != 0)
+      goto fail;
+
+   return server;
+
+fail:
+   if (server->fd != -1) close(server->fd);
+   free(server->root);
+   pthread_cond_destroy(&server->done);
+   pthread_mutex_destroy(&server->mutex);
+   free(server);
+   return NULL;
+}
+
+/* \brief port server listens on */
+unsigned short bench_server_port(bench_server *server)
+{
+   return server->port;
+}
+
+/* \brief number of requests served */
+unsigned int bench_server_requests(bench_server *server)
+{
+   unsigned int requests;
+   pthread_mutex_lock(&server->mutex);
+   requests = server->requests;
+   pthread_mutex_unlock(&server->mutex);
+   return requests;
+}
+
+/* \brief stop server */
+void bench_server_stop(bench_server *server)
+{
+   /* wakes up accept */
+   shutdown(server->fd, SHUT_RDWR);
+   close(server->fd);
+   pthread_join(server->thread, NULL);
+
+   /* let running connections finish */
+   pthread_mutex_lock(&server->mutex);
+   while (server->active) pthread_cond_wait(&server->done, &server->mutex);
+   pthread_mutex_unlock(&server->mutex);
+
+   pthread_cond_destroy(&server->done);
+   pthread_mutex_destroy(&server->mutex);
+   free(server->root);
+   free(server);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
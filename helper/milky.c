@@ -1106,24 +1106,6 @@ static int pndinstalled(pndman_package *pnd, _USR_DATA *data)
    return RETURN_FALSE;
 }
 
-/* get pnd title */
-static const char* pndtitle(pndman_package *pnd, const char *lang)
-{
-   pndman_translated *t;
-   for (t = pnd->title; t; t = t->next)
-      if (t->lang && lang && !strupcmp(t->lang, lang)) return t->string?t->string:NULL;
-   return NULL;
-}
-
-/* get pnd description */
-static const char* pnddesc(pndman_package *pnd, const char *lang)
-{
-   pndman_translated *t;
-   for (t = pnd->description; t; t = t->next)
-      if (t->lang && lang && !strupcmp(t->lang, lang)) return t->string?t->string:NULL;
-   return NULL;
-}
-
 /* get application title */
 static const char* apptitle(pndman_application *app, const char *lang)
 {
@@ -1215,8 +1197,7 @@ static void pndinfo(pndman_package *pnd, _USR_DATA *data, size_t longest_title)
    assert(pnd);
 
    /* get description */
-   if (!(desc = strstrip((char*)pnddesc(pnd, data->syslc))))
-      desc = strstrip((char*)pnddesc(pnd, "en_US")); /* fallback locale */
+   desc = strstrip((char*)pndman_package_get_description(pnd));
 
    /* strip description to maximum length */
    if (!(data->flags & A_INFO) && desc && strlen(desc) > DESCRIPTION_LENGTH)
@@ -1252,9 +1233,7 @@ static void pndinfo(pndman_package *pnd, _USR_DATA *data, size_t longest_title)
             printf("%s ", l->name?l->name:"");
          puts("");
       }
-      if (!(title = strstrip((char*)pndtitle(pnd, data->syslc))))
-         title = strstrip((char*)pndtitle(pnd, "en_US")); /* fallback locale */
-      if (title) {
+      if ((title = strstrip((char*)pndman_package_get_title(pnd)))) {
          _printf("\2Title         \5: %s", title?title:pnd->id);
          free(title);
       }
@@ -1304,8 +1283,7 @@ static void pndinfo(pndman_package *pnd, _USR_DATA *data, size_t longest_title)
             pnd->version.type==PND_VERSION_ALPHA?" alpha":"");
       if ((data->flags & OP_QUERY) && (data->flags & A_LIST)) {
          pndman_package_crawl_single_package(1, pnd);
-         if (!(title = strstrip((char*)pndtitle(pnd, data->syslc))))
-            title = strstrip((char*)pndtitle(pnd, "en_US")); /* fallback locale */
+         title = strstrip((char*)pndman_package_get_title(pnd));
          _printf("\n"
                  "\1─┬─\4%s", (title && strlen(title))?title:pnd->id);
          _printf("\1 └─%s─\5%s/%s", pnd->app?"┬":"",
@@ -2318,6 +2296,25 @@ static void handlecorrupt(pndman_package *p, pndman_package *rp,
            certain==0?_PND_MAY_CORRUPT:_PND_DIF_CORRUPT, p->id);
 }
 
+/* calculate missing md5 sums of local packages in one batch */
+static void fillmd5(_USR_DATA *data)
+{
+   pndman_package *p, **list;
+   size_t count = 0;
+
+   for (p = data->rlist->pnd; p; p = p->next)
+      if (!p->md5 || (data->flags & GB_FORCE)) ++count;
+   if (!count || !(list = malloc(count * sizeof(pndman_package*))))
+      return;
+
+   count = 0;
+   for (p = data->rlist->pnd; p; p = p->next)
+      if (!p->md5 || (data->flags & GB_FORCE)) list[count++] = p;
+
+   pndman_package_fill_md5_batch(list, count, 0, NULL, NULL);
+   free(list);
+}
+
 /* crawl operation logic */
 static int crawlprocess(_USR_DATA *data)
 {
@@ -2346,9 +2343,8 @@ static int crawlprocess(_USR_DATA *data)
    if ((data->flags & A_INTEGRITY)) {
       /* check that we aren't using local repository */
       if ((rs = checkremoterepo("crawl", data))) {
+         fillmd5(data);
          for (p = data->rlist->pnd; p; p = p->next) {
-            if (!p->md5 || (data->flags & GB_FORCE))
-               pndman_package_fill_md5(p);
             for (r = rs; r; r = r->next)
                for (pp = r->pnd; pp; pp = pp->next) {
                   if (strcmp(p->id, pp->id)) continue;
@@ -3188,6 +3184,7 @@ int main(int argc, char **argv)
    /* init userdata */
    init_usrdata(&data);
    data.bin = argv[0];
+   pndman_set_locale(data.syslc);
 
    /* detect devices */
    data.dlist = pndman_device_detect(NULL);
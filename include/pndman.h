@@ -36,6 +36,7 @@
 #endif
 
 #include <stdint.h>
+#include <stdarg.h> /* for va_list */
 
 #ifdef __cplusplus
 extern "C" {
@@ -61,6 +62,43 @@ typedef void (*PNDMAN_DEBUG_HOOK_FUNC)(
       const char *file, int line, const char *function,
       int verbose_level, const char *str);
 
+/* \brief structured debug hook typedef,
+ * gets printf format and its arguments unformatted */
+typedef void (*PNDMAN_DEBUG_EVENT_FUNC)(
+      const char *file, int line, const char *function,
+      int verbose_level, const char *fmt, va_list args,
+      void *user_data);
+
+/* \brief collected metrics,
+ * times are in microseconds */
+typedef enum pndman_metric
+{
+   PNDMAN_METRIC_BYTES_DOWNLOADED, /* per download */
+   PNDMAN_METRIC_TRANSFER_TIME,
+   PNDMAN_METRIC_CONNECT_TIME,
+   PNDMAN_METRIC_TRANSFER_RETRIES,
+   PNDMAN_METRIC_PNDS_CRAWLED,     /* per crawl */
+   PNDMAN_METRIC_CRAWL_TIME,
+   PNDMAN_METRIC_PND_PARSE_TIME,   /* per PND */
+   PNDMAN_METRIC_JSON_LOAD_TIME,
+   PNDMAN_METRIC_JSON_COMMIT_TIME,
+   PNDMAN_METRIC_DB_COMMIT_TIME,
+   PNDMAN_METRIC_LOCK_WAIT_TIME,
+   PNDMAN_METRIC_COUNT
+} pndman_metric;
+
+#define PNDMAN_METRIC_BUCKETS 32
+
+/* \brief value of metric,
+ * count is number of samples and sum their total.
+ * bucket[n] counts samples in range [2^n, 2^(n+1)) */
+typedef struct pndman_metric_value
+{
+   const char *name;
+   uint64_t count, sum, min, max;
+   uint64_t bucket[PNDMAN_METRIC_BUCKETS];
+} pndman_metric_value;
+
 /* \brief flags for sync handle */
 typedef enum pndman_sync_handle_flags
 {
@@ -78,6 +116,7 @@ typedef enum pndman_package_handle_flags
    PNDMAN_PACKAGE_INSTALL_APPS    = 0x020,
    PNDMAN_PACKAGE_BACKUP          = 0x040,
    PNDMAN_PACKAGE_LOG_HISTORY     = 0x080,
+   PNDMAN_PACKAGE_PRIORITY        = 0x100,
 } pndman_package_handle_flags;
 
 /* \brief type enum for version struct */
@@ -96,6 +135,28 @@ typedef enum pndman_exec_x11
    PND_EXEC_IGNORE
 } pndman_exec_x11;
 
+/* \brief facets of package index */
+typedef enum pndman_facet_type
+{
+   PNDMAN_FACET_CATEGORY,
+   PNDMAN_FACET_SUBCATEGORY,
+   PNDMAN_FACET_REPOSITORY,
+   PNDMAN_FACET_VENDOR,
+   PNDMAN_FACET_COMMERCIAL,
+   PNDMAN_FACET_LICENSE,
+   PNDMAN_FACET_COUNT
+} pndman_facet_type;
+
+/* \brief sort keys of package view */
+typedef enum pndman_view_sort
+{
+   PNDMAN_VIEW_SORT_ID,
+   PNDMAN_VIEW_SORT_TITLE,
+   PNDMAN_VIEW_SORT_MODIFIED,
+   PNDMAN_VIEW_SORT_SIZE,
+   PNDMAN_VIEW_SORT_RATING
+} pndman_view_sort;
+
 /* \brief struct holding version information */
 typedef struct pndman_version
 {
@@ -224,8 +285,41 @@ typedef struct pndman_package
    struct pndman_package *next;
    int commercial;
    struct pndman_repository *repositoryptr;
+
+   /* preferred locale cache,
+    * use pndman_package_get_title and pndman_package_get_description */
+   const char *locale_title;
+   const char *locale_description;
+   unsigned int locale_serial;
 } pndman_package;
 
+/*! \brief library context, see pndman_context_new */
+typedef struct pndman_context pndman_context;
+
+/*! \brief batch of package operations, see pndman_transaction_new */
+typedef struct pndman_transaction pndman_transaction;
+
+/*! \brief pipelined full system upgrade, see pndman_upgrade_new */
+typedef struct pndman_upgrade pndman_upgrade;
+
+/*! \brief watcher of local PNDs, see pndman_watch_new */
+typedef struct pndman_watch pndman_watch;
+
+/*! \brief search index of packages, see pndman_search_new */
+typedef struct pndman_search pndman_search;
+
+/*! \brief facet index of packages, see pndman_facet_new */
+typedef struct pndman_facet pndman_facet;
+
+/*! \brief sorted view of packages, see pndman_view_new */
+typedef struct pndman_view pndman_view;
+
+/*! \brief filter of view, return non zero to keep package */
+typedef int (*pndman_view_filter)(pndman_package *pnd, void *user_data);
+
+/*! \brief monitor of mounted devices, see pndman_device_monitor_new */
+typedef struct pndman_device_monitor pndman_device_monitor;
+
 /*! \brief struct representing client api access */
 typedef struct pndman_repository_api
 {
@@ -246,6 +340,7 @@ typedef struct pndman_repository
    time_t timestamp;
    pndman_package *pnd;
    pndman_repository_api api;
+   pndman_context *context; /* context for pndman_api_* calls, NULL for default */
    struct pndman_repository *next, *prev;
 } pndman_repository;
 
@@ -278,6 +373,43 @@ typedef void (*pndman_package_handle_callback)(
 typedef void (*pndman_sync_handle_callback)(
       pndman_curl_code code, struct pndman_sync_handle *handle);
 
+/* \brief what happened to PND on watched device */
+typedef enum pndman_watch_event
+{
+   PNDMAN_WATCH_ADDED,
+   PNDMAN_WATCH_CHANGED,
+   PNDMAN_WATCH_REMOVED, /* pnd is freed after callback */
+   PNDMAN_WATCH_RESCAN,  /* events were lost and devices crawled again, pnd is NULL */
+} pndman_watch_event;
+
+/* \brief callback for watcher */
+typedef void (*pndman_watch_callback)(
+      pndman_watch_event event, pndman_package *pnd, void *user_data);
+
+/* \brief what happened to mounted device */
+typedef enum pndman_device_event
+{
+   PNDMAN_DEVICE_ADDED,   /* device is in list and crawled, if crawling was asked */
+   PNDMAN_DEVICE_REMOVED, /* device and its PNDs are freed after callback */
+} pndman_device_event;
+
+/* \brief callback for device monitor */
+typedef void (*pndman_device_monitor_callback)(
+      pndman_device_event event, pndman_device *device, void *user_data);
+
+/* \brief callback for upgrade, either sync or package is set.
+ * DONE for package means it was installed, FAIL that either
+ * download or install failed. */
+typedef void (*pndman_upgrade_callback)(
+      pndman_curl_code code, struct pndman_sync_handle *sync,
+      struct pndman_package_handle *package, void *user_data);
+
+/* \brief callback for pndman_package_fill_md5_batch,
+ * md5 is NULL if package could not be hashed */
+typedef void (*pndman_md5_callback)(
+      pndman_package *pnd, size_t done, size_t total,
+      const char *md5, void *user_data);
+
 /*! \brief Struct for PND transaction */
 typedef struct pndman_package_handle
 {
@@ -288,6 +420,7 @@ typedef struct pndman_package_handle
    unsigned int flags;
    pndman_curl_progress progress;
    pndman_package_handle_callback callback;
+   pndman_context *context; /* NULL for default context */
 
    /* assign your own data here */
    void *user_data;
@@ -305,6 +438,7 @@ typedef struct pndman_sync_handle
    unsigned int flags;
    pndman_curl_progress progress;
    pndman_sync_handle_callback callback;
+   pndman_context *context; /* NULL for default context */
 
    /* assign your own data here */
    void *user_data;
@@ -404,6 +538,13 @@ PNDMANAPI void pndman_set_verbose(int level);
 PNDMANAPI void pndman_set_debug_hook(
       PNDMAN_DEBUG_HOOK_FUNC func);
 
+/* \brief set structured debug hook function,
+ * called for every message before it's formatted.
+ * Formatting is skipped unless verbose level
+ * or pndman_set_debug_hook asks for it. */
+PNDMANAPI void pndman_set_debug_event_hook(
+      PNDMAN_DEBUG_EVENT_FUNC func, void *user_data);
+
 /* \brief get current verbose level */
 PNDMANAPI int pndman_get_verbose(void);
 
@@ -413,6 +554,147 @@ PNDMANAPI void pndman_set_curl_timeout(int timeout);
 /* \brief get internal curl timeout for libpndman */
 PNDMANAPI int pndman_get_curl_timeout(void);
 
+/* \brief set how many transfers may run at once,
+ * in total and against single host.
+ * Rest of the transfers are queued and started
+ * as slots free up, smaller and PNDMAN_PACKAGE_PRIORITY
+ * downloads first. 0 means unlimited. */
+PNDMANAPI void pndman_set_curl_max_connections(int total, int per_host);
+
+/* \brief get maximum number of concurrent transfers */
+PNDMANAPI int pndman_get_curl_max_connections(void);
+
+/* \brief get maximum number of concurrent transfers per host */
+PNDMANAPI int pndman_get_curl_max_host_connections(void);
+
+/* \brief set total download speed limit (bytes per second),
+ * which is shared evenly between running transfers.
+ * 0 means unlimited. */
+PNDMANAPI void pndman_set_curl_max_speed(uint64_t bytes_per_second);
+
+/* \brief get total download speed limit */
+PNDMANAPI uint64_t pndman_get_curl_max_speed(void);
+
+/* \brief split package downloads of min_size bytes or more
+ * into given number of byte ranges, which are downloaded
+ * concurrently. 1 disables segmented downloads (default).
+ * Segmented download counts as one transfer against
+ * pndman_set_curl_max_connections limits, but opens segments
+ * connections to its host. */
+PNDMANAPI void pndman_set_curl_segments(int segments, uint64_t min_size);
+
+/* \brief get number of segments used for large downloads */
+PNDMANAPI int pndman_get_curl_segments(void);
+
+/* \brief get minimum size of segmented download */
+PNDMANAPI uint64_t pndman_get_curl_segment_min_size(void);
+
+/* \brief create new library context.
+ * Context owns the transfers of handles performed on it,
+ * and their settings, which are copied from the default context
+ * (the one pndman_set_curl_* and pndman_curl_process use).
+ *
+ * Handles run on context set in their context member,
+ * pndman_api_* calls on context of the repository.
+ * NULL means the default context everywhere.
+ *
+ * THREAD SAFETY:
+ * A context, the handles performed on it and the repository lists
+ * and devices they touch must be used from one thread at a time.
+ * Different contexts may be processed concurrently from different
+ * threads without locking, as long as they don't share repository
+ * lists or devices.
+ * Process wide settings (verbose level, debug hooks, download cache)
+ * should be set before threads are started. Metrics are safe to
+ * collect from any thread.
+ *
+ * returns NULL on failure */
+PNDMANAPI pndman_context* pndman_context_new(void);
+
+/* \brief free context.
+ * Free handles performed on the context before freeing it,
+ * pending transfers are dropped without callbacks. */
+PNDMANAPI void pndman_context_free(pndman_context *context);
+
+/* \brief pndman_set_curl_* and pndman_get_curl_* for context */
+PNDMANAPI void pndman_context_set_curl_timeout(pndman_context *context, int timeout);
+PNDMANAPI int pndman_context_get_curl_timeout(pndman_context *context);
+PNDMANAPI void pndman_context_set_curl_max_connections(pndman_context *context, int total, int per_host);
+PNDMANAPI int pndman_context_get_curl_max_connections(pndman_context *context);
+PNDMANAPI int pndman_context_get_curl_max_host_connections(pndman_context *context);
+PNDMANAPI void pndman_context_set_curl_max_speed(pndman_context *context, uint64_t bytes_per_second);
+PNDMANAPI uint64_t pndman_context_get_curl_max_speed(pndman_context *context);
+PNDMANAPI void pndman_context_set_curl_segments(pndman_context *context, int segments, uint64_t min_size);
+PNDMANAPI int pndman_context_get_curl_segments(pndman_context *context);
+PNDMANAPI uint64_t pndman_context_get_curl_segment_min_size(pndman_context *context);
+
+/* \brief run transfers of context on its own IO thread.
+ * Handles are submitted to the thread on perform, and their
+ * callbacks are called later from pndman_context_dispatch or
+ * pndman_context_curl_process on the thread calling those.
+ * Progress is coalesced, so a handle has at most one progress
+ * callback pending no matter how fast the transfer is.
+ *
+ * In this mode perform only fails on allocation failure,
+ * other errors arrive as PNDMAN_CURL_FAIL callbacks.
+ * Debug hooks may get called from the IO thread.
+ *
+ * Must be called while no transfers are running on context.
+ * returns 0 on success, -1 on failure (or without pthread) */
+PNDMANAPI int pndman_context_start_thread(pndman_context *context);
+
+/* \brief stop IO thread of context,
+ * unfinished transfers continue on pndman_context_curl_process.
+ * pndman_context_free stops the thread as well. */
+PNDMANAPI void pndman_context_stop_thread(pndman_context *context);
+
+/* \brief fd that becomes readable when context has events to dispatch,
+ * for poll/select of application main loop.
+ * returns -1 when context has no IO thread */
+PNDMANAPI int pndman_context_get_fd(pndman_context *context);
+
+/* \brief call callbacks of pending events without waiting.
+ * returns number of events dispatched */
+PNDMANAPI int pndman_context_dispatch(pndman_context *context);
+
+/* \brief keep downloaded packages in local cache directory,
+ * keyed by their MD5. Installing same package again,
+ * or to another device, links or copies it from cache
+ * instead of downloading. Cache holds its own copy of installed
+ * packages, packages installed from cache may share blocks with it.
+ * Least recently used packages are evicted when cache exceeds max_size bytes.
+ * 0 means unlimited, NULL path disables cache (default). */
+PNDMANAPI int pndman_set_download_cache(const char *path, uint64_t max_size);
+
+/* \brief get download cache directory, NULL if disabled.
+ * string is freed by next pndman_set_download_cache,
+ * don't call that from other thread while using it */
+PNDMANAPI const char* pndman_get_download_cache(void);
+
+/* \brief get size budget of download cache */
+PNDMANAPI uint64_t pndman_get_download_cache_size(void);
+
+/* \brief enable collection of metrics (disabled by default) */
+PNDMANAPI void pndman_metrics_enable(int enable);
+
+/* \brief enable recording of trace spans,
+ * this enables metrics as well */
+PNDMANAPI void pndman_metrics_trace(int enable);
+
+/* \brief clear collected metrics and trace spans */
+PNDMANAPI void pndman_metrics_reset(void);
+
+/* \brief get value of metric */
+PNDMANAPI int pndman_metrics_get(pndman_metric metric,
+      pndman_metric_value *value);
+
+/* \brief get bytes downloaded from repository */
+PNDMANAPI uint64_t pndman_metrics_get_repository_bytes(const char *url);
+
+/* \brief write recorded trace spans to file,
+ * in Chrome trace event format (chrome://tracing, Perfetto) */
+PNDMANAPI int pndman_metrics_trace_dump(const char *path);
+
 /* \brief colored put function
  * this is manily provided public to milkyhelper,
  * to avoid some code duplication.
@@ -462,6 +744,11 @@ PNDMANAPI void pndman_repository_free_all(
 PNDMANAPI int pndman_repository_commit_all(
       pndman_repository *list, pndman_device *device);
 
+/* \brief commit all repositories to every device in list,
+ * devices on different disks are written in parallel */
+PNDMANAPI int pndman_repository_commit_all_devices(
+      pndman_repository *list, pndman_device *device);
+
 /* \brief check PND updates for all repositories
  * in the repository list
  * returns number of updates found */
@@ -498,6 +785,48 @@ PNDMANAPI pndman_device* pndman_device_free(
 PNDMANAPI void pndman_device_free_all(
       pndman_device *device);
 
+/* \brief follow mount table, so devices are added and removed
+ * as cards are inserted and ejected. Space information of devices
+ * is refreshed on every change. list may be NULL,
+ * the list can change on dispatch, get it with
+ * pndman_device_monitor_get_devices.
+ * returns NULL on failure, or when platform can't monitor mounts */
+PNDMANAPI pndman_device_monitor* pndman_device_monitor_new(
+      pndman_device *list);
+
+/* \brief set callback of monitor, called for each added and removed device */
+PNDMANAPI void pndman_device_monitor_set_callback(pndman_device_monitor *monitor,
+      pndman_device_monitor_callback callback, void *user_data);
+
+/* \brief crawl PNDs of monitored devices to local repository now,
+ * PNDs of added devices on dispatch, and forget PNDs of removed devices.
+ * NULL local stops crawling. */
+PNDMANAPI void pndman_device_monitor_set_crawl(pndman_device_monitor *monitor,
+      pndman_repository *local, int full_crawl);
+
+/* \brief add and remove devices of watcher along with monitored devices,
+ * so watcher never follows freed device. NULL stops it.
+ * Free the monitor or set NULL watch before freeing the watcher. */
+PNDMANAPI void pndman_device_monitor_set_watch(pndman_device_monitor *monitor,
+      pndman_watch *watch);
+
+/* \brief first device of monitored list */
+PNDMANAPI pndman_device* pndman_device_monitor_get_devices(
+      pndman_device_monitor *monitor);
+
+/* \brief fd that signals POLLPRI when mount table changes,
+ * for poll/select (exceptfds) of application main loop */
+PNDMANAPI int pndman_device_monitor_get_fd(pndman_device_monitor *monitor);
+
+/* \brief apply mount table changes to device list without waiting.
+ * Free space of devices is refreshed here and after installs,
+ * use pndman_device_update for space other programs used meanwhile.
+ * returns number of devices added and removed */
+PNDMANAPI int pndman_device_monitor_dispatch(pndman_device_monitor *monitor);
+
+/* \brief free monitor, device list is left to caller */
+PNDMANAPI void pndman_device_monitor_free(pndman_device_monitor *monitor);
+
 /* \brief read repository data from device
  * 0 if repository data could be found
  * -1 if failure or no repository data */
@@ -517,6 +846,15 @@ PNDMANAPI int pndman_device_read_repository(
 PNDMANAPI const char* pndman_package_fill_md5(
       pndman_package *pnd);
 
+/* \brief calculate md5 for many packages at once.
+ * Files are hashed in parallel by given number of threads
+ * (0 uses all cpus), callback is called from the calling
+ * thread after each package.
+ * returns number of packages hashed, -1 on failure */
+PNDMANAPI int pndman_package_fill_md5_batch(
+      pndman_package **pnds, size_t count, unsigned int threads,
+      pndman_md5_callback callback, void *user_data);
+
 /* \brief crawl device for PNDs, fills local repository
  * if full_crawl is 1, everything from PND is crawled,
  * otherwise only package data is crawled,
@@ -525,12 +863,159 @@ PNDMANAPI const char* pndman_package_fill_md5(
 PNDMANAPI int pndman_package_crawl(int full_crawl,
       pndman_device *device, pndman_repository *local);
 
+/* \brief crawl every device in list, like pndman_package_crawl.
+ * devices on different disks are crawled in parallel.
+ * returns number of crawled PNDs */
+PNDMANAPI int pndman_package_crawl_all(int full_crawl,
+      pndman_device *device, pndman_repository *local);
+
 /* \brief update pnd_package struct
  * by crawling it locally.
  * returns 0 on success, -1 on failure */
 PNDMANAPI int pndman_package_crawl_single_package(int full_crawl,
       pndman_package *pnd);
 
+/* \brief set preferred locales, colon separated and best first
+ * (for example "fi_FI:sv:en_US"). Encoding and modifier are ignored,
+ * so $LANG works as is. Locale without territory matches any territory.
+ * en_US and then first translation are used when nothing matches.
+ * NULL or "" leaves only the fallbacks.
+ * returns 0 on success, -1 on failure */
+PNDMANAPI int pndman_set_locale(const char *locales);
+
+/* \brief title of package in preferred locale, see pndman_set_locale.
+ * resolved when package is loaded or crawled and cached until
+ * locale or titles change, so no string compares happen per call.
+ * returns NULL if package has no titles */
+PNDMANAPI const char* pndman_package_get_title(pndman_package *pnd);
+
+/* \brief description of package in preferred locale,
+ * like pndman_package_get_title */
+PNDMANAPI const char* pndman_package_get_description(pndman_package *pnd);
+
+/* \brief leave descriptions, previewpics and license sources
+ * in the database when it is loaded, until pndman_package_load is called.
+ * Titles of every locale stay. Affects databases loaded after this.
+ * Application data stays lazy by crawling without full_crawl.
+ * Database is kept mapped from disk, when temporary files are in memory
+ * it is copied to unlinked file in /var/tmp, or loaded eagerly if that fails. */
+PNDMANAPI void pndman_set_lazy_load(int lazy);
+
+/* \brief decode fields left behind by lazy loading.
+ * does nothing for packages that are already loaded.
+ * returns 0 on success, -1 on failure */
+PNDMANAPI int pndman_package_load(pndman_package *pnd);
+
+/* \brief release fields decoded by pndman_package_load */
+PNDMANAPI void pndman_package_unload(pndman_package *pnd);
+
+/* \brief create search index over packages of every repository in list.
+ * Index follows syncs, crawls, installs and removals by itself.
+ * Ids, titles, categories and descriptions are indexed. */
+PNDMANAPI pndman_search* pndman_search_new(pndman_repository *list);
+
+/* \brief find packages matching every word of query,
+ * words match whole words, their start, or inside of them.
+ * Best matches come first, at most max are stored to result.
+ * returns number of packages stored, -1 on failure */
+PNDMANAPI int pndman_search_query(pndman_search *search, const char *query,
+      pndman_package **result, int max);
+
+/* \brief free search index */
+PNDMANAPI void pndman_search_free(pndman_search *search);
+
+/* \brief create facet index over packages of every repository in list.
+ * Packages are grouped by main category, subcategory, repository url,
+ * vendor, commercial flag ("1" or "0") and license, with counts
+ * kept up to date on syncs, crawls, installs and removals.
+ * Values are compared ignoring case. */
+PNDMANAPI pndman_facet* pndman_facet_new(pndman_repository *list);
+
+/* \brief values of facet sorted by name, at most max are stored.
+ * For PNDMAN_FACET_SUBCATEGORY category is the main category,
+ * it is ignored for other facets. Names stay valid until
+ * the value is no longer used by any package.
+ * returns number of values, -1 on failure */
+PNDMANAPI int pndman_facet_values(pndman_facet *facet, pndman_facet_type type,
+      const char *category, const char **values, int max);
+
+/* \brief number of packages with value of facet,
+ * category as in pndman_facet_values.
+ * returns count, -1 on failure */
+PNDMANAPI int pndman_facet_count(pndman_facet *facet, pndman_facet_type type,
+      const char *category, const char *value);
+
+/* \brief packages with value of facet in no particular order,
+ * at most max are stored, category as in pndman_facet_values.
+ * returns number of packages with value, -1 on failure */
+PNDMANAPI int pndman_facet_packages(pndman_facet *facet, pndman_facet_type type,
+      const char *category, const char *value, pndman_package **result, int max);
+
+/* \brief free facet index */
+PNDMANAPI void pndman_facet_free(pndman_facet *facet);
+
+/* \brief create view of packages of every repository in list,
+ * sorted by key, ties by id. Title sorts by pndman_package_get_title.
+ * View follows syncs, crawls, installs and removals, changed
+ * packages are sorted in on next access. */
+PNDMANAPI pndman_view* pndman_view_new(pndman_repository *list,
+      pndman_view_sort sort, int descending);
+
+/* \brief sort view by other key.
+ * returns 0 on success, -1 on failure */
+PNDMANAPI int pndman_view_set_sort(pndman_view *view, pndman_view_sort sort, int descending);
+
+/* \brief keep only packages filter accepts, NULL keeps all.
+ * Filter is also called for packages that change later,
+ * on the thread that next reads the view.
+ * returns 0 on success, -1 on failure */
+PNDMANAPI int pndman_view_set_filter(pndman_view *view,
+      pndman_view_filter filter, void *user_data);
+
+/* \brief number of packages in view */
+PNDMANAPI int pndman_view_count(pndman_view *view);
+
+/* \brief package at index of view, NULL if out of range */
+PNDMANAPI pndman_package* pndman_view_get(pndman_view *view, int index);
+
+/* \brief index of package in view, -1 if not in view */
+PNDMANAPI int pndman_view_find(pndman_view *view, pndman_package *pnd);
+
+/* \brief free view */
+PNDMANAPI void pndman_view_free(pndman_view *view);
+
+/* \brief watch PND directories of every device in list,
+ * so local repository is kept up to date without crawling again.
+ * Only PNDs that are written, moved or removed are crawled.
+ * Crawl the devices once before, the watcher only follows changes.
+ * Free the watcher before devices or local repository.
+ * returns NULL on failure, or when platform has no inotify */
+PNDMANAPI pndman_watch* pndman_watch_new(pndman_device *device,
+      pndman_repository *local, int full_crawl);
+
+/* \brief watch device that was added to list after pndman_watch_new.
+ * Watches of unmounted device are dropped, add it again when it's mounted.
+ * returns 0 on success, -1 on failure */
+PNDMANAPI int pndman_watch_add_device(pndman_watch *watch, pndman_device *device);
+
+/* \brief stop watching device, call before device is freed */
+PNDMANAPI void pndman_watch_remove_device(pndman_watch *watch, pndman_device *device);
+
+/* \brief set callback of watcher, called for each change */
+PNDMANAPI void pndman_watch_set_callback(pndman_watch *watch,
+      pndman_watch_callback callback, void *user_data);
+
+/* \brief fd that becomes readable when there are changes,
+ * for poll/select of application main loop */
+PNDMANAPI int pndman_watch_get_fd(pndman_watch *watch);
+
+/* \brief apply pending changes to local repository without waiting.
+ * returns number of PNDs changed */
+PNDMANAPI int pndman_watch_dispatch(pndman_watch *watch);
+
+/* \brief free watcher */
+PNDMANAPI void pndman_watch_free(pndman_watch *watch);
+
 /* \brief get embedded png file from pnd.
  * you need to provide your buffer and it's size.
  * if this functions returns 0, your buffer is filled
@@ -568,6 +1053,89 @@ PNDMANAPI int pndman_package_handle_commit(
 PNDMANAPI void pndman_package_handle_free(
       pndman_package_handle *handle);
 
+/* \brief create transaction for many package operations.
+ * Downloads of the transaction run concurrently, and
+ * nothing is installed or removed until pndman_transaction_commit,
+ * which applies everything or nothing.
+ *
+ * list is the repository list (local repository first),
+ * device the device list databases are written to.
+ * returns NULL on failure */
+PNDMANAPI pndman_transaction* pndman_transaction_new(
+      pndman_repository *list, pndman_device *device);
+
+/* \brief add install/upgrade/remove operation to transaction.
+ * flags are pndman_package_handle flags.
+ * Returned handle is owned by the transaction, set its callback,
+ * user_data and context as you like but don't free it.
+ * returns NULL on failure or if pnd is already part of transaction */
+PNDMANAPI pndman_package_handle* pndman_transaction_add(
+      pndman_transaction *transaction, pndman_package *pnd,
+      pndman_device *device, unsigned int flags);
+
+/* \brief start downloads of transaction,
+ * see pndman_curl_process for what to do next.
+ * returns 0 on success, -1 if any download failed to start */
+PNDMANAPI int pndman_transaction_perform(
+      pndman_transaction *transaction);
+
+/* \brief apply transaction after its downloads are done.
+ * Every download is verified before any file is touched, files
+ * moved so far are moved back if one of the moves fails, and the
+ * database of each affected device is written once, atomically.
+ * Handle pnd pointers are NULL after successful commit.
+ * returns 0 on success, -1 on failure */
+PNDMANAPI int pndman_transaction_commit(
+      pndman_transaction *transaction);
+
+/* \brief free transaction,
+ * unfinished downloads are cancelled */
+PNDMANAPI void pndman_transaction_free(
+      pndman_transaction *transaction);
+
+/* \brief create upgrade of every package in local repository.
+ * Every remote repository of list is synced, and as soon as one
+ * repository is parsed, its updates start downloading and each
+ * verified download is installed while other transfers continue.
+ *
+ * list is the repository list (local repository first),
+ * device where packages are installed and database is written.
+ * sync_flags are pndman_sync_handle flags,
+ * flags extra pndman_package_handle flags (eg. PNDMAN_PACKAGE_BACKUP).
+ * returns NULL on failure */
+PNDMANAPI pndman_upgrade* pndman_upgrade_new(
+      pndman_repository *list, pndman_device *device,
+      unsigned int sync_flags, unsigned int flags);
+
+/* \brief set callback of upgrade */
+PNDMANAPI void pndman_upgrade_set_callback(pndman_upgrade *upgrade,
+      pndman_upgrade_callback callback, void *user_data);
+
+/* \brief start upgrade,
+ * see pndman_curl_process for what to do next.
+ * returns 0 on success, -1 if any sync failed to start */
+PNDMANAPI int pndman_upgrade_perform(
+      pndman_upgrade *upgrade);
+
+/* \brief number of syncs and downloads still running */
+PNDMANAPI int pndman_upgrade_pending(
+      pndman_upgrade *upgrade);
+
+/* \brief get number of installed and failed packages,
+ * either pointer can be NULL */
+PNDMANAPI void pndman_upgrade_get_stats(pndman_upgrade *upgrade,
+      int *installed, int *failed);
+
+/* \brief write database once upgrade is done.
+ * returns 0 on success, -1 on failure or if upgrade is still running */
+PNDMANAPI int pndman_upgrade_commit(
+      pndman_upgrade *upgrade);
+
+/* \brief free upgrade,
+ * unfinished syncs and downloads are cancelled */
+PNDMANAPI void pndman_upgrade_free(
+      pndman_upgrade *upgrade);
+
 /* \brief initialize synchorization handle.
  * NOTE: you should pass reference to
  * declared pndman_sync_handle variable.
@@ -667,6 +1235,10 @@ PNDMANAPI int pndman_api_archived_pnd(void *user_data, pndman_package *pnd,
  * returns number of curl operations pending, -1 on failure */
 PNDMANAPI int pndman_curl_process(unsigned long tv_sec, unsigned long tv_usec);
 
+/* \brief pndman_curl_process for context */
+PNDMANAPI int pndman_context_curl_process(pndman_context *context,
+      unsigned long tv_sec, unsigned long tv_usec);
+
 /* \brief function that does some internal
  * tests to catch up bad programming..
  * eh, let it be :) */
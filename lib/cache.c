@@ -0,0 +1,348 @@
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+static pthread_mutex_t _pndman_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define CACHE_LOCK()   pthread_mutex_lock(&_pndman_cache_mutex)
+#  define CACHE_UNLOCK() pthread_mutex_unlock(&_pndman_cache_mutex)
+#else
+#  define CACHE_LOCK()
+#  define CACHE_UNLOCK()
+#endif
+
+/* \brief download cache directory, NULL when disabled.
+ * contexts and per device threads use the cache at once,
+ * so settings and entries are only touched with CACHE_LOCK */
+static char *_PNDMAN_CACHE_PATH = NULL;
+
+/* \brief size budget of download cache, 0 = unlimited */
+static uint64_t _PNDMAN_CACHE_MAX_SIZE = 0;
+
+/* \brief cache entry, used for eviction */
+typedef struct _pndman_cache_entry
+{
+   char *dir;
+   uint64_t size;
+   time_t mtime;
+} _pndman_cache_entry;
+
+/* \brief md5 sums are the only keys we accept,
+ * so they can't point outside of cache */
+static int _pndman_cache_key_valid(const char *md5)
+{
+   size_t i;
+   if (!md5 || strlen(md5) != PNDMAN_MD5_LEN)
+      return RETURN_FALSE;
+   for (i = 0; i != PNDMAN_MD5_LEN; ++i)
+      if (!isxdigit((unsigned char)md5[i])) return RETURN_FALSE;
+   return RETURN_TRUE;
+}
+
+/* \brief path to directory of cache entry */
+static char* _pndman_cache_entry_dir(const char *md5)
+{
+   char *dir;
+   int size = snprintf(NULL, 0, "%s/%s", _PNDMAN_CACHE_PATH, md5)+1;
+   if (!(dir = malloc(size))) return NULL;
+   sprintf(dir, "%s/%s", _PNDMAN_CACHE_PATH, md5);
+   return dir;
+}
+
+/* \brief find the cached file in entry directory,
+ * entry holds single file named like it was downloaded */
+static char* _pndman_cache_entry_file(const char *dir, char **name, struct stat *st)
+{
+   DIR *dp;
+   struct dirent *ep;
+   char *path = NULL;
+
+   if (!(dp = opendir(dir)))
+      return NULL;
+
+   while (!path && (ep = readdir(dp))) {
+      if (ep->d_name[0] == '.') continue;
+      int size = snprintf(NULL, 0, "%s/%s", dir, ep->d_name)+1;
+      if (!(path = malloc(size))) break;
+      sprintf(path, "%s/%s", dir, ep->d_name);
+      if (stat(path, st) != 0 || !S_ISREG(st->st_mode)) {
+         NULLDO(free, path);
+         continue;
+      }
+      if (name) *name = strdup(ep->d_name);
+   }
+
+   closedir(dp);
+   return path;
+}
+
+/* \brief remove cache entry directory */
+static void _pndman_cache_remove_entry(const char *dir)
+{
+   DIR *dp;
+   struct dirent *ep;
+   char *path;
+
+   if ((dp = opendir(dir))) {
+      while ((ep = readdir(dp))) {
+         if (!strcmp(ep->d_name, ".") || !strcmp(ep->d_name, "..")) continue;
+         int size = snprintf(NULL, 0, "%s/%s", dir, ep->d_name)+1;
+         if (!(path = malloc(size))) continue;
+         sprintf(path, "%s/%s", dir, ep->d_name);
+         unlink(path);
+         free(path);
+      }
+      closedir(dp);
+   }
+
+   rmdir(dir);
+}
+
+/* \brief hardlink file, copy when source is on another filesystem */
+static int _pndman_cache_link(const char *src, const char *dst)
+{
+   unlink(dst);
+#ifndef _WIN32
+   if (link(src, dst) == 0)
+      return RETURN_OK;
+#endif
+   return _pndman_file_copy(src, dst);
+}
+
+/* \brief sort entries, least recently used first */
+static int _pndman_cache_entry_cmp(const void *a, const void *b)
+{
+   const _pndman_cache_entry *ea = a, *eb = b;
+   if (ea->mtime != eb->mtime) return (ea->mtime < eb->mtime ? -1 : 1);
+   return 0;
+}
+
+/* \brief evict least recently used entries,
+ * until cache fits in its size budget. caller holds CACHE_LOCK */
+static void _pndman_cache_evict(const char *keep)
+{
+   DIR *dp;
+   struct dirent *ep;
+   struct stat st;
+   char *dir, *file;
+   size_t count = 0, alloc = 0, i;
+   uint64_t total = 0;
+   _pndman_cache_entry *entry = NULL, *tmp;
+
+   if (!_PNDMAN_CACHE_PATH || !_PNDMAN_CACHE_MAX_SIZE)
+      return;
+
+   if (!(dp = opendir(_PNDMAN_CACHE_PATH)))
+      return;
+
+   while ((ep = readdir(dp))) {
+      if (!_pndman_cache_key_valid(ep->d_name)) continue;
+      if (!(dir = _pndman_cache_entry_dir(ep->d_name))) continue;
+      if (!(file = _pndman_cache_entry_file(dir, NULL, &st))) {
+         /* interrupted insert */
+         _pndman_cache_remove_entry(dir);
+         free(dir);
+         continue;
+      }
+      free(file);
+
+      if (count == alloc) {
+         if (!(tmp = realloc(entry, (alloc + 32) * sizeof(_pndman_cache_entry)))) {
+            free(dir);
+            break;
+         }
+         entry = tmp;
+         alloc += 32;
+      }
+
+      entry[count].dir  = dir;
+      entry[count].size = st.st_size;
+      entry[count].mtime = (stat(dir, &st) == 0 ? st.st_mtime : 0);
+      total += entry[count].size;
+      ++count;
+   }
+   closedir(dp);
+
+   qsort(entry, count, sizeof(_pndman_cache_entry), _pndman_cache_entry_cmp);
+   for (i = 0; i != count; ++i) {
+      if (total > _PNDMAN_CACHE_MAX_SIZE && (!keep || strcmp(entry[i].dir, keep))) {
+         DEBUG(PNDMAN_LEVEL_CRAP, "cache evict: %s", entry[i].dir);
+         _pndman_cache_remove_entry(entry[i].dir);
+         total -= entry[i].size;
+      }
+      free(entry[i].dir);
+   }
+   IFDO(free, entry);
+}
+
+/* INTERNAL API */
+
+/* \brief satisfy download of package with given md5 from cache,
+ * file is linked or copied to path and verified.
+ * filename is set to the name file was originally downloaded with. */
+int _pndman_cache_fetch(const char *md5, const char *path, char **filename)
+{
+   struct stat st;
+   char *dir = NULL, *file = NULL, *name = NULL, *sum = NULL;
+   int linked;
+   assert(path && filename);
+
+   if (!_pndman_cache_key_valid(md5))
+      return RETURN_FAIL;
+
+   CACHE_LOCK();
+   linked = (_PNDMAN_CACHE_PATH && (dir = _pndman_cache_entry_dir(md5)) &&
+             (file = _pndman_cache_entry_file(dir, &name, &st)) &&
+             _pndman_cache_link(file, path) == RETURN_OK);
+   CACHE_UNLOCK();
+   if (!linked) goto fail;
+
+   /* never trust what is on disk,
+    * path is ours now so it's hashed without lock */
+   if (!(sum = _pndman_md5(path)) || _strupcmp(sum, md5))
+      goto corrupt;
+
+   /* mark used, directory mtime is what eviction looks at */
+   utime(dir, NULL);
+   DEBUG(PNDMAN_LEVEL_CRAP, "cache hit: %s", file);
+
+   *filename = name;
+   free(sum);
+   free(file);
+   free(dir);
+   return RETURN_OK;
+
+corrupt:
+   DEBUG(PNDMAN_LEVEL_WARN, CACHE_CORRUPT, file);
+   CACHE_LOCK();
+   _pndman_cache_remove_entry(dir);
+   CACHE_UNLOCK();
+   unlink(path);
+fail:
+   IFDO(free, sum);
+   IFDO(free, name);
+   IFDO(free, file);
+   IFDO(free, dir);
+   return RETURN_FAIL;
+}
+
+/* \brief insert copy of verified download to cache */
+void _pndman_cache_insert(const char *md5, const char *path, const char *filename)
+{
+   struct stat st;
+   char *dir = NULL, *file = NULL;
+   assert(path && filename);
+
+   if (!_pndman_cache_key_valid(md5) || strchr(filename, '/'))
+      return;
+
+   CACHE_LOCK();
+   if (!_PNDMAN_CACHE_PATH || !(dir = _pndman_cache_entry_dir(md5)))
+      goto out;
+
+   /* already cached, just mark used */
+   if ((file = _pndman_cache_entry_file(dir, NULL, &st))) {
+      utime(dir, NULL);
+      goto out;
+   }
+
+   /* don't bother if it won't ever fit */
+   if (_PNDMAN_CACHE_MAX_SIZE && (stat(path, &st) != 0 || (uint64_t)st.st_size > _PNDMAN_CACHE_MAX_SIZE))
+      goto out;
+
+#ifdef _WIN32
+   if (mkdir(dir) == -1 && errno != EEXIST)
+#else
+   if (mkdir(dir, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1 && errno != EEXIST)
+#endif
+      goto fail;
+
+   int size = snprintf(NULL, 0, "%s/%s", dir, filename)+1;
+   if (!(file = malloc(size))) goto fail;
+   sprintf(file, "%s/%s", dir, filename);
+
+   /* installed file is removed or upgraded later,
+    * so cache keeps blocks of its own that count in budget */
+   if (_pndman_file_copy(path, file) != RETURN_OK) {
+      _pndman_cache_remove_entry(dir);
+      goto fail;
+   }
+
+   DEBUG(PNDMAN_LEVEL_CRAP, "cache insert: %s", file);
+   _pndman_cache_evict(dir);
+   goto out;
+
+fail:
+   DEBUG(PNDMAN_LEVEL_WARN, CACHE_INSERT_FAIL, path);
+out:
+   CACHE_UNLOCK();
+   IFDO(free, file);
+   IFDO(free, dir);
+}
+
+/* PUBLIC API */
+
+/* \brief set download cache directory and its size budget */
+PNDMANAPI int pndman_set_download_cache(const char *path, uint64_t max_size)
+{
+   char *tmp = NULL;
+
+   if (path) {
+      if (!(tmp = strdup(path)))
+         goto fail;
+      _strip_slash(tmp);
+#ifdef _WIN32
+      if (mkdir(tmp) == -1 && errno != EEXIST)
+#else
+      if (mkdir(tmp, S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1 && errno != EEXIST)
+#endif
+         goto access_fail;
+   }
+
+   CACHE_LOCK();
+   IFDO(free, _PNDMAN_CACHE_PATH);
+   _PNDMAN_CACHE_PATH = tmp;
+   _PNDMAN_CACHE_MAX_SIZE = max_size;
+   _pndman_cache_evict(NULL);
+   CACHE_UNLOCK();
+   return RETURN_OK;
+
+access_fail:
+   DEBFAIL(ACCESS_FAIL, tmp);
+fail:
+   IFDO(free, tmp);
+   return RETURN_FAIL;
+}
+
+/* \brief get download cache directory,
+ * valid until pndman_set_download_cache is called again */
+PNDMANAPI const char* pndman_get_download_cache(void)
+{
+   const char *path;
+   CACHE_LOCK();
+   path = _PNDMAN_CACHE_PATH;
+   CACHE_UNLOCK();
+   return path;
+}
+
+/* \brief get size budget of download cache */
+PNDMANAPI uint64_t pndman_get_download_cache_size(void)
+{
+   uint64_t size;
+   CACHE_LOCK();
+   size = _PNDMAN_CACHE_MAX_SIZE;
+   CACHE_UNLOCK();
+   return size;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
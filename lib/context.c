@@ -0,0 +1,165 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+static pthread_once_t _pndman_curl_once = PTHREAD_ONCE_INIT;
+#else
+static int _pndman_curl_once = 0;
+#endif
+
+/* \brief result of curl_global_init */
+static CURLcode _pndman_curl_global = CURLE_OK;
+
+/* \brief context used when none is given,
+ * pndman_set_curl_* functions configure this one */
+static pndman_context _pndman_context_default = {
+   NULL, NULL, NULL, NULL,
+   0,
+   PNDMAN_CURL_MAX_CONNECTIONS,
+   PNDMAN_CURL_MAX_HOST_CONNECTIONS,
+   0,
+   PNDMAN_CURL_SEGMENTS,
+   PNDMAN_CURL_SEGMENT_MIN_SIZE,
+   NULL,
+};
+
+/* \brief run curl_global_init */
+static void _pndman_curl_global_init_once(void)
+{
+   _pndman_curl_global = curl_global_init(CURL_GLOBAL_ALL);
+}
+
+/* INTERNAL API */
+
+/* \brief get context, NULL is the default context */
+pndman_context* _pndman_context(pndman_context *context)
+{
+   return (context ? context : &_pndman_context_default);
+}
+
+/* \brief initialize curl once per process,
+ * curl_global_init is not thread-safe so every thread goes through here.
+ * curl_global_cleanup is never called, other contexts may still need curl. */
+int _pndman_curl_global_init(void)
+{
+#ifdef HAVE_PTHREAD
+   pthread_once(&_pndman_curl_once, _pndman_curl_global_init_once);
+#else
+   if (!_pndman_curl_once) {
+      _pndman_curl_global_init_once();
+      _pndman_curl_once = 1;
+   }
+#endif
+   return (_pndman_curl_global == CURLE_OK ? RETURN_OK : RETURN_FAIL);
+}
+
+/* PUBLIC API */
+
+/* \brief create new context,
+ * settings are copied from the default context */
+PNDMANAPI pndman_context* pndman_context_new(void)
+{
+   pndman_context *context;
+
+   if (_pndman_curl_global_init() != RETURN_OK)
+      goto curl_fail;
+
+   if (!(context = malloc(sizeof(pndman_context))))
+      goto fail;
+
+   memcpy(context, &_pndman_context_default, sizeof(pndman_context));
+   context->curlm  = NULL;
+   context->queue  = NULL;
+   context->active = NULL;
+   context->local  = NULL;
+   return context;
+
+curl_fail:
+   DEBFAIL(CURL_CURLM_FAIL);
+   return NULL;
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "pndman_context");
+   return NULL;
+}
+
+/* \brief free context,
+ * pending transfers are dropped without callbacks */
+PNDMANAPI void pndman_context_free(pndman_context *context)
+{
+   if (!context || context == &_pndman_context_default)
+      return;
+
+   _pndman_io_stop(context);
+   _pndman_curl_context_cleanup(context);
+   free(context);
+}
+
+/* \brief set curl timeout of context */
+PNDMANAPI void pndman_context_set_curl_timeout(pndman_context *context, int timeout)
+{
+   context = _pndman_context(context);
+   if (timeout >= 0) context->curl_timeout = timeout;
+}
+
+/* \brief get curl timeout of context */
+PNDMANAPI int pndman_context_get_curl_timeout(pndman_context *context)
+{
+   return _pndman_context(context)->curl_timeout;
+}
+
+/* \brief set concurrent transfer limits of context */
+PNDMANAPI void pndman_context_set_curl_max_connections(pndman_context *context, int total, int per_host)
+{
+   context = _pndman_context(context);
+   if (total >= 0)    context->max_connections = total;
+   if (per_host >= 0) context->max_host_connections = per_host;
+}
+
+/* \brief get maximum number of concurrent transfers of context */
+PNDMANAPI int pndman_context_get_curl_max_connections(pndman_context *context)
+{
+   return _pndman_context(context)->max_connections;
+}
+
+/* \brief get maximum number of concurrent transfers per host of context */
+PNDMANAPI int pndman_context_get_curl_max_host_connections(pndman_context *context)
+{
+   return _pndman_context(context)->max_host_connections;
+}
+
+/* \brief set total download speed limit of context */
+PNDMANAPI void pndman_context_set_curl_max_speed(pndman_context *context, uint64_t bytes_per_second)
+{
+   _pndman_context(context)->max_speed = bytes_per_second;
+}
+
+/* \brief get total download speed limit of context */
+PNDMANAPI uint64_t pndman_context_get_curl_max_speed(pndman_context *context)
+{
+   return _pndman_context(context)->max_speed;
+}
+
+/* \brief set segmented download options of context */
+PNDMANAPI void pndman_context_set_curl_segments(pndman_context *context, int segments, uint64_t min_size)
+{
+   context = _pndman_context(context);
+   if (segments > 0) context->segments = segments;
+   context->segment_min_size = min_size;
+}
+
+/* \brief get number of segments used for large downloads of context */
+PNDMANAPI int pndman_context_get_curl_segments(pndman_context *context)
+{
+   return _pndman_context(context)->segments;
+}
+
+/* \brief get minimum size of segmented download of context */
+PNDMANAPI uint64_t pndman_context_get_curl_segment_min_size(pndman_context *context)
+{
+   return _pndman_context(context)->segment_min_size;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -1,14 +1,81 @@
+#ifdef __linux__
+#  define _GNU_SOURCE /* fallocate */
+#endif
 #include "internal.h"
 #include <stdio.h>
+#include <errno.h>
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
 #include <curl/curl.h>
 #include "version.h"
 
-/* internal multi curl handle */
-static CURLM *_pndman_curlm = NULL;
+/* \brief collect metrics of finished transfer,
+ * retries and segments add up to one download */
+static void _pndman_curl_metrics(pndman_curl_handle *handle, CURL *curl)
+{
+   curl_off_t bytes = 0;
+   double total = 0, connect = 0;
+   uint64_t start;
+   curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+   curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total);
+   curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect);
+
+   start = _pndman_metrics_now() - (uint64_t)(total * 1000000);
+   if (!handle->metric_start || start < handle->metric_start)
+      handle->metric_start = start;
+   if (bytes > 0) handle->metric_bytes += (uint64_t)bytes;
+   handle->metric_connect += (uint64_t)(connect * 1000000);
+}
+
+/* \brief record metrics of download once it's done or failed */
+static void _pndman_curl_metrics_flush(pndman_curl_handle *handle)
+{
+   uint64_t total;
+   if (!handle->metric_start) return;
+
+   total = _pndman_metrics_now() - handle->metric_start;
+   _pndman_metrics_bytes(handle->repository, handle->metric_bytes);
+   _pndman_metrics_add(PNDMAN_METRIC_TRANSFER_TIME, total);
+   _pndman_metrics_add(PNDMAN_METRIC_CONNECT_TIME, handle->metric_connect);
+   _pndman_metrics_span("transfer", handle->url, handle->metric_start, total);
+   handle->metric_start = handle->metric_bytes = handle->metric_connect = 0;
+}
+
+/* \brief report state of handle to its owner.
+ * With IO thread the owner gets it as event, and the handle
+ * belongs to dispatching thread until it's performed again.
+ * returns RETURN_TRUE when handle was handed over, caller must not touch it after */
+static int _pndman_curl_notify(pndman_curl_handle *handle,
+      pndman_curl_code code, const char *info)
+{
+   if (code != PNDMAN_CURL_PROGRESS)
+      _pndman_curl_metrics_flush(handle);
+
+   if (!handle->context->io) {
+      handle->callback(code, handle->data, info, handle);
+   } else if (code == PNDMAN_CURL_PROGRESS) {
+      _pndman_io_progress(handle);
+   } else {
+      _pndman_curl_unschedule(handle);
+      _pndman_io_event(handle->context,
+            (code == PNDMAN_CURL_DONE ? PNDMAN_IO_DONE : PNDMAN_IO_FAIL), handle, info);
+      return RETURN_TRUE;
+   }
+   return RETURN_FALSE;
+}
+
+/* \brief release handle freed inside callback,
+ * with IO thread it's released by the dispatching thread instead */
+static void _pndman_curl_handle_collect(pndman_curl_handle *handle)
+{
+   if (handle->free && !handle->context->io)
+      _pndman_curl_handle_release(handle);
+}
 
 /* \brief init internal curl header */
 static void _pndman_curl_header_init(pndman_curl_header *header)
@@ -33,12 +100,153 @@ static void _pndman_curl_init_progress(pndman_curl_progress *progress)
    memset(progress, 0, sizeof(pndman_curl_progress));
 }
 
+/* \brief hash file contents from current md5 position to end */
+static int _pndman_curl_md5_file(pndman_curl_handle *handle, uint64_t end)
+{
+#ifdef _WIN32
+   (void)handle;
+   (void)end;
+   return RETURN_FAIL;
+#else
+   char buffer[PNDMAN_MD5_CHUNK];
+   ssize_t len;
+   size_t want;
+
+   while (handle->md5_pos < end) {
+      want = (end - handle->md5_pos < sizeof(buffer) ? end - handle->md5_pos : sizeof(buffer));
+      if ((len = pread(fileno(handle->file), buffer, want, handle->md5_pos)) <= 0)
+         return RETURN_FAIL;
+      _pndman_md5_update(handle->md5_ctx, buffer, len);
+      handle->md5_pos += len;
+   }
+   return RETURN_OK;
+#endif
+}
+
+/* \brief hash segments that got written ahead of md5 position */
+static void _pndman_curl_md5_catchup(pndman_curl_handle *handle)
+{
+   int i;
+   pndman_curl_segment *seg;
+
+   for (i = 0; i != handle->segments && handle->md5_ctx; ++i) {
+      seg = &handle->segment[i];
+      if (seg->end < handle->md5_pos) continue;
+      if (seg->start + seg->pos <= handle->md5_pos) break;
+      if (_pndman_curl_md5_file(handle, seg->start + seg->pos) != RETURN_OK) {
+         IFDO(free, handle->md5_ctx);
+      }
+      if (seg->start + seg->pos <= seg->end) break;
+   }
+}
+
+/* \brief start md5 for transfer, existing part of file
+ * is hashed once, the rest while it's downloaded */
+static void _pndman_curl_md5_start(pndman_curl_handle *handle)
+{
+   IFDO(free, handle->md5);
+
+   /* only downloads to file are verified */
+   if (!handle->path) {
+      IFDO(free, handle->md5_ctx);
+      return;
+   }
+
+   /* retry, we already have the state for what's on disk */
+   if (handle->md5_ctx && !handle->segment && handle->md5_pos == handle->resume)
+      return;
+
+   IFDO(free, handle->md5_ctx);
+   handle->md5_pos = 0;
+   if (!(handle->md5_ctx = _pndman_md5_new()))
+      return;
+
+   if (handle->segment) {
+      _pndman_curl_md5_catchup(handle);
+   } else if (handle->resume && _pndman_curl_md5_file(handle, handle->resume) != RETURN_OK) {
+      IFDO(free, handle->md5_ctx);
+   }
+}
+
+/* \brief finish md5 of downloaded file */
+static void _pndman_curl_md5_finish(pndman_curl_handle *handle)
+{
+   struct stat st;
+   if (!handle->md5_ctx) return;
+
+   /* don't trust the state, if it doesn't cover the whole file */
+   if (fstat(fileno(handle->file), &st) != 0 || (uint64_t)st.st_size != handle->md5_pos) {
+      DEBUG(PNDMAN_LEVEL_CRAP, "md5 state covers %"PRIu64" bytes, dropping it", handle->md5_pos);
+      IFDO(free, handle->md5_ctx);
+      return;
+   }
+
+   IFDO(free, handle->md5);
+   handle->md5 = _pndman_md5_final(handle->md5_ctx);
+   handle->md5_ctx = NULL;
+}
+
+/* \brief give back space reserved for handle */
+static void _pndman_curl_space_release(pndman_curl_handle *handle)
+{
+   if (!handle->reserved) return;
+   _pndman_device_release(handle->space, handle->reserved);
+   handle->reserved = 0;
+}
+
+/* \brief allocate blocks for the whole download once its size is known.
+ * File size is kept, so appending and resume work like before,
+ * and the file is not fragmented by small writes. */
+static void _pndman_curl_preallocate(pndman_curl_handle *handle)
+{
+   handle->preallocated = 1;
+#ifdef FALLOC_FL_KEEP_SIZE
+   curl_off_t length = 0;
+   uint64_t size = handle->size;
+
+   if (!size && curl_easy_getinfo(handle->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK && length > 0)
+      size = handle->resume + (uint64_t)length;
+   if (!size) return;
+
+   if (fallocate(fileno(handle->file), FALLOC_FL_KEEP_SIZE, 0, size) != 0) {
+      DEBUG(PNDMAN_LEVEL_CRAP, "fallocate %s: %s", handle->path, strerror(errno));
+      return;
+   }
+
+   /* blocks are taken now */
+   _pndman_curl_space_release(handle);
+   handle->reserve = 0;
+#endif
+}
+
+/* \brief drop preallocated blocks past end of file,
+ * when the download turned out smaller than expected */
+static void _pndman_curl_preallocate_trim(pndman_curl_handle *handle)
+{
+#ifdef FALLOC_FL_KEEP_SIZE
+   struct stat st;
+   if (!handle->preallocated || !handle->size || handle->segment) return;
+   if (fstat(fileno(handle->file), &st) == 0 && (uint64_t)st.st_size < handle->size &&
+       ftruncate(fileno(handle->file), st.st_size) != 0)
+      DEBUG(PNDMAN_LEVEL_CRAP, "ftruncate %s: %s", handle->path, strerror(errno));
+#else
+   (void)handle;
+#endif
+}
+
 /* \brief write to file */
 static size_t _pndman_curl_write_file(void *data, size_t size, size_t nmemb, void *out)
 {
+   size_t written;
    pndman_curl_handle *handle = out;
    if (!handle || handle->free) return 0;
-   return fwrite(data, size, nmemb, handle->file);
+   if (!handle->preallocated && handle->path) _pndman_curl_preallocate(handle);
+   written = fwrite(data, size, nmemb, handle->file);
+   if (handle->md5_ctx) {
+      _pndman_md5_update(handle->md5_ctx, data, written * size);
+      handle->md5_pos += written * size;
+   }
+   return written;
 }
 
 /* \brief write to header */
@@ -85,11 +293,532 @@ static int _pndman_curl_progress_func(void *userdata,
    if (!handle || handle->free) return 1;
    handle->progress->download           = handle->resume + download;
    handle->progress->total_to_download  = handle->resume + total_to_download;
-   handle->callback(PNDMAN_CURL_PROGRESS, handle->data, NULL, handle);
+   _pndman_curl_notify(handle, PNDMAN_CURL_PROGRESS, NULL);
    return 0;
 }
 
-static void _pndman_curl_handle_free_real(pndman_curl_handle *handle)
+/* \brief path of segment state file, free when done */
+static char* _pndman_curl_segment_state_path(pndman_curl_handle *handle)
+{
+   char *path;
+   int size = snprintf(NULL, 0, "%s"PNDMAN_CURL_SEGMENT_STATE, handle->path)+1;
+   if (!(path = malloc(size))) return NULL;
+   sprintf(path, "%s"PNDMAN_CURL_SEGMENT_STATE, handle->path);
+   return path;
+}
+
+/* \brief write segment positions to state file,
+ * so segmented download can be resumed later */
+static void _pndman_curl_segments_save(pndman_curl_handle *handle)
+{
+   int i;
+   FILE *f;
+   char *path;
+
+   if (!handle->segment || !handle->path) return;
+   if (!(path = _pndman_curl_segment_state_path(handle))) return;
+   if ((f = fopen(path, "wb"))) {
+      fprintf(f, "%"PRIu64" %d\n", handle->size, handle->segments);
+      for (i = 0; i != handle->segments; ++i)
+         fprintf(f, "%"PRIu64" %"PRIu64" %"PRIu64"\n", handle->segment[i].start,
+               handle->segment[i].end, handle->segment[i].pos);
+      fclose(f);
+   }
+   free(path);
+}
+
+/* \brief remove segment state file */
+static void _pndman_curl_segments_unlink(pndman_curl_handle *handle)
+{
+   char *path;
+   if (!handle->path) return;
+   if (!(path = _pndman_curl_segment_state_path(handle))) return;
+   unlink(path);
+   free(path);
+}
+
+/* \brief free segments of handle */
+static void _pndman_curl_segments_free(pndman_curl_handle *handle)
+{
+   int i;
+   if (!handle->segment) return;
+   for (i = 0; i != handle->segments; ++i) {
+      if (handle->segment[i].state == PNDMAN_CURL_ACTIVE && handle->context->curlm)
+         curl_multi_remove_handle(handle->context->curlm, handle->segment[i].curl);
+      IFDO(curl_easy_cleanup, handle->segment[i].curl);
+   }
+   NULLDO(free, handle->segment);
+   handle->segments = 0;
+}
+
+/* \brief should the handle be downloaded in segments? */
+static int _pndman_curl_handle_segmented(pndman_curl_handle *handle)
+{
+#ifdef _WIN32
+   (void)handle;
+   return RETURN_FALSE;
+#else
+   char *path;
+   int state;
+
+   if (handle->fallback || handle->post || !handle->path)
+      return RETURN_FALSE;
+   if (handle->context->segments < 2 || !handle->size ||
+       handle->size < handle->context->segment_min_size)
+      return RETURN_FALSE;
+
+   /* every segment needs at least one byte */
+   if (handle->size < (uint64_t)handle->context->segments)
+      return RETURN_FALSE;
+
+   /* partial file without segment state was downloaded
+    * in single stream, keep resuming it that way */
+   if (access(handle->path, F_OK) != 0)
+      return RETURN_TRUE;
+   if (!(path = _pndman_curl_segment_state_path(handle)))
+      return RETURN_FALSE;
+   state = (access(path, F_OK) == 0);
+   free(path);
+   return (state ? RETURN_TRUE : RETURN_FALSE);
+#endif
+}
+
+/* \brief load segment positions from state file */
+static int _pndman_curl_segments_load(pndman_curl_handle *handle)
+{
+   int i, count;
+   uint64_t size;
+   FILE *f;
+   char *path;
+   pndman_curl_segment *seg;
+
+   if (!(path = _pndman_curl_segment_state_path(handle))) return RETURN_FAIL;
+   f = fopen(path, "rb");
+   free(path);
+   if (!f) return RETURN_FAIL;
+
+   if (fscanf(f, "%"SCNu64" %d", &size, &count) != 2 ||
+       size != handle->size || count != handle->segments)
+      goto fail;
+
+   for (i = 0; i != handle->segments; ++i) {
+      seg = &handle->segment[i];
+      if (fscanf(f, "%"SCNu64" %"SCNu64" %"SCNu64, &seg->start, &seg->end, &seg->pos) != 3 ||
+          seg->end >= size || seg->start > seg->end + 1 || seg->pos > seg->end - seg->start + 1)
+         goto fail;
+   }
+
+   fclose(f);
+   return RETURN_OK;
+
+fail:
+   fclose(f);
+   return RETURN_FAIL;
+}
+
+/* \brief write segment data to its region of the file */
+static size_t _pndman_curl_write_segment(void *data, size_t size, size_t nmemb, void *out)
+{
+   long code = 0;
+   size_t len = size * nmemb;
+   pndman_curl_segment *seg = out;
+   pndman_curl_handle *handle = seg->handle;
+   if (!handle || handle->free) return 0;
+
+   /* server sent something else than our range */
+   curl_easy_getinfo(seg->curl, CURLINFO_RESPONSE_CODE, &code);
+   if (code != 206 || seg->start + seg->pos + len > seg->end + 1) {
+      handle->fallback = 1;
+      return 0;
+   }
+
+   if (pwrite(fileno(handle->file), data, len, seg->start + seg->pos) != (ssize_t)len)
+      return 0;
+
+   /* hash in order, segments ahead are hashed when we get there */
+   if (handle->md5_ctx && seg->start + seg->pos == handle->md5_pos) {
+      _pndman_md5_update(handle->md5_ctx, data, len);
+      handle->md5_pos += len;
+   }
+
+   seg->pos += len;
+   if (handle->md5_ctx && handle->md5_pos > seg->end)
+      _pndman_curl_md5_catchup(handle);
+   return len;
+}
+
+/* \brief check that the range reply is for file of expected size,
+ * headers of first segment are kept for the handle */
+static size_t _pndman_curl_write_segment_header(char *data, size_t size, size_t nmemb, void *out)
+{
+   uint64_t total;
+   pndman_curl_segment *seg = out;
+   pndman_curl_handle *handle = seg->handle;
+   if (!handle || handle->free) return 0;
+
+   if (!_strnupcmp(data, "Content-Range:", strlen("Content-Range:"))) {
+      const char *slash = memchr(data, '/', size * nmemb);
+      if (slash && sscanf(slash+1, "%"SCNu64, &total) == 1 && total != handle->size) {
+         handle->fallback = 1;
+         return 0;
+      }
+   }
+
+   if (seg != handle->segment) return size * nmemb;
+   return _pndman_curl_write_header(data, size, nmemb, handle);
+}
+
+/* \brief progress of segmented download */
+static int _pndman_curl_segment_progress_func(void *userdata,
+      curl_off_t total_to_download, curl_off_t download, curl_off_t total_to_upload, curl_off_t upload)
+{
+   (void)total_to_download;
+   (void)download;
+   (void)total_to_upload;
+   (void)upload;
+   int i;
+   uint64_t done = 0;
+   pndman_curl_segment *seg = userdata;
+   pndman_curl_handle *handle = seg->handle;
+   if (!handle || handle->free) return 1;
+   for (i = 0; i != handle->segments; ++i) done += handle->segment[i].pos;
+   handle->progress->download          = done;
+   handle->progress->total_to_download = handle->size;
+   _pndman_curl_notify(handle, PNDMAN_CURL_PROGRESS, NULL);
+   return 0;
+}
+
+/* \brief set options shared by all transfers */
+static void _pndman_curl_setopt(void *curl, pndman_curl_handle *handle)
+{
+   curl_easy_setopt(curl, CURLOPT_USERAGENT, "libpndman ("VERSION")");
+   curl_easy_setopt(curl, CURLOPT_URL, handle->url);
+   curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, handle->context->curl_timeout);
+   curl_easy_setopt(curl, CURLOPT_COOKIEFILE, "");
+   curl_easy_setopt(curl, CURLOPT_PRIVATE, handle);
+   curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 10240L);
+   curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 300L);
+}
+
+/* \brief split the download into ranges and open
+ * preallocated file for them */
+static int _pndman_curl_segments_init(pndman_curl_handle *handle)
+{
+   int i, fd;
+   uint64_t len;
+   pndman_curl_segment *seg;
+   assert(handle && !handle->segment);
+
+   handle->segments = handle->context->segments;
+   if (!(handle->segment = calloc(handle->segments, sizeof(pndman_curl_segment))))
+      goto segment_fail;
+
+   /* resume from state file, or start over */
+   if ((handle->file = fopen(handle->path, "r+b")) &&
+       _pndman_curl_segments_load(handle) == RETURN_OK) {
+      DEBUG(PNDMAN_LEVEL_CRAP, "Segmented resume: %s", handle->path);
+   } else {
+      IFDO(fclose, handle->file);
+      if (!(handle->file = fopen(handle->path, "w+b")))
+         goto open_fail;
+
+      len = handle->size / handle->segments;
+      for (i = 0; i != handle->segments; ++i) {
+         handle->segment[i].start = len * i;
+         handle->segment[i].end   = (i+1 == handle->segments ? handle->size : len * (i+1)) - 1;
+         handle->segment[i].pos   = 0;
+      }
+   }
+
+   /* reserve the whole file, so segments can be written anywhere */
+   fd = fileno(handle->file);
+#ifndef _WIN32
+   if (posix_fallocate(fd, 0, handle->size) != 0)
+#endif
+   {
+      if (ftruncate(fd, handle->size) != 0)
+         goto open_fail;
+   }
+#ifndef _WIN32
+   else {
+      /* blocks are taken, nothing to reserve */
+      handle->preallocated = 1;
+      handle->reserve = 0;
+   }
+#endif
+
+   for (i = 0; i != handle->segments; ++i) {
+      seg = &handle->segment[i];
+      seg->handle = handle;
+      if (!(seg->curl = curl_easy_init()))
+         goto curl_fail;
+
+      _pndman_curl_setopt(seg->curl, handle);
+      curl_easy_setopt(seg->curl, CURLOPT_HEADERFUNCTION, _pndman_curl_write_segment_header);
+      curl_easy_setopt(seg->curl, CURLOPT_HEADERDATA, seg);
+      curl_easy_setopt(seg->curl, CURLOPT_WRITEFUNCTION, _pndman_curl_write_segment);
+      curl_easy_setopt(seg->curl, CURLOPT_WRITEDATA, seg);
+      curl_easy_setopt(seg->curl, CURLOPT_NOPROGRESS, handle->progress?0:1);
+      curl_easy_setopt(seg->curl, CURLOPT_XFERINFOFUNCTION, _pndman_curl_segment_progress_func);
+      curl_easy_setopt(seg->curl, CURLOPT_XFERINFODATA, seg);
+   }
+
+   _pndman_curl_segments_save(handle);
+   return RETURN_OK;
+
+segment_fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "pndman_curl_segment");
+   goto fail;
+open_fail:
+   DEBFAIL(ACCESS_FAIL, handle->path);
+   goto fail;
+curl_fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "CURL");
+fail:
+   _pndman_curl_segments_free(handle);
+   return RETURN_FAIL;
+}
+
+/* \brief get host part of url, free when done */
+static char* _pndman_curl_host(const char *url)
+{
+   const char *start, *end, *at;
+   char *host;
+   assert(url);
+
+   if ((start = strstr(url, "://"))) start += 3;
+   else start = url;
+
+   end = start + strcspn(start, "/?#");
+   if ((at = memchr(start, '@', end - start))) start = at + 1;
+
+   if (!(host = malloc(end - start + 1)))
+      return NULL;
+
+   memcpy(host, start, end - start);
+   host[end - start] = 0;
+   return host;
+}
+
+/* \brief number of connections handle is using */
+static int _pndman_curl_connections(pndman_curl_handle *handle)
+{
+   int i, count = 0;
+   if (!handle->segment) return 1;
+   for (i = 0; i != handle->segments; ++i)
+      if (handle->segment[i].state == PNDMAN_CURL_ACTIVE) ++count;
+   return count;
+}
+
+/* \brief count active transfers against host,
+ * segmented download is one transfer, its segments have own allowance */
+static int _pndman_curl_host_count(pndman_context *context, const char *host)
+{
+   int count = 0;
+   pndman_curl_handle *h;
+   for (h = context->active; h; h = h->next)
+      if (host && h->host && !strcmp(h->host, host))
+         ++count;
+   return count;
+}
+
+/* \brief share the speed limit evenly between active transfers */
+static void _pndman_curl_share_bandwidth(pndman_context *context)
+{
+   int i, count = 0;
+   curl_off_t share = 0;
+   pndman_curl_handle *h;
+   uint64_t speed = context->max_speed;
+
+   for (h = context->active; h; h = h->next)
+      count += _pndman_curl_connections(h);
+   if (speed && count) share = (speed / count) ?: 1;
+   for (h = context->active; h; h = h->next) {
+      if (!h->segment) {
+         curl_easy_setopt(h->curl, CURLOPT_MAX_RECV_SPEED_LARGE, share);
+         continue;
+      }
+      for (i = 0; i != h->segments; ++i)
+         curl_easy_setopt(h->segment[i].curl, CURLOPT_MAX_RECV_SPEED_LARGE, share);
+   }
+}
+
+/* \brief add handle to the scheduler queue,
+ * higher priority first, then smaller transfers first */
+static void _pndman_curl_enqueue(pndman_curl_handle *handle)
+{
+   pndman_curl_handle *h, *prev = NULL;
+   assert(handle && handle->state == PNDMAN_CURL_IDLE);
+
+   for (h = handle->context->queue; h; prev = h, h = h->next) {
+      if (h->priority < handle->priority) break;
+      if (h->priority == handle->priority && h->size > handle->size) break;
+   }
+
+   handle->next = h;
+   if (prev) prev->next = handle;
+   else handle->context->queue = handle;
+   handle->state = PNDMAN_CURL_QUEUED;
+}
+
+/* \brief remove handle from scheduler */
+void _pndman_curl_unschedule(pndman_curl_handle *handle)
+{
+   int i;
+   pndman_curl_handle *h, *prev = NULL;
+   pndman_curl_handle **list;
+   pndman_context *context;
+   assert(handle);
+
+   _pndman_curl_space_release(handle);
+   if (handle->state == PNDMAN_CURL_IDLE)
+      return;
+
+   context = handle->context;
+   if (handle->state == PNDMAN_CURL_ACTIVE) list = &context->active;
+   else if (handle->state == PNDMAN_CURL_LOCAL) list = &context->local;
+   else list = &context->queue;
+   for (h = *list; h && h != handle; prev = h, h = h->next);
+   if (h) {
+      if (prev) prev->next = h->next;
+      else *list = h->next;
+   }
+
+   if (handle->state == PNDMAN_CURL_ACTIVE) {
+      if (handle->segment) {
+         for (i = 0; i != handle->segments; ++i) {
+            if (handle->segment[i].state != PNDMAN_CURL_ACTIVE) continue;
+            if (context->curlm) curl_multi_remove_handle(context->curlm, handle->segment[i].curl);
+            handle->segment[i].state = PNDMAN_CURL_IDLE;
+         }
+      } else if (context->curlm) {
+         curl_multi_remove_handle(context->curlm, handle->curl);
+      }
+      _pndman_curl_share_bandwidth(context);
+   }
+
+   handle->state = PNDMAN_CURL_IDLE;
+   handle->next  = NULL;
+}
+
+/* \brief start segments of segmented download that are not running,
+ * download took its transfer slot already, so segments are not capped.
+ * returns -1 if segment could not be added */
+static int _pndman_curl_start_segments(pndman_curl_handle *handle)
+{
+   int i, added = 0;
+   char range[64];
+   pndman_curl_segment *seg;
+
+   for (i = 0; i != handle->segments; ++i) {
+      seg = &handle->segment[i];
+      if (seg->state != PNDMAN_CURL_IDLE || seg->start + seg->pos > seg->end)
+         continue;
+
+      snprintf(range, sizeof(range)-1, "%"PRIu64"-%"PRIu64, seg->start + seg->pos, seg->end);
+      curl_easy_setopt(seg->curl, CURLOPT_RANGE, range);
+      if (curl_multi_add_handle(handle->context->curlm, seg->curl) != CURLM_OK)
+         return RETURN_FAIL;
+
+      seg->state = PNDMAN_CURL_ACTIVE;
+      ++added;
+      DEBUG(PNDMAN_LEVEL_CRAP, "segment %d: %s", i, range);
+   }
+
+   return added;
+}
+
+/* \brief start queued transfers while there are free slots,
+ * returns number of transfers still waiting for a slot */
+static int _pndman_curl_schedule(pndman_context *context)
+{
+   int active = 0, queued = 0, added = 0, ret;
+   uint64_t pending;
+   const char *error;
+   pndman_curl_handle *h, *next, *prev = NULL;
+   int total    = context->max_connections;
+   int per_host = context->max_host_connections;
+
+   /* limits count transfers, segmented download is one */
+   for (h = context->active; h; h = h->next)
+      ++active;
+
+   /* segments waiting for a retry */
+   for (h = context->active; h; h = h->next) {
+      if (!h->segment) continue;
+      if ((ret = _pndman_curl_start_segments(h)) > 0)
+         added += ret;
+   }
+
+   for (h = context->queue; h; h = next) {
+      next = h->next;
+
+      if ((total && active >= total) ||
+          (per_host && _pndman_curl_host_count(context, h->host) >= per_host)) {
+         prev = h;
+         continue;
+      }
+
+      /* admission, wait while other downloads hold the space we need */
+      error = CURL_ADD_FAIL;
+      ret = RETURN_OK;
+      if (h->space && h->reserve && !h->reserved) {
+         if (_pndman_device_reserve(h->space, h->reserve, &pending) == RETURN_OK) {
+            h->reserved = h->reserve;
+         } else if (pending) {
+            prev = h;
+            continue;
+         } else {
+            error = CURL_SPACE_FAIL;
+            ret = RETURN_FAIL;
+         }
+      }
+
+      if (prev) prev->next = next;
+      else context->queue = next;
+      h->next  = NULL;
+      h->state = PNDMAN_CURL_IDLE;
+
+      if (ret == RETURN_FAIL) {
+         /* does not fit, even when nothing else is downloading */
+      } else if (h->segment) {
+         h->state = PNDMAN_CURL_ACTIVE;
+         h->next  = context->active;
+         context->active = h;
+         ++active;
+         ret = _pndman_curl_start_segments(h);
+      } else if ((ret = curl_multi_add_handle(context->curlm, h->curl)) == CURLM_OK) {
+         h->state = PNDMAN_CURL_ACTIVE;
+         h->next  = context->active;
+         context->active = h;
+         ++active;
+      } else ret = RETURN_FAIL;
+
+      if (ret == RETURN_FAIL) {
+         /* callback may touch the queue, so stop here */
+         DEBFAIL("%s", error);
+         _pndman_curl_unschedule(h);
+         h->busy = 1;
+         if (!_pndman_curl_notify(h, PNDMAN_CURL_FAIL, error)) {
+            h->busy = 0;
+            _pndman_curl_handle_collect(h);
+         }
+         break;
+      }
+
+      ++added;
+      DEBUG(PNDMAN_LEVEL_CRAP, "scheduled: %s", h->url);
+   }
+
+   if (added) _pndman_curl_share_bandwidth(context);
+   for (h = context->queue; h; h = h->next) ++queued;
+   return queued;
+}
+
+/* INTERNAL API */
+
+/* \brief release memory of handle */
+void _pndman_curl_handle_release(pndman_curl_handle *handle)
 {
    assert(handle);
 
@@ -97,10 +826,15 @@ static void _pndman_curl_handle_free_real(pndman_curl_handle *handle)
    if (!handle->free) return;
 
    /* cleanup */
-   if (handle->curl) {
-      if (_pndman_curlm) curl_multi_remove_handle(_pndman_curlm, handle->curl);
-      curl_easy_cleanup(handle->curl);
-   }
+   _pndman_curl_unschedule(handle);
+   _pndman_curl_segments_free(handle);
+   IFDO(curl_easy_cleanup, handle->curl);
+   IFDO(free, handle->host);
+   IFDO(free, handle->repository);
+   IFDO(free, handle->space);
+   IFDO(free, handle->md5_ctx);
+   IFDO(free, handle->md5);
+   IFDO(free, handle->cache);
    _pndman_curl_header_free(&handle->header);
    IFDO(curl_slist_free_all, handle->header_list);
    IFDO(fclose, handle->file);
@@ -116,31 +850,52 @@ static void _pndman_curl_handle_free_real(pndman_curl_handle *handle)
    free(handle);
 }
 
-/* INTERNAL API */
-
-/* \brief free curl handle */
-void _pndman_curl_handle_free(pndman_curl_handle *handle)
+/* \brief mark handle freed, so no more callbacks get called */
+void _pndman_curl_handle_detach(pndman_curl_handle *handle)
 {
    assert(handle);
+   _pndman_curl_segments_save(handle);
    handle->free = 1;
    handle->progress = NULL;
+   handle->user_progress = NULL;
    handle->callback = NULL;
    IFDO(free, handle->path);
    IFDO(free, handle->url);
    IFDO(free, handle->post);
+}
+
+/* \brief free curl handle */
+void _pndman_curl_handle_free(pndman_curl_handle *handle)
+{
+   assert(handle);
+
+   /* IO thread releases it through event */
+   if (_pndman_io_offload(handle->context)) {
+      if (handle->detached) return;
+      handle->detached = 1;
+      _pndman_io_command(handle->context, PNDMAN_IO_FREE, handle, NULL);
+      return;
+   }
+
+   _pndman_curl_handle_detach(handle);
 
-   /* can we free immediatly? */
-   if (!_pndman_curlm)
-      _pndman_curl_handle_free_real(handle);
+   /* can we free immediatly?
+    * active handles are freed after curl is done with them */
+   if (handle->state != PNDMAN_CURL_ACTIVE && !handle->busy)
+      _pndman_curl_handle_release(handle);
 }
 
-/* \brief create new curl handle */
-pndman_curl_handle* _pndman_curl_handle_new(void *data,
+/* \brief create new curl handle,
+ * transfers of handle run on context (NULL for default) */
+pndman_curl_handle* _pndman_curl_handle_new(pndman_context *context, void *data,
       pndman_curl_progress *progress, pndman_curl_callback callback,
       const char *path)
 {
    pndman_curl_handle *handle;
 
+   if (_pndman_curl_global_init() != RETURN_OK)
+      goto curl_fail;
+
    if (!(handle = calloc(1, sizeof(pndman_curl_handle))))
       goto handle_fail;
 
@@ -149,9 +904,11 @@ pndman_curl_handle* _pndman_curl_handle_new(void *data,
 
    /* set defaults */
    if (path) handle->path = strdup(path);
+   handle->context   = _pndman_context(context);
    handle->data      = data;
    handle->callback  = callback;
    handle->progress  = progress;
+   handle->user_progress = progress;
    return handle;
 
 handle_fail:
@@ -183,7 +940,8 @@ void _pndman_curl_handle_set_post(pndman_curl_handle *handle, const char *post)
 void _pndman_curl_handle_reset(pndman_curl_handle *handle)
 {
    assert(handle);
-   curl_multi_remove_handle(_pndman_curlm, handle->curl);
+   _pndman_curl_unschedule(handle);
+   _pndman_curl_segments_free(handle);
    curl_easy_reset(handle->curl);
 
    if (handle->file) {
@@ -192,8 +950,104 @@ void _pndman_curl_handle_reset(pndman_curl_handle *handle)
    }
 }
 
-/* \brief perform curl operation */
+/* \brief complete handle from file that is already on disk,
+ * the DONE callback is called on next perform of context.
+ * filename is reported in header like server would. */
+static int _pndman_curl_handle_perform_local(pndman_curl_handle *handle, const char *filename)
+{
+   char header[320];
+   struct stat st;
+   assert(handle && handle->path);
+
+   /* no callback or data, we will fail */
+   if (!handle->data || !handle->callback)
+      goto no_data_or_callback;
+
+   _pndman_curl_handle_reset(handle);
+   _pndman_curl_header_free(&handle->header);
+   if (filename && strlen(filename) < 256) {
+      snprintf(header, sizeof(header)-1, "Content-Disposition: attachment; filename=\"%s\"\r\n", filename);
+      _pndman_curl_write_header(header, 1, strlen(header), handle);
+   }
+
+   if (!(handle->file = fopen(handle->path, "rb")))
+      goto open_fail;
+
+   if (!handle->context->curlm && !(handle->context->curlm = curl_multi_init()))
+      goto curlm_fail;
+
+   if (handle->progress) {
+      _pndman_curl_init_progress(handle->progress);
+      if (fstat(fileno(handle->file), &st) == 0)
+         handle->progress->download = handle->progress->total_to_download = st.st_size;
+   }
+
+   handle->next  = handle->context->local;
+   handle->state = PNDMAN_CURL_LOCAL;
+   handle->context->local = handle;
+   return RETURN_OK;
+
+no_data_or_callback:
+   DEBFAIL(CURL_NO_DATA_OR_CALLBACK);
+   goto fail;
+open_fail:
+   DEBFAIL(ACCESS_FAIL, handle->path);
+   goto fail;
+curlm_fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "CURLM");
+fail:
+   IFDO(fclose, handle->file);
+   return RETURN_FAIL;
+}
+
+/* \brief complete download from cache, on transfer path.
+ * copy across filesystems takes the space download would,
+ * so it is reserved first. Cache is tried once, retries download */
+static int _pndman_curl_handle_cached(pndman_curl_handle *handle)
+{
+   char *md5 = handle->cache, *filename = NULL;
+   uint64_t pending;
+   int ret = RETURN_FAIL;
+   handle->cache = NULL;
+
+   if (handle->space && handle->reserve) {
+      if (_pndman_device_reserve(handle->space, handle->reserve, &pending) != RETURN_OK)
+         goto out;
+      handle->reserved = handle->reserve;
+   }
+
+   if (_pndman_cache_fetch(md5, handle->path, &filename) == RETURN_OK) {
+      IFDO(free, handle->md5);
+      if ((handle->md5 = strdup(md5)))
+         ret = _pndman_curl_handle_perform_local(handle, filename);
+   }
+
+   /* blocks are taken or download takes over, nothing stays reserved */
+   _pndman_curl_space_release(handle);
+out:
+   IFDO(free, filename);
+   free(md5);
+   return ret;
+}
+
+/* \brief perform curl operation,
+ * on IO thread when context has one */
 int _pndman_curl_handle_perform(pndman_curl_handle *handle)
+{
+   assert(handle);
+
+   if (_pndman_io_offload(handle->context)) {
+      /* progress of the transfer is published to user through events */
+      handle->progress = (handle->user_progress ? &handle->io_progress : NULL);
+      if (handle->user_progress) _pndman_curl_init_progress(handle->user_progress);
+      return _pndman_io_command(handle->context, PNDMAN_IO_PERFORM, handle, NULL);
+   }
+
+   return _pndman_curl_handle_perform_real(handle);
+}
+
+/* \brief perform curl operation on this thread */
+int _pndman_curl_handle_perform_real(pndman_curl_handle *handle)
 {
    assert(handle);
    struct curl_slist *slist = NULL;
@@ -206,8 +1060,12 @@ int _pndman_curl_handle_perform(pndman_curl_handle *handle)
    if (!handle->url)
       goto no_url;
 
+   /* downloaded before, the file is on disk already */
+   if (handle->cache && handle->path && _pndman_curl_handle_cached(handle) == RETURN_OK)
+      return RETURN_OK;
+
    /* reopen handle if needed */
-   if (handle->file) {
+   if (handle->file || handle->segment) {
       _pndman_curl_handle_reset(handle);
       _pndman_curl_header_free(&handle->header);
       DEBUG(PNDMAN_LEVEL_CRAP, "CURL REOPEN");
@@ -216,6 +1074,9 @@ int _pndman_curl_handle_perform(pndman_curl_handle *handle)
    if (!handle->path) {
       if (!(handle->file = _pndman_get_tmp_file()))
          goto fail;
+   } else if (_pndman_curl_handle_segmented(handle)) {
+      if (_pndman_curl_segments_init(handle) != RETURN_OK)
+         goto fail;
    } else {
       /* this temporary file exists, lets do resume! */
       if ((handle->file = fopen(handle->path, "rb"))) {
@@ -227,29 +1088,25 @@ int _pndman_curl_handle_perform(pndman_curl_handle *handle)
          goto open_fail;
    }
 
+   /* hash what we already have */
+   _pndman_curl_md5_start(handle);
+
    /* print url */
    DEBUG(PNDMAN_LEVEL_CRAP, "url: %s", handle->url);
 
    /* set curl options */
-   curl_easy_setopt(handle->curl, CURLOPT_USERAGENT, "libpndman ("VERSION")");
-   curl_easy_setopt(handle->curl, CURLOPT_URL, handle->url);
+   _pndman_curl_setopt(handle->curl, handle);
    if (handle->post) {
       curl_easy_setopt(handle->curl, CURLOPT_POSTFIELDS, handle->post);
       DEBUG(PNDMAN_LEVEL_CRAP, "POST: %s", handle->post);
    }
    curl_easy_setopt(handle->curl, CURLOPT_HEADERFUNCTION, _pndman_curl_write_header);
-   curl_easy_setopt(handle->curl, CURLOPT_HEADERFUNCTION, _pndman_curl_write_header);
-   curl_easy_setopt(handle->curl, CURLOPT_CONNECTTIMEOUT, pndman_get_curl_timeout());
    curl_easy_setopt(handle->curl, CURLOPT_NOPROGRESS, handle->progress?0:1);
    curl_easy_setopt(handle->curl, CURLOPT_PROGRESSFUNCTION, _pndman_curl_progress_func);
    curl_easy_setopt(handle->curl, CURLOPT_HEADERDATA, handle);
    curl_easy_setopt(handle->curl, CURLOPT_PROGRESSDATA, handle);
-   curl_easy_setopt(handle->curl, CURLOPT_COOKIEFILE, "");
-   curl_easy_setopt(handle->curl, CURLOPT_PRIVATE, handle);
    curl_easy_setopt(handle->curl, CURLOPT_WRITEFUNCTION, _pndman_curl_write_file);
    curl_easy_setopt(handle->curl, CURLOPT_WRITEDATA, handle);
-   curl_easy_setopt(handle->curl, CURLOPT_LOW_SPEED_LIMIT, 10240L);
-   curl_easy_setopt(handle->curl, CURLOPT_LOW_SPEED_TIME, 300L);
    if (handle->resume && handle->path) {
       curl_easy_setopt(handle->curl, CURLOPT_RESUME_FROM, handle->resume);
       DEBUG(PNDMAN_LEVEL_CRAP, "Handle resume: %zu", handle->resume);
@@ -257,8 +1114,13 @@ int _pndman_curl_handle_perform(pndman_curl_handle *handle)
    if (handle->if_modified_since) {
       char header[82];
       char rfc2822[42];
-      struct tm *ptm = gmtime(&handle->if_modified_since);
-      strftime(rfc2822, sizeof(rfc2822)-1, "%a, %d %b %Y %H:%M:%S %z", ptm);
+      struct tm tm;
+#ifdef _WIN32
+      tm = *gmtime(&handle->if_modified_since); /* thread local on windows */
+#else
+      gmtime_r(&handle->if_modified_since, &tm);
+#endif
+      strftime(rfc2822, sizeof(rfc2822)-1, "%a, %d %b %Y %H:%M:%S %z", &tm);
       snprintf(header, sizeof(header)-1, "If-Modified-Since: %s", rfc2822);
       slist = curl_slist_append(slist, header);
       curl_easy_setopt(handle->curl, CURLOPT_HTTPHEADER, slist);
@@ -266,16 +1128,18 @@ int _pndman_curl_handle_perform(pndman_curl_handle *handle)
       DEBUG(PNDMAN_LEVEL_CRAP, header);
    }
 
-   if (!_pndman_curlm && !(_pndman_curlm = curl_multi_init()))
+   if (!handle->context->curlm && !(handle->context->curlm = curl_multi_init()))
       goto curlm_fail;
 
    /* init progress if needed */
    if (handle->progress)
       _pndman_curl_init_progress(handle->progress);
 
-   if (curl_multi_add_handle(_pndman_curlm, handle->curl) != CURLM_OK)
-      goto add_fail;
-
+   /* queue for scheduler, it starts the transfer
+    * once there is a free slot for it */
+   IFDO(free, handle->host);
+   handle->host = _pndman_curl_host(handle->url);
+   _pndman_curl_enqueue(handle);
    return RETURN_OK;
 
 no_data_or_callback:
@@ -289,34 +1153,141 @@ open_fail:
    goto fail;
 curlm_fail:
    DEBFAIL(PNDMAN_ALLOC_FAIL, "CURLM");
-   goto fail;
-add_fail:
-   DEBFAIL("curl_multi_add_handle failed");
 fail:
    IFDO(fclose, handle->file);
    IFDO(curl_slist_free_all, slist);
+   _pndman_curl_segments_free(handle);
+   _pndman_curl_segments_unlink(handle);
    if (handle->path) unlink(handle->path);
    return RETURN_FAIL;
 }
 
-/* \brief query cleanup */
-static void _pndman_curl_cleanup(void)
+/* \brief deliver handles completed from disk,
+ * returns number of handles delivered */
+static int _pndman_curl_deliver_local(pndman_context *context)
 {
-   if (!_pndman_curlm) return;
-   curl_multi_cleanup(_pndman_curlm);
-   curl_global_cleanup();
-   _pndman_curlm = NULL;
+   int delivered = 0;
+   pndman_curl_handle *h;
+
+   /* callbacks may add or remove local handles, so pop one at time */
+   while ((h = context->local)) {
+      context->local = h->next;
+      h->next  = NULL;
+      h->state = PNDMAN_CURL_IDLE;
+      if (h->progress) h->progress->done = 1;
+
+      h->busy = 1;
+      if (!_pndman_curl_notify(h, PNDMAN_CURL_DONE, NULL)) {
+         h->busy = 0;
+         _pndman_curl_handle_collect(h);
+      }
+      ++delivered;
+   }
+
+   return delivered;
+}
+
+/* \brief query cleanup,
+ * curl itself stays initialized since other contexts may be using it */
+void _pndman_curl_context_cleanup(pndman_context *context)
+{
+   pndman_curl_handle *h;
+   assert(context);
+   if (!context->curlm) return;
+   while ((h = context->active)) _pndman_curl_unschedule(h);
+   while ((h = context->queue))  _pndman_curl_unschedule(h);
+   while ((h = context->local))  _pndman_curl_unschedule(h);
+   curl_multi_cleanup(context->curlm);
+   context->curlm = NULL;
 }
 
-/* \brief handle curl message */
-static void _pndman_curl_msg(int result, pndman_curl_handle *handle)
+/* \brief retries that handle needed */
+static int _pndman_curl_retries(pndman_curl_handle *handle)
 {
+   int i, retries = handle->retry;
+   for (i = 0; i != handle->segments; ++i)
+      retries += handle->segment[i].retry;
+   return retries;
+}
+
+/* \brief handle message of single segment,
+ * returns RETURN_TRUE when handle was handed over, see _pndman_curl_notify */
+static int _pndman_curl_segment_msg(int result, pndman_curl_handle *handle, pndman_curl_segment *seg)
+{
+   int i, done;
    if (!handle || handle->free)
-      return;
+      return RETURN_FALSE;
+
+   curl_multi_remove_handle(handle->context->curlm, seg->curl);
+   seg->state = PNDMAN_CURL_IDLE;
+   _pndman_curl_share_bandwidth(handle->context);
+
+   /* server can't do ranges for us,
+    * start over with single stream */
+   if (handle->fallback) {
+      DEBUG(PNDMAN_LEVEL_WARN, CURL_SEGMENT_FALLBACK, handle->url);
+      _pndman_curl_segments_free(handle);
+      _pndman_curl_segments_unlink(handle);
+      unlink(handle->path);
+      if (_pndman_curl_handle_perform_real(handle) != RETURN_OK) {
+         if (_pndman_curl_notify(handle, PNDMAN_CURL_FAIL, CURL_REQUEST_FAIL))
+            return RETURN_TRUE;
+         if (!handle->free && handle->state == PNDMAN_CURL_ACTIVE)
+            _pndman_curl_unschedule(handle);
+      }
+      return RETURN_FALSE;
+   }
+
+   if (seg->start + seg->pos <= seg->end) {
+      /* segment is retried by scheduler, from where it was left */
+      DEBUG(PNDMAN_LEVEL_CRAP, "segment: %s", curl_easy_strerror(result));
+      if (++seg->retry < PNDMAN_CURL_MAX_RETRY) {
+         _pndman_curl_segments_save(handle);
+         return RETURN_FALSE;
+      }
+
+      if (handle->progress) handle->progress->done = 1;
+      _pndman_metrics_add(PNDMAN_METRIC_TRANSFER_RETRIES, _pndman_curl_retries(handle));
+      _pndman_curl_segments_save(handle);
+      _pndman_curl_unschedule(handle);
+      return _pndman_curl_notify(handle, PNDMAN_CURL_FAIL,
+            (result != CURLE_OK ? curl_easy_strerror(result) : CURL_SEGMENT_INCOMPLETE));
+   }
 
+   for (i = 0, done = 1; i != handle->segments && done; ++i)
+      if (handle->segment[i].start + handle->segment[i].pos <= handle->segment[i].end)
+         done = 0;
+
+   if (!done) {
+      _pndman_curl_segments_save(handle);
+      return RETURN_FALSE;
+   }
+
+   /* every range written, complete the file before verification */
+   DEBUG(PNDMAN_LEVEL_CRAP, "segmented download complete: %s", handle->path);
    if (handle->progress) handle->progress->done = 1;
+   _pndman_metrics_add(PNDMAN_METRIC_TRANSFER_RETRIES, _pndman_curl_retries(handle));
+   _pndman_curl_md5_catchup(handle);
+   _pndman_curl_unschedule(handle);
+   _pndman_curl_segments_free(handle);
+   _pndman_curl_segments_unlink(handle);
+   handle->retry = 0;
+   fflush(handle->file);
+   _pndman_curl_md5_finish(handle);
+   fseek(handle->file, 0L, SEEK_SET);
+   return _pndman_curl_notify(handle, PNDMAN_CURL_DONE, NULL);
+}
 
-   if (pndman_get_verbose() >= PNDMAN_LEVEL_CRAP) {
+/* \brief handle curl message,
+ * returns RETURN_TRUE when handle was handed over, see _pndman_curl_notify */
+static int _pndman_curl_msg(int result, pndman_curl_handle *handle)
+{
+   if (!handle || handle->free)
+      return RETURN_FALSE;
+
+   if (handle->progress) handle->progress->done = 1;
+
+   if (DEBUG_ENABLED(PNDMAN_LEVEL_CRAP)) {
       if (handle->header.size)
          DEBUG(PNDMAN_LEVEL_CRAP, "%s", (char*)handle->header.data);
 
@@ -342,29 +1313,43 @@ static void _pndman_curl_msg(int result, pndman_curl_handle *handle)
             handle->retry < PNDMAN_CURL_MAX_RETRY) {
          /* retry */
          DEBUG(PNDMAN_LEVEL_CRAP, "%s", curl_easy_strerror(result));
-         if (_pndman_curl_handle_perform(handle) == RETURN_OK)
+         if (_pndman_curl_handle_perform_real(handle) == RETURN_OK)
             handle->retry++;
          else handle->retry = PNDMAN_CURL_MAX_RETRY;
       } else handle->retry = PNDMAN_CURL_MAX_RETRY;
 
       /* fail if max retries exceeded */
       if (handle->retry >= PNDMAN_CURL_MAX_RETRY) {
+         _pndman_metrics_add(PNDMAN_METRIC_TRANSFER_RETRIES, handle->retry);
          handle->resume = 0;
          handle->retry  = 0;
-         handle->callback(PNDMAN_CURL_FAIL, handle->data,
-               curl_easy_strerror(result), handle);
+         if (_pndman_curl_notify(handle, PNDMAN_CURL_FAIL, curl_easy_strerror(result)))
+            return RETURN_TRUE;
+
+         /* give the slot to next transfer */
+         if (!handle->free && handle->state == PNDMAN_CURL_ACTIVE)
+            _pndman_curl_unschedule(handle);
       }
    } else {
+      _pndman_metrics_add(PNDMAN_METRIC_TRANSFER_RETRIES, handle->retry);
       handle->resume = 0;
       handle->retry  = 0;
       fflush(handle->file);
-      handle->callback(PNDMAN_CURL_DONE, handle->data, NULL, handle);
-      _pndman_curl_handle_reset(handle);
+      _pndman_curl_preallocate_trim(handle);
+      _pndman_curl_md5_finish(handle);
+      if (_pndman_curl_notify(handle, PNDMAN_CURL_DONE, NULL))
+         return RETURN_TRUE;
+
+      /* callback may have started new request on this handle */
+      if (!handle->free && handle->state == PNDMAN_CURL_ACTIVE)
+         _pndman_curl_handle_reset(handle);
    }
+   return RETURN_FALSE;
 }
 
-/* \brief perform curl operation */
-static int _pndman_curl_perform(unsigned long tv_sec, unsigned long tv_usec)
+/* \brief perform transfers of context once,
+ * select wakes up for IO thread commands as well */
+int _pndman_curl_context_perform(pndman_context *context, unsigned long tv_sec, unsigned long tv_usec)
 {
    int still_running;
    int maxfd = -1;
@@ -378,17 +1363,26 @@ static int _pndman_curl_perform(unsigned long tv_sec, unsigned long tv_usec)
    CURLMsg *msg;
    int msgs_left;
 
+   int i, queued, local, wake, posted;
    pndman_curl_handle *handle;
 
+   /* nothing to transfer for these */
+   local = _pndman_curl_deliver_local(context);
+
+   /* start queued transfers */
+   queued = _pndman_curl_schedule(context);
+
    /* perform download */
-   while ((ret = curl_multi_perform(_pndman_curlm, &still_running)) == CURLM_CALL_MULTI_PERFORM);
+   while ((ret = curl_multi_perform(context->curlm, &still_running)) == CURLM_CALL_MULTI_PERFORM);
 
    /* check error */
    if (ret != CURLM_OK)
       goto fail;
 
-   /* run multi_timeout, if still running */
-   if (still_running) {
+   /* run multi_timeout, if still running.
+    * queued transfers with nothing running wait for space held elsewhere,
+    * so sleep the timeout instead of spinning back to caller */
+   if (still_running || (queued && !local)) {
       /* zero file descriptions */
       FD_ZERO(&fdread);
       FD_ZERO(&fdwrite);
@@ -400,7 +1394,7 @@ static int _pndman_curl_perform(unsigned long tv_sec, unsigned long tv_usec)
       timeout.tv_usec = tv_usec;
 
       /* timeout */
-      ret = curl_multi_timeout(_pndman_curlm, &curl_timeout);
+      ret = curl_multi_timeout(context->curlm, &curl_timeout);
       if (ret != CURLM_OK) goto fail;
 
       if (curl_timeout >= 0) {
@@ -414,20 +1408,36 @@ static int _pndman_curl_perform(unsigned long tv_sec, unsigned long tv_usec)
       }
 
       /* get file descriptors from the transfers */
-      ret = curl_multi_fdset(_pndman_curlm, &fdread, &fdwrite, &fdexcep, &maxfd);
+      ret = curl_multi_fdset(context->curlm, &fdread, &fdwrite, &fdexcep, &maxfd);
       if (ret != CURLM_OK || maxfd < -1) goto fail;
+      if ((wake = _pndman_io_wake_fd(context)) != -1) {
+         FD_SET(wake, &fdread);
+         if (wake > maxfd) maxfd = wake;
+      }
       select(maxfd+1, &fdread, &fdwrite, &fdexcep, &timeout);
    }
 
    /* update status of curl handles */
-   while ((msg = curl_multi_info_read(_pndman_curlm, &msgs_left))) {
+   while ((msg = curl_multi_info_read(context->curlm, &msgs_left))) {
       curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&handle);
       if (msg->msg == CURLMSG_DONE) { /* DONE */
-         _pndman_curl_msg(msg->data.result, handle);
+         pndman_curl_segment *seg = NULL;
+         if (handle && handle->segment) {
+            for (i = 0; i != handle->segments && !seg; ++i)
+               if (handle->segment[i].curl == msg->easy_handle) seg = &handle->segment[i];
+         }
 
-         /* free handle if requested */
-         if (handle && handle->free)
-            _pndman_curl_handle_free_real(handle);
+         if (handle && !handle->free) _pndman_curl_metrics(handle, msg->easy_handle);
+         if (handle) handle->busy = 1;
+         if (seg) posted = _pndman_curl_segment_msg(msg->data.result, handle, seg);
+         else posted = _pndman_curl_msg(msg->data.result, handle);
+
+         /* free handle if requested,
+          * posted handle belongs to dispatching thread now */
+         if (handle && !posted) {
+            handle->busy = 0;
+            _pndman_curl_handle_collect(handle);
+         }
 
          /* if we got messages and still running == 0
           * make it back 1, since callbacks might restart
@@ -436,7 +1446,7 @@ static int _pndman_curl_perform(unsigned long tv_sec, unsigned long tv_usec)
       }
    }
 
-   return still_running;
+   return still_running + queued + local;
 
 fail:
    DEBFAIL("%s", ret);
@@ -445,22 +1455,28 @@ fail:
 
 /* PUBLIC API */
 
-/* \brief process all internal curl requests */
-PNDMANAPI int pndman_curl_process(unsigned long tv_sec, unsigned long tv_usec)
+/* \brief process curl requests of context */
+PNDMANAPI int pndman_context_curl_process(pndman_context *context,
+      unsigned long tv_sec, unsigned long tv_usec)
 {
    int still_running;
+   context = _pndman_context(context);
+
+   /* IO thread does the transfers, we dispatch events */
+   if (context->io)
+      return _pndman_io_process(context, tv_sec, tv_usec);
 
    /* we are done :) */
-   if (!_pndman_curlm) return 0;
+   if (!context->curlm) return 0;
 
    /* perform sync */
-   if ((still_running = _pndman_curl_perform(tv_sec, tv_usec)) == -1)
+   if ((still_running = _pndman_curl_context_perform(context, tv_sec, tv_usec)) == -1)
       goto fail;
 
    /* destoroy curlm when done,
     * and return exit code */
    if (!still_running) {
-      _pndman_curl_cleanup();
+      _pndman_curl_context_cleanup(context);
 
       /* fake so that we are still running, why?
        * this lets user to catch the final completed handles
@@ -473,8 +1489,14 @@ PNDMANAPI int pndman_curl_process(unsigned long tv_sec, unsigned long tv_usec)
    return still_running;
 
 fail:
-   _pndman_curl_cleanup();
+   _pndman_curl_context_cleanup(context);
    return RETURN_FAIL;
 }
 
+/* \brief process all internal curl requests of default context */
+PNDMANAPI int pndman_curl_process(unsigned long tv_sec, unsigned long tv_usec)
+{
+   return pndman_context_curl_process(NULL, tv_sec, tv_usec);
+}
+
 /* vim: set ts=8 sw=3 tw=0 :*/
@@ -39,6 +39,7 @@ static int blockfile(char *path)
 {
    int timeout=5;
    FILE *f;
+   uint64_t start = _pndman_metrics_now();
    /* block until lock doesn't exist */
    while ((f = fopen(path, "r"))) {
       fclose(f);
@@ -52,11 +53,13 @@ static int blockfile(char *path)
       if (--timeout==0)
          goto timedout;
    }
+   _pndman_metrics_time(PNDMAN_METRIC_LOCK_WAIT_TIME, "lock wait", path, start);
    return RETURN_OK;
 
 timedout:
    DEBUG(PNDMAN_LEVEL_WARN, DATABASE_LOCK_TIMEOUT, path);
    unlink(path);
+   _pndman_metrics_time(PNDMAN_METRIC_LOCK_WAIT_TIME, "lock wait", path, start);
    return RETURN_OK;
 }
 
@@ -125,12 +128,54 @@ static void unlockfile(FILE *f, char *path)
    free(lckpath);
 }
 
+/* \brief open temporary file database is written to,
+ * readers never see half written database this way */
+static FILE* _pndman_db_open_tmp(const char *db_path, char **tmp_path)
+{
+   FILE *f;
+   int size = snprintf(NULL, 0, "%s.tmp", db_path)+1;
+   if (!(*tmp_path = malloc(size)))
+      return NULL;
+
+   sprintf(*tmp_path, "%s.tmp", db_path);
+   if (!(f = fopen(*tmp_path, "w"))) {
+      NULLDO(free, *tmp_path);
+   }
+   return f;
+}
+
+/* \brief replace database with fully written temporary file */
+static int _pndman_db_replace(FILE *f, const char *tmp_path, const char *db_path)
+{
+   int ret = RETURN_OK;
+
+   if (fflush(f) != 0) ret = RETURN_FAIL;
+#ifndef _WIN32
+   if (ret == RETURN_OK && fsync(fileno(f)) != 0) ret = RETURN_FAIL;
+#endif
+   if (fclose(f) != 0) ret = RETURN_FAIL;
+   if (ret != RETURN_OK) goto fail;
+
+#ifdef _WIN32
+   /* rename doesn't replace on windows */
+   unlink(db_path);
+#endif
+   if (rename(tmp_path, db_path) != 0)
+      goto fail;
+
+   return RETURN_OK;
+
+fail:
+   unlink(tmp_path);
+   return RETURN_FAIL;
+}
+
 /* \brief Store local database seperately */
 static int _pndman_db_commit_local(pndman_repository *repo, pndman_device *device)
 {
    FILE *f = NULL;
    BLOCK_FD fd = BLOCK_INIT;
-   char *db_path = NULL, *appdata;
+   char *db_path = NULL, *tmp_path = NULL, *appdata;
    assert(device);
 
    /* check appdata */
@@ -149,47 +194,68 @@ static int _pndman_db_commit_local(pndman_repository *repo, pndman_device *devic
    if (!(fd = lockfile(db_path)))
       goto fail;
 
-   if (!(f = fopen(db_path, "w")))
+   if (!(f = _pndman_db_open_tmp(db_path, &tmp_path)))
       goto write_fail;
 
    /* write local db */
    _pndman_json_commit(repo, device, f);
-   repo->commited = 1;
+   if (_pndman_db_replace(f, tmp_path, db_path) != RETURN_OK) {
+      f = NULL;
+      goto write_fail;
+   }
 
-   fclose(f);
    unlockfile(fd, db_path);
    free(appdata);
    free(db_path);
+   free(tmp_path);
    return RETURN_OK;
 
 write_fail:
    DEBFAIL(WRITE_FAIL, db_path);
 fail:
+   if (fd) unlockfile(fd, db_path);
+   IFDO(fclose, f);
    IFDO(free, appdata);
    IFDO(free, db_path);
-   IFDO(fclose, fd);
-   IFDO(fclose, f);
+   IFDO(free, tmp_path);
    return RETURN_FAIL;
 }
 
-/* \brief Store repositories to database */
-static int _pndman_db_commit(pndman_repository *repo, pndman_device *device)
+/* \brief do remote repositories need to be written? */
+static int _pndman_db_remote_dirty(pndman_repository *repo)
+{
+   pndman_repository *r;
+   for (r = repo->next; r && r->commited; r = r->next);
+   return (r ? RETURN_TRUE : RETURN_FALSE);
+}
+
+/* \brief mark repositories written */
+static void _pndman_db_set_commited(pndman_repository *repo)
+{
+   pndman_repository *r;
+   for (r = repo; r; r = r->next)
+      if (r == repo || r->url) r->commited = 1;
+}
+
+/* \brief Store repositories to database of device,
+ * leaves repositories untouched so devices can be written in parallel */
+static int _pndman_db_commit_device(pndman_repository *repo, pndman_device *device, int remote)
 {
    FILE *f = NULL;
    BLOCK_FD fd = BLOCK_INIT;
    pndman_repository *r;
-   char *db_path = NULL, *appdata;
-   clock_t now = clock();
-   assert(device);
+   char *db_path = NULL, *tmp_path = NULL, *appdata = NULL;
+   uint64_t now = _pndman_metrics_now();
+   assert(repo && device);
 
    /* find local db and read it first */
-   repo = _pndman_repository_first(repo);
-   _pndman_db_commit_local(repo, device);
+   if (_pndman_db_commit_local(repo, device) != RETURN_OK)
+      goto fail;
 
    /* do we need to commit remote repositories? */
-   for (r = repo->next; r && r->commited; r = r->next);
-   if (!r) {
-      DEBUG(PNDMAN_LEVEL_CRAP, "Database commit took %.2f seconds", (double)(clock()-now)/CLOCKS_PER_SEC);
+   if (!remote) {
+      DEBUG(PNDMAN_LEVEL_CRAP, "Database commit took %.2f seconds", (_pndman_metrics_now()-now)/1000000.0);
+      _pndman_metrics_time(PNDMAN_METRIC_DB_COMMIT_TIME, "db commit", device->mount, now);
       return RETURN_OK;
    }
 
@@ -208,7 +274,7 @@ static int _pndman_db_commit(pndman_repository *repo, pndman_device *device)
    if (!(fd = lockfile(db_path)))
       goto fail;
 
-   if (!(f = fopen(db_path, "w")))
+   if (!(f = _pndman_db_open_tmp(db_path, &tmp_path)))
       goto write_fail;
 
    /* write repositories */
@@ -216,23 +282,87 @@ static int _pndman_db_commit(pndman_repository *repo, pndman_device *device)
       if (!r->url) continue;
       fprintf(f, "[%s]\n", r->url);
       _pndman_json_commit(r, device, f);
-      r->commited = 1;
    }
 
-   fclose(f);
+   if (_pndman_db_replace(f, tmp_path, db_path) != RETURN_OK) {
+      f = NULL;
+      goto write_fail;
+   }
+
    unlockfile(fd, db_path);
    free(appdata);
    free(db_path);
-   DEBUG(PNDMAN_LEVEL_CRAP, "Database commit took %.2f seconds", (double)(clock()-now)/CLOCKS_PER_SEC);
+   free(tmp_path);
+   DEBUG(PNDMAN_LEVEL_CRAP, "Database commit took %.2f seconds", (_pndman_metrics_now()-now)/1000000.0);
+   _pndman_metrics_time(PNDMAN_METRIC_DB_COMMIT_TIME, "db commit", device->mount, now);
    return RETURN_OK;
 
 write_fail:
    DEBFAIL(WRITE_FAIL, db_path);
 fail:
+   if (fd) unlockfile(fd, db_path);
+   IFDO(fclose, f);
    IFDO(free, appdata);
    IFDO(free, db_path);
-   IFDO(fclose, fd);
-   IFDO(fclose, f);
+   IFDO(free, tmp_path);
+   return RETURN_FAIL;
+}
+
+/* \brief state of multi device commit */
+typedef struct _pndman_db_commit_state
+{
+   pndman_repository *repo;
+   int remote;
+   int *result;
+} _pndman_db_commit_state;
+
+/* \brief commit of one device, runs in device worker */
+static void _pndman_db_commit_job(pndman_device *device, size_t index, void *user_data)
+{
+   _pndman_db_commit_state *commit = user_data;
+   commit->result[index] = _pndman_db_commit_device(commit->repo, device, commit->remote);
+}
+
+/* \brief Store repositories to database */
+int _pndman_db_commit(pndman_repository *repo, pndman_device *device)
+{
+   assert(repo && device);
+   repo = _pndman_repository_first(repo);
+   if (_pndman_db_commit_device(repo, device, _pndman_db_remote_dirty(repo)) != RETURN_OK)
+      return RETURN_FAIL;
+   _pndman_db_set_commited(repo);
+   return RETURN_OK;
+}
+
+/* \brief Store repositories to database of every device in list,
+ * devices on different disks are written in parallel */
+int _pndman_db_commit_devices(pndman_repository *repo, pndman_device *device)
+{
+   _pndman_db_commit_state commit;
+   pndman_device *d;
+   size_t i, count = 0;
+   int ret = RETURN_OK;
+   assert(repo && device);
+
+   for (d = _pndman_device_first(device); d; d = d->next) ++count;
+   if (!(commit.result = calloc(count, sizeof(int))))
+      goto fail;
+
+   commit.repo   = _pndman_repository_first(repo);
+   commit.remote = _pndman_db_remote_dirty(commit.repo);
+   if (_pndman_device_foreach(device, _pndman_db_commit_job, &commit) == RETURN_FAIL)
+      ret = RETURN_FAIL;
+
+   for (i = 0; i != count && ret == RETURN_OK; ++i)
+      if (commit.result[i] != RETURN_OK) ret = RETURN_FAIL;
+
+   /* every device must have it, before it's commited */
+   if (ret == RETURN_OK) _pndman_db_set_commited(commit.repo);
+   free(commit.result);
+   return ret;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "commit results");
    return RETURN_FAIL;
 }
 
@@ -491,11 +621,13 @@ static int _pndman_sync_handle_perform(pndman_sync_handle *object)
       goto url_cpy_fail;
 
    /* send to curl handler */
-   object->data = handle = _pndman_curl_handle_new(object, &object->progress, _pndman_sync_done, NULL);
+   object->data = handle = _pndman_curl_handle_new(object->context, object, &object->progress, _pndman_sync_done, NULL);
    if (!handle) goto fail;
 
    if (!(object->flags & PNDMAN_SYNC_FULL))
       handle->if_modified_since = object->repository->timestamp;
+   if (object->repository->url)
+      handle->repository = strdup(object->repository->url);
    _pndman_curl_handle_set_url(handle, url);
    free(url);
 
@@ -513,7 +645,7 @@ fail:
 }
 
 /* \brief do version comparision and set update pointer */
-static int _pndman_version_check(pndman_package *lp, pndman_package *rp)
+int _pndman_version_check(pndman_package *lp, pndman_package *rp)
 {
    /* md5sums are same, no update */
    if (lp->md5 && rp->md5 && !strcmp(lp->md5, rp->md5))
@@ -559,16 +691,39 @@ static int _pndman_check_updates(pndman_repository *list)
 {
    pndman_repository *r;
    pndman_package    *p, *pnd;
+   _pndman_scan      **scan = NULL;
+   size_t repos = 0, s, i;
+   uint32_t hash;
    int updates = 0;
    assert(list);
 
    if (!list->next) return 0;
-   for (pnd = list->pnd; pnd; pnd = pnd->next)
-      for (r = list->next; r; r = r->next)
-         for (p = r->pnd; p; p = p->next)
-            if (pnd->id && p->id && !strcmp(pnd->id, p->id))
-               updates += _pndman_version_check(pnd, p);
+
+   /* flat tables of remote repositories,
+    * so every local pnd is a linear pass over hashes */
+   for (r = list->next; r; r = r->next) ++repos;
+   if (!(scan = calloc(repos, sizeof(_pndman_scan*))))
+      goto fail;
+   for (s = 0, r = list->next; r; r = r->next, ++s)
+      if (!(scan[s] = _pndman_scan_new(r->pnd))) goto fail;
+
+   for (pnd = list->pnd; pnd; pnd = pnd->next) {
+      if (!pnd->id) continue;
+      hash = _pndman_scan_hash(pnd->id);
+      for (s = 0; s != repos; ++s)
+         for (i = 0; (p = _pndman_scan_find(scan[s], pnd->id, hash, &i)); ++i)
+            updates += _pndman_version_check(pnd, p);
+   }
+
+   for (s = 0; s != repos; ++s) _pndman_scan_free(scan[s]);
+   free(scan);
    return updates;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "update check");
+   if (scan) for (s = 0; s != repos; ++s) _pndman_scan_free(scan[s]);
+   IFDO(free, scan);
+   return RETURN_FAIL;
 }
 
 /* API */
@@ -622,4 +777,13 @@ PNDMANAPI int pndman_repository_commit_all(pndman_repository *repo,
    return _pndman_db_commit(repo, device);
 }
 
+/* \brief commits _all_ repositories to every device in list */
+PNDMANAPI int pndman_repository_commit_all_devices(pndman_repository *repo,
+      pndman_device *device)
+{
+   CHECKUSE(repo);
+   CHECKUSE(device);
+   return _pndman_db_commit_devices(repo, device);
+}
+
 /* vim: set ts=8 sw=3 tw=0 :*/
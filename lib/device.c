@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
+#include <inttypes.h>
 
 #ifdef __linux__
 #  include <dirent.h>
@@ -12,6 +13,7 @@
 #  include <sys/vfs.h>
 #  include <sys/stat.h>
 #  include <sys/statvfs.h>
+#  include <sys/sysmacros.h>
 #  define LINUX_MTAB "/etc/mtab" /* "/proc/mounts" */
 #endif
 
@@ -28,6 +30,45 @@
 #  include <malloc.h>
 #endif
 
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+static pthread_mutex_t _pndman_space_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define SPACE_LOCK()   pthread_mutex_lock(&_pndman_space_mutex)
+#  define SPACE_UNLOCK() pthread_mutex_unlock(&_pndman_space_mutex)
+#else
+#  define SPACE_LOCK()
+#  define SPACE_UNLOCK()
+#endif
+
+/* \brief space promised to downloads on one mount,
+ * but not yet allocated on disk */
+typedef struct _pndman_space
+{
+   char *mount;
+   uint64_t reserved;
+   struct _pndman_space *next;
+} _pndman_space;
+
+/* \brief reservations of every mount, shared by all contexts */
+static _pndman_space *_pndman_spaces = NULL;
+
+/* \brief shared state of job over devices */
+typedef struct _pndman_device_jobs
+{
+   pndman_device **device;
+   size_t *disk; /* index of first device on same disk */
+   size_t count;
+   _pndman_device_job job;
+   void *user_data;
+} _pndman_device_jobs;
+
+/* \brief worker of one disk */
+typedef struct _pndman_device_worker
+{
+   _pndman_device_jobs *jobs;
+   size_t disk;
+} _pndman_device_worker;
+
 /* \brief creates new device */
 static pndman_device* _pndman_device_init()
 {
@@ -457,6 +498,39 @@ static pndman_device* _pndman_device_add(const char *path, pndman_device *device
    return device;
 }
 
+#ifdef __linux__
+/* \brief check that mount is removable storage that can hold PNDs */
+static int _pndman_device_usable(const char *fsname, const char *dir)
+{
+   struct statfs fs;
+   char *pandoradir;
+   int size, ret;
+
+   if (!strstr(fsname, "/dev")    ||
+       strcmp(dir, "/")     == 0 ||
+       strcmp(dir, "/home") == 0 ||
+       strcmp(dir, "/boot") == 0
+#ifdef PANDORA /* don't add /mnt/utmp entries, PND's are there */
+       || strstr(dir, "/mnt/utmp")
+#endif
+      ) return RETURN_FALSE;
+
+   if (statfs(dir, &fs) != 0)
+      return RETURN_FALSE;
+
+   /* check for read && write perms
+    * test against both, / and /pandora,
+    * this might be SD with rootfs install.
+    * where only /pandora is owned by everyone. */
+   size = snprintf(NULL, 0, "%s/pandora", dir)+1;
+   if (!(pandoradir = malloc(size))) return RETURN_FALSE;
+   sprintf(pandoradir, "%s/pandora", dir);
+   ret = (access(pandoradir, R_OK | W_OK) == 0);
+   free(pandoradir);
+   return (ret ? RETURN_TRUE : RETURN_FALSE);
+}
+#endif
+
 /* \brief Detect devices and fill them automatically. */
 static pndman_device* _pndman_device_detect(pndman_device *device)
 {
@@ -465,47 +539,20 @@ static pndman_device* _pndman_device_detect(pndman_device *device)
    FILE *mtab;
    struct mntent *m;
    struct mntent mnt;
-   struct statfs fs;
    char strings[4096];
 
    first = device;
    mtab = setmntent(LINUX_MTAB, "r");
    memset(strings, 0, 4096);
    while ((m = getmntent_r(mtab, &mnt, strings, sizeof(strings)))) {
-      if ((mnt.mnt_dir != NULL) && (statfs(mnt.mnt_dir, &fs) == 0)) {
-         if(strstr(mnt.mnt_fsname, "/dev")                   &&
-            strcmp(mnt.mnt_dir, "/")		        != 0 &&
-            strcmp(mnt.mnt_dir, "/home")		!= 0 &&
-            strcmp(mnt.mnt_dir, "/boot")		!= 0
-#ifdef PANDORA /* don't add /mnt/utmp entries, PND's are there */
-            && !strstr(mnt.mnt_dir, "/mnt/utmp")
-#endif
-            )
-         {
-            /* check for read && write perms
-             * test against both, / and /pandora,
-             * this might be SD with rootfs install.
-             * where only /pandora is owned by everyone. */
-            char *pandoradir;
-            int size = snprintf(NULL, 0, "%s/pandora", mnt.mnt_dir)+1;
-            if (!(pandoradir = malloc(size))) continue;
-            sprintf(pandoradir, "%s/pandora", mnt.mnt_dir);
-            if (access(pandoradir,  R_OK | W_OK) == -1) {
-               free(pandoradir);
-               continue;
-            }
-            free(pandoradir);
-
-            if (!_pndman_device_new_if_exist(&device, mnt.mnt_dir))
-               break;
-
-            DEBUG(PNDMAN_LEVEL_CRAP, "DETECT: %s", mnt.mnt_dir);
-            _pndman_device_set_mount(device, mnt.mnt_dir);
-            _pndman_device_set_device(device, mnt.mnt_fsname);
-            device->free      = (uint64_t)fs.f_bfree  * (uint64_t)fs.f_bsize;
-            device->size      = (uint64_t)fs.f_blocks * (uint64_t)fs.f_bsize;
-            device->available = (uint64_t)fs.f_bavail * (uint64_t)fs.f_bsize;
-         }
+      if (mnt.mnt_dir != NULL && _pndman_device_usable(mnt.mnt_fsname, mnt.mnt_dir)) {
+         if (!_pndman_device_new_if_exist(&device, mnt.mnt_dir))
+            break;
+
+         DEBUG(PNDMAN_LEVEL_CRAP, "DETECT: %s", mnt.mnt_dir);
+         _pndman_device_set_mount(device, mnt.mnt_dir);
+         _pndman_device_set_device(device, mnt.mnt_fsname);
+         _pndman_device_update(device);
       }
       m = NULL;
    }
@@ -606,8 +653,262 @@ void _pndman_device_update(pndman_device *device)
 #endif
 }
 
+/* \brief get available space on mount,
+ * returns -1 when it can't be known */
+static int _pndman_device_space(const char *mount, uint64_t *available)
+{
+#ifdef __linux__
+   struct statfs fs;
+   if (statfs(mount, &fs) != 0) return RETURN_FAIL;
+   *available = (uint64_t)fs.f_bavail * (uint64_t)fs.f_bsize;
+   return RETURN_OK;
+#elif _WIN32
+   char szDrive[3] = { ' ', ':', '\0' };
+   ULARGE_INTEGER bytes_available, bytes_size, bytes_free;
+   szDrive[0] = mount[0];
+   if (!GetDiskFreeSpaceEx(szDrive, &bytes_available, &bytes_size, &bytes_free))
+      return RETURN_FAIL;
+   *available = bytes_available.QuadPart;
+   return RETURN_OK;
+#else
+   (void)mount; (void)available;
+   return RETURN_FAIL;
+#endif
+}
+
+/* \brief get reservations of mount, create if asked */
+static _pndman_space* _pndman_space_get(const char *mount, int create)
+{
+   _pndman_space *s;
+   for (s = _pndman_spaces; s && strcmp(s->mount, mount); s = s->next);
+   if (s || !create) return s;
+
+   if (!(s = calloc(1, sizeof(_pndman_space))))
+      return NULL;
+   if (!(s->mount = strdup(mount))) {
+      free(s);
+      return NULL;
+   }
+   s->next = _pndman_spaces;
+   _pndman_spaces = s;
+   return s;
+}
+
+/* \brief forget reservations of mount once nothing is reserved,
+ * so the list only holds mounts with downloads in flight */
+static void _pndman_space_drop(_pndman_space *space)
+{
+   _pndman_space *s, *prev = NULL;
+   if (space->reserved) return;
+
+   for (s = _pndman_spaces; s && s != space; prev = s, s = s->next);
+   if (!s) return;
+   if (prev) prev->next = s->next;
+   else _pndman_spaces = s->next;
+   free(s->mount);
+   free(s);
+}
+
+/* \brief name of physical disk mount is on, free it.
+ * partitions of one card share the name */
+static char* _pndman_device_disk(const char *mount)
+{
+   char *disk = NULL;
+#ifdef __linux__
+   struct stat st;
+   char sys[64], *part, *slash;
+
+   if (stat(mount, &st) != 0)
+      return strdup(mount);
+
+   snprintf(sys, sizeof(sys), "/sys/dev/block/%u:%u", major(st.st_dev), minor(st.st_dev));
+   if ((disk = realpath(sys, NULL))) {
+      int size = snprintf(NULL, 0, "%s/partition", disk)+1;
+      if ((part = malloc(size))) {
+         sprintf(part, "%s/partition", disk);
+         if (access(part, F_OK) == 0 && (slash = strrchr(disk, '/')))
+            *slash = 0;
+         free(part);
+      }
+      return disk;
+   }
+
+   /* not a block device, tmpfs, network.. */
+   disk = strdup(sys);
+#else
+   disk = strdup(mount);
+#endif
+   return disk;
+}
+
+/* \brief run job for each device of the disk */
+static void _pndman_device_worker_run(_pndman_device_jobs *jobs, size_t disk)
+{
+   size_t i;
+   for (i = disk; i != jobs->count; ++i)
+      if (jobs->disk[i] == disk)
+         jobs->job(jobs->device[i], i, jobs->user_data);
+}
+
+#ifdef HAVE_PTHREAD
+static void* _pndman_device_worker_thread(void *arg)
+{
+   _pndman_device_worker *worker = arg;
+   _pndman_device_worker_run(worker->jobs, worker->disk);
+   return NULL;
+}
+#endif
+
 /* INTERNAL */
 
+/* \brief run job for every device in list, devices on different
+ * disks in parallel. index is position of device in list.
+ * returns number of devices, -1 on failure */
+int _pndman_device_foreach(pndman_device *device, _pndman_device_job job, void *user_data)
+{
+   _pndman_device_jobs jobs;
+   pndman_device *d;
+   char **name = NULL;
+   size_t i, j;
+#ifdef HAVE_PTHREAD
+   _pndman_device_worker *worker = NULL;
+   pthread_t *thread = NULL;
+   size_t w, workers = 0;
+#endif
+   assert(device && job);
+
+   memset(&jobs, 0, sizeof(_pndman_device_jobs));
+   jobs.job       = job;
+   jobs.user_data = user_data;
+
+   for (d = _pndman_device_first(device); d; d = d->next) ++jobs.count;
+   if (!(jobs.device = calloc(jobs.count, sizeof(pndman_device*))) ||
+       !(jobs.disk   = calloc(jobs.count, sizeof(size_t))) ||
+       !(name        = calloc(jobs.count, sizeof(char*))))
+      goto fail;
+
+   for (d = _pndman_device_first(device), i = 0; d; d = d->next, ++i) {
+      jobs.device[i] = d;
+      name[i] = (d->mount ? _pndman_device_disk(d->mount) : NULL);
+      for (j = 0; j != i && (!name[i] || !name[j] || strcmp(name[i], name[j])); ++j);
+      jobs.disk[i] = j;
+#ifdef HAVE_PTHREAD
+      if (j == i) ++workers;
+#endif
+   }
+
+#ifdef HAVE_PTHREAD
+   if (workers > 1) {
+      if (!(worker = calloc(workers, sizeof(_pndman_device_worker))) ||
+          !(thread = calloc(workers, sizeof(pthread_t))))
+         goto fail;
+
+      for (i = 0, w = 0; i != jobs.count; ++i) {
+         if (jobs.disk[i] != i) continue;
+         worker[w].jobs = &jobs;
+         worker[w].disk = i;
+         if (pthread_create(&thread[w], NULL, _pndman_device_worker_thread, &worker[w]) == 0) ++w;
+         else _pndman_device_worker_run(&jobs, i); /* do it here then */
+      }
+      DEBUG(PNDMAN_LEVEL_CRAP, "devices: %zu devices on %zu disks", jobs.count, workers);
+      while (w) pthread_join(thread[--w], NULL);
+   } else
+#endif
+   for (i = 0; i != jobs.count; ++i)
+      if (jobs.disk[i] == i) _pndman_device_worker_run(&jobs, i);
+
+   for (i = 0; i != jobs.count; ++i) free(name[i]);
+#ifdef HAVE_PTHREAD
+   IFDO(free, worker);
+   IFDO(free, thread);
+#endif
+   free(name);
+   free(jobs.device);
+   free(jobs.disk);
+   return jobs.count;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "device jobs");
+   if (name) for (i = 0; i != jobs.count; ++i) free(name[i]);
+#ifdef HAVE_PTHREAD
+   IFDO(free, worker);
+   IFDO(free, thread);
+#endif
+   IFDO(free, name);
+   IFDO(free, jobs.device);
+   IFDO(free, jobs.disk);
+   return RETURN_FAIL;
+}
+
+/* \brief reserve size bytes on mount for download.
+ * returns 0 when reserved, -1 when it does not fit now.
+ * On failure pending is set to bytes reserved by other downloads,
+ * when that is 0 the download does not fit at all. */
+int _pndman_device_reserve(const char *mount, uint64_t size, uint64_t *pending)
+{
+   _pndman_space *s;
+   uint64_t available, reserved;
+   assert(mount && pending);
+   *pending = 0;
+
+   /* unknown space, let write errors tell */
+   if (_pndman_device_space(mount, &available) != RETURN_OK)
+      return RETURN_OK;
+
+   SPACE_LOCK();
+   s = _pndman_space_get(mount, 0);
+   reserved = (s ? s->reserved : 0);
+   if (available < reserved || available - reserved < size) {
+      *pending = reserved;
+      SPACE_UNLOCK();
+      DEBUG(PNDMAN_LEVEL_CRAP, "space: %s, need %"PRIu64", available %"PRIu64", reserved %"PRIu64,
+            mount, size, available, reserved);
+      return RETURN_FAIL;
+   }
+   if (size && (s || (s = _pndman_space_get(mount, 1))))
+      s->reserved += size;
+   SPACE_UNLOCK();
+   return RETURN_OK;
+}
+
+/* \brief give back reservation of _pndman_device_reserve */
+void _pndman_device_release(const char *mount, uint64_t size)
+{
+   _pndman_space *s;
+   assert(mount);
+
+   SPACE_LOCK();
+   if ((s = _pndman_space_get(mount, 0))) {
+      s->reserved = (s->reserved > size ? s->reserved - size : 0);
+      _pndman_space_drop(s);
+   }
+   SPACE_UNLOCK();
+}
+
+#ifdef __linux__
+/* \brief add mount to device list, if it can hold PNDs.
+ * on success device points to the new device */
+pndman_device* _pndman_device_add_mount(const char *fsname, const char *dir, pndman_device **device)
+{
+   char *appdata;
+   assert(fsname && dir && device);
+
+   if (!_pndman_device_usable(fsname, dir))
+      return NULL;
+   if (!_pndman_device_new_if_exist(device, dir))
+      return NULL;
+
+   _pndman_device_set_mount(*device, dir);
+   _pndman_device_set_device(*device, fsname);
+   _pndman_device_update(*device);
+   if ((appdata = _pndman_device_get_appdata_no_create(*device))) {
+      _pndman_device_set_appdata(*device, appdata);
+      free(appdata);
+   }
+   return *device;
+}
+#endif
+
 /* \brief check's devices structure and returns appdata, free it*/
 char* _pndman_device_get_appdata(pndman_device *device)
 {
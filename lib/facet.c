@@ -0,0 +1,421 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define FACET_MAX_KEY 256
+
+struct _pndman_facet_set;
+struct _pndman_facet_doc;
+
+/* \brief value of facet and packages having it */
+typedef struct _pndman_facet_value
+{
+   char *name; /* as first seen, lookups ignore case */
+   struct _pndman_facet_doc **doc;
+   size_t count, alloc;
+   struct _pndman_facet_set *set; /* set value belongs to */
+   struct _pndman_facet_set *sub; /* subcategories of category */
+} _pndman_facet_value;
+
+/* \brief values of one facet */
+typedef struct _pndman_facet_set
+{
+   _pndman_hash *value; /* lowercase name -> _pndman_facet_value */
+   _pndman_facet_value **sorted;
+   size_t nsorted;
+   char dirty;
+} _pndman_facet_set;
+
+/* \brief value of indexed package */
+typedef struct _pndman_facet_entry
+{
+   _pndman_facet_value *value;
+   size_t index; /* in packages of value */
+} _pndman_facet_entry;
+
+/* \brief indexed package */
+typedef struct _pndman_facet_doc
+{
+   pndman_package *pnd;
+   _pndman_facet_entry *entry;
+   size_t count, alloc;
+} _pndman_facet_doc;
+
+/* \brief facet index of repository list */
+struct pndman_facet
+{
+   pndman_repository *list;
+   _pndman_facet_set *set[PNDMAN_FACET_COUNT];
+   _pndman_hash *doc; /* pndman_package* -> _pndman_facet_doc */
+};
+
+static void _pndman_facet_set_free(_pndman_facet_set *set);
+
+/* \brief grow array to hold count+1 items */
+static int _pndman_facet_grow(void **array, size_t *alloc, size_t count, size_t size)
+{
+   void *tmp;
+   if (count < *alloc) return RETURN_OK;
+   if (!(tmp = realloc(*array, (*alloc ? *alloc * 2 : 4) * size)))
+      return RETURN_FAIL;
+   *array = tmp;
+   *alloc = (*alloc ? *alloc * 2 : 4);
+   return RETURN_OK;
+}
+
+/* \brief lowercase key of name */
+static size_t _pndman_facet_key(char *key, const char *name)
+{
+   size_t len;
+   for (len = 0; name[len] && len + 1 < FACET_MAX_KEY; ++len)
+      key[len] = (name[len] >= 'A' && name[len] <= 'Z' ? name[len] + ('a' - 'A') : name[len]);
+   key[len] = 0;
+   return len;
+}
+
+/* \brief free value */
+static void _pndman_facet_value_free(void *ptr)
+{
+   _pndman_facet_value *value = ptr;
+   _pndman_facet_set_free(value->sub);
+   IFDO(free, value->name);
+   IFDO(free, value->doc);
+   free(value);
+}
+
+/* \brief create value set */
+static _pndman_facet_set* _pndman_facet_set_new(void)
+{
+   _pndman_facet_set *set;
+   if (!(set = calloc(1, sizeof(_pndman_facet_set))))
+      return NULL;
+   if (!(set->value = _pndman_hash_new())) {
+      free(set);
+      return NULL;
+   }
+   return set;
+}
+
+/* \brief free value set */
+static void _pndman_facet_set_free(_pndman_facet_set *set)
+{
+   if (!set) return;
+   _pndman_hash_free(set->value, _pndman_facet_value_free);
+   IFDO(free, set->sorted);
+   free(set);
+}
+
+/* \brief get value of set by name */
+static _pndman_facet_value* _pndman_facet_set_get(_pndman_facet_set *set, const char *name)
+{
+   char key[FACET_MAX_KEY];
+   size_t len;
+   if (!set || !name) return NULL;
+   len = _pndman_facet_key(key, name);
+   return _pndman_hash_get(set->value, key, len);
+}
+
+/* \brief get value of set by name, creating it */
+static _pndman_facet_value* _pndman_facet_set_add(_pndman_facet_set *set, const char *name)
+{
+   _pndman_facet_value *value;
+   char key[FACET_MAX_KEY];
+   size_t len = _pndman_facet_key(key, name);
+
+   if ((value = _pndman_hash_get(set->value, key, len)))
+      return value;
+
+   if (!(value = calloc(1, sizeof(_pndman_facet_value))))
+      return NULL;
+   if (!(value->name = strdup(name)) ||
+       _pndman_hash_set(set->value, key, len, value) != RETURN_OK) {
+      _pndman_facet_value_free(value);
+      return NULL;
+   }
+   value->set = set;
+   set->dirty = 1;
+   return value;
+}
+
+/* \brief remove value from its set */
+static void _pndman_facet_value_drop(_pndman_facet_value *value)
+{
+   char key[FACET_MAX_KEY];
+   size_t len = _pndman_facet_key(key, value->name);
+   value->set->dirty = 1;
+   _pndman_facet_value_free(_pndman_hash_remove(value->set->value, key, len));
+}
+
+static int _pndman_facet_value_cmp(const void *a, const void *b)
+{
+   return _strupord((*(_pndman_facet_value**)a)->name, (*(_pndman_facet_value**)b)->name);
+}
+
+/* \brief collect value to sorted array */
+static void _pndman_facet_collect(const void *key, size_t len, void *value, void *user_data)
+{
+   _pndman_facet_set *set = user_data;
+   (void)key; (void)len;
+   set->sorted[set->nsorted++] = value;
+}
+
+/* \brief sort values of set, when values were added or removed */
+static int _pndman_facet_set_sort(_pndman_facet_set *set)
+{
+   _pndman_facet_value **tmp;
+
+   if (!set->dirty) return RETURN_OK;
+   if (!(tmp = realloc(set->sorted, (_pndman_hash_count(set->value)+1) * sizeof(_pndman_facet_value*))))
+      return RETURN_FAIL;
+   set->sorted  = tmp;
+   set->nsorted = 0;
+   _pndman_hash_foreach(set->value, _pndman_facet_collect, set);
+   qsort(set->sorted, set->nsorted, sizeof(_pndman_facet_value*), _pndman_facet_value_cmp);
+   set->dirty = 0;
+   return RETURN_OK;
+}
+
+/* \brief add package to value, once */
+static _pndman_facet_value* _pndman_facet_doc_add(_pndman_facet_doc *doc, _pndman_facet_set *set, const char *name)
+{
+   _pndman_facet_value *value;
+   size_t i;
+
+   if (!set || !name || !*name)
+      return NULL;
+   if (!(value = _pndman_facet_set_add(set, name)))
+      return NULL;
+   for (i = 0; i != doc->count; ++i)
+      if (doc->entry[i].value == value) return value;
+
+   if (_pndman_facet_grow((void**)&doc->entry, &doc->alloc, doc->count, sizeof(_pndman_facet_entry)) != RETURN_OK ||
+       _pndman_facet_grow((void**)&value->doc, &value->alloc, value->count, sizeof(_pndman_facet_doc*)) != RETURN_OK) {
+      /* value may be new and empty */
+      if (!value->count) _pndman_facet_value_drop(value);
+      return NULL;
+   }
+   doc->entry[doc->count].value = value;
+   doc->entry[doc->count].index = value->count;
+   doc->count++;
+   value->doc[value->count++] = doc;
+   return value;
+}
+
+/* \brief remove package from value, value goes away with its last package */
+static void _pndman_facet_entry_remove(_pndman_facet_entry *entry)
+{
+   _pndman_facet_value *value = entry->value;
+   _pndman_facet_doc *moved;
+   size_t i;
+
+   if (entry->index != --value->count) {
+      moved = value->doc[value->count];
+      value->doc[entry->index] = moved;
+      for (i = 0; i != moved->count; ++i)
+         if (moved->entry[i].value == value) {
+            moved->entry[i].index = entry->index;
+            break;
+         }
+   }
+
+   if (!value->count) _pndman_facet_value_drop(value);
+}
+
+/* \brief free document */
+static void _pndman_facet_doc_free(void *ptr)
+{
+   _pndman_facet_doc *doc = ptr;
+   IFDO(free, doc->entry);
+   free(doc);
+}
+
+/* \brief remove package from index */
+static void _pndman_facet_remove(pndman_facet *object, pndman_package *pnd)
+{
+   _pndman_facet_doc *doc;
+   size_t i;
+
+   if (!(doc = _pndman_hash_remove(object->doc, &pnd, sizeof(pndman_package*))))
+      return;
+
+   /* reverse order, subcategories go before their category */
+   for (i = doc->count; i; --i)
+      _pndman_facet_entry_remove(&doc->entry[i-1]);
+   _pndman_facet_doc_free(doc);
+}
+
+/* \brief repository package comes from */
+static const char* _pndman_facet_repository(pndman_package *pnd)
+{
+   if (pnd->repository) return pnd->repository;
+   if (!pnd->repositoryptr) return NULL;
+   return (pnd->repositoryptr->url ? pnd->repositoryptr->url : pnd->repositoryptr->name);
+}
+
+/* \brief (re)index package */
+static void _pndman_facet_add(pndman_facet *object, pndman_package *pnd)
+{
+   _pndman_facet_doc *doc;
+   _pndman_facet_value *category;
+   pndman_category *c;
+   pndman_license *l;
+
+   _pndman_facet_remove(object, pnd);
+
+   if (!(doc = calloc(1, sizeof(_pndman_facet_doc))))
+      goto fail;
+   doc->pnd = pnd;
+   if (_pndman_hash_set(object->doc, &pnd, sizeof(pndman_package*), doc) != RETURN_OK)
+      goto fail;
+
+   for (c = pnd->category; c; c = c->next) {
+      if (!(category = _pndman_facet_doc_add(doc, object->set[PNDMAN_FACET_CATEGORY], c->main)))
+         continue;
+      if (!category->sub) category->sub = _pndman_facet_set_new();
+      _pndman_facet_doc_add(doc, category->sub, c->sub);
+   }
+   _pndman_facet_doc_add(doc, object->set[PNDMAN_FACET_REPOSITORY], _pndman_facet_repository(pnd));
+   _pndman_facet_doc_add(doc, object->set[PNDMAN_FACET_VENDOR], pnd->vendor);
+   _pndman_facet_doc_add(doc, object->set[PNDMAN_FACET_COMMERCIAL], (pnd->commercial ? "1" : "0"));
+   for (l = pnd->license; l; l = l->next)
+      _pndman_facet_doc_add(doc, object->set[PNDMAN_FACET_LICENSE], l->name);
+   return;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "facet document");
+   IFDO(free, doc);
+}
+
+/* \brief follow packages of repositories */
+static void _pndman_facet_observer(_pndman_package_event event, pndman_package *pnd, void *user_data)
+{
+   pndman_facet *object = user_data;
+
+   if (event == PNDMAN_PACKAGE_FREED)
+      _pndman_facet_remove(object, pnd);
+   else if (_pndman_repository_first(pnd->repositoryptr) == object->list)
+      _pndman_facet_add(object, pnd);
+}
+
+/* \brief values set of type, subcategories live under their category */
+static _pndman_facet_set* _pndman_facet_get_set(pndman_facet *object, pndman_facet_type type, const char *category)
+{
+   _pndman_facet_value *value;
+
+   if (type < 0 || type >= PNDMAN_FACET_COUNT)
+      return NULL;
+   if (type != PNDMAN_FACET_SUBCATEGORY)
+      return object->set[type];
+   if (!(value = _pndman_facet_set_get(object->set[PNDMAN_FACET_CATEGORY], category)))
+      return NULL;
+   return value->sub;
+}
+
+/* API */
+
+/* \brief create facet index of repository list */
+PNDMANAPI pndman_facet* pndman_facet_new(pndman_repository *list)
+{
+   pndman_facet *object;
+   pndman_repository *r;
+   pndman_package *p, *pi;
+   int i;
+   CHECKUSEP(list);
+
+   if (!(object = calloc(1, sizeof(pndman_facet))))
+      goto fail;
+
+   object->list = _pndman_repository_first(list);
+   if (!(object->doc = _pndman_hash_new()))
+      goto fail;
+
+   /* subcategories are kept under their category */
+   for (i = 0; i != PNDMAN_FACET_COUNT; ++i)
+      if (i != PNDMAN_FACET_SUBCATEGORY && !(object->set[i] = _pndman_facet_set_new()))
+         goto fail;
+
+   for (r = object->list; r; r = r->next)
+      for (p = r->pnd; p; p = p->next)
+         for (pi = p; pi; pi = pi->next_installed)
+            _pndman_facet_add(object, pi);
+
+   if (_pndman_package_observe(_pndman_facet_observer, object) != RETURN_OK)
+      goto fail;
+
+   return object;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "pndman_facet");
+   if (object) {
+      for (i = 0; i != PNDMAN_FACET_COUNT; ++i)
+         _pndman_facet_set_free(object->set[i]);
+      _pndman_hash_free(object->doc, _pndman_facet_doc_free);
+      free(object);
+   }
+   return NULL;
+}
+
+/* \brief values of facet sorted by name */
+PNDMANAPI int pndman_facet_values(pndman_facet *facet, pndman_facet_type type,
+      const char *category, const char **values, int max)
+{
+   _pndman_facet_set *set;
+   int i;
+   CHECKUSE(facet);
+   if (max > 0) CHECKUSE(values);
+
+   if (!(set = _pndman_facet_get_set(facet, type, category)))
+      return 0;
+   if (_pndman_facet_set_sort(set) != RETURN_OK)
+      return RETURN_FAIL;
+
+   for (i = 0; i < max && (size_t)i != set->nsorted; ++i)
+      values[i] = set->sorted[i]->name;
+   return set->nsorted;
+}
+
+/* \brief number of packages with value of facet */
+PNDMANAPI int pndman_facet_count(pndman_facet *facet, pndman_facet_type type,
+      const char *category, const char *value)
+{
+   _pndman_facet_value *v;
+   CHECKUSE(facet);
+   CHECKUSE(value);
+
+   if (!(v = _pndman_facet_set_get(_pndman_facet_get_set(facet, type, category), value)))
+      return 0;
+   return v->count;
+}
+
+/* \brief packages with value of facet */
+PNDMANAPI int pndman_facet_packages(pndman_facet *facet, pndman_facet_type type,
+      const char *category, const char *value, pndman_package **result, int max)
+{
+   _pndman_facet_value *v;
+   int i;
+   CHECKUSE(facet);
+   CHECKUSE(value);
+   if (max > 0) CHECKUSE(result);
+
+   if (!(v = _pndman_facet_set_get(_pndman_facet_get_set(facet, type, category), value)))
+      return 0;
+
+   for (i = 0; i < max && (size_t)i != v->count; ++i)
+      result[i] = v->doc[i]->pnd;
+   return v->count;
+}
+
+/* \brief free facet index */
+PNDMANAPI void pndman_facet_free(pndman_facet *facet)
+{
+   int i;
+   CHECKUSEV(facet);
+   _pndman_package_unobserve(_pndman_facet_observer, facet);
+   for (i = 0; i != PNDMAN_FACET_COUNT; ++i)
+      _pndman_facet_set_free(facet->set[i]);
+   _pndman_hash_free(facet->doc, _pndman_facet_doc_free);
+   free(facet);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,248 @@
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <libgen.h>
+
+#ifdef __linux__
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <sys/sendfile.h>
+#  include <linux/fs.h>
+#endif
+
+#ifndef O_BINARY
+#  define O_BINARY 0
+#endif
+#ifndef RENAME_NOREPLACE
+#  define RENAME_NOREPLACE (1 << 0)
+#endif
+#ifndef RENAME_EXCHANGE
+#  define RENAME_EXCHANGE  (1 << 1)
+#endif
+
+/* \brief rename with renameat2 flags,
+ * errno is ENOSYS/EINVAL when kernel or filesystem can't do it */
+static int _pndman_file_rename2(const char *src, const char *dst, unsigned int flags)
+{
+#if defined(__linux__) && defined(SYS_renameat2)
+   if (syscall(SYS_renameat2, AT_FDCWD, src, AT_FDCWD, dst, flags) == 0)
+      return RETURN_OK;
+#else
+   (void)src; (void)dst; (void)flags;
+   errno = ENOSYS;
+#endif
+   return RETURN_FAIL;
+}
+
+/* \brief rename that fails when dst exists */
+static int _pndman_file_rename_noreplace(const char *src, const char *dst)
+{
+   if (_pndman_file_rename2(src, dst, RENAME_NOREPLACE) == RETURN_OK)
+      return RETURN_OK;
+   if (errno != ENOSYS && errno != EINVAL)
+      return RETURN_FAIL;
+
+   /* no kernel support, racy check is the best we can do */
+   if (access(dst, F_OK) == 0) {
+      errno = EEXIST;
+      return RETURN_FAIL;
+   }
+   return (rename(src, dst) == 0 ? RETURN_OK : RETURN_FAIL);
+}
+
+/* \brief copy contents of in to out, without going through
+ * user space when the kernel can do it for us */
+static int _pndman_file_copy_fd(int in, int out)
+{
+   char buffer[PNDMAN_MD5_CHUNK];
+   ssize_t len;
+   struct stat st;
+
+   if (fstat(in, &st) != 0)
+      return RETURN_FAIL;
+
+#ifdef __linux__
+   /* share extents, nothing is copied at all */
+#  ifdef FICLONE
+   if (ioctl(out, FICLONE, in) == 0)
+      return RETURN_OK;
+#  endif
+
+   /* in kernel copy, server side on network filesystems */
+#  ifdef SYS_copy_file_range
+   {
+      loff_t off_in = 0, off_out = 0;
+      while (off_in < st.st_size &&
+             (len = syscall(SYS_copy_file_range, in, &off_in, out, &off_out, st.st_size - off_in, 0)) > 0);
+      if (off_in == st.st_size)
+         return RETURN_OK;
+      if (off_in != 0)
+         return RETURN_FAIL;
+   }
+#  endif
+
+   {
+      off_t off = 0;
+      while (off < st.st_size && (len = sendfile(out, in, &off, st.st_size - off)) > 0);
+      if (off == st.st_size)
+         return RETURN_OK;
+      if (off != 0)
+         return RETURN_FAIL;
+   }
+#endif
+
+   while ((len = read(in, buffer, sizeof(buffer))) > 0)
+      if (write(out, buffer, len) != len) return RETURN_FAIL;
+   return (len < 0 ? RETURN_FAIL : RETURN_OK);
+}
+
+/* \brief sync directory of path, so a rename in it is durable */
+static int _pndman_file_sync_dir(const char *path)
+{
+#ifndef _WIN32
+   char *dir;
+   int fd, ret;
+
+   if (!(dir = strdup(path)))
+      return RETURN_FAIL;
+   if ((fd = open(dirname(dir), O_RDONLY)) == -1) {
+      free(dir);
+      return RETURN_FAIL;
+   }
+   free(dir);
+
+   /* some filesystems can't sync directories, nothing more to do there */
+   ret = (fsync(fd) == 0 || errno == EINVAL ? RETURN_OK : RETURN_FAIL);
+   close(fd);
+   return ret;
+#else
+   (void)path;
+   return RETURN_OK;
+#endif
+}
+
+/* \brief copy file to other filesystem and move it in place,
+ * dst is never seen half written */
+static int _pndman_file_move_copy(const char *src, const char *dst, unsigned int flags)
+{
+   char *part = NULL;
+   int in = -1, out = -1;
+
+   int size = snprintf(NULL, 0, "%s.part", dst)+1;
+   if (!(part = malloc(size)))
+      goto fail;
+   sprintf(part, "%s.part", dst);
+
+   if ((in = open(src, O_RDONLY | O_BINARY)) == -1)
+      goto fail;
+   if ((out = open(part, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1)
+      goto fail;
+
+   if (_pndman_file_copy_fd(in, out) != RETURN_OK)
+      goto fail;
+#ifndef _WIN32
+   if (fsync(out) != 0)
+      goto fail;
+#endif
+
+   close(in); in = -1;
+   if (close(out) != 0) {
+      out = -1;
+      goto fail;
+   }
+   out = -1;
+
+   if (flags & PNDMAN_MOVE_NOREPLACE) {
+      if (_pndman_file_rename_noreplace(part, dst) != RETURN_OK)
+         goto fail;
+   } else if (rename(part, dst) != 0)
+      goto fail;
+
+   DEBUG(PNDMAN_LEVEL_CRAP, "copied: %s -> %s", src, dst);
+   free(part);
+   if (_pndman_file_sync_dir(dst) != RETURN_OK)
+      DEBUG(PNDMAN_LEVEL_WARN, "Failed to sync directory of %s: %s", dst, strerror(errno));
+   if (unlink(src) != 0)
+      DEBUG(PNDMAN_LEVEL_WARN, HANDLE_RM_FAIL, src);
+   return RETURN_OK;
+
+fail:
+   if (in != -1) close(in);
+   if (out != -1) close(out);
+   if (part) {
+      unlink(part);
+      free(part);
+   }
+   return RETURN_FAIL;
+}
+
+/* INTERNAL API */
+
+/* \brief copy file, dst is replaced */
+int _pndman_file_copy(const char *src, const char *dst)
+{
+   int in = -1, out = -1;
+   assert(src && dst);
+
+   if ((in = open(src, O_RDONLY | O_BINARY)) == -1)
+      goto fail;
+   if ((out = open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) == -1)
+      goto fail;
+
+   if (_pndman_file_copy_fd(in, out) != RETURN_OK)
+      goto fail;
+
+   close(in);
+   if (close(out) != 0) {
+      out = -1;
+      goto fail;
+   }
+   return RETURN_OK;
+
+fail:
+   if (in != -1) close(in);
+   if (out != -1) close(out);
+   unlink(dst);
+   return RETURN_FAIL;
+}
+
+/* \brief move file, src -> dst.
+ * Existing dst is replaced atomically, unless PNDMAN_MOVE_NOREPLACE
+ * is given, then move fails when dst exists. Between filesystems
+ * the file is copied next to dst, synced and renamed over it. */
+int _pndman_file_move(const char *src, const char *dst, unsigned int flags)
+{
+   assert(src && dst);
+
+   if (flags & PNDMAN_MOVE_NOREPLACE) {
+      if (_pndman_file_rename_noreplace(src, dst) == RETURN_OK)
+         return RETURN_OK;
+   } else {
+#ifdef _WIN32
+      /* rename does not replace on windows */
+      unlink(dst);
+#endif
+      if (rename(src, dst) == 0)
+         return RETURN_OK;
+   }
+
+   if (errno != EXDEV)
+      return RETURN_FAIL;
+   return _pndman_file_move_copy(src, dst, flags);
+}
+
+/* \brief swap two files atomically,
+ * fails when filesystem can't do it */
+int _pndman_file_exchange(const char *a, const char *b)
+{
+   assert(a && b);
+   return _pndman_file_rename2(a, b, RENAME_EXCHANGE);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
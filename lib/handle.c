@@ -4,6 +4,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <libgen.h>
 #include <assert.h>
 
@@ -11,31 +12,29 @@
 #  include <sys/stat.h>
 #endif
 
-/* \brief move file, src -> dst */
+/* \brief bytes of file already allocated on disk */
+static uint64_t _pndman_file_allocated(const char *path)
+{
+#ifndef _WIN32
+   struct stat st;
+   if (stat(path, &st) == 0) return (uint64_t)st.st_blocks * 512;
+#endif
+   return 0;
+}
+
+/* \brief move file, src -> dst,
+ * dst is replaced atomically and moves between filesystems work */
 static int _pndman_move_file(const char* src, const char* dst)
 {
-   FILE *f;
    assert(src && dst);
 
-   /* remove dst, if exists */
-   if ((f = fopen(dst, "rb"))) {
-      fclose(f);
-      if (unlink(dst) != 0)
-         goto rm_fail;
-   }
-
-   /* rename */
-   if (rename(src, dst) != 0)
+   if (_pndman_file_move(src, dst, 0) != RETURN_OK)
       goto mv_fail;
 
    return RETURN_OK;
 
-rm_fail:
-   DEBFAIL(HANDLE_RM_FAIL, dst);
-   goto fail;
 mv_fail:
    DEBFAIL(HANDLE_MV_FAIL, src, dst);
-fail:
    return RETURN_FAIL;
 }
 
@@ -59,8 +58,7 @@ static char* _get_backup_dir(pndman_device *device)
          goto fail;
    }
 
-   free(buffer);
-   return RETURN_OK;
+   return buffer;
 
 fail:
    IFDO(free, buffer);
@@ -81,20 +79,12 @@ static int _file_exist(char *path)
    return RETURN_FALSE;
 }
 
-/* \brief backup pnd */
-static int _pndman_backup(pndman_package *pnd, pndman_device *device)
+/* \brief get backup path of pnd, free when done */
+static char* _pndman_backup_path(pndman_package *pnd, pndman_device *device)
 {
-   char *tmp = NULL, *bckdir = NULL, *path = NULL;
+   char *tmp = NULL, *bckdir = NULL;
    assert(pnd && device);
 
-   /* get full path */
-   if (!(path = _pndman_pnd_get_path(pnd)))
-      goto fail;
-
-   /* can't backup from void */
-   if (_file_exist(path) != RETURN_OK)
-      goto fail;
-
    /* get backup directory */
    if (!(bckdir = _get_backup_dir(device)))
       goto backup_fail;
@@ -108,32 +98,32 @@ static int _pndman_backup(pndman_package *pnd, pndman_device *device)
    sprintf(tmp, "%s/%s - %s.%s.%s.%s.pnd", bckdir, pnd->id,
          pnd->version.major, pnd->version.minor, pnd->version.release, pnd->version.build);
    free(bckdir);
-
-   DEBUG(PNDMAN_LEVEL_CRAP, "backup: %s -> %s", path, tmp);
-   int ret = _pndman_move_file(path, tmp);
-   free(path);
-   free(tmp);
-   return ret;
+   return tmp;
 
 backup_fail:
-   DEBFAIL(HANDLE_BACKUP_DIR_FAIL, device);
+   DEBFAIL(HANDLE_BACKUP_DIR_FAIL, device->mount);
 fail:
    IFDO(free, tmp);
    IFDO(free, bckdir);
-   IFDO(free, path);
-   return RETURN_FAIL;
+   return NULL;
 }
 
 /* \brief check conflicts */
 static int _conflict(char *id, char *path, pndman_device *device, pndman_repository *local)
 {
    pndman_package *pnd;
+   const char *mount;
    assert(id && path && local);
 
+   /* mounts of packages are interned, no package is on device
+    * when its mount isn't, others compare by pointer */
+   if (!(mount = _pndman_intern_find(device->mount)))
+      return RETURN_FALSE;
+
    for (pnd = local->pnd; pnd; pnd = pnd->next)
-      if (id && pnd->id && strcmp(id, pnd->id) &&
-          path && pnd->path && !strcmp(path, pnd->path) &&
-          device->mount && pnd->mount && !strcmp(device->mount, pnd->mount)) {
+      if (pnd->mount == mount &&
+          id && pnd->id && strcmp(id, pnd->id) &&
+          path && pnd->path && !strcmp(path, pnd->path)) {
          DEBUG(PNDMAN_LEVEL_CRAP, "CONFLICT: %s - %s", pnd->id, pnd->path);
          return RETURN_TRUE;
       }
@@ -144,6 +134,7 @@ static int _conflict(char *id, char *path, pndman_device *device, pndman_reposit
 static int _pndman_package_handle_download(pndman_package_handle *object)
 {
    char *tmp_path = NULL, *appdata = NULL;
+   uint64_t need, have;
    pndman_device *d;
    pndman_curl_handle *handle;
    assert(object);
@@ -185,15 +176,35 @@ static int _pndman_package_handle_download(pndman_package_handle *object)
    sprintf(tmp_path, "%s/%s.tmp", appdata, object->pnd->id);
    NULLDO(free, appdata);
 
-   object->data = handle = _pndman_curl_handle_new(object, &object->progress, _pndman_package_handle_done, tmp_path);
+   object->data = handle = _pndman_curl_handle_new(object->context, object, &object->progress, _pndman_package_handle_done, tmp_path);
    NULLDO(free, tmp_path);
    if (!handle) goto fail;
 
+   /* scheduling hints */
+   handle->size     = object->pnd->size;
+   handle->priority = (object->flags & PNDMAN_PACKAGE_PRIORITY ? 1 : 0);
+   if (object->device->mount)
+      handle->space = strdup(object->device->mount);
+   if (object->pnd->repositoryptr && object->pnd->repositoryptr->url)
+      handle->repository = strdup(object->pnd->repositoryptr->url);
+
+   /* refuse download that won't fit even on its own,
+    * partial download already on disk counts */
+   need = object->pnd->size;
+   have = _pndman_file_allocated(handle->path);
+   need = (have < need ? need - have : 0);
+   _pndman_device_update(object->device);
+   if (need && object->device->available < need)
+      goto object_no_space;
+   handle->reserve = need;
+
    /* commercial or logged download */
    if (object->pnd->repositoryptr && (object->pnd->commercial || (object->flags & PNDMAN_PACKAGE_LOG_HISTORY))) {
       return _pndman_api_commercial_download(handle, object);
    } else {
-      /* normal anonyomous */
+      /* normal anonyomous, downloaded before comes from cache */
+      if (object->pnd->md5 && !(handle->cache = strdup(object->pnd->md5)))
+         goto fail;
       _pndman_curl_handle_set_url(handle, object->pnd->url);
       return _pndman_curl_handle_perform(handle);
    }
@@ -216,6 +227,9 @@ object_no_dst:
    goto fail;
 object_wtf:
    DEBFAIL(HANDLE_WTF);
+   goto fail;
+object_no_space:
+   DEBFAIL(HANDLE_NO_SPACE, object->device->mount, object->pnd->id, need);
 fail:
    IFDO(free, tmp_path);
    IFDO(free, appdata);
@@ -261,15 +275,145 @@ fail:
    return NULL;
 }
 
+/* \brief move downloaded pnd in place of plan.
+ * New pnd is staged next to install path and swapped in first,
+ * old pnd is backed up or removed only after that. On failure
+ * files are put back where they were */
+static int _pndman_package_handle_install_files(pndman_curl_handle *handle, _pndman_install_plan *plan)
+{
+   char *staged = NULL, *displaced = NULL;
+   const char *old;
+   int same, installed = 0;
+   assert(handle && plan);
+
+   same = (plan->old && !strcmp(plan->old, plan->install));
+
+   /* rest of the moves are renames on one filesystem */
+   int size = snprintf(NULL, 0, "%s.new", plan->install)+1;
+   if (!(staged = malloc(size))) goto fail;
+   sprintf(staged, "%s.new", plan->install);
+
+   DEBUG(PNDMAN_LEVEL_CRAP, "stage: %s -> %s", handle->path, staged);
+   if (_pndman_move_file(handle->path, staged) != RETURN_OK)
+      goto fail;
+
+   /* whatever is at install path is swapped out in one step,
+    * or moved aside when filesystem can't swap */
+   if (access(plan->install, F_OK) == 0) {
+      if (_pndman_file_exchange(staged, plan->install) == RETURN_OK) {
+         displaced = staged;
+         staged = NULL;
+         installed = 1;
+      } else {
+         size = snprintf(NULL, 0, "%s.old", plan->install)+1;
+         if (!(displaced = malloc(size))) goto undo;
+         sprintf(displaced, "%s.old", plan->install);
+         if (_pndman_move_file(plan->install, displaced) != RETURN_OK) {
+            NULLDO(free, displaced);
+            goto undo;
+         }
+      }
+   }
+
+   DEBUG(PNDMAN_LEVEL_CRAP, "install: %s", plan->install);
+   if (!installed) {
+      if (_pndman_move_file(staged, plan->install) != RETURN_OK)
+         goto undo;
+      installed = 1;
+   }
+
+   /* new pnd is in place, old one can go */
+   old = (same ? displaced : plan->old);
+   if (old && plan->backup) {
+      DEBUG(PNDMAN_LEVEL_CRAP, "backup: %s -> %s", old, plan->backup);
+      if (_pndman_move_file(old, plan->backup) != RETURN_OK)
+         goto undo;
+      if (same) {
+         NULLDO(free, displaced);
+      }
+   } else if (old && !same && unlink(old) != 0) {
+      DEBUG(PNDMAN_LEVEL_WARN, HANDLE_RM_FAIL, old);
+   }
+
+   if (displaced && unlink(displaced) != 0)
+      DEBUG(PNDMAN_LEVEL_WARN, HANDLE_RM_FAIL, displaced);
+   IFDO(free, displaced);
+   IFDO(free, staged);
+   return RETURN_OK;
+
+undo:
+   if (installed) _pndman_file_move(plan->install, handle->path, 0);
+   else _pndman_file_move(staged, handle->path, 0);
+   if (displaced) _pndman_file_move(displaced, plan->install, 0);
+fail:
+   IFDO(free, displaced);
+   IFDO(free, staged);
+   return RETURN_FAIL;
+}
+
 /* \brief post routine when handle has install flag */
 static int _pndman_package_handle_install(pndman_package_handle *object, pndman_repository *local)
 {
-   char *install = NULL, *relative = NULL, *filename = NULL, *prefix = NULL, *tmp = NULL, *tmp2 = NULL, *md5 = NULL;
-   int uniqueid = 0;
-   pndman_package *pnd, *oldp;
-   pndman_curl_handle *handle;
+   _pndman_install_plan plan;
    assert(object && local);
 
+   if (_pndman_package_handle_verify(object) != RETURN_OK ||
+       _pndman_package_handle_plan(object, local, &plan) != RETURN_OK)
+      return RETURN_FAIL;
+
+   if (_pndman_package_handle_install_files((pndman_curl_handle*)object->data, &plan) != RETURN_OK)
+      goto fail;
+
+   if (_pndman_package_handle_apply(object, local, &plan) != RETURN_OK)
+      goto fail;
+
+   _pndman_install_plan_free(&plan);
+   return RETURN_OK;
+
+fail:
+   _pndman_install_plan_free(&plan);
+   return RETURN_FAIL;
+}
+
+/* \brief post routine when handle has removal flag */
+static int _pndman_package_handle_remove(pndman_package_handle *object, pndman_repository *local)
+{
+   FILE *f;
+   char *path;
+   assert(object && local);
+
+   /* get full path to pnd */
+   if (!(path = _pndman_pnd_get_path(object->pnd)))
+      goto fail;
+
+   /* sanity checks */
+   if (!(f = fopen(path, "rb")))
+      goto read_fail;
+   fclose(f);
+
+   /* remove */
+   DEBUG(PNDMAN_LEVEL_CRAP, "remove: %s", path);
+   if (unlink(path) != 0) goto fail;
+   NULLDO(free, path);
+
+   return _pndman_package_handle_forget(object, local);
+
+read_fail:
+   DEBFAIL(READ_FAIL, path);
+fail:
+   IFDO(free, path);
+   return RETURN_FAIL;
+}
+
+/* INTERNAL API */
+
+/* \brief check downloaded pnd of install handle,
+ * MD5 is usually calculated while downloading */
+int _pndman_package_handle_verify(pndman_package_handle *object)
+{
+   pndman_curl_handle *handle;
+   assert(object);
+
    handle = (pndman_curl_handle*)object->data;
    _pndman_curl_handle_reset(handle);
 
@@ -284,20 +428,50 @@ static int _pndman_package_handle_install(pndman_package_handle *object, pndman_
        !(object->flags & PNDMAN_PACKAGE_INSTALL_APPS))
       goto handle_no_dst;
 
-   /* check MD5 */
-   md5 = _pndman_md5(handle->path);
-   if (!md5 && !(object->flags & PNDMAN_PACKAGE_FORCE))
+   if (!handle->md5) handle->md5 = _pndman_md5(handle->path);
+   if (!handle->md5 && !(object->flags & PNDMAN_PACKAGE_FORCE))
       goto fail;
 
-   DEBUG(PNDMAN_LEVEL_CRAP, "R: %s L: %s", object->pnd->md5, md5);
+   DEBUG(PNDMAN_LEVEL_CRAP, "R: %s L: %s", object->pnd->md5, handle->md5);
    DEBUG(PNDMAN_LEVEL_CRAP, "%s", handle->path);
 
    /* do check against remote */
-   if (md5 && object->pnd->md5 && strcmp(md5, object->pnd->md5)) {
+   if (handle->md5 && object->pnd->md5 && strcmp(handle->md5, object->pnd->md5)) {
       if (!(object->flags & PNDMAN_PACKAGE_FORCE))
          goto md5_fail;
       else DEBUG(2, HANDLE_MD5_DIFF);
-   } NULLDO(free, md5);
+   }
+
+   return RETURN_OK;
+
+handle_no_dev:
+   DEBFAIL(HANDLE_NO_DEV);
+   goto fail;
+handle_no_pnd:
+   DEBFAIL(HANDLE_NO_PND);
+   goto fail;
+handle_no_dst:
+   DEBFAIL(HANDLE_NO_DST);
+   goto fail;
+md5_fail:
+   DEBFAIL(HANDLE_MD5_FAIL, object->pnd->id);
+fail:
+   return RETURN_FAIL;
+}
+
+/* \brief decide where verified install handle goes,
+ * and what happens to the pnd it replaces. Nothing is moved yet. */
+int _pndman_package_handle_plan(pndman_package_handle *object, pndman_repository *local,
+      _pndman_install_plan *plan)
+{
+   char *relative = NULL, *filename = NULL, *prefix = NULL, *tmp = NULL, *tmp2 = NULL;
+   int uniqueid = 0;
+   pndman_package *pnd, *oldp;
+   pndman_curl_handle *handle;
+   assert(object && local && plan);
+
+   memset(plan, 0, sizeof(_pndman_install_plan));
+   handle = (pndman_curl_handle*)object->data;
 
    if (object->pnd->update && object->pnd->update->path &&
       !(object->flags & PNDMAN_PACKAGE_INSTALL_DESKTOP) &&
@@ -386,21 +560,66 @@ static int _pndman_package_handle_install(pndman_package_handle *object, pndman_
    }
 
    IFDO(free, tmp);
-   NULLDO(free, filename);
+   plan->filename = filename;
+   filename = NULL;
+
+   /* complete install path */
+   size = snprintf(NULL, 0, "%s/%s", object->device->mount, relative)+1;
+   if (!(plan->install = malloc(size))) goto fail;
+   sprintf(plan->install, "%s/%s", object->device->mount, relative);
+   plan->relative = relative;
+   relative = NULL;
 
-   /* backup? */
    if (oldp && (object->flags & PNDMAN_PACKAGE_BACKUP)) {
-      _pndman_backup(oldp, object->device);
-   } else {
-      /* remove old pnd if no backup specified and path differs */
-      if (oldp && oldp->path && strcmp(oldp->path, relative)) {
-         if ((tmp = _pndman_pnd_get_path(oldp))) {
-            unlink(tmp);
-            NULLDO(free, tmp);
-         }
+      /* backup? */
+      plan->old = _pndman_pnd_get_path(oldp);
+      if (plan->old && _file_exist(plan->old))
+         plan->backup = _pndman_backup_path(oldp, object->device);
+      if (!plan->backup) {
+         IFDO(free, plan->old);
       }
+   } else if (oldp && oldp->path && strcmp(oldp->path, plan->relative)) {
+      /* remove old pnd if no backup specified and path differs */
+      plan->old = _pndman_pnd_get_path(oldp);
    }
 
+   return RETURN_OK;
+
+fail:
+   IFDO(free, filename);
+   IFDO(free, prefix);
+   IFDO(free, relative);
+   IFDO(free, tmp);
+   IFDO(free, tmp2);
+   _pndman_install_plan_free(plan);
+   return RETURN_FAIL;
+}
+
+/* \brief free install plan */
+void _pndman_install_plan_free(_pndman_install_plan *plan)
+{
+   assert(plan);
+   IFDO(free, plan->relative);
+   IFDO(free, plan->install);
+   IFDO(free, plan->old);
+   IFDO(free, plan->backup);
+   IFDO(free, plan->filename);
+}
+
+/* \brief update local repository once pnd of install handle is in place */
+int _pndman_package_handle_apply(pndman_package_handle *object, pndman_repository *local,
+      _pndman_install_plan *plan)
+{
+   pndman_package *pnd;
+   pndman_curl_handle *handle;
+   assert(object && local && plan);
+   handle = (pndman_curl_handle*)object->data;
+
+   /* keep verified download for later installs,
+    * only now that it went through */
+   if (handle->md5 && object->pnd->md5 && plan->filename && !strcmp(handle->md5, object->pnd->md5))
+      _pndman_cache_insert(object->pnd->md5, plan->install, plan->filename);
+
    /* remove old pnd from repo */
    if (object->pnd->update)
       _pndman_repository_free_pnd(object->pnd->update, local);
@@ -408,74 +627,28 @@ static int _pndman_package_handle_install(pndman_package_handle *object, pndman_
 
    /* Copy the pnd object to local database
     * path should be always "" when installing from remote repository */
-   pnd = _pndman_repository_new_pnd_check(object->pnd, relative, object->device->mount, local);
+   pnd = _pndman_repository_new_pnd_check(object->pnd, plan->relative, object->device->mount, local);
    if (!pnd) goto fail;
    _pndman_copy_pnd(pnd, object->pnd);
 
-   /* complete install path */
-   size = snprintf(NULL, 0, "%s/%s", object->device->mount, relative)+1;
-   if (!(install = malloc(size))) goto fail;
-   sprintf(install, "%s/%s", object->device->mount, relative);
-
-   DEBUG(PNDMAN_LEVEL_CRAP, "install: %s", install);
-   DEBUG(PNDMAN_LEVEL_CRAP, "from: %s", handle->path);
-   if (_pndman_move_file(handle->path, install) != RETURN_OK)
-      goto fail;
-
    /* mark installed */
    DEBUG(PNDMAN_LEVEL_CRAP, "install mark");
    IFDO(free, pnd->path);
-   pnd->path = strdup(relative);
-   IFDO(free, pnd->mount);
-   pnd->mount = strdup(object->device->mount);
-
-   free(install);
-   free(relative);
+   pnd->path = strdup(plan->relative);
+   _pndman_intern_set(&pnd->mount, object->device->mount);
+   _pndman_package_notify(PNDMAN_PACKAGE_CHANGED, pnd);
    return RETURN_OK;
 
-handle_no_dev:
-   DEBFAIL(HANDLE_NO_DEV);
-   goto fail;
-handle_no_pnd:
-   DEBFAIL(HANDLE_NO_PND);
-   goto fail;
-handle_no_dst:
-   DEBFAIL(HANDLE_NO_DST);
-   goto fail;
-md5_fail:
-   DEBFAIL(HANDLE_MD5_FAIL, object->pnd->id);
 fail:
-   IFDO(free, filename);
-   IFDO(free, prefix);
-   IFDO(free, relative);
-   IFDO(free, install);
-   IFDO(free, tmp);
-   IFDO(free, tmp2);
-   IFDO(free, md5);
    return RETURN_FAIL;
 }
 
-/* \brief post routine when handle has removal flag */
-static int _pndman_package_handle_remove(pndman_package_handle *object, pndman_repository *local)
+/* \brief remove pnd of removal handle from local repository,
+ * once its file is gone */
+int _pndman_package_handle_forget(pndman_package_handle *object, pndman_repository *local)
 {
-   FILE *f;
-   char *path;
    assert(object && local);
 
-   /* get full path to pnd */
-   if (!(path = _pndman_pnd_get_path(object->pnd)))
-      goto fail;
-
-   /* sanity checks */
-   if (!(f = fopen(path, "rb")))
-      goto read_fail;
-   fclose(f);
-
-   /* remove */
-   DEBUG(PNDMAN_LEVEL_CRAP, "remove: %s", path);
-   if (unlink(path) != 0) goto fail;
-   NULLDO(free, path);
-
    /* this can't be updated anymore */
    if (object->pnd->update)
       object->pnd->update->update = NULL;
@@ -483,16 +656,8 @@ static int _pndman_package_handle_remove(pndman_package_handle *object, pndman_r
 
    /* remove from local repo */
    return _pndman_repository_free_pnd(object->pnd, local);
-
-read_fail:
-   DEBFAIL(READ_FAIL, path);
-fail:
-   IFDO(free, path);
-   return RETURN_FAIL;
 }
 
-/* INTERNAL API */
-
 /* \brief handle callback */
 void _pndman_package_handle_done(pndman_curl_code code, void *data, const char *info, pndman_curl_handle *chandle)
 {
@@ -568,7 +733,7 @@ PNDMANAPI int pndman_package_handle_commit(pndman_package_handle *handle, pndman
    CHECKUSE(handle->flags);
    CHECKUSE(handle->pnd);
    CHECKUSE(local);
-   clock_t now = clock();
+   uint64_t now = _pndman_metrics_now();
 
    /* make this idiot proof */
    local = _pndman_repository_first(local);
@@ -580,7 +745,7 @@ PNDMANAPI int pndman_package_handle_commit(pndman_package_handle *handle, pndman
       if (_pndman_package_handle_install(handle, local) != RETURN_OK)
          return RETURN_FAIL;
 
-   DEBUG(PNDMAN_LEVEL_CRAP, "Handle commit took %.2f seconds", (double)(clock()-now)/CLOCKS_PER_SEC);
+   DEBUG(PNDMAN_LEVEL_CRAP, "Handle commit took %.2f seconds", (_pndman_metrics_now()-now)/1000000.0);
    return RETURN_OK;
 }
 
@@ -0,0 +1,194 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define HASH_MIN_SIZE 16
+#define HASH_TOMBSTONE ((void*)&_pndman_hash_tombstone)
+
+static char _pndman_hash_tombstone;
+
+/* \brief slot of hash table, key NULL when free */
+typedef struct _pndman_hash_slot
+{
+   void *key;
+   void *value;
+   uint32_t hash;
+   uint32_t len;
+} _pndman_hash_slot;
+
+/* \brief open addressing hash table with copied keys */
+struct _pndman_hash
+{
+   _pndman_hash_slot *slot;
+   size_t size; /* power of two */
+   size_t count, used; /* used includes tombstones */
+};
+
+/* \brief fnv-1a */
+uint32_t _pndman_hash_key(const void *key, size_t len)
+{
+   const unsigned char *p = key;
+   uint32_t h = 2166136261u;
+   while (len--) h = (h ^ *p++) * 16777619u;
+   return h;
+}
+
+/* \brief find slot of key, or free slot where it belongs */
+static _pndman_hash_slot* _pndman_hash_find(_pndman_hash *hash, const void *key, size_t len, uint32_t h)
+{
+   _pndman_hash_slot *s, *free_slot = NULL;
+   size_t i = h & (hash->size - 1);
+
+   for (;; i = (i + 1) & (hash->size - 1)) {
+      s = &hash->slot[i];
+      if (!s->key) return (free_slot ? free_slot : s);
+      if (s->key == HASH_TOMBSTONE) {
+         if (!free_slot) free_slot = s;
+         continue;
+      }
+      if (s->hash == h && s->len == len && !memcmp(s->key, key, len))
+         return s;
+   }
+}
+
+/* \brief resize table, tombstones are dropped */
+static int _pndman_hash_resize(_pndman_hash *hash, size_t size)
+{
+   _pndman_hash_slot *old = hash->slot, *s;
+   size_t i, old_size = hash->size;
+
+   if (!(hash->slot = calloc(size, sizeof(_pndman_hash_slot)))) {
+      hash->slot = old;
+      return RETURN_FAIL;
+   }
+   hash->size = size;
+   hash->used = hash->count;
+
+   for (i = 0; i != old_size; ++i) {
+      if (!old[i].key || old[i].key == HASH_TOMBSTONE) continue;
+      s = _pndman_hash_find(hash, old[i].key, old[i].len, old[i].hash);
+      *s = old[i];
+   }
+   free(old);
+   return RETURN_OK;
+}
+
+/* INTERNAL API */
+
+/* \brief create hash table */
+_pndman_hash* _pndman_hash_new(void)
+{
+   _pndman_hash *hash;
+
+   if (!(hash = calloc(1, sizeof(_pndman_hash))))
+      goto fail;
+   if (!(hash->slot = calloc(HASH_MIN_SIZE, sizeof(_pndman_hash_slot))))
+      goto fail;
+   hash->size = HASH_MIN_SIZE;
+   return hash;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "hash table");
+   IFDO(free, hash);
+   return NULL;
+}
+
+/* \brief free hash table, free_value is called for each value */
+void _pndman_hash_free(_pndman_hash *hash, void (*free_value)(void*))
+{
+   size_t i;
+   if (!hash) return;
+
+   for (i = 0; i != hash->size; ++i) {
+      if (!hash->slot[i].key || hash->slot[i].key == HASH_TOMBSTONE) continue;
+      if (free_value) free_value(hash->slot[i].value);
+      free(hash->slot[i].key);
+   }
+   free(hash->slot);
+   free(hash);
+}
+
+/* \brief get value of key, NULL if not found */
+void* _pndman_hash_get(_pndman_hash *hash, const void *key, size_t len)
+{
+   _pndman_hash_slot *s;
+   assert(hash && key);
+   s = _pndman_hash_find(hash, key, len, _pndman_hash_key(key, len));
+   return (s->key && s->key != HASH_TOMBSTONE ? s->value : NULL);
+}
+
+/* \brief set value of key, replacing old value */
+int _pndman_hash_set(_pndman_hash *hash, const void *key, size_t len, void *value)
+{
+   _pndman_hash_slot *s;
+   uint32_t h = _pndman_hash_key(key, len);
+   assert(hash && key);
+
+   s = _pndman_hash_find(hash, key, len, h);
+   if (s->key && s->key != HASH_TOMBSTONE) {
+      s->value = value;
+      return RETURN_OK;
+   }
+
+   /* keep load under 3/4 */
+   if (!s->key && (hash->used + 1) * 4 > hash->size * 3) {
+      if (_pndman_hash_resize(hash, (hash->count * 2 > hash->size ? hash->size * 2 : hash->size)) != RETURN_OK)
+         goto fail;
+      s = _pndman_hash_find(hash, key, len, h);
+   }
+
+   if (!s->key) ++hash->used;
+   if (!(s->key = malloc(len ? len : 1))) {
+      s->key = HASH_TOMBSTONE;
+      goto fail;
+   }
+   memcpy(s->key, key, len);
+   s->len   = len;
+   s->hash  = h;
+   s->value = value;
+   ++hash->count;
+   return RETURN_OK;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "hash slot");
+   return RETURN_FAIL;
+}
+
+/* \brief remove key, returns its value */
+void* _pndman_hash_remove(_pndman_hash *hash, const void *key, size_t len)
+{
+   _pndman_hash_slot *s;
+   void *value;
+   assert(hash && key);
+
+   s = _pndman_hash_find(hash, key, len, _pndman_hash_key(key, len));
+   if (!s->key || s->key == HASH_TOMBSTONE)
+      return NULL;
+
+   value = s->value;
+   free(s->key);
+   s->key   = HASH_TOMBSTONE;
+   s->value = NULL;
+   --hash->count;
+   return value;
+}
+
+/* \brief number of keys in table */
+size_t _pndman_hash_count(_pndman_hash *hash)
+{
+   assert(hash);
+   return hash->count;
+}
+
+/* \brief call func for every key and value */
+void _pndman_hash_foreach(_pndman_hash *hash, _pndman_hash_func func, void *user_data)
+{
+   size_t i;
+   assert(hash && func);
+   for (i = 0; i != hash->size; ++i)
+      if (hash->slot[i].key && hash->slot[i].key != HASH_TOMBSTONE)
+         func(hash->slot[i].key, hash->slot[i].len, hash->slot[i].value, user_data);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,114 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+static pthread_mutex_t _pndman_intern_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define INTERN_LOCK()   pthread_mutex_lock(&_pndman_intern_mutex)
+#  define INTERN_UNLOCK() pthread_mutex_unlock(&_pndman_intern_mutex)
+#else
+#  define INTERN_LOCK()
+#  define INTERN_UNLOCK()
+#endif
+
+/* \brief shared string, freed when last user releases it */
+typedef struct _pndman_intern_string
+{
+   size_t refs;
+   char str[];
+} _pndman_intern_string;
+
+/* \brief string -> _pndman_intern_string,
+ * crawl workers parse in parallel so table is locked */
+static _pndman_hash *_pndman_intern_table = NULL;
+
+/* INTERNAL API */
+
+/* \brief get shared copy of string, release with _pndman_intern_release */
+char* _pndman_intern(const char *str)
+{
+   _pndman_intern_string *s;
+   size_t len;
+
+   if (!str) return NULL;
+   len = strlen(str);
+
+   INTERN_LOCK();
+   if (!_pndman_intern_table && !(_pndman_intern_table = _pndman_hash_new()))
+      goto fail;
+
+   if (!(s = _pndman_hash_get(_pndman_intern_table, str, len))) {
+      if (!(s = malloc(sizeof(_pndman_intern_string) + len + 1)))
+         goto fail;
+      s->refs = 0;
+      memcpy(s->str, str, len + 1);
+      if (_pndman_hash_set(_pndman_intern_table, str, len, s) != RETURN_OK) {
+         free(s);
+         goto fail;
+      }
+   }
+   ++s->refs;
+   INTERN_UNLOCK();
+   return s->str;
+
+fail:
+   INTERN_UNLOCK();
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "interned string");
+   return NULL;
+}
+
+/* \brief release string from _pndman_intern,
+ * strings that were not interned are just freed */
+void _pndman_intern_release(char *str)
+{
+   _pndman_intern_string *s = NULL;
+   size_t len;
+
+   if (!str) return;
+   len = strlen(str);
+
+   INTERN_LOCK();
+   if (_pndman_intern_table)
+      s = _pndman_hash_get(_pndman_intern_table, str, len);
+   if (s && s->str == str) {
+      if (!--s->refs) {
+         _pndman_hash_remove(_pndman_intern_table, str, len);
+         free(s);
+      }
+      if (!_pndman_hash_count(_pndman_intern_table)) {
+         _pndman_hash_free(_pndman_intern_table, NULL);
+         _pndman_intern_table = NULL;
+      }
+      str = NULL;
+   }
+   INTERN_UNLOCK();
+   IFDO(free, str);
+}
+
+/* \brief replace string with interned copy of str */
+void _pndman_intern_set(char **dst, const char *str)
+{
+   char *old;
+   assert(dst);
+   old = *dst;
+   *dst = _pndman_intern(str);
+   _pndman_intern_release(old);
+}
+
+/* \brief interned copy of string without taking reference,
+ * only for comparing by pointer. NULL when nobody uses str */
+const char* _pndman_intern_find(const char *str)
+{
+   _pndman_intern_string *s = NULL;
+
+   if (!str) return NULL;
+   INTERN_LOCK();
+   if (_pndman_intern_table)
+      s = _pndman_hash_get(_pndman_intern_table, str, strlen(str));
+   INTERN_UNLOCK();
+   return (s ? s->str : NULL);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -27,16 +27,31 @@
 #define CHECKUSE(x)           if (!x) { BADUSE("%s is NULL", #x); return RETURN_FAIL; }
 #define CHECKUSEP(x)          if (!x) { BADUSE("%s is NULL", #x); return NULL; }
 #define CHECKUSEV(x)          if (!x) { BADUSE("%s is NULL", #x); return; }
-#define BADUSE(fmt,...)       _pndman_debug_hook(THIS_FILE, __LINE__, __func__, \
-                                       PNDMAN_LEVEL_WARN, DBG_WRN_BAD_USE""fmt, ##__VA_ARGS__)
-#define DEBUG(level,fmt,...)  _pndman_debug_hook(THIS_FILE, __LINE__, __func__, \
-                                       level, fmt, ##__VA_ARGS__)
-#define DEBFAIL(fmt,...)      _pndman_debug_hook(THIS_FILE, __LINE__, __func__, \
-                                       PNDMAN_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define BADUSE(fmt,...)       DEBUG(PNDMAN_LEVEL_WARN, DBG_WRN_BAD_USE""fmt, ##__VA_ARGS__)
+#define DEBUG(level,fmt,...)  do { if (DEBUG_ENABLED(level)) _pndman_debug_hook(THIS_FILE, __LINE__, __func__, \
+                                       level, fmt, ##__VA_ARGS__); } while (0)
+#define DEBFAIL(fmt,...)      DEBUG(PNDMAN_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+
+/* \brief check if message of level would be consumed,
+ * levels above PNDMAN_DEBUG_MAX_LEVEL are compiled out */
+#ifndef PNDMAN_DEBUG_MAX_LEVEL
+#  define PNDMAN_DEBUG_MAX_LEVEL PNDMAN_LEVEL_CRAP
+#endif
+#define DEBUG_ENABLED(level)  ((level) <= PNDMAN_DEBUG_MAX_LEVEL && (level) < _pndman_debug_threshold)
 
 /* etc.. */
 #define PNDMAN_CURL_CHUNK     1024
 #define PNDMAN_CURL_MAX_RETRY 3
+#define PNDMAN_CURL_MAX_CONNECTIONS      4
+#define PNDMAN_CURL_MAX_HOST_CONNECTIONS 2
+#define PNDMAN_CURL_SEGMENTS             1
+#define PNDMAN_CURL_SEGMENT_MIN_SIZE     (16 * 1024 * 1024)
+#define PNDMAN_CURL_SEGMENT_STATE        ".seg"
+#define PNDMAN_MOVE_NOREPLACE            0x1 /* _pndman_file_move flag */
+#define PNDMAN_MD5_CHUNK                 (32 * 1024)
+#define PNDMAN_MD5_READ_SIZE             (1024 * 1024)
+#define PNDMAN_MD5_ALIGN                 4096
+#define PNDMAN_MD5_LEN                   32
 
 /* strings */
 #define DATABASE_URL_COPY_FAIL   "Failed to copy url from repository."
@@ -52,6 +67,14 @@
 #define CURL_REQUEST_FAIL        "Failed to init curl request."
 #define CURL_NO_DATA_OR_CALLBACK "No data or callback in internal curl handle."
 #define CURL_NO_URL              "No url specified for curl handle"
+#define CURL_ADD_FAIL            "curl_multi_add_handle failed"
+#define CURL_SPACE_FAIL          "Not enough space for download."
+#define CURL_SEGMENT_FALLBACK    "Range requests not usable for %s, falling back to single stream."
+#define CURL_SEGMENT_INCOMPLETE  "Segmented download ended before all ranges were written."
+#define IO_THREAD_BUSY           "Transfers are running on context, IO thread not started."
+#define IO_THREAD_FAIL           "Failed to start IO thread."
+#define CACHE_CORRUPT            "Cached file doesn't match its MD5, removing: %s"
+#define CACHE_INSERT_FAIL        "Failed to insert %s to download cache."
 #define DEVICE_IS_NOT_DIR        "%s, is not a directory."
 #define DEVICE_ACCESS_FAIL       "%s, should have write and read permissions."
 #define DEVICE_ROOT_FAIL         "Could not get root device of %s absolute directory."
@@ -65,8 +88,22 @@
 #define HANDLE_PND_URL           "PND assigned to handle has invalid url."
 #define HANDLE_NO_DEV            "Handle has no device! (install)"
 #define HANDLE_NO_DEV_UP         "Handle has no device list! (update)"
+#define HANDLE_NO_SPACE          "Not enough space on %s for %s, %"PRIu64" bytes needed."
 #define HANDLE_NO_DST            "Handle has no destination, nor the PND has upgrade."
 #define HANDLE_WTF               "WTF. Something that should never happen, just happened!"
+#define TRANSACTION_BUSY         "Transaction has unfinished downloads."
+#define TRANSACTION_FAILED       "Transaction operation failed: %s"
+#define TRANSACTION_DUPLICATE    "%s, is already part of transaction."
+#define TRANSACTION_ROLLBACK     "Rolling back transaction, %s failed."
+#define WATCH_INIT_FAIL          "Failed to initialize inotify: %s"
+#define WATCH_ADD_FAIL           "Failed to watch %s: %s"
+#define WATCH_NOT_SUPPORTED      "Watching devices is not supported on this platform."
+#define WATCH_OVERFLOW           "Watch events were lost, rescanning devices."
+#define MONITOR_INIT_FAIL        "Failed to open mount table: %s"
+#define MONITOR_READ_FAIL        "Failed to read mount table: %s"
+#define MONITOR_NOT_SUPPORTED    "Monitoring mounts is not supported on this platform."
+#define UPGRADE_BUSY             "Upgrade has unfinished syncs or downloads."
+#define UPGRADE_INSTALL_FAIL     "Failed to install update."
 #define HANDLE_HEADER_FAIL       "Failed to parse filename from HTTP header."
 #define JSON_BAD_JSON            "JSON fail: \"%s\"\n\tWon't process sync for: %s"
 #define JSON_NO_P_ARRAY          "No packages array for: %s"
@@ -112,6 +149,63 @@ typedef struct pndman_curl_header
    size_t pos, size;
 } pndman_curl_header;
 
+/* \brief scheduling state of curl handle */
+typedef enum pndman_curl_state
+{
+   PNDMAN_CURL_IDLE,
+   PNDMAN_CURL_QUEUED,
+   PNDMAN_CURL_ACTIVE,
+   PNDMAN_CURL_LOCAL  /* completed from disk */
+} pndman_curl_state;
+
+/* \brief byte range of segmented download */
+typedef struct pndman_curl_segment
+{
+   void *curl;
+   uint64_t start, end; /* inclusive range */
+   uint64_t pos;        /* bytes written from start */
+   int retry;
+   char state;
+   struct pndman_curl_handle *handle;
+} pndman_curl_segment;
+
+/* \brief node of intrusive lock-free MPSC queue */
+typedef struct _pndman_queue_node
+{
+   struct _pndman_queue_node *next;
+} _pndman_queue_node;
+
+/* \brief intrusive lock-free MPSC queue,
+ * any thread may push, only one may pop */
+typedef struct _pndman_queue
+{
+   _pndman_queue_node *head, *tail;
+   _pndman_queue_node stub;
+} _pndman_queue;
+
+/* \brief message passed between IO thread and dispatching thread */
+typedef enum _pndman_io_type
+{
+   /* commands, to IO thread */
+   PNDMAN_IO_PERFORM,
+   PNDMAN_IO_FREE,
+   PNDMAN_IO_STOP,
+
+   /* events, to dispatching thread */
+   PNDMAN_IO_DONE,
+   PNDMAN_IO_FAIL,
+   PNDMAN_IO_PROGRESS,
+   PNDMAN_IO_RELEASE
+} _pndman_io_type;
+
+typedef struct _pndman_io_msg
+{
+   _pndman_queue_node node; /* must be first */
+   _pndman_io_type type;
+   struct pndman_curl_handle *handle;
+   char *info;
+} _pndman_io_msg;
+
 /* \brief internal curl handle */
 typedef struct pndman_curl_handle
 {
@@ -128,9 +222,57 @@ typedef struct pndman_curl_handle
    char *url;
    char *post;
    char *path;
+   char *host;
+   char *repository; /* url of repository, for metrics */
+   uint64_t size; /* expected size, used for scheduling */
+   char *space;       /* mount download is written to, NULL for no admission */
+   uint64_t reserve;  /* bytes download still needs on space */
+   uint64_t reserved; /* bytes reserved on space while active */
+   int priority;  /* higher gets scheduled first */
+   pndman_context *context; /* context handle is scheduled on */
+   struct pndman_curl_handle *next; /* scheduler list */
+   pndman_curl_segment *segment;    /* segmented download */
+   int segments;
+   void *md5_ctx;    /* md5 of downloaded file, calculated while downloading */
+   uint64_t md5_pos; /* bytes of file hashed so far */
+   char *md5;        /* result, set when download is done */
+   char *cache;      /* md5 of cached download to try first, NULL for none */
+   uint64_t metric_start;   /* start of first transfer of download, 0 for none */
+   uint64_t metric_bytes;   /* summed over retries and segments */
+   uint64_t metric_connect;
+   char fallback; /* ranges not usable, use single stream */
+   char preallocated; /* blocks of whole file reserved */
+   char state;
+   char busy;     /* inside callback, don't free yet */
    char free;
+
+   /* IO thread, progress is the transfer's own copy there,
+    * published to user_progress through coalesced progress_msg */
+   pndman_curl_progress *user_progress;
+   pndman_curl_progress io_progress;
+   double shared_download, shared_total;
+   int progress_pending;
+   _pndman_io_msg progress_msg;
+   char detached; /* freed by owner, events are dropped */
 } pndman_curl_handle;
 
+/* \brief library context,
+ * owns the multi handle, scheduler lists and transfer settings */
+struct pndman_context
+{
+   void *curlm;
+   pndman_curl_handle *queue;  /* kept in priority order */
+   pndman_curl_handle *active;
+   pndman_curl_handle *local;  /* completed from disk, delivered on next process */
+   int curl_timeout;
+   int max_connections;
+   int max_host_connections;
+   uint64_t max_speed;
+   int segments;
+   uint64_t segment_min_size;
+   struct _pndman_io *io; /* IO thread, NULL when processed by caller */
+};
+
 /* \brief client api return error code */
 typedef enum pndman_api_code {
    API_SUCCESS,
@@ -145,26 +287,109 @@ typedef struct pndman_api_status {
    char *text;
 } pndman_api_status;
 
+/* \brief where files of install handle go,
+ * see _pndman_package_handle_plan */
+typedef struct _pndman_install_plan {
+   char *relative; /* install path relative to mount */
+   char *install;  /* full install path */
+   char *old;      /* full path of replaced pnd, NULL if it stays */
+   char *backup;   /* where old is backed up, NULL if it's removed */
+   char *filename; /* name download was served with, cached by that */
+} _pndman_install_plan;
+
 /* internal string utils */
 void  _strip_slash(char *path);
 char* _strupstr(const char *hay, const char *needle);
 int   _strupcmp(const char *hay, const char *needle);
+int   _strupord(const char *a, const char *b);
 int   _strnupcmp(const char *hay, const char *needle, size_t len);
 
+/* string interning */
+char* _pndman_intern(const char *str);
+void  _pndman_intern_release(char *str);
+void  _pndman_intern_set(char **dst, const char *str);
+const char* _pndman_intern_find(const char *str);
+
+/* flat id lookup tables of package lists */
+typedef struct _pndman_scan _pndman_scan;
+uint32_t _pndman_scan_hash(const char *id);
+_pndman_scan* _pndman_scan_new(pndman_package *list);
+void _pndman_scan_free(_pndman_scan *scan);
+int  _pndman_scan_add(_pndman_scan *scan, pndman_package *pnd);
+pndman_package* _pndman_scan_last(_pndman_scan *scan);
+pndman_package* _pndman_scan_find(_pndman_scan *scan, const char *id, uint32_t hash, size_t *i);
+
+/* shared lists */
+void* _pndman_share(void *list);
+int   _pndman_share_release(void *list);
+int   _pndman_shared(void *list);
+
+/* preferred locale */
+unsigned int _pndman_locale_serial_get(void);
+void _pndman_locale_resolve(pndman_package *pnd);
+
+/* lazy loading */
+typedef struct _pndman_lazy_map _pndman_lazy_map;
+_pndman_lazy_map* _pndman_lazy_map_new(void *file);
+const char* _pndman_lazy_map_data(_pndman_lazy_map *map, size_t *size);
+void _pndman_lazy_map_release(_pndman_lazy_map *map);
+int  _pndman_lazy_set(pndman_package *pnd, _pndman_lazy_map *map, size_t offset, size_t size);
+void _pndman_lazy_forget(pndman_package *pnd);
+void _pndman_lazy_copy(pndman_package *pnd, pndman_package *src);
+int  _pndman_lazy_load(pndman_package *pnd);
+int  _pndman_lazy_decode(pndman_package *pnd, pndman_package **heavy);
+void _pndman_lazy_unload(pndman_package *pnd);
+
 /* temporary files */
 void* _pndman_get_tmp_file();
 
 /* verbose */
+extern int _pndman_debug_threshold;
 void _pndman_debug_hook(const char *file, int line, const char *function, int verbose_level, const char *fmt, ...);
 
+/* context */
+pndman_context* _pndman_context(pndman_context *context);
+int _pndman_curl_global_init(void);
+
+/* lock-free queue */
+void _pndman_queue_init(_pndman_queue *queue);
+void _pndman_queue_push(_pndman_queue *queue, _pndman_queue_node *node);
+_pndman_queue_node* _pndman_queue_pop(_pndman_queue *queue);
+
+/* IO thread */
+int  _pndman_io_offload(pndman_context *context);
+int  _pndman_io_command(pndman_context *context, _pndman_io_type type, pndman_curl_handle *handle, const char *info);
+void _pndman_io_event(pndman_context *context, _pndman_io_type type, pndman_curl_handle *handle, const char *info);
+void _pndman_io_progress(pndman_curl_handle *handle);
+int  _pndman_io_wake_fd(pndman_context *context);
+int  _pndman_io_process(pndman_context *context, unsigned long tv_sec, unsigned long tv_usec);
+void _pndman_io_stop(pndman_context *context);
+
 /* curl */
-pndman_curl_handle* _pndman_curl_handle_new(void *data, pndman_curl_progress *progress, pndman_curl_callback callback, const char *path);
+void _pndman_curl_context_cleanup(pndman_context *context);
+int  _pndman_curl_context_perform(pndman_context *context, unsigned long tv_sec, unsigned long tv_usec);
+int  _pndman_curl_handle_perform_real(pndman_curl_handle *handle);
+void _pndman_curl_handle_detach(pndman_curl_handle *handle);
+void _pndman_curl_unschedule(pndman_curl_handle *handle);
+void _pndman_curl_handle_release(pndman_curl_handle *handle);
+pndman_curl_handle* _pndman_curl_handle_new(pndman_context *context, void *data, pndman_curl_progress *progress, pndman_curl_callback callback, const char *path);
 void _pndman_curl_handle_free(pndman_curl_handle *handle);
 void _pndman_curl_handle_reset(pndman_curl_handle *handle);
 int  _pndman_curl_handle_perform(pndman_curl_handle *handle);
 void _pndman_curl_handle_set_post(pndman_curl_handle *handle, const char *post);
 void _pndman_curl_handle_set_url(pndman_curl_handle *handle, const char *url);
 
+/* metrics */
+uint64_t _pndman_metrics_now(void);
+void _pndman_metrics_add(pndman_metric metric, uint64_t value);
+void _pndman_metrics_time(pndman_metric metric, const char *name, const char *detail, uint64_t start);
+void _pndman_metrics_span(const char *name, const char *detail, uint64_t start, uint64_t duration);
+void _pndman_metrics_bytes(const char *repository, uint64_t bytes);
+
+/* download cache */
+int  _pndman_cache_fetch(const char *md5, const char *path, char **filename);
+void _pndman_cache_insert(const char *md5, const char *path, const char *filename);
+
 /* json */
 int _pndman_json_api_value(const char *key, char *value, size_t size, const char *buffer);
 int _pndman_json_api_status(const char *buffer, pndman_api_status *status);
@@ -176,16 +401,46 @@ int _pndman_json_get_int_value(const char *key, int *value, void *file);
 int _pndman_json_comment_pull(void *user_data, pndman_api_comment_callback callback, pndman_package *pnd, void *file);
 int _pndman_json_download_history(void *user_data, pndman_api_history_callback callback, void *file);
 int _pndman_json_archived_pnd(pndman_package *pnd, void *file);
+int _pndman_json_lazy_apply(pndman_package *pnd, const char *data, size_t size);
+pndman_package* _pndman_json_lazy_decode(const char *data, size_t size);
 
 /* md5 functions (remember free result) */
 char* _pndman_md5_buf(char *buffer, size_t size);
 char* _pndman_md5(const char *file);
+void* _pndman_md5_new(void);
+void  _pndman_md5_update(void *ctx, const void *data, size_t size);
+char* _pndman_md5_final(void *ctx);
+typedef void (*_pndman_md5_batch_callback)(size_t index, size_t done, size_t total, const char *md5, void *user_data);
+int _pndman_md5_batch(const char **paths, char **results, size_t count, unsigned int threads, _pndman_md5_batch_callback callback, void *user_data);
+
+/* hash table */
+typedef struct _pndman_hash _pndman_hash;
+typedef void (*_pndman_hash_func)(const void *key, size_t len, void *value, void *user_data);
+_pndman_hash* _pndman_hash_new(void);
+void   _pndman_hash_free(_pndman_hash *hash, void (*free_value)(void*));
+void*  _pndman_hash_get(_pndman_hash *hash, const void *key, size_t len);
+int    _pndman_hash_set(_pndman_hash *hash, const void *key, size_t len, void *value);
+void*  _pndman_hash_remove(_pndman_hash *hash, const void *key, size_t len);
+size_t _pndman_hash_count(_pndman_hash *hash);
+uint32_t _pndman_hash_key(const void *key, size_t len);
+void   _pndman_hash_foreach(_pndman_hash *hash, _pndman_hash_func func, void *user_data);
+
+/* files */
+int _pndman_file_copy(const char *src, const char *dst);
+int _pndman_file_move(const char *src, const char *dst, unsigned int flags);
+int _pndman_file_exchange(const char *a, const char *b);
 
 /* devices */
 pndman_device* _pndman_device_first(pndman_device *device);
 pndman_device* _pndman_device_last(pndman_device *device);
 char* _pndman_device_get_appdata(pndman_device *device);
 char* _pndman_device_get_appdata_no_create(pndman_device *device);
+void  _pndman_device_update(pndman_device *device);
+int   _pndman_device_reserve(const char *mount, uint64_t size, uint64_t *pending);
+void  _pndman_device_release(const char *mount, uint64_t size);
+pndman_device* _pndman_device_add_mount(const char *fsname, const char *dir, pndman_device **device);
+typedef void (*_pndman_device_job)(pndman_device *device, size_t index, void *user_data);
+int   _pndman_device_foreach(pndman_device *device, _pndman_device_job job, void *user_data);
 
 /* repositories */
 pndman_repository* _pndman_repository_first(pndman_repository *repo);
@@ -193,8 +448,21 @@ pndman_repository* _pndman_repository_last(pndman_repository *repo);
 pndman_repository* _pndman_repository_get(const char *url, pndman_repository *list);
 pndman_package* _pndman_repository_new_pnd(pndman_repository *repo);
 pndman_package* _pndman_repository_new_pnd_check(pndman_package *in_pnd, const char *path, const char *mount, pndman_repository *repo);
+pndman_package* _pndman_repository_new_pnd_scan(pndman_package *in_pnd, _pndman_scan *scan, pndman_repository *repo);
 int _pndman_repository_free_pnd(pndman_package *pnd, pndman_repository *repo);
 
+/* database */
+int _pndman_db_commit(pndman_repository *repo, pndman_device *device);
+int _pndman_db_commit_devices(pndman_repository *repo, pndman_device *device);
+int _pndman_version_check(pndman_package *lp, pndman_package *rp);
+
+/* package handle commit steps */
+int  _pndman_package_handle_verify(pndman_package_handle *handle);
+int  _pndman_package_handle_plan(pndman_package_handle *handle, pndman_repository *local, _pndman_install_plan *plan);
+int  _pndman_package_handle_apply(pndman_package_handle *handle, pndman_repository *local, _pndman_install_plan *plan);
+int  _pndman_package_handle_forget(pndman_package_handle *handle, pndman_repository *local);
+void _pndman_install_plan_free(_pndman_install_plan *plan);
+
 /* internal callback access */
 void _pndman_package_handle_done(pndman_curl_code code, void *data, const char *info, pndman_curl_handle *chandle);
 
@@ -202,7 +470,19 @@ void _pndman_package_handle_done(pndman_curl_code code, void *data, const char *
 int _pndman_api_commercial_download(pndman_curl_handle *handle, pndman_package_handle *package);
 
 /* pndman_package  */
+typedef enum _pndman_package_event
+{
+   PNDMAN_PACKAGE_CHANGED, /* added to repository or its data was replaced */
+   PNDMAN_PACKAGE_FREED,
+} _pndman_package_event;
+typedef void (*_pndman_package_observer)(_pndman_package_event event, pndman_package *pnd, void *user_data);
+int  _pndman_package_observe(_pndman_package_observer func, void *user_data);
+void _pndman_package_unobserve(_pndman_package_observer func, void *user_data);
+void _pndman_package_observe_lock(void);
+void _pndman_package_observe_unlock(void);
+void _pndman_package_notify(_pndman_package_event event, pndman_package *pnd);
 pndman_package* _pndman_new_pnd(void);
+pndman_package* _pndman_crawl_file(int full, pndman_device *device, const char *relative, pndman_repository *local);
 int  _pndman_vercmp(pndman_version *lp, pndman_version *rp);
 char* _pndman_pnd_get_path(pndman_package *pnd);
 void _pndman_copy_version(pndman_version *dst, pndman_version *src);
@@ -213,6 +493,12 @@ void _pndman_package_free_previewpics(pndman_package *pnd);
 void _pndman_package_free_licenses(pndman_package *pnd);
 void _pndman_package_free_categories(pndman_package *pnd);
 void _pndman_package_free_applications(pndman_package *pnd);
+void _pndman_package_own_titles(pndman_package *pnd);
+void _pndman_package_own_descriptions(pndman_package *pnd);
+void _pndman_package_own_previewpics(pndman_package *pnd);
+void _pndman_package_own_licenses(pndman_package *pnd);
+void _pndman_package_own_categories(pndman_package *pnd);
+void _pndman_package_own_applications(pndman_package *pnd);
 pndman_translated*   _pndman_package_new_title(pndman_package *pnd);
 pndman_translated*   _pndman_package_new_description(pndman_package *pnd);
 pndman_license*      _pndman_package_new_license(pndman_package *pnd);
@@ -0,0 +1,494 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(HAVE_PTHREAD) && !defined(_WIN32)
+#  define PNDMAN_IO_THREAD
+#  include <pthread.h>
+#  include <unistd.h>
+#  include <fcntl.h>
+#  include <poll.h>
+#  ifdef __linux__
+#     include <sys/eventfd.h>
+#  endif
+#endif
+
+/* INTERNAL API */
+
+/* \brief init lock-free queue */
+void _pndman_queue_init(_pndman_queue *queue)
+{
+   assert(queue);
+   queue->stub.next = NULL;
+   queue->head = queue->tail = &queue->stub;
+}
+
+/* \brief push node to queue, safe from any thread */
+void _pndman_queue_push(_pndman_queue *queue, _pndman_queue_node *node)
+{
+   _pndman_queue_node *prev;
+   assert(queue && node);
+   __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+   prev = __atomic_exchange_n(&queue->head, node, __ATOMIC_ACQ_REL);
+   __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+/* \brief pop node from queue, only from the consuming thread.
+ * returns NULL when empty, or when producer is halfway through push */
+_pndman_queue_node* _pndman_queue_pop(_pndman_queue *queue)
+{
+   _pndman_queue_node *tail, *next, *head;
+   assert(queue);
+
+   tail = queue->tail;
+   next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+   if (tail == &queue->stub) {
+      if (!next) return NULL;
+      queue->tail = tail = next;
+      next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+   }
+
+   if (next) {
+      queue->tail = next;
+      return tail;
+   }
+
+   head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+   if (tail != head) return NULL;
+
+   /* last node, put stub behind it so it can be taken */
+   _pndman_queue_push(queue, &queue->stub);
+   if ((next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE))) {
+      queue->tail = next;
+      return tail;
+   }
+   return NULL;
+}
+
+#ifdef PNDMAN_IO_THREAD
+
+/* \brief IO thread of context */
+typedef struct _pndman_io
+{
+   pthread_t thread;
+   _pndman_queue commands; /* popped by IO thread */
+   _pndman_queue events;   /* popped by dispatching thread */
+   int event_fd[2];        /* readable when events are pending */
+   int wake_fd[2];         /* wakes IO thread for commands */
+   int pending;            /* transfers running on IO thread */
+   int submitted;          /* commands not yet processed */
+} _pndman_io;
+
+/* \brief create notification fd, fd[0] for polling and fd[1] for signaling.
+ * eventfd when available, pipe otherwise */
+static int _pndman_io_fd_open(int fd[2])
+{
+#ifdef __linux__
+   if ((fd[0] = fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) != -1)
+      return RETURN_OK;
+#endif
+   if (pipe(fd) != 0)
+      return RETURN_FAIL;
+   fcntl(fd[0], F_SETFL, O_NONBLOCK);
+   fcntl(fd[1], F_SETFL, O_NONBLOCK);
+   fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+   fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+   return RETURN_OK;
+}
+
+static void _pndman_io_fd_close(int fd[2])
+{
+   if (fd[0] != -1) close(fd[0]);
+   if (fd[1] != -1 && fd[1] != fd[0]) close(fd[1]);
+   fd[0] = fd[1] = -1;
+}
+
+static void _pndman_io_fd_signal(int fd[2])
+{
+   uint64_t one = 1;
+   if (fd[0] == fd[1]) {
+      if (write(fd[1], &one, sizeof(one))) {}
+   } else {
+      if (write(fd[1], &one, 1)) {}
+   }
+}
+
+static void _pndman_io_fd_drain(int fd[2])
+{
+   char buffer[64];
+   while (read(fd[0], buffer, sizeof(buffer)) > 0);
+}
+
+/* \brief wait until fd is readable, timeout in ms (-1 forever) */
+static int _pndman_io_fd_wait(int fd[2], int timeout)
+{
+   struct pollfd pfd;
+   pfd.fd = fd[0];
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+   return (poll(&pfd, 1, timeout) > 0);
+}
+
+/* \brief new message */
+static _pndman_io_msg* _pndman_io_msg_new(_pndman_io_type type,
+      pndman_curl_handle *handle, const char *info)
+{
+   _pndman_io_msg *msg;
+   if (!(msg = calloc(1, sizeof(_pndman_io_msg))))
+      return NULL;
+   msg->type   = type;
+   msg->handle = handle;
+   if (info) msg->info = strdup(info);
+   return msg;
+}
+
+static void _pndman_io_msg_free(_pndman_io_msg *msg)
+{
+   IFDO(free, msg->info);
+   free(msg);
+}
+
+/* \brief run command, on IO thread */
+static void _pndman_io_execute(pndman_context *context, _pndman_io_msg *msg)
+{
+   pndman_curl_handle *handle = msg->handle;
+
+   switch (msg->type) {
+      case PNDMAN_IO_PERFORM:
+         if (_pndman_curl_handle_perform_real(handle) != RETURN_OK)
+            _pndman_io_event(context, PNDMAN_IO_FAIL, handle, CURL_REQUEST_FAIL);
+         break;
+      case PNDMAN_IO_FREE:
+         /* events before this may still point to handle,
+          * so memory is released by dispatching thread after them */
+         _pndman_curl_handle_detach(handle);
+         _pndman_curl_unschedule(handle);
+         _pndman_io_event(context, PNDMAN_IO_RELEASE, handle, NULL);
+         break;
+      default:
+         break;
+   }
+}
+
+/* \brief IO thread, owns the transfers of context */
+static void* _pndman_io_thread(void *arg)
+{
+   pndman_context *context = arg;
+   _pndman_io *io = context->io;
+   _pndman_io_msg *msg;
+   int handled, running = 0, stop = 0;
+
+   while (!stop) {
+      /* nothing to transfer, sleep until there is */
+      if (!running) _pndman_io_fd_wait(io->wake_fd, -1);
+      _pndman_io_fd_drain(io->wake_fd);
+
+      for (handled = 0; (msg = (_pndman_io_msg*)_pndman_queue_pop(&io->commands)); ++handled) {
+         if (msg->type == PNDMAN_IO_STOP) stop = 1;
+         else _pndman_io_execute(context, msg);
+         _pndman_io_msg_free(msg);
+      }
+
+      running = 0;
+      if (!stop && context->curlm &&
+          (running = _pndman_curl_context_perform(context, 1, 0)) == -1) {
+         _pndman_curl_context_cleanup(context);
+         running = 0;
+      }
+
+      /* publish before commands are marked done,
+       * so dispatcher never sees both as zero in between */
+      __atomic_store_n(&io->pending, running, __ATOMIC_RELEASE);
+      __atomic_sub_fetch(&io->submitted, handled, __ATOMIC_ACQ_REL);
+   }
+
+   return NULL;
+}
+
+/* \brief handle event, on dispatching thread */
+static void _pndman_io_dispatch_msg(_pndman_io_msg *msg)
+{
+   pndman_curl_handle *handle = msg->handle;
+   pndman_curl_progress *progress;
+
+   if (msg->type == PNDMAN_IO_RELEASE) {
+      _pndman_curl_handle_release(handle);
+      return;
+   }
+
+   if (msg->type == PNDMAN_IO_PROGRESS) {
+      /* cleared first, so newer progress gets new event */
+      __atomic_store_n(&handle->progress_pending, 0, __ATOMIC_SEQ_CST);
+      if (handle->detached || !(progress = handle->user_progress) || !handle->callback)
+         return;
+      __atomic_load(&handle->shared_download, &progress->download, __ATOMIC_RELAXED);
+      __atomic_load(&handle->shared_total, &progress->total_to_download, __ATOMIC_RELAXED);
+      handle->callback(PNDMAN_CURL_PROGRESS, handle->data, NULL, handle);
+      return;
+   }
+
+   /* DONE or FAIL, IO thread is done with handle */
+   if (handle->detached || !handle->callback)
+      return;
+   if ((progress = handle->user_progress)) {
+      memcpy(progress, &handle->io_progress, sizeof(pndman_curl_progress));
+      progress->done = 1;
+   }
+   handle->callback((msg->type == PNDMAN_IO_DONE ? PNDMAN_CURL_DONE : PNDMAN_CURL_FAIL),
+         handle->data, msg->info, handle);
+}
+
+/* \brief dispatch pending events, returns number of events */
+static int _pndman_io_dispatch(_pndman_io *io)
+{
+   int dispatched = 0;
+   _pndman_io_msg *msg;
+
+   _pndman_io_fd_drain(io->event_fd);
+   while ((msg = (_pndman_io_msg*)_pndman_queue_pop(&io->events))) {
+      /* progress message lives inside handle */
+      int embedded = (msg->type == PNDMAN_IO_PROGRESS);
+      _pndman_io_dispatch_msg(msg);
+      if (!embedded) _pndman_io_msg_free(msg);
+      ++dispatched;
+   }
+
+   return dispatched;
+}
+
+#endif /* PNDMAN_IO_THREAD */
+
+/* \brief should handle operation go through IO thread */
+int _pndman_io_offload(pndman_context *context)
+{
+   return (context && context->io);
+}
+
+/* \brief post command to IO thread */
+int _pndman_io_command(pndman_context *context, _pndman_io_type type,
+      pndman_curl_handle *handle, const char *info)
+{
+#ifdef PNDMAN_IO_THREAD
+   _pndman_io_msg *msg;
+   _pndman_io *io = context->io;
+   assert(io);
+
+   if (!(msg = _pndman_io_msg_new(type, handle, info)))
+      goto fail;
+
+   __atomic_add_fetch(&io->submitted, 1, __ATOMIC_ACQ_REL);
+   _pndman_queue_push(&io->commands, &msg->node);
+   _pndman_io_fd_signal(io->wake_fd);
+   return RETURN_OK;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "_pndman_io_msg");
+   return RETURN_FAIL;
+#else
+   (void)context; (void)type; (void)handle; (void)info;
+   return RETURN_FAIL;
+#endif
+}
+
+/* \brief post event to dispatching thread */
+void _pndman_io_event(pndman_context *context, _pndman_io_type type,
+      pndman_curl_handle *handle, const char *info)
+{
+#ifdef PNDMAN_IO_THREAD
+   _pndman_io_msg *msg;
+   _pndman_io *io = context->io;
+   assert(io);
+
+   if (!(msg = _pndman_io_msg_new(type, handle, info))) {
+      DEBFAIL(PNDMAN_ALLOC_FAIL, "_pndman_io_msg");
+      return;
+   }
+
+   _pndman_queue_push(&io->events, &msg->node);
+   _pndman_io_fd_signal(io->event_fd);
+#else
+   (void)context; (void)type; (void)handle; (void)info;
+#endif
+}
+
+/* \brief publish progress of handle,
+ * at most one progress event per handle is pending */
+void _pndman_io_progress(pndman_curl_handle *handle)
+{
+#ifdef PNDMAN_IO_THREAD
+   _pndman_io *io = handle->context->io;
+   assert(io);
+
+   __atomic_store(&handle->shared_download, &handle->io_progress.download, __ATOMIC_RELAXED);
+   __atomic_store(&handle->shared_total, &handle->io_progress.total_to_download, __ATOMIC_RELAXED);
+   if (__atomic_exchange_n(&handle->progress_pending, 1, __ATOMIC_SEQ_CST))
+      return;
+
+   handle->progress_msg.type   = PNDMAN_IO_PROGRESS;
+   handle->progress_msg.handle = handle;
+   handle->progress_msg.info   = NULL;
+   _pndman_queue_push(&io->events, &handle->progress_msg.node);
+   _pndman_io_fd_signal(io->event_fd);
+#else
+   (void)handle;
+#endif
+}
+
+/* \brief fd that wakes IO thread, -1 if not on IO thread */
+int _pndman_io_wake_fd(pndman_context *context)
+{
+#ifdef PNDMAN_IO_THREAD
+   return (context->io ? context->io->wake_fd[0] : -1);
+#else
+   (void)context;
+   return -1;
+#endif
+}
+
+/* \brief pndman_curl_process for context with IO thread,
+ * waits for events and dispatches them */
+int _pndman_io_process(pndman_context *context, unsigned long tv_sec, unsigned long tv_usec)
+{
+#ifdef PNDMAN_IO_THREAD
+   int dispatched, submitted, pending;
+   _pndman_io *io = context->io;
+   assert(io);
+
+   _pndman_io_fd_wait(io->event_fd, tv_sec * 1000 + tv_usec / 1000);
+   dispatched = _pndman_io_dispatch(io);
+
+   /* reverse order of IO thread's stores */
+   submitted = __atomic_load_n(&io->submitted, __ATOMIC_ACQUIRE);
+   pending   = __atomic_load_n(&io->pending, __ATOMIC_ACQUIRE);
+   return submitted + pending + dispatched + _pndman_io_fd_wait(io->event_fd, 0);
+#else
+   (void)context; (void)tv_sec; (void)tv_usec;
+   return RETURN_FAIL;
+#endif
+}
+
+/* \brief stop IO thread of context,
+ * transfers left continue on pndman_curl_process */
+void _pndman_io_stop(pndman_context *context)
+{
+#ifdef PNDMAN_IO_THREAD
+   _pndman_io *io = context->io;
+   _pndman_io_msg *msg;
+   pndman_curl_handle *h, *lists[3];
+   int i, left;
+   if (!io) return;
+
+   _pndman_io_command(context, PNDMAN_IO_STOP, NULL, NULL);
+   pthread_join(io->thread, NULL);
+
+   /* we own the transfers now, run what was left in queues */
+   do {
+      left = 0;
+      while ((msg = (_pndman_io_msg*)_pndman_queue_pop(&io->commands))) {
+         if (msg->type != PNDMAN_IO_STOP) _pndman_io_execute(context, msg);
+         _pndman_io_msg_free(msg);
+         ++left;
+      }
+      left += _pndman_io_dispatch(io);
+   } while (left);
+
+   /* progress goes straight to owner again */
+   lists[0] = context->queue; lists[1] = context->active; lists[2] = context->local;
+   for (i = 0; i != 3; ++i)
+      for (h = lists[i]; h; h = h->next) h->progress = h->user_progress;
+
+   _pndman_io_fd_close(io->event_fd);
+   _pndman_io_fd_close(io->wake_fd);
+   context->io = NULL;
+   free(io);
+#else
+   (void)context;
+#endif
+}
+
+/* PUBLIC API */
+
+/* \brief run transfers of context on its own thread */
+PNDMANAPI int pndman_context_start_thread(pndman_context *context)
+{
+#ifdef PNDMAN_IO_THREAD
+   _pndman_io *io;
+   context = _pndman_context(context);
+
+   if (context->io)
+      return RETURN_OK;
+
+   /* transfers must not be running while ownership changes */
+   if (context->queue || context->active || context->local)
+      goto busy_fail;
+
+   if (!(io = calloc(1, sizeof(_pndman_io))))
+      goto alloc_fail;
+
+   io->event_fd[0] = io->event_fd[1] = io->wake_fd[0] = io->wake_fd[1] = -1;
+   _pndman_queue_init(&io->commands);
+   _pndman_queue_init(&io->events);
+   if (_pndman_io_fd_open(io->event_fd) != RETURN_OK ||
+       _pndman_io_fd_open(io->wake_fd) != RETURN_OK)
+      goto fd_fail;
+
+   context->io = io;
+   if (pthread_create(&io->thread, NULL, _pndman_io_thread, context) != 0) {
+      context->io = NULL;
+      goto fd_fail;
+   }
+
+   return RETURN_OK;
+
+busy_fail:
+   DEBFAIL(IO_THREAD_BUSY);
+   return RETURN_FAIL;
+alloc_fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "_pndman_io");
+   return RETURN_FAIL;
+fd_fail:
+   DEBFAIL(IO_THREAD_FAIL);
+   _pndman_io_fd_close(io->event_fd);
+   _pndman_io_fd_close(io->wake_fd);
+   free(io);
+   return RETURN_FAIL;
+#else
+   (void)context;
+   DEBFAIL(IO_THREAD_FAIL);
+   return RETURN_FAIL;
+#endif
+}
+
+/* \brief stop thread of context */
+PNDMANAPI void pndman_context_stop_thread(pndman_context *context)
+{
+   _pndman_io_stop(_pndman_context(context));
+}
+
+/* \brief fd to poll for events of context with thread */
+PNDMANAPI int pndman_context_get_fd(pndman_context *context)
+{
+#ifdef PNDMAN_IO_THREAD
+   context = _pndman_context(context);
+   return (context->io ? context->io->event_fd[0] : -1);
+#else
+   (void)context;
+   return -1;
+#endif
+}
+
+/* \brief call callbacks of pending events */
+PNDMANAPI int pndman_context_dispatch(pndman_context *context)
+{
+#ifdef PNDMAN_IO_THREAD
+   context = _pndman_context(context);
+   if (!context->io) return 0;
+   return _pndman_io_dispatch(context->io);
+#else
+   (void)context;
+   return 0;
+#endif
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -17,6 +17,16 @@ static int _json_set_string(char **string, json_t *object)
    return RETURN_OK;
 }
 
+/* \brief helper setter for strings shared by many packages */
+static int _json_set_interned(char **string, json_t *object)
+{
+   if (!object) return RETURN_FAIL;
+   const char *value = json_string_value(object);
+   if (!value || !strlen(value)) return RETURN_FAIL;
+   _pndman_intern_set(string, value);
+   return (*string ? RETURN_OK : RETURN_FAIL);
+}
+
 /* \brief helper int setter */
 #define  _json_set_number(i, object, type) \
          if (object) *i = (type)json_number_value(object);
@@ -47,7 +57,7 @@ static int _json_set_version(pndman_version *ver, json_t *object)
 static int _json_set_author(pndman_author *author, json_t *object)
 {
    if (!object) return RETURN_FAIL;
-   _json_set_string(&author->name,      json_object_get(object,"name"));
+   _json_set_interned(&author->name,    json_object_get(object,"name"));
    _json_set_string(&author->website,   json_object_get(object,"website"));
    _json_set_string(&author->email,     json_object_get(object,"email"));
    return RETURN_OK;
@@ -94,7 +104,7 @@ static int _json_set_licenses(pndman_package *pnd, json_t *object)
 
       /* check fail */
       char *name = NULL;
-      if (_json_set_string(&name, element) != RETURN_OK)
+      if (_json_set_interned(&name, element) != RETURN_OK)
          continue;
 
       /* copy */
@@ -150,7 +160,7 @@ static int _json_set_categories(pndman_package *pnd, json_t *object)
 
       /* check fail */
       char *cat = NULL;
-      if (_json_set_string(&cat, element) != RETURN_OK)
+      if (_json_set_interned(&cat, element) != RETURN_OK)
          continue;
 
       /* copy either main or sub */
@@ -167,8 +177,9 @@ static int _json_set_categories(pndman_package *pnd, json_t *object)
    return RETURN_OK;
 }
 
-/* \brief helper localization setter */
-static int _json_set_localization(pndman_package *pnd, json_t *object)
+/* \brief helper localization setter,
+ * lazy sets only titles */
+static int _json_set_localization(pndman_package *pnd, json_t *object, int lazy)
 {
    const char *key;
    json_t *element;
@@ -189,13 +200,13 @@ static int _json_set_localization(pndman_package *pnd, json_t *object)
 
       /* add title */
       if ((t = _pndman_package_new_title(pnd))) {
-         if (key) t->lang = strdup(key);
+         if (key) t->lang = _pndman_intern(key);
          _json_set_string(&t->string, json_object_get(element, "title"));
       }
 
       /* add description */
-      if ((t = _pndman_package_new_description(pnd))) {
-         if (key) t->lang = strdup(key);
+      if (!lazy && (t = _pndman_package_new_description(pnd))) {
+         if (key) t->lang = _pndman_intern(key);
          _json_set_string(&t->string, json_object_get(element, "description"));
       }
 
@@ -244,11 +255,119 @@ static int _pndman_json_repo_header(json_t *repo_header, pndman_repository *repo
    return RETURN_OK;
 }
 
-/* \brief json parse repository packages */
-static int _pndman_json_process_packages(json_t *packages, pndman_repository *repo, pndman_device *device)
+#define JSON_SKIM_FAIL ((size_t)-1)
+
+/* \brief skip whitespace */
+static size_t _json_skim_ws(const char *data, size_t size, size_t i)
+{
+   while (i < size && isspace((unsigned char)data[i])) ++i;
+   return i;
+}
+
+/* \brief skip string starting at i, returns index after closing quote */
+static size_t _json_skim_string(const char *data, size_t size, size_t i)
+{
+   if (i >= size || data[i] != '"') return JSON_SKIM_FAIL;
+   for (++i; i < size; ++i) {
+      if (data[i] == '\\') ++i;
+      else if (data[i] == '"') return i + 1;
+   }
+   return JSON_SKIM_FAIL;
+}
+
+/* \brief skip any value starting at i, returns index after it */
+static size_t _json_skim_value(const char *data, size_t size, size_t i)
+{
+   size_t depth = 0;
+
+   if (i >= size) return JSON_SKIM_FAIL;
+   if (data[i] == '"') return _json_skim_string(data, size, i);
+
+   /* scalar */
+   if (data[i] != '{' && data[i] != '[') {
+      while (i < size && !strchr(",]} \t\r\n", data[i])) ++i;
+      return i;
+   }
+
+   /* object or array */
+   while (i < size) {
+      if (data[i] == '"') {
+         if ((i = _json_skim_string(data, size, i)) == JSON_SKIM_FAIL)
+            return JSON_SKIM_FAIL;
+         continue;
+      }
+      if (data[i] == '{' || data[i] == '[') ++depth;
+      else if ((data[i] == '}' || data[i] == ']') && !--depth)
+         return i + 1;
+      ++i;
+   }
+   return JSON_SKIM_FAIL;
+}
+
+/* \brief find offset and size of each element in top level packages array,
+ * without decoding anything. ranges holds offset,size pairs */
+static int _json_skim_packages(const char *data, size_t size, size_t **ranges, size_t *count)
+{
+   size_t i, key, e, allocated = 0, *r, *tmp;
+   assert(data && ranges && count);
+
+   *ranges = NULL; *count = 0;
+   if ((i = _json_skim_ws(data, size, 0)) >= size || data[i] != '{')
+      goto fail;
+
+   for (i = i + 1;;) {
+      if ((i = _json_skim_ws(data, size, i)) >= size) goto fail;
+      if (data[i] == '}') break;
+
+      key = i;
+      if ((i = _json_skim_string(data, size, i)) == JSON_SKIM_FAIL) goto fail;
+      if ((e = _json_skim_ws(data, size, i)) >= size || data[e] != ':') goto fail;
+      if ((e = _json_skim_ws(data, size, e + 1)) >= size) goto fail;
+
+      if (i - key == 10 && !memcmp(data + key, "\"packages\"", 10) && data[e] == '[') {
+         /* last packages key wins, like in jansson */
+         *count = 0;
+         for (i = e + 1;;) {
+            if ((i = _json_skim_ws(data, size, i)) >= size) goto fail;
+            if (data[i] == ']') { ++i; break; }
+
+            if ((e = _json_skim_value(data, size, i)) == JSON_SKIM_FAIL) goto fail;
+            if (*count >= allocated) {
+               allocated = (allocated ? allocated * 2 : 256);
+               if (!(tmp = realloc(*ranges, allocated * 2 * sizeof(size_t))))
+                  goto fail;
+               *ranges = tmp;
+            }
+            r = *ranges + *count * 2;
+            r[0] = i; r[1] = e - i;
+            ++*count;
+
+            if ((i = _json_skim_ws(data, size, e)) < size && data[i] == ',') ++i;
+         }
+      } else if ((i = _json_skim_value(data, size, e)) == JSON_SKIM_FAIL)
+         goto fail;
+
+      if ((i = _json_skim_ws(data, size, i)) < size && data[i] == ',') ++i;
+   }
+
+   return RETURN_OK;
+
+fail:
+   IFDO(free, *ranges);
+   *count = 0;
+   return RETURN_FAIL;
+}
+
+#undef JSON_SKIM_FAIL
+
+/* \brief json parse repository packages,
+ * with map heavy fields are left in the json (see lazy.c) */
+static int _pndman_json_process_packages(json_t *packages, pndman_repository *repo, pndman_device *device,
+      _pndman_lazy_map *map, size_t *ranges)
 {
    json_t         *package;
    pndman_package *pnd, *tmp;
+   _pndman_scan   *scan = NULL;
    unsigned int p;
    assert(packages && repo);
 
@@ -256,6 +375,9 @@ static int _pndman_json_process_packages(json_t *packages, pndman_repository *re
    if (!(tmp = _pndman_new_pnd()))
       return RETURN_FAIL;
 
+   /* remote repositories are big, look up duplicates from flat table */
+   if (repo->prev) scan = _pndman_scan_new(repo->pnd);
+
    p = 0;
    for (; p != json_array_size(packages); ++p) {
       package = json_array_get(packages, p);
@@ -267,8 +389,9 @@ static int _pndman_json_process_packages(json_t *packages, pndman_repository *re
       _json_set_version(&tmp->version,  json_object_get(package,"version"));
       if (tmp->path) _strip_slash(tmp->path);
 
-      pnd = _pndman_repository_new_pnd_check(tmp, tmp->path, (device?device->mount:NULL), repo);
-      if (!pnd) return RETURN_FAIL;
+      if (scan) pnd = _pndman_repository_new_pnd_scan(tmp, scan, repo);
+      else pnd = _pndman_repository_new_pnd_check(tmp, tmp->path, (device?device->mount:NULL), repo);
+      if (!pnd) goto fail;
 
       /* free old titles and descriptions (if instance or old) */
       _pndman_package_free_titles(pnd);
@@ -286,36 +409,49 @@ static int _pndman_json_process_packages(json_t *packages, pndman_repository *re
          pnd->path = strdup(tmp->path);
       }
       _pndman_copy_version(&pnd->version, &tmp->version);
-      _json_set_string(&pnd->repository,   json_object_get(package,"repository"));
+      _json_set_interned(&pnd->repository, json_object_get(package,"repository"));
       _json_set_string(&pnd->md5,          json_object_get(package,"md5"));
       _json_set_string(&pnd->url,          json_object_get(package,"uri"));
-      _json_set_localization(pnd,         json_object_get(package,"localizations"));
+      _json_set_localization(pnd,         json_object_get(package,"localizations"), map?1:0);
       _json_set_string(&pnd->info,         json_object_get(package,"info"));
       _json_set_number(&pnd->size,        json_object_get(package, "size"),            size_t);
       _json_set_number(&pnd->modified_time, json_object_get(package, "modified-time"), time_t);
       _json_set_number(&pnd->local_modified_time, json_object_get(package, "local-modified-time"), time_t);
       _json_set_number(&pnd->rating,      json_object_get(package, "rating"),          int);
       _json_set_author(&pnd->author,      json_object_get(package,"author"));
-      _json_set_string(&pnd->vendor,       json_object_get(package,"vendor"));
+      _json_set_interned(&pnd->vendor,     json_object_get(package,"vendor"));
       _json_set_string(&pnd->icon,         json_object_get(package,"icon"));
-      _json_set_previewpics(pnd,          json_object_get(package,"previewpics"));
       _json_set_licenses(pnd,             json_object_get(package,"licenses"));
-      _json_set_sources(pnd,              json_object_get(package,"source"));
       _json_set_categories(pnd,           json_object_get(package,"categories"));
       _json_set_number(&pnd->commercial,  json_object_get(package,"commercial"), int);
 
+      /* heavy fields now, or on pndman_package_load */
+      if (map) {
+         _pndman_lazy_set(pnd, map, ranges[p*2], ranges[p*2+1]);
+      } else {
+         _json_set_previewpics(pnd,       json_object_get(package,"previewpics"));
+         _json_set_sources(pnd,           json_object_get(package,"source"));
+         _pndman_lazy_forget(pnd);
+      }
+
       /* update mount, if device given */
       if (device) {
-         IFDO(free, pnd->mount);
-         if (device->mount) pnd->mount = strdup(device->mount);
+         _pndman_intern_set(&pnd->mount, device->mount);
       }
 
       if (pnd->url) _strip_slash(pnd->url);
       if (pnd->icon) _strip_slash(pnd->icon);
+      _pndman_package_notify(PNDMAN_PACKAGE_CHANGED, pnd);
    }
 
+   _pndman_scan_free(scan);
    _pndman_free_pnd(tmp);
    return RETURN_OK;
+
+fail:
+   _pndman_scan_free(scan);
+   _pndman_free_pnd(tmp);
+   return RETURN_FAIL;
 }
 
 /* INTERNAL */
@@ -566,6 +702,63 @@ bad_json:
    return RETURN_FAIL;
 }
 
+/* \brief decode heavy fields of lazily processed package */
+int _pndman_json_lazy_apply(pndman_package *pnd, const char *data, size_t size)
+{
+   json_t *package;
+   json_error_t error;
+   assert(pnd && data);
+
+   if (!(package = json_loadb(data, size, 0, &error)))
+      goto bad_json;
+
+   _pndman_package_free_titles(pnd);
+   _pndman_package_free_descriptions(pnd);
+   _pndman_package_free_previewpics(pnd);
+   _json_set_localization(pnd,   json_object_get(package,"localizations"), 0);
+   _json_set_previewpics(pnd,    json_object_get(package,"previewpics"));
+   _pndman_package_own_licenses(pnd);
+   _json_set_sources(pnd,        json_object_get(package,"source"));
+
+   json_decref(package);
+   return RETURN_OK;
+
+bad_json:
+   DEBFAIL(JSON_BAD_JSON, error.text, pnd->id);
+   return RETURN_FAIL;
+}
+
+/* \brief decode heavy fields of lazily processed package into new package,
+ * the live package is left untouched */
+pndman_package* _pndman_json_lazy_decode(const char *data, size_t size)
+{
+   pndman_package *pnd = NULL;
+   json_t *package;
+   json_error_t error;
+   assert(data);
+
+   if (!(package = json_loadb(data, size, 0, &error)))
+      goto bad_json;
+
+   if (!(pnd = _pndman_new_pnd()))
+      goto fail;
+
+   _json_set_localization(pnd,   json_object_get(package,"localizations"), 0);
+   _json_set_previewpics(pnd,    json_object_get(package,"previewpics"));
+   _json_set_licenses(pnd,       json_object_get(package,"licenses"));
+   _json_set_sources(pnd,        json_object_get(package,"source"));
+
+   json_decref(package);
+   return pnd;
+
+bad_json:
+   DEBFAIL(JSON_BAD_JSON, error.text, "lazy package");
+   return NULL;
+fail:
+   json_decref(package);
+   return NULL;
+}
+
 /* undef macros for above functions */
 #undef json_fast_number
 #undef json_fast_string
@@ -576,29 +769,50 @@ int _pndman_json_process(pndman_repository *repo,
 {
    json_t *root = NULL, *repo_header, *packages;
    json_error_t error;
+   _pndman_lazy_map *map;
+   const char *data;
+   size_t size, *ranges = NULL, count = 0;
+   uint64_t start = _pndman_metrics_now();
    assert(repo && file);
 
-   /* flush and reset to beginning */
-   fflush(file); fseek(file, 0L, SEEK_SET);
-   if (!(root = json_loadf(file, 0, &error)))
-      goto bad_json;
+   /* lazy loading decodes packages from mapped file later */
+   if ((map = _pndman_lazy_map_new(file))) {
+      data = _pndman_lazy_map_data(map, &size);
+      if (!(root = json_loadb(data, size, 0, &error)))
+         goto bad_json;
+   } else {
+      /* flush and reset to beginning */
+      fflush(file); fseek(file, 0L, SEEK_SET);
+      if (!(root = json_loadf(file, 0, &error)))
+         goto bad_json;
+   }
 
    repo_header = json_object_get(root, "repository");
    if (json_is_object(repo_header)) {
       if (_pndman_json_repo_header(repo_header, repo) == RETURN_OK) {
          packages = json_object_get(root, "packages");
-         if (json_is_array(packages))
-            _pndman_json_process_packages(packages, repo, device);
-         else DEBUG(PNDMAN_LEVEL_WARN, JSON_NO_P_ARRAY, repo->url);
+         if (json_is_array(packages)) {
+            /* fall back to eager, if skimmer disagrees with jansson */
+            if (map && (_json_skim_packages(data, size, &ranges, &count) != RETURN_OK ||
+                        count != json_array_size(packages))) {
+               DEBUG(PNDMAN_LEVEL_WARN, "lazy skim failed, loading packages eagerly");
+               NULLDO(_pndman_lazy_map_release, map);
+            }
+            _pndman_json_process_packages(packages, repo, device, map, ranges);
+         } else DEBUG(PNDMAN_LEVEL_WARN, JSON_NO_P_ARRAY, repo->url);
       }
    } else DEBUG(PNDMAN_LEVEL_WARN, JSON_NO_R_HEADER, repo->url);
 
    json_decref(root);
+   IFDO(free, ranges);
+   IFDO(_pndman_lazy_map_release, map);
+   _pndman_metrics_time(PNDMAN_METRIC_JSON_LOAD_TIME, "json load", repo->url, start);
    return RETURN_OK;
 
 bad_json:
    DEBFAIL(JSON_BAD_JSON, error.text, repo->url);
    IFDO(json_decref, root);
+   IFDO(_pndman_lazy_map_release, map);
    return RETURN_FAIL;
 }
 
@@ -709,13 +923,13 @@ static void _fstrf(json_buffer *f, char *value, int delim)
 /* \brief outputs json for repository */
 int _pndman_json_commit(pndman_repository *r, pndman_device *d, void *file)
 {
-   pndman_package *p;
+   pndman_package *p, *h, *heavy;
    pndman_translated *t, *td;
    pndman_previewpic *pic;
    pndman_category *c;
    pndman_license *l;
    int found = 0, delim = 0;
-   clock_t now = clock();
+   uint64_t now = _pndman_metrics_now();
    json_buffer *f;
    assert(file && d && r);
 
@@ -744,6 +958,12 @@ int _pndman_json_commit(pndman_repository *r, pndman_device *d, void *file)
       if (!r->prev && p->mount && d->mount && strcmp(p->mount, d->mount))
          continue;
 
+      /* lazy packages are decoded to detached copy for the write,
+       * other device commits may be reading the live package */
+      if (_pndman_lazy_decode(p, &heavy) != RETURN_OK)
+         goto fail;
+      h = (heavy ? heavy : p);
+
       buf_appendf(f, "%s{\n", delim?",":""); delim = 1;
 
       /* local repository */
@@ -769,10 +989,10 @@ int _pndman_json_commit(pndman_repository *r, pndman_device *d, void *file)
 
       /* localization object */
       buf_append(f, "\"localizations\":{\n");
-      for (t = p->title; t; t = t->next) {
+      for (t = h->title; t; t = t->next) {
          found = 0;
-         for (td = p->description; td ; td = td->next)
-            if (td->lang && t->lang && !_strupcmp(td->lang, t->lang)) {
+         for (td = h->description; td ; td = td->next)
+            if (td->lang == t->lang || (td->lang && t->lang && !_strupcmp(td->lang, t->lang))) {
                found = 1;
                break;
             }
@@ -784,7 +1004,7 @@ int _pndman_json_commit(pndman_repository *r, pndman_device *d, void *file)
       }
 
       /* fallback */
-      if (!p->title)
+      if (!h->title)
          buf_appendf(f, "\"en_US\":{\"title\":\"\",\"description\":\"\"}\n");
       buf_append(f, "},\n");
 
@@ -808,19 +1028,19 @@ int _pndman_json_commit(pndman_repository *r, pndman_device *d, void *file)
 
       /* previewpics array */
       buf_append(f, "\"previewpics\":[\n");
-      for (pic = p->previewpic; pic; pic = pic->next)
+      for (pic = h->previewpic; pic; pic = pic->next)
          _fstrf(f, pic->src, pic->next ? 1 : 0);
       buf_append(f, "],\n");
 
       /* licenses array */
       buf_append(f, "\"licenses\":[\n");
-      for (l = p->license; l; l = l->next)
+      for (l = h->license; l; l = l->next)
          _fstrf(f, l->name, l->next ? 1 : 0);
       buf_append(f, "],\n");
 
       /* sources array */
       buf_append(f, "\"source\":[\n");
-      for (l = p->license; l; l = l->next)
+      for (l = h->license; l; l = l->next)
          _fstrf(f, l->sourcecodeurl, l->next ? 1 : 0);
       buf_append(f, "],\n");
 
@@ -832,6 +1052,8 @@ int _pndman_json_commit(pndman_repository *r, pndman_device *d, void *file)
       }
       buf_append(f, "]\n");
       buf_append(f, "}\n");
+
+      IFDO(_pndman_free_pnd, heavy);
    }
    buf_append(f, "]}\n"); /* end */
 
@@ -839,11 +1061,13 @@ int _pndman_json_commit(pndman_repository *r, pndman_device *d, void *file)
    fflush(file);
    buf_free(f);
 
-   DEBUG(PNDMAN_LEVEL_CRAP, "JSON write took %.2f seconds", (double)(clock()-now)/CLOCKS_PER_SEC);
+   DEBUG(PNDMAN_LEVEL_CRAP, "JSON write took %.2f seconds", (_pndman_metrics_now()-now)/1000000.0);
+   _pndman_metrics_time(PNDMAN_METRIC_JSON_COMMIT_TIME, "json commit", r->url, now);
    return RETURN_OK;
 
 fail:
-   DEBUG(PNDMAN_LEVEL_ERROR, "Out of memory!");
+   DEBUG(PNDMAN_LEVEL_ERROR, "JSON write failed");
+   IFDO(buf_free, f);
    return RETURN_FAIL;
 }
 
@@ -0,0 +1,367 @@
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#  include <sys/vfs.h>
+#  include <linux/magic.h>
+#endif
+
+/* \brief disk backed directory for json that would be mapped from memory */
+#define PNDMAN_LAZY_SPILL_DIR "/var/tmp"
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+static pthread_mutex_t _pndman_lazy_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define LAZY_LOCK()   pthread_mutex_lock(&_pndman_lazy_mutex)
+#  define LAZY_UNLOCK() pthread_mutex_unlock(&_pndman_lazy_mutex)
+#else
+#  define LAZY_LOCK()
+#  define LAZY_UNLOCK()
+#endif
+
+/* \brief read only mapping of processed json,
+ * shared by every package that still points into it */
+struct _pndman_lazy_map
+{
+   size_t refs;
+   char *data;
+   size_t size;
+};
+
+/* \brief where heavy fields of package live in the json */
+typedef struct _pndman_lazy_record
+{
+   _pndman_lazy_map *map;
+   size_t offset, size;
+   int loaded;
+} _pndman_lazy_record;
+
+/* \brief lazy loading enabled? */
+static int _pndman_lazy_enabled = 0;
+
+/* \brief pndman_package* -> _pndman_lazy_record,
+ * crawl workers free and copy packages in parallel so table is locked */
+static _pndman_hash *_pndman_lazy_table = NULL;
+
+/* \brief release reference to mapping, caller holds LAZY_LOCK */
+static void _pndman_lazy_map_unref(_pndman_lazy_map *map)
+{
+   assert(map && map->refs);
+   if (--map->refs) return;
+#ifndef _WIN32
+   munmap(map->data, map->size);
+#endif
+   free(map);
+}
+
+/* \brief free record, caller holds LAZY_LOCK */
+static void _pndman_lazy_record_free(void *data)
+{
+   _pndman_lazy_record *record = data;
+   _pndman_lazy_map_unref(record->map);
+   free(record);
+}
+
+/* \brief record of package, caller holds LAZY_LOCK */
+static _pndman_lazy_record* _pndman_lazy_record_get(pndman_package *pnd)
+{
+   if (!_pndman_lazy_table) return NULL;
+   return _pndman_hash_get(_pndman_lazy_table, &pnd, sizeof(pnd));
+}
+
+/* \brief remove record of package, caller holds LAZY_LOCK */
+static void _pndman_lazy_record_remove(pndman_package *pnd)
+{
+   _pndman_lazy_record *record;
+   if (!_pndman_lazy_table) return;
+   if (!(record = _pndman_hash_remove(_pndman_lazy_table, &pnd, sizeof(pnd))))
+      return;
+
+   _pndman_lazy_record_free(record);
+   if (!_pndman_hash_count(_pndman_lazy_table)) {
+      _pndman_hash_free(_pndman_lazy_table, NULL);
+      _pndman_lazy_table = NULL;
+   }
+}
+
+/* \brief store record for package, replacing old one.
+ * takes reference to map. caller holds LAZY_LOCK */
+static int _pndman_lazy_record_set(pndman_package *pnd,
+      _pndman_lazy_map *map, size_t offset, size_t size, int loaded)
+{
+   _pndman_lazy_record *record;
+
+   if (!_pndman_lazy_table && !(_pndman_lazy_table = _pndman_hash_new()))
+      goto fail;
+
+   if (!(record = _pndman_hash_get(_pndman_lazy_table, &pnd, sizeof(pnd)))) {
+      if (!(record = calloc(1, sizeof(_pndman_lazy_record))))
+         goto fail;
+      if (_pndman_hash_set(_pndman_lazy_table, &pnd, sizeof(pnd), record) != RETURN_OK) {
+         free(record);
+         goto fail;
+      }
+   } else _pndman_lazy_map_unref(record->map);
+
+   ++map->refs;
+   record->map    = map;
+   record->offset = offset;
+   record->size   = size;
+   record->loaded = loaded;
+   return RETURN_OK;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "lazy record");
+   return RETURN_FAIL;
+}
+
+/* \brief drop everything that pndman_package_load would bring back,
+ * titles stay, so pndman_set_locale can pick another one without loading */
+static void _pndman_lazy_strip(pndman_package *pnd)
+{
+   pndman_license *l;
+
+   _pndman_package_own_licenses(pnd);
+   for (l = pnd->license; l; l = l->next) {
+      IFDO(free, l->sourcecodeurl);
+   }
+
+   _pndman_package_free_descriptions(pnd);
+   _pndman_package_free_previewpics(pnd);
+}
+
+#ifndef _WIN32
+/* \brief is file in memory? mapping it keeps whole json resident */
+static int _pndman_lazy_in_memory(int fd)
+{
+#ifdef __linux__
+   struct statfs fs;
+   if (fstatfs(fd, &fs) == 0 && (fs.f_type == TMPFS_MAGIC || fs.f_type == RAMFS_MAGIC))
+      return RETURN_TRUE;
+#else
+   (void)fd;
+#endif
+   return RETURN_FALSE;
+}
+
+/* \brief copy json from temporary file in memory to unlinked file on disk,
+ * returns descriptor of the copy, -1 on failure */
+static int _pndman_lazy_spill(void *file)
+{
+   char path[] = PNDMAN_LAZY_SPILL_DIR"/libpndman-XXXXXX";
+   char buf[4096*2];
+   size_t len;
+   int fd;
+
+   if ((fd = mkstemp(path)) == -1)
+      return -1;
+   unlink(path);
+
+   if (_pndman_lazy_in_memory(fd))
+      goto fail;
+
+   fseek(file, 0L, SEEK_SET);
+   while ((len = fread(buf, 1, sizeof(buf), file)))
+      if (write(fd, buf, len) != (ssize_t)len) goto fail;
+   if (ferror(file)) goto fail;
+   return fd;
+
+fail:
+   close(fd);
+   return -1;
+}
+#endif
+
+/* INTERNAL API */
+
+/* \brief map json file for lazy processing,
+ * returns NULL when lazy loading is disabled or file can't be mapped */
+_pndman_lazy_map* _pndman_lazy_map_new(void *file)
+{
+#ifndef _WIN32
+   _pndman_lazy_map *map;
+   struct stat st;
+   void *data;
+   int fd;
+   assert(file);
+
+   if (!_pndman_lazy_enabled)
+      return NULL;
+
+   fflush(file);
+   fd = fileno(file);
+   if (fstat(fd, &st) != 0 || st.st_size <= 0)
+      return NULL;
+
+   /* temporary files often live in tmpfs, page cache of disk file can be dropped */
+   if (_pndman_lazy_in_memory(fd) && (fd = _pndman_lazy_spill(file)) == -1) {
+      DEBUG(PNDMAN_LEVEL_WARN, "no disk backed file for lazy loading, loading packages eagerly");
+      return NULL;
+   }
+
+   data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   if (fd != fileno(file)) close(fd);
+   if (data == MAP_FAILED) {
+      DEBUG(PNDMAN_LEVEL_WARN, "mmap failed, loading packages eagerly");
+      return NULL;
+   }
+
+   if (!(map = malloc(sizeof(_pndman_lazy_map)))) {
+      munmap(data, st.st_size);
+      DEBFAIL(PNDMAN_ALLOC_FAIL, "lazy map");
+      return NULL;
+   }
+
+   map->refs = 1;
+   map->data = data;
+   map->size = st.st_size;
+   return map;
+#else
+   (void)file;
+   return NULL;
+#endif
+}
+
+/* \brief mapped json data */
+const char* _pndman_lazy_map_data(_pndman_lazy_map *map, size_t *size)
+{
+   assert(map && size);
+   *size = map->size;
+   return map->data;
+}
+
+/* \brief release mapping from _pndman_lazy_map_new */
+void _pndman_lazy_map_release(_pndman_lazy_map *map)
+{
+   if (!map) return;
+   LAZY_LOCK();
+   _pndman_lazy_map_unref(map);
+   LAZY_UNLOCK();
+}
+
+/* \brief heavy fields of package live in map at offset..offset+size */
+int _pndman_lazy_set(pndman_package *pnd, _pndman_lazy_map *map, size_t offset, size_t size)
+{
+   int ret;
+   assert(pnd && map && offset + size <= map->size);
+   LAZY_LOCK();
+   if ((ret = _pndman_lazy_record_set(pnd, map, offset, size, 0)) == RETURN_OK)
+      _pndman_lazy_strip(pnd);
+   LAZY_UNLOCK();
+   return ret;
+}
+
+/* \brief package is no longer lazy (freed or fully loaded again) */
+void _pndman_lazy_forget(pndman_package *pnd)
+{
+   assert(pnd);
+   LAZY_LOCK();
+   _pndman_lazy_record_remove(pnd);
+   LAZY_UNLOCK();
+}
+
+/* \brief pnd got heavy fields from src by copy, share its record */
+void _pndman_lazy_copy(pndman_package *pnd, pndman_package *src)
+{
+   _pndman_lazy_record *record;
+   assert(pnd && src);
+
+   LAZY_LOCK();
+   if ((record = _pndman_lazy_record_get(src)) && !_pndman_lazy_record_get(pnd))
+      _pndman_lazy_record_set(pnd, record->map, record->offset, record->size, record->loaded);
+   LAZY_UNLOCK();
+}
+
+/* \brief load heavy fields of package.
+ * returns 1 if package was loaded by this call, 0 if nothing to load */
+int _pndman_lazy_load(pndman_package *pnd)
+{
+   _pndman_lazy_record *record;
+   int ret = 0;
+   assert(pnd);
+
+   LAZY_LOCK();
+   if ((record = _pndman_lazy_record_get(pnd)) && !record->loaded) {
+      if (_pndman_json_lazy_apply(pnd, record->map->data + record->offset, record->size) == RETURN_OK) {
+         record->loaded = 1;
+         ret = 1;
+      } else ret = -1;
+   }
+   LAZY_UNLOCK();
+   return ret;
+}
+
+/* \brief decode heavy fields of lazy package to new package in *heavy,
+ * live package and its shared state are left untouched.
+ * *heavy is NULL when package is not lazy or is already loaded */
+int _pndman_lazy_decode(pndman_package *pnd, pndman_package **heavy)
+{
+   _pndman_lazy_record *record;
+   _pndman_lazy_map *map = NULL;
+   size_t offset = 0, size = 0;
+   assert(pnd && heavy);
+
+   *heavy = NULL;
+   LAZY_LOCK();
+   if ((record = _pndman_lazy_record_get(pnd)) && !record->loaded) {
+      map    = record->map;
+      offset = record->offset;
+      size   = record->size;
+      ++map->refs;
+   }
+   LAZY_UNLOCK();
+
+   /* mapping is read only, decode outside lock */
+   if (!map) return RETURN_OK;
+   *heavy = _pndman_json_lazy_decode(map->data + offset, size);
+   _pndman_lazy_map_release(map);
+   return (*heavy ? RETURN_OK : RETURN_FAIL);
+}
+
+/* \brief release heavy fields of package loaded by _pndman_lazy_load */
+void _pndman_lazy_unload(pndman_package *pnd)
+{
+   _pndman_lazy_record *record;
+   assert(pnd);
+
+   LAZY_LOCK();
+   if ((record = _pndman_lazy_record_get(pnd)) && record->loaded) {
+      _pndman_lazy_strip(pnd);
+      record->loaded = 0;
+   }
+   LAZY_UNLOCK();
+}
+
+/* API */
+
+/* \brief keep heavy package fields in the mapped database until needed */
+PNDMANAPI void pndman_set_lazy_load(int lazy)
+{
+   _pndman_lazy_enabled = lazy;
+}
+
+/* \brief decode heavy fields of lazily loaded package */
+PNDMANAPI int pndman_package_load(pndman_package *pnd)
+{
+   CHECKUSE(pnd);
+   return (_pndman_lazy_load(pnd) < 0 ? RETURN_FAIL : RETURN_OK);
+}
+
+/* \brief release heavy fields of lazily loaded package */
+PNDMANAPI void pndman_package_unload(pndman_package *pnd)
+{
+   CHECKUSEV(pnd);
+   _pndman_lazy_unload(pnd);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
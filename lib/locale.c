@@ -0,0 +1,172 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+static pthread_mutex_t _pndman_locale_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define LOCALE_LOCK()   pthread_mutex_lock(&_pndman_locale_mutex)
+#  define LOCALE_UNLOCK() pthread_mutex_unlock(&_pndman_locale_mutex)
+#  define LOCALE_SERIAL_LOAD(x)     __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#  define LOCALE_SERIAL_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#else
+#  define LOCALE_LOCK()
+#  define LOCALE_UNLOCK()
+#  define LOCALE_SERIAL_LOAD(x)     (x)
+#  define LOCALE_SERIAL_STORE(x, v) ((x) = (v))
+#endif
+
+/* \brief fallback after preferred locales */
+#define LOCALE_FALLBACK "en_US"
+
+/* \brief preferred locales, best first */
+static char **_pndman_locale_chain = NULL;
+static size_t _pndman_locale_count = 0;
+
+/* \brief bumped when chain changes,
+ * packages resolved with other serial are stale.
+ * 0 is never used, so calloced packages start stale.
+ * written under LOCALE_LOCK, read without it */
+static unsigned int _pndman_locale_serial = 1;
+
+/* \brief free locale chain, caller holds LOCALE_LOCK */
+static void _pndman_locale_chain_free(void)
+{
+   size_t i;
+   for (i = 0; i < _pndman_locale_count; ++i)
+      free(_pndman_locale_chain[i]);
+   IFDO(free, _pndman_locale_chain);
+   _pndman_locale_count = 0;
+}
+
+/* \brief length of language part of locale (fi of fi_FI) */
+static size_t _pndman_locale_language_len(const char *locale)
+{
+   return strcspn(locale, "_-");
+}
+
+/* \brief find translation for single locale, exact match first,
+ * then same language in any territory */
+static pndman_translated* _pndman_locale_match(pndman_translated *list, const char *locale)
+{
+   pndman_translated *t;
+   size_t len;
+
+   for (t = list; t; t = t->next)
+      if (t->lang && t->string && !_strupcmp(t->lang, locale)) return t;
+
+   len = _pndman_locale_language_len(locale);
+   for (t = list; t; t = t->next) {
+      if (!t->lang || !t->string) continue;
+      if (_pndman_locale_language_len(t->lang) == len && !_strnupcmp(t->lang, locale, len))
+         return t;
+   }
+
+   return NULL;
+}
+
+/* \brief best translation in list for preferred locales,
+ * falls back to en_US and then first translation.
+ * caller holds LOCALE_LOCK */
+static pndman_translated* _pndman_locale_find(pndman_translated *list)
+{
+   pndman_translated *t = NULL;
+   size_t i;
+
+   if (!list) return NULL;
+
+   for (i = 0; !t && i < _pndman_locale_count; ++i)
+      t = _pndman_locale_match(list, _pndman_locale_chain[i]);
+
+   if (!t) t = _pndman_locale_match(list, LOCALE_FALLBACK);
+   for (t = (t ? t : list); t && !t->string; t = t->next);
+   return t;
+}
+
+/* INTERNAL API */
+
+/* \brief current serial of locale chain */
+unsigned int _pndman_locale_serial_get(void)
+{
+   return LOCALE_SERIAL_LOAD(_pndman_locale_serial);
+}
+
+/* \brief cache best title and description of package,
+ * serial and chain are read together so result is never newer than serial */
+void _pndman_locale_resolve(pndman_package *pnd)
+{
+   pndman_translated *t;
+   assert(pnd);
+
+   LOCALE_LOCK();
+   pnd->locale_serial      = _pndman_locale_serial;
+   pnd->locale_title       = ((t = _pndman_locale_find(pnd->title)) ? t->string : NULL);
+   pnd->locale_description = ((t = _pndman_locale_find(pnd->description)) ? t->string : NULL);
+   LOCALE_UNLOCK();
+}
+
+/* API */
+
+/* \brief set preferred locales */
+PNDMANAPI int pndman_set_locale(const char *locales)
+{
+   char **chain = NULL, **tmp;
+   size_t count = 0, len;
+   const char *s;
+
+   for (s = locales; s && *s; s += len + (s[len] ? 1 : 0)) {
+      len = strcspn(s, ":");
+      if (!len) continue;
+
+      if (!(tmp = realloc(chain, (count + 1) * sizeof(char*))))
+         goto fail;
+      chain = tmp;
+
+      /* fi_FI.UTF-8@euro -> fi_FI */
+      if (!(chain[count] = malloc(len + 1)))
+         goto fail;
+      memcpy(chain[count], s, len);
+      chain[count][len] = '\0';
+      chain[count][strcspn(chain[count], ".@")] = '\0';
+      if (!strlen(chain[count])) {
+         free(chain[count]);
+         continue;
+      }
+      ++count;
+   }
+
+   LOCALE_LOCK();
+   _pndman_locale_chain_free();
+   _pndman_locale_chain = chain;
+   _pndman_locale_count = count;
+   LOCALE_SERIAL_STORE(_pndman_locale_serial, (_pndman_locale_serial + 1 ? _pndman_locale_serial + 1 : 1));
+   LOCALE_UNLOCK();
+   return RETURN_OK;
+
+fail:
+   while (count) free(chain[--count]);
+   IFDO(free, chain);
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "locale chain");
+   return RETURN_FAIL;
+}
+
+/* \brief title in preferred locale */
+PNDMANAPI const char* pndman_package_get_title(pndman_package *pnd)
+{
+   CHECKUSEP(pnd);
+   if (pnd->locale_serial != _pndman_locale_serial_get())
+      _pndman_locale_resolve(pnd);
+   return pnd->locale_title;
+}
+
+/* \brief description in preferred locale */
+PNDMANAPI const char* pndman_package_get_description(pndman_package *pnd)
+{
+   CHECKUSEP(pnd);
+   if (pnd->locale_serial != _pndman_locale_serial_get())
+      _pndman_locale_resolve(pnd);
+   return pnd->locale_description;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
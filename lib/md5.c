@@ -4,23 +4,70 @@
 #include <string.h>
 #include <openssl/md5.h>
 
-#ifdef __APPLE__
-#  include <malloc/malloc.h>
-#else
-#  include <malloc.h>
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
 #endif
 
-static int _pndman_md5file(FILE *file, unsigned char *digest)
+/* \brief hash whole file with large aligned reads,
+ * the kernel is told we read it once from start to end.
+ * drop releases its page cache, for batches of files nobody reads next */
+static int _pndman_md5file(const char *path, unsigned char *digest, int drop)
 {
-   unsigned char buf[512];
    MD5_CTX c;
+   void *buf = NULL;
+   int ret = RETURN_FAIL;
+#ifdef _WIN32
+   FILE *f;
    size_t len;
+   (void)drop;
+
+   if (!(f = fopen(path, "rb")))
+      return RETURN_FAIL;
+   if (!(buf = malloc(PNDMAN_MD5_READ_SIZE)))
+      goto fail;
 
    MD5_Init(&c);
-   while ((len = fread(buf, sizeof(buf[0]), sizeof(buf), file)))
+   while ((len = fread(buf, 1, PNDMAN_MD5_READ_SIZE, f)))
       MD5_Update(&c, buf, len);
    MD5_Final(digest, &c);
-   return ferror(file);
+   if (!ferror(f)) ret = RETURN_OK;
+
+fail:
+   IFDO(free, buf);
+   fclose(f);
+#else
+   int fd;
+   ssize_t len;
+
+   if ((fd = open(path, O_RDONLY)) == -1)
+      return RETURN_FAIL;
+   if (posix_memalign(&buf, PNDMAN_MD5_ALIGN, PNDMAN_MD5_READ_SIZE) != 0)
+      goto fail;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+   MD5_Init(&c);
+   while ((len = read(fd, buf, PNDMAN_MD5_READ_SIZE)) > 0)
+      MD5_Update(&c, buf, len);
+   MD5_Final(digest, &c);
+   if (len == 0) ret = RETURN_OK;
+
+#ifdef POSIX_FADV_DONTNEED
+   if (drop) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+
+fail:
+   IFDO(free, buf);
+   close(fd);
+#endif
+   return ret;
 }
 
 static char _pndman_nibble2hex(unsigned char b)
@@ -65,30 +112,190 @@ char* _pndman_md5_buf(char *buffer, size_t size)
    return md5;
 }
 
-/* \brief get md5 of file, remember to free the result */
-char* _pndman_md5(const char *file)
+/* \brief new md5 state for incremental hashing */
+void* _pndman_md5_new(void)
+{
+   MD5_CTX *c;
+   if (!(c = malloc(sizeof(MD5_CTX))))
+      return NULL;
+   MD5_Init(c);
+   return c;
+}
+
+/* \brief hash more data to md5 state */
+void _pndman_md5_update(void *ctx, const void *data, size_t size)
+{
+   MD5_Update((MD5_CTX*)ctx, data, size);
+}
+
+/* \brief finish incremental md5, frees the state.
+ * remember to free the result */
+char* _pndman_md5_final(void *ctx)
 {
-   FILE *f;
    char *md5;
    unsigned char digest[MD5_DIGEST_LENGTH];
 
-   if (!(f = fopen(file, "rb")))
-      goto fail;
+   MD5_Final(digest, (MD5_CTX*)ctx);
+   free(ctx);
 
-   if (_pndman_md5file(f, digest) != 0)
-      goto fail;
-   fclose(f);
+   if (!(md5 = malloc(MD5_DIGEST_LENGTH * 2 + 1)))
+      return NULL;
+
+   memset(md5, 0, MD5_DIGEST_LENGTH * 2 + 1);
+   _pndman_bytes2hex(digest, MD5_DIGEST_LENGTH, md5, MD5_DIGEST_LENGTH * 2 + 1);
+   return md5;
+}
+
+/* \brief md5 of file as hex, see _pndman_md5file for drop */
+static char* _pndman_md5_hex(const char *file, int drop)
+{
+   char *md5;
+   unsigned char digest[MD5_DIGEST_LENGTH];
+
+   if (_pndman_md5file(file, digest, drop) != RETURN_OK)
+      return NULL;
 
    if (!(md5 = malloc(MD5_DIGEST_LENGTH * 2 + 1)))
-      goto fail;
+      return NULL;
 
    memset(md5, 0, MD5_DIGEST_LENGTH * 2 + 1);
    _pndman_bytes2hex(digest, MD5_DIGEST_LENGTH, md5, MD5_DIGEST_LENGTH * 2 + 1);
    return md5;
+}
+
+/* \brief get md5 of file, remember to free the result.
+ * file stays cached, it's usually installed or copied next */
+char* _pndman_md5(const char *file)
+{
+   return _pndman_md5_hex(file, 0);
+}
+
+/* \brief shared state of md5 batch */
+typedef struct _pndman_md5_batch_state
+{
+   const char **paths;
+   char **results;
+   size_t count, next;
+   size_t *finished; /* indexes in order of completion */
+   size_t nfinished;
+#ifdef HAVE_PTHREAD
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+#endif
+} _pndman_md5_batch_state;
+
+#ifdef HAVE_PTHREAD
+/* \brief md5 batch worker, takes next file until none left */
+static void* _pndman_md5_batch_worker(void *arg)
+{
+   size_t i;
+   char *md5;
+   _pndman_md5_batch_state *state = arg;
+
+   for (;;) {
+      pthread_mutex_lock(&state->mutex);
+      i = state->next < state->count ? state->next++ : state->count;
+      pthread_mutex_unlock(&state->mutex);
+      if (i == state->count) break;
+
+      md5 = (state->paths[i] ? _pndman_md5_hex(state->paths[i], 1) : NULL);
+
+      pthread_mutex_lock(&state->mutex);
+      state->results[i] = md5;
+      state->finished[state->nfinished++] = i;
+      pthread_cond_signal(&state->cond);
+      pthread_mutex_unlock(&state->mutex);
+   }
 
-fail:
-   IFDO(fclose, f);
    return NULL;
 }
 
+/* \brief number of online cpus */
+static unsigned int _pndman_md5_cpus(void)
+{
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   return (cpus > 0 ? cpus : 1);
+}
+#endif
+
+/* \brief hash many files, using threads workers.
+ * results[i] is set to md5 of paths[i] (NULL on failure)
+ * and callback is called from calling thread as files complete.
+ * page cache of hashed files is dropped, scans would evict everything else.
+ * returns number of files hashed, -1 on failure */
+int _pndman_md5_batch(const char **paths, char **results, size_t count,
+      unsigned int threads, _pndman_md5_batch_callback callback, void *user_data)
+{
+   size_t i, seen = 0;
+   int hashed = 0;
+   _pndman_md5_batch_state state;
+#ifdef HAVE_PTHREAD
+   unsigned int t, started = 0;
+   pthread_t *workers = NULL;
+#endif
+
+   memset(&state, 0, sizeof(_pndman_md5_batch_state));
+   state.paths   = paths;
+   state.results = results;
+   state.count   = count;
+   memset(results, 0, count * sizeof(char*));
+
+#ifdef HAVE_PTHREAD
+   if (!threads) threads = _pndman_md5_cpus();
+   if (threads > count) threads = count;
+   if (threads > 1) {
+      if (!(state.finished = malloc(count * sizeof(size_t))) ||
+          !(workers = malloc(threads * sizeof(pthread_t))))
+         goto fail;
+
+      pthread_mutex_init(&state.mutex, NULL);
+      pthread_cond_init(&state.cond, NULL);
+      for (t = 0; t != threads; ++t)
+         if (pthread_create(&workers[t], NULL, _pndman_md5_batch_worker, &state) == 0)
+            ++started;
+
+      /* report from this thread as workers finish */
+      pthread_mutex_lock(&state.mutex);
+      while (started && seen != count) {
+         while (seen == state.nfinished)
+            pthread_cond_wait(&state.cond, &state.mutex);
+         while (seen != state.nfinished) {
+            i = state.finished[seen++];
+            pthread_mutex_unlock(&state.mutex);
+            if (results[i]) ++hashed;
+            if (callback) callback(i, seen, count, results[i], user_data);
+            pthread_mutex_lock(&state.mutex);
+         }
+      }
+      pthread_mutex_unlock(&state.mutex);
+
+      for (t = 0; t != started; ++t)
+         pthread_join(workers[t], NULL);
+      pthread_cond_destroy(&state.cond);
+      pthread_mutex_destroy(&state.mutex);
+      free(workers);
+      free(state.finished);
+
+      /* no threads could be started, do it here then */
+      if (started) return hashed;
+   }
+#else
+   (void)threads;
+#endif
+
+   for (i = seen; i != count; ++i) {
+      if (paths[i] && (results[i] = _pndman_md5_hex(paths[i], 1))) ++hashed;
+      if (callback) callback(i, i+1, count, results[i], user_data);
+   }
+   return hashed;
+
+#ifdef HAVE_PTHREAD
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "md5 batch");
+   IFDO(free, workers);
+   IFDO(free, state.finished);
+   return RETURN_FAIL;
+#endif
+}
+
 /* vim: set ts=8 sw=3 tw=0 :*/
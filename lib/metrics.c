@@ -0,0 +1,283 @@
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <inttypes.h>
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+static pthread_mutex_t _pndman_metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define METRICS_LOCK()   pthread_mutex_lock(&_pndman_metrics_mutex)
+#  define METRICS_UNLOCK() pthread_mutex_unlock(&_pndman_metrics_mutex)
+#else
+#  define METRICS_LOCK()
+#  define METRICS_UNLOCK()
+#endif
+
+/* \brief bytes downloaded from single repository */
+typedef struct _pndman_metrics_repository
+{
+   char *url;
+   uint64_t bytes;
+   struct _pndman_metrics_repository *next;
+} _pndman_metrics_repository;
+
+/* \brief recorded trace span */
+typedef struct _pndman_trace_span
+{
+   const char *name;
+   char *detail;
+   uint64_t start, duration;
+} _pndman_trace_span;
+
+/* \brief metric names, in pndman_metric order */
+static const char *_pndman_metric_name[PNDMAN_METRIC_COUNT] = {
+   "bytes_downloaded",
+   "transfer_time",
+   "connect_time",
+   "transfer_retries",
+   "pnds_crawled",
+   "crawl_time",
+   "pnd_parse_time",
+   "json_load_time",
+   "json_commit_time",
+   "db_commit_time",
+   "lock_wait_time",
+};
+
+static int _pndman_metrics_enabled = 0;
+static int _pndman_metrics_tracing = 0;
+static pndman_metric_value _pndman_metrics[PNDMAN_METRIC_COUNT];
+static _pndman_metrics_repository *_pndman_metrics_repositories = NULL;
+static _pndman_trace_span *_pndman_metrics_spans = NULL;
+static size_t _pndman_metrics_span_count = 0, _pndman_metrics_span_alloc = 0;
+
+/* \brief free recorded spans */
+static void _pndman_metrics_free_spans(void)
+{
+   size_t i;
+   for (i = 0; i != _pndman_metrics_span_count; ++i) {
+      IFDO(free, _pndman_metrics_spans[i].detail);
+   }
+   IFDO(free, _pndman_metrics_spans);
+   _pndman_metrics_span_count = _pndman_metrics_span_alloc = 0;
+}
+
+/* \brief log2 bucket of value */
+static int _pndman_metrics_bucket(uint64_t value)
+{
+   int bucket = 0;
+   while (value > 1 && bucket != PNDMAN_METRIC_BUCKETS-1) {
+      value >>= 1;
+      ++bucket;
+   }
+   return bucket;
+}
+
+/* \brief write json string, escaped */
+static void _pndman_metrics_fputs(const char *str, FILE *f)
+{
+   fputc('"', f);
+   for (; str && *str; ++str) {
+      if (*str == '"' || *str == '\\') fputc('\\', f);
+      if ((unsigned char)*str < 0x20) fprintf(f, "\\u%04x", *str);
+      else fputc(*str, f);
+   }
+   fputc('"', f);
+}
+
+/* INTERNAL API */
+
+/* \brief monotonic time in microseconds */
+uint64_t _pndman_metrics_now(void)
+{
+#ifdef _WIN32
+   LARGE_INTEGER freq, count;
+   QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&count);
+   return (uint64_t)(count.QuadPart / (double)freq.QuadPart * 1000000.0);
+#else
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/* \brief add value to metric, counters add up,
+ * histograms record it as a sample */
+void _pndman_metrics_add(pndman_metric metric, uint64_t value)
+{
+   pndman_metric_value *m;
+   assert(metric < PNDMAN_METRIC_COUNT);
+   if (!_pndman_metrics_enabled) return;
+
+   METRICS_LOCK();
+   m = &_pndman_metrics[metric];
+   if (!m->count || value < m->min) m->min = value;
+   if (value > m->max) m->max = value;
+   m->sum += value;
+   m->count++;
+   m->bucket[_pndman_metrics_bucket(value)]++;
+   METRICS_UNLOCK();
+}
+
+/* \brief record time elapsed since start to metric,
+ * and trace span with name and detail if tracing */
+void _pndman_metrics_time(pndman_metric metric, const char *name, const char *detail, uint64_t start)
+{
+   uint64_t now;
+   if (!_pndman_metrics_enabled) return;
+
+   now = _pndman_metrics_now();
+   _pndman_metrics_add(metric, now - start);
+   _pndman_metrics_span(name, detail, start, now - start);
+}
+
+/* \brief record trace span */
+void _pndman_metrics_span(const char *name, const char *detail, uint64_t start, uint64_t duration)
+{
+   _pndman_trace_span *s;
+   assert(name);
+   if (!_pndman_metrics_tracing) return;
+
+   METRICS_LOCK();
+   if (_pndman_metrics_span_count == _pndman_metrics_span_alloc) {
+      size_t alloc = (_pndman_metrics_span_alloc ? _pndman_metrics_span_alloc * 2 : 256);
+      if (!(s = realloc(_pndman_metrics_spans, alloc * sizeof(_pndman_trace_span))))
+         goto out;
+      _pndman_metrics_spans = s;
+      _pndman_metrics_span_alloc = alloc;
+   }
+
+   s = &_pndman_metrics_spans[_pndman_metrics_span_count++];
+   s->name     = name;
+   s->detail   = (detail ? strdup(detail) : NULL);
+   s->start    = start;
+   s->duration = duration;
+out:
+   METRICS_UNLOCK();
+}
+
+/* \brief count downloaded bytes for repository */
+void _pndman_metrics_bytes(const char *repository, uint64_t bytes)
+{
+   _pndman_metrics_repository *r;
+   if (!_pndman_metrics_enabled || !bytes) return;
+
+   _pndman_metrics_add(PNDMAN_METRIC_BYTES_DOWNLOADED, bytes);
+   if (!repository) return;
+
+   METRICS_LOCK();
+   for (r = _pndman_metrics_repositories; r && strcmp(r->url, repository); r = r->next);
+   if (!r && (r = calloc(1, sizeof(_pndman_metrics_repository)))) {
+      if (!(r->url = strdup(repository))) {
+         NULLDO(free, r);
+      } else {
+         r->next = _pndman_metrics_repositories;
+         _pndman_metrics_repositories = r;
+      }
+   }
+   if (r) r->bytes += bytes;
+   METRICS_UNLOCK();
+}
+
+/* PUBLIC API */
+
+/* \brief enable or disable metrics collection */
+PNDMANAPI void pndman_metrics_enable(int enable)
+{
+   _pndman_metrics_enabled = enable;
+}
+
+/* \brief enable or disable recording of trace spans */
+PNDMANAPI void pndman_metrics_trace(int enable)
+{
+   if (enable) _pndman_metrics_enabled = 1;
+   _pndman_metrics_tracing = enable;
+}
+
+/* \brief clear collected metrics and spans */
+PNDMANAPI void pndman_metrics_reset(void)
+{
+   _pndman_metrics_repository *r, *rn;
+
+   METRICS_LOCK();
+   memset(_pndman_metrics, 0, sizeof(_pndman_metrics));
+   for (r = _pndman_metrics_repositories; r; r = rn) {
+      rn = r->next;
+      free(r->url);
+      free(r);
+   }
+   _pndman_metrics_repositories = NULL;
+   _pndman_metrics_free_spans();
+   METRICS_UNLOCK();
+}
+
+/* \brief get value of metric */
+PNDMANAPI int pndman_metrics_get(pndman_metric metric, pndman_metric_value *value)
+{
+   CHECKUSE(value);
+   if (metric >= PNDMAN_METRIC_COUNT)
+      return RETURN_FAIL;
+
+   METRICS_LOCK();
+   memcpy(value, &_pndman_metrics[metric], sizeof(pndman_metric_value));
+   METRICS_UNLOCK();
+   value->name = _pndman_metric_name[metric];
+   return RETURN_OK;
+}
+
+/* \brief get bytes downloaded from repository */
+PNDMANAPI uint64_t pndman_metrics_get_repository_bytes(const char *url)
+{
+   uint64_t bytes = 0;
+   _pndman_metrics_repository *r;
+   if (!url) return 0;
+
+   METRICS_LOCK();
+   for (r = _pndman_metrics_repositories; r && strcmp(r->url, url); r = r->next);
+   if (r) bytes = r->bytes;
+   METRICS_UNLOCK();
+   return bytes;
+}
+
+/* \brief write recorded spans as Chrome trace JSON,
+ * loadable in chrome://tracing and Perfetto */
+PNDMANAPI int pndman_metrics_trace_dump(const char *path)
+{
+   FILE *f;
+   size_t i;
+   _pndman_trace_span *s;
+   CHECKUSE(path);
+
+   if (!(f = fopen(path, "w")))
+      goto write_fail;
+
+   METRICS_LOCK();
+   fputs("{\"traceEvents\":[\n", f);
+   for (i = 0; i != _pndman_metrics_span_count; ++i) {
+      s = &_pndman_metrics_spans[i];
+      fputs("{\"name\":", f);
+      _pndman_metrics_fputs(s->name, f);
+      fprintf(f, ",\"cat\":\"pndman\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+            "\"ts\":%"PRIu64",\"dur\":%"PRIu64, s->start, s->duration);
+      if (s->detail) {
+         fputs(",\"args\":{\"detail\":", f);
+         _pndman_metrics_fputs(s->detail, f);
+         fputc('}', f);
+      }
+      fprintf(f, "}%s\n", (i + 1 != _pndman_metrics_span_count ? "," : ""));
+   }
+   fputs("],\"displayTimeUnit\":\"ms\"}\n", f);
+   METRICS_UNLOCK();
+
+   fclose(f);
+   return RETURN_OK;
+
+write_fail:
+   DEBFAIL(WRITE_FAIL, path);
+   return RETURN_FAIL;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,345 @@
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef __linux__
+#  define PNDMAN_MONITOR_MOUNTINFO "/proc/self/mountinfo"
+#endif
+
+/* \brief one line of mount table */
+typedef struct _pndman_mount
+{
+   int id; /* unique for each mount, new card gets new id */
+   char *dir;
+   char *fsname;
+   struct _pndman_mount *next;
+} _pndman_mount;
+
+/* \brief monitor of mounted devices */
+struct pndman_device_monitor
+{
+   int fd;
+   int full;
+   pndman_device *device;
+   pndman_repository *local;
+   pndman_watch *watch;
+   pndman_device_monitor_callback callback;
+   void *user_data;
+   _pndman_mount *mount;
+};
+
+#ifdef PNDMAN_MONITOR_MOUNTINFO
+/* \brief free mount table */
+static void _pndman_mount_free_all(_pndman_mount *mount)
+{
+   _pndman_mount *next;
+   for (; mount; mount = next) {
+      next = mount->next;
+      IFDO(free, mount->dir);
+      IFDO(free, mount->fsname);
+      free(mount);
+   }
+}
+
+/* \brief find mount by id */
+static _pndman_mount* _pndman_mount_get(_pndman_mount *mount, int id)
+{
+   for (; mount && mount->id != id; mount = mount->next);
+   return mount;
+}
+
+/* \brief decode \040 style escapes of mountinfo in place */
+static void _pndman_mount_unescape(char *str)
+{
+   char *w = str;
+   for (; *str; ++str, ++w) {
+      if (str[0] == '\\' &&
+          str[1] >= '0' && str[1] <= '7' &&
+          str[2] >= '0' && str[2] <= '7' &&
+          str[3] >= '0' && str[3] <= '7') {
+         *w = (char)((str[1]-'0')*64 + (str[2]-'0')*8 + (str[3]-'0'));
+         str += 3;
+      } else *w = *str;
+   }
+   *w = 0;
+}
+
+/* \brief parse line of mountinfo,
+ * id parent major:minor root dir options [optional] - type fsname options */
+static _pndman_mount* _pndman_mount_parse(char *line)
+{
+   _pndman_mount *mount;
+   char *sep, *save, *id, *dir, *fsname;
+   int i;
+
+   if (!(sep = strstr(line, " - ")))
+      return NULL;
+   *sep = 0;
+
+   if (!(id = strtok_r(line, " ", &save)))
+      return NULL;
+   for (i = 0; i < 3 && strtok_r(NULL, " ", &save); ++i);
+   if (i != 3 || !(dir = strtok_r(NULL, " ", &save)))
+      return NULL;
+   if (!strtok_r(sep + 3, " ", &save) || !(fsname = strtok_r(NULL, " ", &save)))
+      return NULL;
+
+   if (!(mount = calloc(1, sizeof(_pndman_mount))))
+      return NULL;
+   _pndman_mount_unescape(dir);
+   _pndman_mount_unescape(fsname);
+   mount->id     = atoi(id);
+   mount->dir    = strdup(dir);
+   mount->fsname = strdup(fsname);
+   if (!mount->dir || !mount->fsname) {
+      _pndman_mount_free_all(mount);
+      return NULL;
+   }
+   return mount;
+}
+
+/* \brief read whole mount table, this also
+ * acknowledges the change that woke us up */
+static int _pndman_mount_read(int fd, _pndman_mount **out)
+{
+   _pndman_mount *list = NULL, *mount;
+   char *buffer = NULL, *tmp, *line, *save;
+   size_t size = 0, len = 0;
+   ssize_t r;
+   assert(out);
+
+   if (lseek(fd, 0, SEEK_SET) == -1)
+      goto read_fail;
+
+   do {
+      if (len + 1 >= size) {
+         size = (size ? size * 2 : 4096);
+         if (!(tmp = realloc(buffer, size)))
+            goto fail;
+         buffer = tmp;
+      }
+      if ((r = read(fd, buffer + len, size - len - 1)) < 0) {
+         if (errno == EINTR) continue;
+         goto read_fail;
+      }
+      len += r;
+   } while (r > 0);
+   buffer[len] = 0;
+
+   for (line = strtok_r(buffer, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+      if (!(mount = _pndman_mount_parse(line))) continue;
+      mount->next = list;
+      list = mount;
+   }
+
+   free(buffer);
+   *out = list;
+   return RETURN_OK;
+
+read_fail:
+   DEBFAIL(MONITOR_READ_FAIL, strerror(errno));
+   IFDO(free, buffer);
+   return RETURN_FAIL;
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "mount table");
+   IFDO(free, buffer);
+   return RETURN_FAIL;
+}
+
+/* \brief find device with mount */
+static pndman_device* _pndman_monitor_find(pndman_device_monitor *object, const char *dir)
+{
+   pndman_device *d;
+   for (d = object->device; d && (!d->mount || strcmp(d->mount, dir)); d = d->next);
+   return d;
+}
+
+/* \brief tell application about change */
+static void _pndman_monitor_notify(pndman_device_monitor *object, pndman_device_event event, pndman_device *device)
+{
+   if (object->callback) object->callback(event, device, object->user_data);
+}
+
+/* \brief mount appeared, add it when it can hold PNDs */
+static int _pndman_monitor_add(pndman_device_monitor *object, _pndman_mount *mount)
+{
+   pndman_device *d = object->device;
+
+   if (_pndman_monitor_find(object, mount->dir))
+      return 0;
+   if (!_pndman_device_add_mount(mount->fsname, mount->dir, &d))
+      return 0;
+   if (!object->device) object->device = d;
+
+   DEBUG(PNDMAN_LEVEL_CRAP, "monitor: added %s", d->mount);
+   if (object->local) pndman_package_crawl(object->full, d, object->local);
+   if (object->watch) pndman_watch_add_device(object->watch, d);
+   _pndman_monitor_notify(object, PNDMAN_DEVICE_ADDED, d);
+   return 1;
+}
+
+/* \brief mount went away, remove its device and PNDs */
+static int _pndman_monitor_remove(pndman_device_monitor *object, _pndman_mount *mount)
+{
+   pndman_device *d;
+   pndman_package *p, *pi;
+
+   if (!(d = _pndman_monitor_find(object, mount->dir)))
+      return 0;
+
+   DEBUG(PNDMAN_LEVEL_CRAP, "monitor: removed %s", d->mount);
+   _pndman_monitor_notify(object, PNDMAN_DEVICE_REMOVED, d);
+   if (object->watch) pndman_watch_remove_device(object->watch, d);
+
+   /* freeing may relink the lists, start over after each */
+again:
+   if (object->local) {
+      for (p = object->local->pnd; p; p = p->next)
+         for (pi = p; pi; pi = pi->next_installed)
+            if (pi->mount && !strcmp(pi->mount, d->mount)) {
+               _pndman_repository_free_pnd(pi, object->local);
+               goto again;
+            }
+   }
+
+   object->device = pndman_device_free(d);
+   return 1;
+}
+#endif
+
+/* API */
+
+/* \brief create monitor of mounted devices */
+PNDMANAPI pndman_device_monitor* pndman_device_monitor_new(pndman_device *list)
+{
+#ifdef PNDMAN_MONITOR_MOUNTINFO
+   pndman_device_monitor *object;
+   _pndman_mount *m;
+
+   if (!(object = calloc(1, sizeof(pndman_device_monitor))))
+      goto fail;
+
+   object->device = (list ? _pndman_device_first(list) : NULL);
+   if ((object->fd = open(PNDMAN_MONITOR_MOUNTINFO, O_RDONLY | O_CLOEXEC)) == -1)
+      goto open_fail;
+
+   if (_pndman_mount_read(object->fd, &object->mount) != RETURN_OK)
+      goto read_fail;
+
+   /* mounts already there, as pndman_device_detect would */
+   for (m = object->mount; m; m = m->next)
+      _pndman_monitor_add(object, m);
+
+   return object;
+
+open_fail:
+   DEBFAIL(MONITOR_INIT_FAIL, strerror(errno));
+read_fail:
+   if (object->fd != -1) close(object->fd);
+   free(object);
+   return NULL;
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "pndman_device_monitor");
+   return NULL;
+#else
+   (void)list;
+   DEBFAIL(MONITOR_NOT_SUPPORTED);
+   return NULL;
+#endif
+}
+
+/* \brief set callback of monitor */
+PNDMANAPI void pndman_device_monitor_set_callback(pndman_device_monitor *monitor,
+      pndman_device_monitor_callback callback, void *user_data)
+{
+   CHECKUSEV(monitor);
+   monitor->callback  = callback;
+   monitor->user_data = user_data;
+}
+
+/* \brief crawl current and added devices to local repository */
+PNDMANAPI void pndman_device_monitor_set_crawl(pndman_device_monitor *monitor,
+      pndman_repository *local, int full_crawl)
+{
+   pndman_device *d;
+   CHECKUSEV(monitor);
+   monitor->local = (local ? _pndman_repository_first(local) : NULL);
+   monitor->full  = full_crawl;
+   if (!monitor->local) return;
+
+   /* devices found by pndman_device_monitor_new weren't crawled yet */
+   for (d = monitor->device; d; d = d->next)
+      pndman_package_crawl(monitor->full, d, monitor->local);
+}
+
+/* \brief keep watcher in sync with added and removed devices */
+PNDMANAPI void pndman_device_monitor_set_watch(pndman_device_monitor *monitor, pndman_watch *watch)
+{
+   CHECKUSEV(monitor);
+   monitor->watch = watch;
+}
+
+/* \brief first device of monitored list */
+PNDMANAPI pndman_device* pndman_device_monitor_get_devices(pndman_device_monitor *monitor)
+{
+   CHECKUSEP(monitor);
+   return monitor->device;
+}
+
+/* \brief fd that signals POLLPRI when mount table changes */
+PNDMANAPI int pndman_device_monitor_get_fd(pndman_device_monitor *monitor)
+{
+   CHECKUSE(monitor);
+   return monitor->fd;
+}
+
+/* \brief apply mount table changes to device list */
+PNDMANAPI int pndman_device_monitor_dispatch(pndman_device_monitor *monitor)
+{
+#ifdef PNDMAN_MONITOR_MOUNTINFO
+   _pndman_mount *now, *m;
+   pndman_device *d;
+   int ret = 0;
+   CHECKUSE(monitor);
+
+   if (_pndman_mount_read(monitor->fd, &now) != RETURN_OK)
+      return RETURN_FAIL;
+
+   for (m = monitor->mount; m; m = m->next)
+      if (!_pndman_mount_get(now, m->id))
+         ret += _pndman_monitor_remove(monitor, m);
+
+   for (m = now; m; m = m->next)
+      if (!_pndman_mount_get(monitor->mount, m->id))
+         ret += _pndman_monitor_add(monitor, m);
+
+   /* remounts and card swaps change space too */
+   for (d = monitor->device; d; d = d->next)
+      _pndman_device_update(d);
+
+   _pndman_mount_free_all(monitor->mount);
+   monitor->mount = now;
+   return ret;
+#else
+   (void)monitor;
+   return 0;
+#endif
+}
+
+/* \brief free monitor */
+PNDMANAPI void pndman_device_monitor_free(pndman_device_monitor *monitor)
+{
+   CHECKUSEV(monitor);
+#ifdef PNDMAN_MONITOR_MOUNTINFO
+   _pndman_mount_free_all(monitor->mount);
+   if (monitor->fd != -1) close(monitor->fd);
+#endif
+   free(monitor);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -10,6 +10,98 @@
 #  include <malloc.h>
 #endif
 
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+static pthread_mutex_t _pndman_observer_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define OBSERVER_LOCK()   pthread_mutex_lock(&_pndman_observer_mutex)
+#  define OBSERVER_UNLOCK() pthread_mutex_unlock(&_pndman_observer_mutex)
+#else
+#  define OBSERVER_LOCK()
+#  define OBSERVER_UNLOCK()
+#endif
+
+/* \brief registered observer of repository packages */
+typedef struct _pndman_observer
+{
+   _pndman_package_observer func;
+   void *user_data;
+   struct _pndman_observer *next;
+} _pndman_observer;
+
+/* \brief observers of every repository */
+static _pndman_observer *_pndman_observers = NULL;
+
+/* \brief observe packages of repositories,
+ * indexes use this to follow syncs, crawls and installs */
+int _pndman_package_observe(_pndman_package_observer func, void *user_data)
+{
+   _pndman_observer *o;
+   assert(func);
+
+   if (!(o = calloc(1, sizeof(_pndman_observer))))
+      goto fail;
+
+   o->func      = func;
+   o->user_data = user_data;
+   OBSERVER_LOCK();
+   o->next = _pndman_observers;
+   _pndman_observers = o;
+   OBSERVER_UNLOCK();
+   return RETURN_OK;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "observer");
+   return RETURN_FAIL;
+}
+
+/* \brief stop observing packages */
+void _pndman_package_unobserve(_pndman_package_observer func, void *user_data)
+{
+   _pndman_observer *o, *prev = NULL;
+
+   OBSERVER_LOCK();
+   for (o = _pndman_observers; o && (o->func != func || o->user_data != user_data); prev = o, o = o->next);
+   if (o) {
+      if (prev) prev->next = o->next;
+      else _pndman_observers = o->next;
+      free(o);
+   }
+   OBSERVER_UNLOCK();
+}
+
+/* \brief hold observers back, while observer state is rebuilt.
+ * observers run on thread of any context, so this is global */
+void _pndman_package_observe_lock(void)
+{
+   OBSERVER_LOCK();
+}
+
+/* \brief let observers run again */
+void _pndman_package_observe_unlock(void)
+{
+   OBSERVER_UNLOCK();
+}
+
+/* \brief tell observers package of repository was filled or is going away,
+ * packages outside repositories are not observed */
+void _pndman_package_notify(_pndman_package_event event, pndman_package *pnd)
+{
+   _pndman_observer *o;
+   assert(pnd);
+
+   /* resolve preferred title and description while data is fresh */
+   if (event == PNDMAN_PACKAGE_CHANGED)
+      _pndman_locale_resolve(pnd);
+
+   if (!pnd->repositoryptr || !_pndman_observers)
+      return;
+
+   OBSERVER_LOCK();
+   for (o = _pndman_observers; o; o = o->next)
+      o->func(event, pnd, o->user_data);
+   OBSERVER_UNLOCK();
+}
+
 /* \brief compare package versions, return 1 on newer, 0 otherwise
  * NOTE: lp == package to use as base, rp == package to compare against
  *       so rp > lp == 1 */
@@ -156,7 +248,7 @@ static void _pndman_init_author(pndman_author *author)
 
 static void _pndman_free_author(pndman_author *author)
 {
-   IFDO(free, author->name);
+   IFDO(_pndman_intern_release, author->name);
    IFDO(free, author->website);
    IFDO(free, author->email);
 }
@@ -164,10 +256,7 @@ static void _pndman_free_author(pndman_author *author)
 /* \brief Copy author struct */
 static void _pndman_copy_author(pndman_author *dst, pndman_author *src)
 {
-   if (src->name) {
-      IFDO(free, dst->name);
-      dst->name = strdup(src->name);
-   }
+   if (src->name) _pndman_intern_set(&dst->name, src->name);
    if (src->website) {
       IFDO(free, dst->website);
       dst->website = strdup(src->website);
@@ -224,7 +313,7 @@ fail:
 
 static void _pndman_free_translated(pndman_translated *t)
 {
-   IFDO(free, t->lang);
+   IFDO(_pndman_intern_release, t->lang);
    IFDO(free, t->string);
 }
 
@@ -237,7 +326,7 @@ static pndman_translated* _pndman_copy_translated(pndman_translated *src)
    if (!(t = calloc(1, sizeof(pndman_translated))))
       goto fail;
 
-   if (src->lang) t->lang = strdup(src->lang);
+   if (src->lang) t->lang = _pndman_intern(src->lang);
    if (src->string) t->string = strdup(src->string);
    t->next = _pndman_copy_translated(src->next);
 
@@ -264,7 +353,7 @@ fail:
 
 static void _pndman_free_license(pndman_license *l)
 {
-   IFDO(free, l->name);
+   IFDO(_pndman_intern_release, l->name);
    IFDO(free, l->url);
    IFDO(free, l->sourcecodeurl);
 }
@@ -278,7 +367,7 @@ static pndman_license* _pndman_copy_license(pndman_license *src)
    if (!(l = calloc(1, sizeof(pndman_license))))
       goto fail;
 
-   if (src->name) l->name = strdup(src->name);
+   if (src->name) l->name = _pndman_intern(src->name);
    if (src->url) l->url = strdup(src->url);
    if (src->sourcecodeurl) l->sourcecodeurl = strdup(src->sourcecodeurl);
    l->next = _pndman_copy_license(src->next);
@@ -384,8 +473,8 @@ fail:
 
 static void _pndman_free_category(pndman_category *cat)
 {
-   IFDO(free, cat->main);
-   IFDO(free, cat->sub);
+   IFDO(_pndman_intern_release, cat->main);
+   IFDO(_pndman_intern_release, cat->sub);
 }
 
 /* \brief Internal copy of pndman_category */
@@ -397,8 +486,8 @@ static pndman_category* _pndman_copy_category(pndman_category *src)
    if (!(c = calloc(1, sizeof(pndman_category))))
       goto fail;
 
-   if (src->main) c->main = strdup(src->main);
-   if (src->sub) c->sub = strdup(src->sub);
+   if (src->main) c->main = _pndman_intern(src->main);
+   if (src->sub) c->sub = _pndman_intern(src->sub);
    c->next = _pndman_copy_category(src->next);
    return c;
 
@@ -524,42 +613,38 @@ int _pndman_copy_pnd(pndman_package *pnd, pndman_package *src)
       IFDO(free, pnd->url);
       pnd->url = strdup(src->url);
    }
-   if (src->vendor) {
-      IFDO(free, pnd->vendor);
-      pnd->vendor = strdup(src->vendor);
-   }
+   if (src->vendor) _pndman_intern_set(&pnd->vendor, src->vendor);
    if (src->icon) {
       IFDO(free, pnd->icon);
       pnd->icon = strdup(src->icon);
    }
-   if (src->repository) {
-      IFDO(free, pnd->repository);
-      pnd->repository = strdup(src->repository);
-   }
-   if (src->mount) {
-      IFDO(free, pnd->mount);
-      pnd->mount = strdup(src->mount);
-   }
+   if (src->repository) _pndman_intern_set(&pnd->repository, src->repository);
+   if (src->mount) _pndman_intern_set(&pnd->mount, src->mount);
 
    _pndman_copy_author(&pnd->author, &src->author);
    _pndman_copy_version(&pnd->version, &src->version);
 
    /* TODO: merge non existant ones instead? */
-   if (!pnd->app)
+   /* lists are shared, packages copy them before changing (see share.c) */
+   if (!pnd->app && !(pnd->app = _pndman_share(src->app)))
       pnd->app          = _pndman_copy_application(src->app);
 
-   if (!pnd->title)
+   pnd->locale_serial = 0;
+   if (!pnd->title && !(pnd->title = _pndman_share(src->title)))
       pnd->title        = _pndman_copy_translated(src->title);
-   if (!pnd->description)
-      pnd->description  = _pndman_copy_translated(src->description);
+   if (!pnd->description) {
+      if (!(pnd->description = _pndman_share(src->description)))
+         pnd->description  = _pndman_copy_translated(src->description);
+      _pndman_lazy_copy(pnd, src);
+   }
 
-   if (!pnd->license)
+   if (!pnd->license && !(pnd->license = _pndman_share(src->license)))
       pnd->license      = _pndman_copy_license(src->license);
 
-   if (!pnd->previewpic)
+   if (!pnd->previewpic && !(pnd->previewpic = _pndman_share(src->previewpic)))
       pnd->previewpic   = _pndman_copy_previewpic(src->previewpic);
 
-   if (!pnd->category)
+   if (!pnd->category && !(pnd->category = _pndman_share(src->category)))
       pnd->category     = _pndman_copy_category(src->category);
 
    if (src->size)
@@ -581,12 +666,13 @@ void _pndman_package_free_titles(pndman_package *pnd)
 {
    pndman_translated  *t, *tn;
 
-   /* free titles */
-   t = pnd->title;
+   /* free titles, unless other packages still use them */
+   t = (_pndman_share_release(pnd->title) ? pnd->title : NULL);
    for (; t; t = tn)
    { tn = t->next; _pndman_free_translated(t); free(t); }
 
    pnd->title = NULL;
+   pnd->locale_serial = 0;
 }
 
 /* \brief Internal free of pndman_package's descriptions */
@@ -594,12 +680,13 @@ void _pndman_package_free_descriptions(pndman_package *pnd)
 {
    pndman_translated  *t, *tn;
 
-   /* free descriptions */
-   t = pnd->description;
+   /* free descriptions, unless other packages still use them */
+   t = (_pndman_share_release(pnd->description) ? pnd->description : NULL);
    for (; t; t = tn)
    { tn = t->next; _pndman_free_translated(t); free(t); }
 
    pnd->description = NULL;
+   pnd->locale_serial = 0;
 }
 
 /* \brief Internal free of pndman_package's previewpics */
@@ -607,8 +694,8 @@ void _pndman_package_free_previewpics(pndman_package *pnd)
 {
    pndman_previewpic  *p, *pn;
 
-   /* free previewpics */
-   p = pnd->previewpic;
+   /* free previewpics, unless other packages still use them */
+   p = (_pndman_share_release(pnd->previewpic) ? pnd->previewpic : NULL);
    for (; p; p = pn)
    { pn = p->next; _pndman_free_previewpic(p); free(p); }
 
@@ -620,8 +707,8 @@ void _pndman_package_free_licenses(pndman_package *pnd)
 {
    pndman_license  *l, *ln;
 
-   /* free licenses */
-   l = pnd->license;
+   /* free licenses, unless other packages still use them */
+   l = (_pndman_share_release(pnd->license) ? pnd->license : NULL);
    for (; l; l = ln)
    { ln = l->next; _pndman_free_license(l); free(l); }
 
@@ -633,8 +720,8 @@ void _pndman_package_free_categories(pndman_package *pnd)
 {
    pndman_category  *c, *cn;
 
-   /* free categoires */
-   c = pnd->category;
+   /* free categoires, unless other packages still use them */
+   c = (_pndman_share_release(pnd->category) ? pnd->category : NULL);
    for (; c; c = cn)
    { cn = c->next; _pndman_free_category(c);; free(c); }
 
@@ -751,12 +838,84 @@ void _pndman_package_free_applications(pndman_package *pnd)
 {
    pndman_application *a, *an;
    assert(pnd);
-   a = pnd->app;
+   a = (_pndman_share_release(pnd->app) ? pnd->app : NULL);
    for (; a; a = an)
    { an = a->next; _pndman_free_application(a); }
    pnd->app = NULL;
 }
 
+/* \brief Internal copy of shared titles, before changing them in place */
+void _pndman_package_own_titles(pndman_package *pnd)
+{
+   pndman_translated *copy;
+   assert(pnd);
+
+   if (!_pndman_shared(pnd->title)) return;
+   copy = _pndman_copy_translated(pnd->title);
+   _pndman_package_free_titles(pnd);
+   pnd->title = copy;
+}
+
+/* \brief Internal copy of shared descriptions, before changing them in place */
+void _pndman_package_own_descriptions(pndman_package *pnd)
+{
+   pndman_translated *copy;
+   assert(pnd);
+
+   if (!_pndman_shared(pnd->description)) return;
+   copy = _pndman_copy_translated(pnd->description);
+   _pndman_package_free_descriptions(pnd);
+   pnd->description = copy;
+}
+
+/* \brief Internal copy of shared previewpics, before changing them in place */
+void _pndman_package_own_previewpics(pndman_package *pnd)
+{
+   pndman_previewpic *copy;
+   assert(pnd);
+
+   if (!_pndman_shared(pnd->previewpic)) return;
+   copy = _pndman_copy_previewpic(pnd->previewpic);
+   _pndman_package_free_previewpics(pnd);
+   pnd->previewpic = copy;
+}
+
+/* \brief Internal copy of shared licenses, before changing them in place */
+void _pndman_package_own_licenses(pndman_package *pnd)
+{
+   pndman_license *copy;
+   assert(pnd);
+
+   if (!_pndman_shared(pnd->license)) return;
+   copy = _pndman_copy_license(pnd->license);
+   _pndman_package_free_licenses(pnd);
+   pnd->license = copy;
+}
+
+/* \brief Internal copy of shared categories, before changing them in place */
+void _pndman_package_own_categories(pndman_package *pnd)
+{
+   pndman_category *copy;
+   assert(pnd);
+
+   if (!_pndman_shared(pnd->category)) return;
+   copy = _pndman_copy_category(pnd->category);
+   _pndman_package_free_categories(pnd);
+   pnd->category = copy;
+}
+
+/* \brief Internal copy of shared applications, before changing them in place */
+void _pndman_package_own_applications(pndman_package *pnd)
+{
+   pndman_application *copy;
+   assert(pnd);
+
+   if (!_pndman_shared(pnd->app)) return;
+   copy = _pndman_copy_application(pnd->app);
+   _pndman_package_free_applications(pnd);
+   pnd->app = copy;
+}
+
 /* \brief Internal free of pndman_package */
 pndman_package* _pndman_free_pnd(pndman_package *pnd)
 {
@@ -765,15 +924,18 @@ pndman_package* _pndman_free_pnd(pndman_package *pnd)
    /* should never be null */
    assert(pnd);
 
+   _pndman_package_notify(PNDMAN_PACKAGE_FREED, pnd);
+   _pndman_lazy_forget(pnd);
+
    IFDO(free, pnd->path);
    IFDO(free, pnd->id);
    IFDO(free, pnd->icon);
    IFDO(free, pnd->info);
    IFDO(free, pnd->md5);
    IFDO(free, pnd->url);
-   IFDO(free, pnd->vendor);
-   IFDO(free, pnd->repository);
-   IFDO(free, pnd->mount);
+   IFDO(_pndman_intern_release, pnd->vendor);
+   IFDO(_pndman_intern_release, pnd->repository);
+   IFDO(_pndman_intern_release, pnd->mount);
 
    /* this is no longer a valid update */
    if (pnd->update) pnd->update->update = NULL;
@@ -805,7 +967,11 @@ pndman_translated* _pndman_package_new_title(pndman_package *pnd)
    /* should not be null */
    assert(pnd);
 
+   /* append to private copy */
+   _pndman_package_own_titles(pnd);
+
    /* how to allocate? */
+   pnd->locale_serial = 0;
    if (!pnd->title) t = pnd->title = _pndman_translated_new();
    else {
       /* find last */
@@ -826,7 +992,11 @@ pndman_translated* _pndman_package_new_description(pndman_package *pnd)
    /* should not be null */
    assert(pnd);
 
+   /* append to private copy */
+   _pndman_package_own_descriptions(pnd);
+
    /* how to allocate? */
+   pnd->locale_serial = 0;
    if (!pnd->description) t = pnd->description = _pndman_translated_new();
    else {
       /* find last */
@@ -847,6 +1017,9 @@ pndman_license* _pndman_package_new_license(pndman_package *pnd)
    /* should not be null */
    assert(pnd);
 
+   /* append to private copy */
+   _pndman_package_own_licenses(pnd);
+
    /* how to allocate? */
    if (!pnd->license) l = pnd->license = _pndman_license_new();
    else {
@@ -868,6 +1041,9 @@ pndman_previewpic* _pndman_package_new_previewpic(pndman_package *pnd)
    /* should not be null */
    assert(pnd);
 
+   /* append to private copy */
+   _pndman_package_own_previewpics(pnd);
+
    /* how to allocate? */
    if (!pnd->previewpic) p = pnd->previewpic = _pndman_previewpic_new();
    else {
@@ -889,6 +1065,9 @@ pndman_category* _pndman_package_new_category(pndman_package *pnd)
    /* should not be null */
    assert(pnd);
 
+   /* append to private copy */
+   _pndman_package_own_categories(pnd);
+
    /* how to allocate? */
    if (!pnd->category) c = pnd->category = _pndman_category_new();
    else {
@@ -910,6 +1089,9 @@ pndman_application* _pndman_package_new_application(pndman_package *pnd)
    /* should not be null */
    assert(pnd);
 
+   /* append to private copy */
+   _pndman_package_own_applications(pnd);
+
    /* how to allocate? */
    if (!pnd->app) app = pnd->app = _pndman_new_application();
    else {
@@ -1073,4 +1255,66 @@ const char* pndman_package_fill_md5(pndman_package *pnd)
    return pnd->md5;
 }
 
+/* \brief user data of md5 batch */
+typedef struct _pndman_md5_batch_data
+{
+   pndman_package **pnds;
+   pndman_md5_callback callback;
+   void *user_data;
+} _pndman_md5_batch_data;
+
+/* \brief store md5 from batch to its PND */
+static void _pndman_package_md5_done(size_t index, size_t done, size_t total,
+      const char *md5, void *user_data)
+{
+   _pndman_md5_batch_data *data = user_data;
+   pndman_package *pnd = data->pnds[index];
+
+   if (pnd && md5) {
+      IFDO(free, pnd->md5);
+      pnd->md5 = strdup(md5);
+   }
+
+   if (pnd && data->callback)
+      data->callback(pnd, done, total, (md5 ? pnd->md5 : NULL), data->user_data);
+}
+
+/* \brief calculate md5 for many PNDs at once */
+PNDMANAPI int pndman_package_fill_md5_batch(pndman_package **pnds, size_t count,
+      unsigned int threads, pndman_md5_callback callback, void *user_data)
+{
+   size_t i;
+   int ret;
+   char **paths = NULL, **results = NULL;
+   _pndman_md5_batch_data data;
+   CHECKUSE(pnds);
+
+   if (!count) return 0;
+   if (!(paths = calloc(count, sizeof(char*))) ||
+       !(results = calloc(count, sizeof(char*))))
+      goto fail;
+
+   for (i = 0; i != count; ++i)
+      if (pnds[i]) paths[i] = _pndman_pnd_get_path(pnds[i]);
+
+   data.pnds      = pnds;
+   data.callback  = callback;
+   data.user_data = user_data;
+   ret = _pndman_md5_batch((const char**)paths, results, count,
+         threads, _pndman_package_md5_done, &data);
+
+   for (i = 0; i != count; ++i) {
+      IFDO(free, paths[i]);
+      IFDO(free, results[i]);
+   }
+   free(paths);
+   free(results);
+   return ret;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "md5 batch");
+   IFDO(free, paths);
+   return RETURN_FAIL;
+}
+
 /* vim: set ts=8 sw=3 tw=0 :*/
@@ -6,6 +6,7 @@
 #include <ctype.h>
 #include <stdarg.h>
 #include <assert.h>
+#include <limits.h>
 
 /* \brief internal verbose level */
 static int _PNDMAN_VERBOSE = 0;
@@ -13,12 +14,17 @@ static int _PNDMAN_VERBOSE = 0;
 /* \brief internal color output */
 static int _PNDMAN_COLOR = 1;
 
-/* \brief curl timeout */
-static int _PNDMAN_CURL_TIMEOUT = 0;
-
 /* \brief internal debug hook function */
 static PNDMAN_DEBUG_HOOK_FUNC _PNDMAN_DEBUG_HOOK = NULL;
 
+/* \brief structured debug hook function */
+static PNDMAN_DEBUG_EVENT_FUNC _PNDMAN_DEBUG_EVENT_HOOK = NULL;
+static void *_PNDMAN_DEBUG_EVENT_DATA = NULL;
+
+/* \brief messages below this level are passed to _pndman_debug_hook,
+ * checked by the DEBUG macros before any arguments are evaluated */
+int _pndman_debug_threshold = 0;
+
 /* \brief strstr strings in uppercase */
 char* _strupstr(const char *hay, const char *needle)
 {
@@ -46,6 +52,13 @@ int _strupcmp(const char *hay, const char *needle)
    return RETURN_FALSE;
 }
 
+/* \brief order strings in uppercase, like strcmp, for sorting */
+int _strupord(const char *a, const char *b)
+{
+   for (; *a && toupper((unsigned char)*a) == toupper((unsigned char)*b); ++a, ++b);
+   return toupper((unsigned char)*a) - toupper((unsigned char)*b);
+}
+
 /* \brief strncmp strings in uppercase, NOTE: returns 0 on found else 1 (so you don't mess up with strcmp) */
 int _strnupcmp(const char *hay, const char *needle, size_t len)
 {
@@ -182,6 +195,16 @@ inline static void _pndman_normal(void)
 #endif
 }
 
+/* \brief update debug threshold,
+ * hooks get every message, stdout only up to verbose level */
+static void _pndman_debug_update_threshold(void)
+{
+   if (_PNDMAN_DEBUG_HOOK || _PNDMAN_DEBUG_EVENT_HOOK)
+      _pndman_debug_threshold = INT_MAX;
+   else
+      _pndman_debug_threshold = _PNDMAN_VERBOSE;
+}
+
 /* \brief handle debug hook for client
  * (printf syntax) */
 void _pndman_debug_hook(const char *file, int line,
@@ -196,16 +219,25 @@ void _pndman_debug_hook(const char *file, int line,
    assert(function);
    assert(fmt);
 
-   memset(buffer, 0, LINE_MAX);
+   /* structured hook gets raw arguments, formatting is up to it */
+   if (_PNDMAN_DEBUG_EVENT_HOOK) {
+      va_start(args, fmt);
+      _PNDMAN_DEBUG_EVENT_HOOK(file, line, function,
+            verbose_level, fmt, args, _PNDMAN_DEBUG_EVENT_DATA);
+      va_end(args);
+      if (!_PNDMAN_DEBUG_HOOK) return;
+   }
+
+   /* no hook, handle it internally */
+   if (!_PNDMAN_DEBUG_HOOK && _PNDMAN_VERBOSE <= verbose_level)
+      return;
+
    va_start(args, fmt);
-   vsnprintf(buffer, LINE_MAX-1, fmt, args);
+   vsnprintf(buffer, LINE_MAX, fmt, args);
    va_end(args);
 
-   /* no hook, handle it internally */
    if (!_PNDMAN_DEBUG_HOOK) {
-      if (_PNDMAN_VERBOSE <= verbose_level) return;
-      memset(buffer2, 0, LINE_MAX);
-      snprintf(buffer2, LINE_MAX-1, DBG_FMT,
+      snprintf(buffer2, LINE_MAX, DBG_FMT,
             file, line, function, buffer);
       pndman_puts(buffer2);
       return;
@@ -223,6 +255,7 @@ void _pndman_debug_hook(const char *file, int line,
 PNDMANAPI void pndman_set_verbose(int verbose)
 {
    _PNDMAN_VERBOSE = verbose;
+   _pndman_debug_update_threshold();
 }
 
 /* \brief set debug hook function */
@@ -230,6 +263,16 @@ PNDMANAPI void pndman_set_debug_hook(
       PNDMAN_DEBUG_HOOK_FUNC func)
 {
    _PNDMAN_DEBUG_HOOK = func;
+   _pndman_debug_update_threshold();
+}
+
+/* \brief set structured debug hook function */
+PNDMANAPI void pndman_set_debug_event_hook(
+      PNDMAN_DEBUG_EVENT_FUNC func, void *user_data)
+{
+   _PNDMAN_DEBUG_EVENT_HOOK = func;
+   _PNDMAN_DEBUG_EVENT_DATA = user_data;
+   _pndman_debug_update_threshold();
 }
 
 /* \brief return current verbose level,
@@ -284,13 +327,61 @@ PNDMANAPI void pndman_set_color(int use_color)
 /* \brief set internal curl timeout for libpndman */
 PNDMANAPI void pndman_set_curl_timeout(int timeout)
 {
-   if (timeout >= 0) _PNDMAN_CURL_TIMEOUT = timeout;
+   pndman_context_set_curl_timeout(NULL, timeout);
 }
 
 /* \brief get internal curl timeout for libpndman */
 PNDMANAPI int pndman_get_curl_timeout(void)
 {
-   return _PNDMAN_CURL_TIMEOUT;
+   return pndman_context_get_curl_timeout(NULL);
+}
+
+/* \brief set concurrent transfer limits for libpndman */
+PNDMANAPI void pndman_set_curl_max_connections(int total, int per_host)
+{
+   pndman_context_set_curl_max_connections(NULL, total, per_host);
+}
+
+/* \brief get maximum number of concurrent transfers */
+PNDMANAPI int pndman_get_curl_max_connections(void)
+{
+   return pndman_context_get_curl_max_connections(NULL);
+}
+
+/* \brief get maximum number of concurrent transfers per host */
+PNDMANAPI int pndman_get_curl_max_host_connections(void)
+{
+   return pndman_context_get_curl_max_host_connections(NULL);
+}
+
+/* \brief set total download speed limit for libpndman */
+PNDMANAPI void pndman_set_curl_max_speed(uint64_t bytes_per_second)
+{
+   pndman_context_set_curl_max_speed(NULL, bytes_per_second);
+}
+
+/* \brief get total download speed limit for libpndman */
+PNDMANAPI uint64_t pndman_get_curl_max_speed(void)
+{
+   return pndman_context_get_curl_max_speed(NULL);
+}
+
+/* \brief set segmented download options for libpndman */
+PNDMANAPI void pndman_set_curl_segments(int segments, uint64_t min_size)
+{
+   pndman_context_set_curl_segments(NULL, segments, min_size);
+}
+
+/* \brief get number of segments used for large downloads */
+PNDMANAPI int pndman_get_curl_segments(void)
+{
+   return pndman_context_get_curl_segments(NULL);
+}
+
+/* \brief get minimum size of segmented download */
+PNDMANAPI uint64_t pndman_get_curl_segment_min_size(void)
+{
+   return pndman_context_get_curl_segment_min_size(NULL);
 }
 
 /* vim: set ts=8 sw=3 tw=0 :*/
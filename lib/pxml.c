@@ -516,8 +516,7 @@ static void _pxml_pnd_license_tag(pndman_license *lic, char **attrs)
    for (; attrs[i]; ++i) {
       /* <license name= */
       if (!memcmp(attrs[i], PXML_NAME_ATTR, strlen(PXML_NAME_ATTR))) {
-         IFDO(free, lic->name);
-         lic->name = strdup(attrs[++i]);
+         _pndman_intern_set(&lic->name, attrs[++i]);
       }
       /* <license url= */
       else if (!memcmp(attrs[i], PXML_URL_ATTR, strlen(PXML_URL_ATTR))) {
@@ -552,8 +551,7 @@ static void _pxml_pnd_category_tag(pndman_category *cat, char **attrs)
    for (; attrs[i]; ++i) {
       /* <category name= */
       if (!memcmp(attrs[i], PXML_NAME_ATTR, strlen(PXML_NAME_ATTR))) {
-         IFDO(free, cat->main);
-         cat->main = strdup(attrs[++i]);
+         _pndman_intern_set(&cat->main, attrs[++i]);
       }
    }
 }
@@ -565,8 +563,7 @@ static void _pxml_pnd_subcategory_tag(pndman_category *cat, char **attrs)
    for (; attrs[i]; ++i) {
       /* <subcategory name= */
       if (!memcmp(attrs[i], PXML_NAME_ATTR, strlen(PXML_NAME_ATTR))) {
-         IFDO(free, cat->sub);
-         cat->sub = strdup(attrs[++i]);
+         _pndman_intern_set(&cat->sub, attrs[++i]);
       }
    }
 }
@@ -601,8 +598,7 @@ static void _pxml_pnd_translated_tag(pndman_translated *title, char **attrs)
    for (; attrs[i]; ++i) {
       /* <title/description lang= */
       if (!memcmp(attrs[i], PXML_LANG_ATTR, strlen(PXML_LANG_ATTR))) {
-         IFDO(free, title->lang);
-         title->lang = strdup(attrs[++i]);
+         _pndman_intern_set(&title->lang, attrs[++i]);
       }
    }
 }
@@ -614,8 +610,7 @@ static void _pxml_pnd_author_tag(pndman_author *author, char **attrs)
    for(; attrs[i]; ++i) {
       /* <author name= */
       if (!memcmp(attrs[i], PXML_NAME_ATTR, strlen(PXML_NAME_ATTR))) {
-         IFDO(free, author->name);
-         author->name = strdup(attrs[++i]);
+         _pndman_intern_set(&author->name, attrs[++i]);
       }
       /* <author website= */
       else if(!memcmp(attrs[i], PXML_WEBSITE_ATTR, strlen(PXML_WEBSITE_ATTR))) {
@@ -1093,7 +1088,7 @@ static void _pxml_pnd_post_process(pndman_package *pnd)
 
    /* author */
    if (!pnd->author.name && pnd->app->author.name)
-      pnd->author.name = strdup(pnd->app->author.name);
+      pnd->author.name = _pndman_intern(pnd->app->author.name);
    if (!pnd->author.website && pnd->app->author.website)
       pnd->author.website = strdup(pnd->app->author.website);
 
@@ -1114,7 +1109,7 @@ static void _pxml_pnd_post_process(pndman_package *pnd)
       t = pnd->app->title;
       for (; t; t = t->next) {
          if ((tc = _pndman_package_new_title(pnd))) {
-            if (t->lang) tc->lang = strdup(t->lang);
+            if (t->lang) tc->lang = _pndman_intern(t->lang);
             if (t->string) tc->string = strdup(t->string);
          }
       }
@@ -1125,7 +1120,7 @@ static void _pxml_pnd_post_process(pndman_package *pnd)
       t = pnd->app->description;
       for (; t; t = t->next) {
          if ((tc = _pndman_package_new_description(pnd))) {
-            if (t->lang) tc->lang = strdup(t->lang);
+            if (t->lang) tc->lang = _pndman_intern(t->lang);
             if (t->string) tc->string = strdup(t->string);
          }
       }
@@ -1136,7 +1131,7 @@ static void _pxml_pnd_post_process(pndman_package *pnd)
       l = pnd->app->license;
       for (; l; l = l->next) {
          if ((lc = _pndman_package_new_license(pnd))) {
-            if (l->name) lc->name = strdup(l->name);
+            if (l->name) lc->name = _pndman_intern(l->name);
             if (l->url) lc->url = strdup(l->url);
             if (l->sourcecodeurl) lc->sourcecodeurl = strdup(l->sourcecodeurl);
          }
@@ -1158,13 +1153,14 @@ static void _pxml_pnd_post_process(pndman_package *pnd)
       c = pnd->app->category;
       for (; c; c = c->next) {
          if ((cc = _pndman_package_new_category(pnd))) {
-            if (c->main) cc->main = strdup(c->main);
-            if (c->sub) cc->sub = strdup(c->sub);
+            if (c->main) cc->main = _pndman_intern(c->main);
+            if (c->sub) cc->sub = _pndman_intern(c->sub);
          }
       }
    }
 
    /* check for null appdata */
+   _pndman_package_own_applications(pnd);
    for (a = pnd->app; a; a = a->next) {
       if (!a->appdata) a->appdata = strdup(a->id);
    }
@@ -1176,6 +1172,7 @@ static int _pndman_crawl_process(const char *path, const char *relative, pxml_pa
    char *PXML = NULL, *full_path = NULL;
    size_t size = 0;
    FILE *f;
+   uint64_t start = _pndman_metrics_now();
    assert(path && relative && data);
 
    int len = snprintf(NULL, 0, "%s/%s", path, relative)+1;
@@ -1214,6 +1211,7 @@ static int _pndman_crawl_process(const char *path, const char *relative, pxml_pa
    char *copy = strdup(relative);
    IFDO(free, data->pnd->path);
    data->pnd->path = copy;
+   _pndman_metrics_time(PNDMAN_METRIC_PND_PARSE_TIME, "parse pnd", relative, start);
    return RETURN_OK;
 
 parse_fail:
@@ -1412,16 +1410,84 @@ fail:
    return RETURN_FAIL;
 }
 
-/* \brief crawl to repository, return number of pnd's found, and -1 on error */
-static int _pndman_crawl_to_repository(int full, pndman_device *device, pndman_repository *local)
+/* \brief merge crawled pnd to local repository,
+ * returns the pnd in repository */
+static pndman_package* _pndman_crawl_merge(int full, pndman_device *device, pndman_package *p, pndman_repository *local)
 {
-   pndman_package *list, *p, *n = NULL, *pnd;
-   int ret;
+   pndman_package *pnd;
 #ifdef _WIN32
    /* TODO: win32 implementation */
 #else
    struct stat st;
 #endif
+   assert(device && p && local);
+
+   if (!(pnd = _pndman_repository_new_pnd_check(p, p->path, device->mount, local)))
+      return NULL;
+
+   /* copy needed stuff over */
+   _pndman_copy_pnd(pnd, p);
+   if (!full) _pndman_package_free_applications(pnd);
+   _pndman_intern_set(&pnd->mount, device->mount);
+   pnd->repositoryptr = local;
+   pnd->modified_time = 0;
+
+   /* the md5 might not be correct anymore
+    * we don't fill it again, since it takes lots of time */
+   IFDO(free, pnd->md5);
+
+   /* stat for modified time */
+   if (!pnd->modified_time) {
+      char *path;
+      if ((path = _pndman_pnd_get_path(pnd))) {
+#ifdef _WIN32
+         /* TODO: win32 implementation */
+#else
+         if (stat(path, &st) == 0)
+            pnd->local_modified_time = st.st_mtime;
+#endif
+         free(path);
+      }
+   }
+
+   _pndman_package_notify(PNDMAN_PACKAGE_CHANGED, pnd);
+   return pnd;
+}
+
+/* \brief free crawled pnd list */
+static void _pndman_crawl_free_list(pndman_package *list)
+{
+   pndman_package *p, *n;
+   for (p = list; p; p = n) {
+      n = p->next;
+      while ((p = _pndman_free_pnd(p)));
+   }
+}
+
+/* \brief merge crawled list to repository and free it,
+ * return number of pnd's merged */
+static int _pndman_crawl_merge_list(int full, pndman_device *device, pndman_package *list, pndman_repository *local)
+{
+   pndman_package *p, *n;
+   int ret = 0;
+
+   for (p = list; p; p = n) {
+      if (_pndman_crawl_merge(full, device, p, local))
+         ++ret; /* count again */
+
+      /* free */
+      n = p->next;
+      while ((p = _pndman_free_pnd(p)));
+   }
+
+   return ret;
+}
+
+/* \brief crawl to repository, return number of pnd's found, and -1 on error */
+static int _pndman_crawl_to_repository(int full, pndman_device *device, pndman_repository *local)
+{
+   pndman_package *list;
+   int ret;
    assert(device && local);
 
    list = _pndman_new_pnd();
@@ -1432,52 +1498,64 @@ static int _pndman_crawl_to_repository(int full, pndman_device *device, pndman_r
 
    /* either crawl failed, or no pnd's found */
    if (ret <= 0) {
-      for (p = list; p; p = n) {
-         n = p->next;
-         while ((p = _pndman_free_pnd(p)));
-      }
+      _pndman_crawl_free_list(list);
       return 0;
    }
 
    /* merge pnd's to repo */
-   for (p = list, ret = 0; p; p = n) {
-      pnd = _pndman_repository_new_pnd_check(p, p->path, device->mount, local);
-      if (pnd) {
-         /* copy needed stuff over */
-         _pndman_copy_pnd(pnd, p);
-         if (!full) _pndman_package_free_applications(pnd);
-         IFDO(free, pnd->mount);
-         pnd->mount = strdup(device->mount);
-         pnd->repositoryptr = local;
-         pnd->modified_time = 0;
-
-         /* the md5 might not be correct anymore
-          * we don't fill it again, since it takes lots of time */
-         IFDO(free, pnd->md5);
-
-         /* stat for modified time */
-         if (!pnd->modified_time) {
-            char *path;
-            if ((path = _pndman_pnd_get_path(pnd))) {
-#ifdef _WIN32
-               /* TODO: win32 implementation */
-#else
-               if (stat(path, &st) == 0)
-                  pnd->local_modified_time = st.st_mtime;
-#endif
-               free(path);
-            }
-         }
+   return _pndman_crawl_merge_list(full, device, list, local);
+}
 
-         /* count again */
-         ++ret;
-      }
+/* \brief pnd lists of multi device crawl */
+typedef struct _pndman_crawl_devices
+{
+   pndman_package **list;
+   int *found;
+} _pndman_crawl_devices;
 
-      /* free */
-      n = p->next;
-      while ((p = _pndman_free_pnd(p)));
-   }
+/* \brief crawl one device to its own list, runs in device worker */
+static void _pndman_crawl_device_job(pndman_device *device, size_t index, void *user_data)
+{
+   _pndman_crawl_devices *crawl = user_data;
+   uint64_t start = _pndman_metrics_now();
+
+   if (!(crawl->list[index] = _pndman_new_pnd()))
+      return;
+   crawl->found[index] = _pndman_crawl_to_pnd_list(device, crawl->list[index]);
+   _pndman_metrics_time(PNDMAN_METRIC_CRAWL_TIME, "crawl", device->mount, start);
+}
+
+/* INTERNAL API */
+
+/* \brief crawl single PND file of device to local repository,
+ * relative is path from device mount.
+ * returns the pnd in repository, NULL if file is not a PND or crawl failed */
+pndman_package* _pndman_crawl_file(int full, pndman_device *device, const char *relative, pndman_repository *local)
+{
+   pxml_parse data;
+   const char *name;
+   pndman_package *pnd, *ret;
+   assert(device && relative && local);
+
+   name = ((name = strrchr(relative, '/')) ? name+1 : relative);
+   if (name[0] == '.' || strlen(name) < 4 || _strupcmp(name+strlen(name)-4, ".pnd"))
+      return NULL; /* we only want .pnd files */
+
+   if (!(pnd = _pndman_new_pnd()))
+      return NULL;
+
+   data.pnd   = pnd;
+   data.app   = NULL;
+   data.data  = NULL;
+   data.bckward_title = 1; /* backwards compatibility with PXML titles */
+   data.bckward_desc  = 1; /* backwards compatibility with PXML descriptions */
+   data.state = PXML_PARSE_DEFAULT;
+
+   ret = NULL;
+   if (_pndman_crawl_process(device->mount, relative, &data) == RETURN_OK)
+      ret = _pndman_crawl_merge(full, device, pnd, local);
 
+   while ((pnd = _pndman_free_pnd(pnd)));
    return ret;
 }
 
@@ -1489,8 +1567,58 @@ PNDMANAPI int pndman_package_crawl(int full_crawl, pndman_device *device, pndman
 {
    CHECKUSE(device);
    CHECKUSE(local);
+   uint64_t start = _pndman_metrics_now();
    local = _pndman_repository_first(local);
-   return _pndman_crawl_to_repository(full_crawl, device, local);
+
+   int ret = _pndman_crawl_to_repository(full_crawl, device, local);
+   if (ret > 0) _pndman_metrics_add(PNDMAN_METRIC_PNDS_CRAWLED, ret);
+   _pndman_metrics_time(PNDMAN_METRIC_CRAWL_TIME, "crawl", device->mount, start);
+   return ret;
+}
+
+/* \brief crawl pnds of every device in list to local repository,
+ * devices on different disks are crawled in parallel.
+ * returns number of pnd's found, and -1 on error */
+PNDMANAPI int pndman_package_crawl_all(int full_crawl, pndman_device *device, pndman_repository *local)
+{
+   _pndman_crawl_devices crawl;
+   pndman_device *d;
+   size_t i, count = 0;
+   int ret = 0;
+   CHECKUSE(device);
+   CHECKUSE(local);
+
+   local = _pndman_repository_first(local);
+   memset(&crawl, 0, sizeof(_pndman_crawl_devices));
+   for (d = _pndman_device_first(device); d; d = d->next) ++count;
+   if (!(crawl.list  = calloc(count, sizeof(pndman_package*))) ||
+       !(crawl.found = calloc(count, sizeof(int))))
+      goto fail;
+
+   if (_pndman_device_foreach(device, _pndman_crawl_device_job, &crawl) == RETURN_FAIL) {
+      ret = RETURN_FAIL;
+      count = 0;
+   }
+
+   /* merge in device order, so result is same as crawling one by one */
+   for (d = _pndman_device_first(device), i = 0; i != count; d = d->next, ++i) {
+      if (crawl.found[i] <= 0) {
+         _pndman_crawl_free_list(crawl.list[i]);
+         continue;
+      }
+      ret += _pndman_crawl_merge_list(full_crawl, d, crawl.list[i], local);
+   }
+
+   if (ret > 0) _pndman_metrics_add(PNDMAN_METRIC_PNDS_CRAWLED, ret);
+   free(crawl.list);
+   free(crawl.found);
+   return ret;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "crawl lists");
+   IFDO(free, crawl.list);
+   IFDO(free, crawl.found);
+   return RETURN_FAIL;
 }
 
 /* \brief fill single PND's data fully by crawling it locally */
@@ -1532,6 +1660,7 @@ PNDMANAPI int pndman_package_crawl_single_package(int full_crawl, pndman_package
 
    /* fill md5 of single pnd crawl */
    pndman_package_fill_md5(pnd);
+   _pndman_package_notify(PNDMAN_PACKAGE_CHANGED, pnd);
    return RETURN_OK;
 
 fail:
@@ -747,7 +747,7 @@ static int _pndman_api_rate_pnd(void *user_data,
    pndman_curl_handle *handle;
    assert(pnd && repository && callback);
 
-   if (!(handle = _pndman_curl_handle_new(NULL, NULL, NULL, NULL)))
+   if (!(handle = _pndman_curl_handle_new(repository->context, NULL, NULL, NULL, NULL)))
       goto fail;
 
    if (!(packet = _pndman_api_rate_packet(repository, pnd, rate)))
@@ -773,7 +773,7 @@ static int _pndman_api_comment_pnd(void *user_data,
    pndman_curl_handle *handle;
    assert(pnd && repository && comment && callback);
 
-   if (!(handle = _pndman_curl_handle_new(NULL, NULL, NULL, NULL)))
+   if (!(handle = _pndman_curl_handle_new(repository->context, NULL, NULL, NULL, NULL)))
       goto fail;
 
    if (!(packet = _pndman_api_comment_packet(repository, pnd, comment, 0)))
@@ -799,7 +799,7 @@ static int _pndman_api_comment_pnd_pull(void *user_data,
    pndman_curl_handle *handle;
    assert(pnd && repository && callback);
 
-   if (!(handle = _pndman_curl_handle_new(NULL, NULL, _pndman_api_comment_pull_cb, NULL)))
+   if (!(handle = _pndman_curl_handle_new(repository->context, NULL, NULL, _pndman_api_comment_pull_cb, NULL)))
       goto fail;
 
    if (!(packet = _pndman_api_comment_packet(repository, pnd, NULL, 0)))
@@ -836,7 +836,7 @@ static int _pndman_api_comment_pnd_delete(void *user_data,
    pndman_curl_handle *handle;
    assert(repository && callback);
 
-   if (!(handle = _pndman_curl_handle_new(NULL, NULL, NULL, NULL)))
+   if (!(handle = _pndman_curl_handle_new(repository->context, NULL, NULL, NULL, NULL)))
       goto fail;
 
    if (!(packet = _pndman_api_comment_packet(repository, pnd, NULL, timestamp)))
@@ -860,7 +860,7 @@ static int _pndman_api_download_history(void *user_data,
    pndman_curl_handle *handle;
    assert(repository && callback);
 
-   if (!(handle = _pndman_curl_handle_new(NULL, NULL, NULL, NULL)))
+   if (!(handle = _pndman_curl_handle_new(repository->context, NULL, NULL, NULL, NULL)))
       goto fail;
 
    if (!(packet = _pndman_api_history_packet(repository, callback)))
@@ -884,7 +884,7 @@ static int _pndman_api_archived_pnd(void *user_data,
    pndman_curl_handle *handle;
    assert(pnd && repository && callback);
 
-   if (!(handle = _pndman_curl_handle_new(NULL, NULL, _pndman_api_archived_cb, NULL)))
+   if (!(handle = _pndman_curl_handle_new(repository->context, NULL, NULL, _pndman_api_archived_cb, NULL)))
       goto fail;
 
    if (!(packet = _pndman_api_archived_packet(repository, pnd)))
@@ -63,8 +63,7 @@ pndman_package* _pndman_repository_new_pnd(pndman_repository *repo)
       for (p = repo->pnd; p->next; p = p->next);
       p = p->next = _pndman_new_pnd();
    } else p = repo->pnd = _pndman_new_pnd();
-   IFDO(free, p->repository);
-   if (repo->url) p->repository = strdup(repo->url);
+   _pndman_intern_set(&p->repository, repo->url);
    p->repositoryptr = repo;
 
    return p;
@@ -100,8 +99,7 @@ pndman_package* _pndman_repository_new_pnd_check(pndman_package *in_pnd,
                   pni->next = pnd->next;
                   DEBUG(PNDMAN_LEVEL_CRAP, "Newer : %s", path);
                }
-               IFDO(free, pni->repository);
-               if (repo->url) pni->repository = strdup(repo->url);
+               _pndman_intern_set(&pni->repository, repo->url);
                pni->repositoryptr = repo;
                return pni;
             } else
@@ -116,6 +114,40 @@ pndman_package* _pndman_repository_new_pnd_check(pndman_package *in_pnd,
    return _pndman_repository_new_pnd(repo);
 }
 
+/* \brief check duplicate pnd on remote repository using scan table of it,
+ * new pnds are appended to both repository and scan */
+pndman_package* _pndman_repository_new_pnd_scan(pndman_package *in_pnd,
+      _pndman_scan *scan, pndman_repository *repo)
+{
+   pndman_package *pnd, *last;
+   size_t i = 0;
+   assert(in_pnd && scan && repo && repo->prev);
+
+   if ((pnd = _pndman_scan_find(scan, in_pnd->id, _pndman_scan_hash(in_pnd->id), &i)))
+      return pnd;
+
+   /* create new pnd */
+   last = _pndman_scan_last(scan);
+   if (!(pnd = _pndman_new_pnd()))
+      return NULL;
+
+   /* scan table hashes id, so it must be set before adding */
+   if (in_pnd->id && !(pnd->id = strdup(in_pnd->id))) {
+      _pndman_free_pnd(pnd);
+      return NULL;
+   }
+   if (_pndman_scan_add(scan, pnd) != RETURN_OK) {
+      _pndman_free_pnd(pnd);
+      return NULL;
+   }
+
+   if (last) last->next = pnd;
+   else repo->pnd = pnd;
+   _pndman_intern_set(&pnd->repository, repo->url);
+   pnd->repositoryptr = repo;
+   return pnd;
+}
+
 /* \brief free pnd from repository */
 int _pndman_repository_free_pnd(pndman_package *pnd, pndman_repository *repo)
 {
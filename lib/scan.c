@@ -0,0 +1,124 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* \brief flat table of package list for id lookups.
+ * hashes are scanned linearly from one small array,
+ * packages are only touched when hash matches */
+struct _pndman_scan
+{
+   size_t count, allocated;
+   uint32_t *hash;            /* hash of id, 0 without id */
+   pndman_package **pnd;      /* in list order */
+};
+
+/* \brief grow table for one more package */
+static int _pndman_scan_grow(_pndman_scan *scan)
+{
+   uint32_t *hash;
+   pndman_package **pnd;
+   size_t allocated;
+
+   if (scan->count < scan->allocated)
+      return RETURN_OK;
+
+   allocated = (scan->allocated ? scan->allocated * 2 : 256);
+   if (!(hash = realloc(scan->hash, allocated * sizeof(uint32_t))))
+      goto fail;
+   scan->hash = hash;
+   if (!(pnd = realloc(scan->pnd, allocated * sizeof(pndman_package*))))
+      goto fail;
+   scan->pnd = pnd;
+   scan->allocated = allocated;
+   return RETURN_OK;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "scan table");
+   return RETURN_FAIL;
+}
+
+/* INTERNAL API */
+
+/* \brief hash of package id for scan table */
+uint32_t _pndman_scan_hash(const char *id)
+{
+   uint32_t hash;
+   if (!id) return 0;
+   hash = _pndman_hash_key(id, strlen(id));
+   return (hash ? hash : 1);
+}
+
+/* \brief build scan table of package list (next pointers, not instances) */
+_pndman_scan* _pndman_scan_new(pndman_package *list)
+{
+   _pndman_scan *scan;
+   pndman_package *p;
+
+   if (!(scan = calloc(1, sizeof(_pndman_scan))))
+      goto fail;
+
+   for (p = list; p; p = p->next)
+      if (_pndman_scan_add(scan, p) != RETURN_OK) {
+         _pndman_scan_free(scan);
+         return NULL;
+      }
+
+   return scan;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "scan table");
+   return NULL;
+}
+
+/* \brief free scan table */
+void _pndman_scan_free(_pndman_scan *scan)
+{
+   if (!scan) return;
+   IFDO(free, scan->hash);
+   IFDO(free, scan->pnd);
+   free(scan);
+}
+
+/* \brief append package to scan table,
+ * table is left untouched on failure */
+int _pndman_scan_add(_pndman_scan *scan, pndman_package *pnd)
+{
+   assert(scan && pnd);
+   if (_pndman_scan_grow(scan) != RETURN_OK)
+      return RETURN_FAIL;
+
+   scan->hash[scan->count] = _pndman_scan_hash(pnd->id);
+   scan->pnd[scan->count]  = pnd;
+   ++scan->count;
+   return RETURN_OK;
+}
+
+/* \brief last package in table, NULL when empty */
+pndman_package* _pndman_scan_last(_pndman_scan *scan)
+{
+   assert(scan);
+   return (scan->count ? scan->pnd[scan->count - 1] : NULL);
+}
+
+/* \brief find package with id starting from *i,
+ * *i is set to its index so next search can continue from *i + 1 */
+pndman_package* _pndman_scan_find(_pndman_scan *scan, const char *id, uint32_t hash, size_t *i)
+{
+   size_t n;
+   assert(scan && i);
+
+   if (!id) return NULL;
+   for (n = *i; n < scan->count; ++n) {
+      if (scan->hash[n] != hash) continue;
+      if (scan->pnd[n]->id && !strcmp(scan->pnd[n]->id, id)) {
+         *i = n;
+         return scan->pnd[n];
+      }
+   }
+
+   *i = n;
+   return NULL;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
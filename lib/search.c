@@ -0,0 +1,603 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define SEARCH_MAX_WORD 64
+
+/* \brief about how many words package has,
+ * decides when candidates are checked one by one */
+#define SEARCH_DOC_WORDS 32
+
+/* \brief weight of field word was found in */
+#define SEARCH_WEIGHT_ID          8
+#define SEARCH_WEIGHT_TITLE       4
+#define SEARCH_WEIGHT_CATEGORY    2
+#define SEARCH_WEIGHT_DESCRIPTION 1
+
+/* \brief how well query term matched word */
+#define SEARCH_MATCH_EXACT     4
+#define SEARCH_MATCH_PREFIX    2
+#define SEARCH_MATCH_SUBSTRING 1
+
+struct _pndman_search_doc;
+
+/* \brief package word is found in */
+typedef struct _pndman_search_posting
+{
+   struct _pndman_search_doc *doc;
+   unsigned int weight;
+   size_t word; /* index in words of package */
+} _pndman_search_posting;
+
+/* \brief indexed word */
+typedef struct _pndman_search_token
+{
+   char *str;
+   size_t len;
+   _pndman_search_posting *post;
+   size_t count, alloc;
+} _pndman_search_token;
+
+/* \brief word of indexed package */
+typedef struct _pndman_search_doc_word
+{
+   _pndman_search_token *token;
+   unsigned int weight;
+   size_t post; /* index in postings of word */
+} _pndman_search_doc_word;
+
+/* \brief indexed package */
+typedef struct _pndman_search_doc
+{
+   pndman_package *pnd;
+   _pndman_search_doc_word *word;
+   size_t count;
+
+   /* query state */
+   unsigned int gen, term, hits, best, score;
+} _pndman_search_doc;
+
+/* \brief words containing trigram */
+typedef struct _pndman_search_trigram
+{
+   _pndman_search_token **token;
+   size_t count, alloc;
+} _pndman_search_trigram;
+
+/* \brief word of package while indexing */
+typedef struct _pndman_search_word
+{
+   char str[SEARCH_MAX_WORD];
+   unsigned int weight;
+} _pndman_search_word;
+
+/* \brief words of package while indexing */
+typedef struct _pndman_search_words
+{
+   _pndman_search_word *word;
+   size_t count, alloc;
+} _pndman_search_words;
+
+/* \brief search index of repository list */
+struct pndman_search
+{
+   pndman_repository *list;
+   _pndman_hash *token;   /* word -> _pndman_search_token */
+   _pndman_hash *trigram; /* three bytes -> _pndman_search_trigram */
+   _pndman_hash *doc;     /* pndman_package* -> _pndman_search_doc */
+   _pndman_search_token **sorted; /* for prefix lookups */
+   size_t nsorted;
+   char dirty;
+   unsigned int gen;
+   _pndman_search_doc **cand;
+   size_t ncand, acand;
+};
+
+/* \brief grow array to hold count+1 items */
+static int _pndman_search_grow(void **array, size_t *alloc, size_t count, size_t size)
+{
+   void *tmp;
+   if (count < *alloc) return RETURN_OK;
+   if (!(tmp = realloc(*array, (*alloc ? *alloc * 2 : 8) * size)))
+      return RETURN_FAIL;
+   *array = tmp;
+   *alloc = (*alloc ? *alloc * 2 : 8);
+   return RETURN_OK;
+}
+
+/* \brief is byte part of word, utf8 sequences are kept whole */
+static int _pndman_search_wordchar(unsigned char c)
+{
+   return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c >= 0x80);
+}
+
+/* \brief split string to lowercase words */
+static void _pndman_search_split(_pndman_search_words *words, const char *str, unsigned int weight)
+{
+   const unsigned char *s = (const unsigned char*)str;
+   _pndman_search_word *w;
+   size_t len;
+
+   while (s && *s) {
+      for (; *s && !_pndman_search_wordchar(*s); ++s);
+      if (!*s) break;
+
+      if (_pndman_search_grow((void**)&words->word, &words->alloc, words->count, sizeof(_pndman_search_word)) != RETURN_OK)
+         return;
+      w = &words->word[words->count++];
+      w->weight = weight;
+      for (len = 0; *s && _pndman_search_wordchar(*s); ++s)
+         if (len + 1 < SEARCH_MAX_WORD)
+            w->str[len++] = (*s >= 'A' && *s <= 'Z' ? *s + ('a' - 'A') : *s);
+      w->str[len] = 0;
+   }
+}
+
+static int _pndman_search_word_cmp(const void *a, const void *b)
+{
+   const _pndman_search_word *wa = a, *wb = b;
+   int r = strcmp(wa->str, wb->str);
+   return (r ? r : (int)wb->weight - (int)wa->weight);
+}
+
+static int _pndman_search_token_cmp(const void *a, const void *b)
+{
+   return strcmp((*(_pndman_search_token**)a)->str, (*(_pndman_search_token**)b)->str);
+}
+
+/* \brief words of package, sorted, each once with its best weight */
+static void _pndman_search_package_words(pndman_package *pnd, _pndman_search_words *words)
+{
+   pndman_translated *t;
+   pndman_category *c;
+   size_t i, j;
+
+   words->count = 0;
+   _pndman_search_split(words, pnd->id, SEARCH_WEIGHT_ID);
+   for (t = pnd->title; t; t = t->next)
+      _pndman_search_split(words, t->string, SEARCH_WEIGHT_TITLE);
+   for (c = pnd->category; c; c = c->next) {
+      _pndman_search_split(words, c->main, SEARCH_WEIGHT_CATEGORY);
+      _pndman_search_split(words, c->sub,  SEARCH_WEIGHT_CATEGORY);
+   }
+   for (t = pnd->description; t; t = t->next)
+      _pndman_search_split(words, t->string, SEARCH_WEIGHT_DESCRIPTION);
+
+   if (!words->count) return;
+   qsort(words->word, words->count, sizeof(_pndman_search_word), _pndman_search_word_cmp);
+   for (i = 1, j = 0; i != words->count; ++i)
+      if (strcmp(words->word[i].str, words->word[j].str))
+         words->word[++j] = words->word[i];
+   words->count = j + 1;
+}
+
+/* \brief free token */
+static void _pndman_search_token_free(void *ptr)
+{
+   _pndman_search_token *token = ptr;
+   IFDO(free, token->str);
+   IFDO(free, token->post);
+   free(token);
+}
+
+/* \brief free trigram */
+static void _pndman_search_trigram_free(void *ptr)
+{
+   _pndman_search_trigram *tri = ptr;
+   IFDO(free, tri->token);
+   free(tri);
+}
+
+/* \brief free document */
+static void _pndman_search_doc_free(void *ptr)
+{
+   _pndman_search_doc *doc = ptr;
+   IFDO(free, doc->word);
+   free(doc);
+}
+
+/* \brief get token of word, creating it and its trigrams */
+static _pndman_search_token* _pndman_search_token_get(pndman_search *object, const char *str)
+{
+   _pndman_search_token *token;
+   _pndman_search_trigram *tri;
+   size_t i, len = strlen(str);
+
+   if ((token = _pndman_hash_get(object->token, str, len)))
+      return token;
+
+   if (!(token = calloc(1, sizeof(_pndman_search_token))))
+      return NULL;
+   if (!(token->str = strdup(str)) ||
+       _pndman_hash_set(object->token, str, len, token) != RETURN_OK) {
+      _pndman_search_token_free(token);
+      return NULL;
+   }
+   token->len = len;
+   object->dirty = 1;
+
+   for (i = 0; i + 3 <= len; ++i) {
+      if (!(tri = _pndman_hash_get(object->trigram, str + i, 3))) {
+         if (!(tri = calloc(1, sizeof(_pndman_search_trigram))))
+            continue;
+         if (_pndman_hash_set(object->trigram, str + i, 3, tri) != RETURN_OK) {
+            free(tri);
+            continue;
+         }
+      }
+      /* same trigram twice in word */
+      if (tri->count && tri->token[tri->count-1] == token)
+         continue;
+      if (_pndman_search_grow((void**)&tri->token, &tri->alloc, tri->count, sizeof(_pndman_search_token*)) != RETURN_OK)
+         continue;
+      tri->token[tri->count++] = token;
+   }
+
+   return token;
+}
+
+/* \brief remove package from index */
+static void _pndman_search_remove(pndman_search *object, pndman_package *pnd)
+{
+   _pndman_search_doc *doc;
+   _pndman_search_token *token;
+   _pndman_search_posting *moved;
+   size_t i, p;
+
+   if (!(doc = _pndman_hash_remove(object->doc, &pnd, sizeof(pndman_package*))))
+      return;
+
+   /* words stay in dictionary, they are likely to come back */
+   for (i = 0; i != doc->count; ++i) {
+      token = doc->word[i].token;
+      p = doc->word[i].post;
+      if (p != --token->count) {
+         moved = &token->post[p];
+         *moved = token->post[token->count];
+         moved->doc->word[moved->word].post = p;
+      }
+   }
+   _pndman_search_doc_free(doc);
+}
+
+/* \brief (re)index package */
+static void _pndman_search_add(pndman_search *object, pndman_package *pnd)
+{
+   _pndman_search_words words;
+   _pndman_search_doc *doc;
+   _pndman_search_token *token;
+   size_t i;
+
+   _pndman_search_remove(object, pnd);
+
+   memset(&words, 0, sizeof(_pndman_search_words));
+   _pndman_search_package_words(pnd, &words);
+
+   if (!(doc = calloc(1, sizeof(_pndman_search_doc))))
+      goto fail;
+   doc->pnd = pnd;
+   if (words.count && !(doc->word = malloc(words.count * sizeof(_pndman_search_doc_word))))
+      goto fail;
+   if (_pndman_hash_set(object->doc, &pnd, sizeof(pndman_package*), doc) != RETURN_OK)
+      goto fail;
+
+   for (i = 0; i != words.count; ++i) {
+      if (!(token = _pndman_search_token_get(object, words.word[i].str)))
+         continue;
+      if (_pndman_search_grow((void**)&token->post, &token->alloc, token->count, sizeof(_pndman_search_posting)) != RETURN_OK)
+         continue;
+      token->post[token->count].doc    = doc;
+      token->post[token->count].weight = words.word[i].weight;
+      token->post[token->count].word   = doc->count;
+      doc->word[doc->count].token  = token;
+      doc->word[doc->count].weight = words.word[i].weight;
+      doc->word[doc->count].post   = token->count++;
+      doc->count++;
+   }
+
+   IFDO(free, words.word);
+   return;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "search document");
+   if (doc) _pndman_search_doc_free(doc);
+   IFDO(free, words.word);
+}
+
+/* \brief follow packages of repositories */
+static void _pndman_search_observer(_pndman_package_event event, pndman_package *pnd, void *user_data)
+{
+   pndman_search *object = user_data;
+
+   if (event == PNDMAN_PACKAGE_FREED)
+      _pndman_search_remove(object, pnd);
+   else if (_pndman_repository_first(pnd->repositoryptr) == object->list)
+      _pndman_search_add(object, pnd);
+}
+
+/* \brief collect token to sorted array */
+static void _pndman_search_collect(const void *key, size_t len, void *value, void *user_data)
+{
+   pndman_search *object = user_data;
+   (void)key; (void)len;
+   object->sorted[object->nsorted++] = value;
+}
+
+/* \brief sort dictionary for prefix lookups, when words were added */
+static int _pndman_search_sort(pndman_search *object)
+{
+   _pndman_search_token **tmp;
+
+   if (!object->dirty) return RETURN_OK;
+   if (!(tmp = realloc(object->sorted, (_pndman_hash_count(object->token)+1) * sizeof(_pndman_search_token*))))
+      return RETURN_FAIL;
+   object->sorted  = tmp;
+   object->nsorted = 0;
+   _pndman_hash_foreach(object->token, _pndman_search_collect, object);
+   qsort(object->sorted, object->nsorted, sizeof(_pndman_search_token*), _pndman_search_token_cmp);
+   object->dirty = 0;
+   return RETURN_OK;
+}
+
+/* \brief score documents of token for query term */
+static void _pndman_search_match(pndman_search *object, _pndman_search_token *token,
+      unsigned int term, unsigned int match)
+{
+   _pndman_search_doc *doc;
+   unsigned int score;
+   size_t p;
+
+   for (p = 0; p != token->count; ++p) {
+      doc = token->post[p].doc;
+      if (!term) {
+         if (doc->gen != object->gen) {
+            if (_pndman_search_grow((void**)&object->cand, &object->acand, object->ncand, sizeof(_pndman_search_doc*)) != RETURN_OK)
+               continue;
+            object->cand[object->ncand++] = doc;
+            doc->gen   = object->gen;
+            doc->hits  = 0;
+            doc->score = 0;
+            doc->term  = (unsigned int)-1;
+         }
+      } else if (doc->gen != object->gen || doc->hits != term) {
+         continue; /* missed earlier term */
+      }
+
+      if (doc->term != term) {
+         doc->term = term;
+         doc->best = 0;
+      }
+      score = token->post[p].weight * match;
+      if (score > doc->best) doc->best = score;
+   }
+}
+
+/* \brief first word in dictionary not before str */
+static size_t _pndman_search_lower(pndman_search *object, const char *str)
+{
+   size_t lo, hi, mid;
+   for (lo = 0, hi = object->nsorted; lo < hi;) {
+      mid = (lo + hi) / 2;
+      if (strcmp(object->sorted[mid]->str, str) < 0) lo = mid + 1;
+      else hi = mid;
+   }
+   return lo;
+}
+
+/* \brief words containing str are among words of its rarest trigram */
+static _pndman_search_trigram* _pndman_search_trigram_rarest(pndman_search *object, const char *str, size_t len)
+{
+   _pndman_search_trigram *tri, *best = NULL;
+   size_t i;
+
+   for (i = 0; i + 3 <= len; ++i) {
+      if (!(tri = _pndman_hash_get(object->trigram, str + i, 3)))
+         return NULL;
+      if (!best || tri->count < best->count) best = tri;
+   }
+   return best;
+}
+
+/* \brief about how many packages term touches */
+static unsigned int _pndman_search_estimate(pndman_search *object, const char *str)
+{
+   _pndman_search_trigram *tri;
+   size_t i, len = strlen(str);
+   unsigned int count = 0;
+
+   for (i = _pndman_search_lower(object, str); i != object->nsorted && !strncmp(object->sorted[i]->str, str, len); ++i)
+      count += object->sorted[i]->count;
+   if (len >= 3 && (tri = _pndman_search_trigram_rarest(object, str, len)))
+      for (i = 0; i != tri->count; ++i)
+         if (strncmp(tri->token[i]->str, str, len) && strstr(tri->token[i]->str, str))
+            count += tri->token[i]->count;
+   return count;
+}
+
+/* \brief score documents for query term */
+static void _pndman_search_term(pndman_search *object, const char *str, unsigned int term)
+{
+   _pndman_search_trigram *best;
+   _pndman_search_token *token;
+   size_t i, len = strlen(str);
+
+   /* words starting with term, dictionary is sorted */
+   for (i = _pndman_search_lower(object, str); i != object->nsorted && !strncmp(object->sorted[i]->str, str, len); ++i) {
+      token = object->sorted[i];
+      _pndman_search_match(object, token, term, (token->len == len ? SEARCH_MATCH_EXACT : SEARCH_MATCH_PREFIX));
+   }
+
+   /* words containing term, candidates from rarest trigram */
+   if (len < 3 || !(best = _pndman_search_trigram_rarest(object, str, len)))
+      return;
+   for (i = 0; i != best->count; ++i) {
+      token = best->token[i];
+      if (strncmp(token->str, str, len) && strstr(token->str, str))
+         _pndman_search_match(object, token, term, SEARCH_MATCH_SUBSTRING);
+   }
+}
+
+/* \brief score remaining candidates by their own words,
+ * cheaper than walking postings of common word */
+static void _pndman_search_term_docs(pndman_search *object, const char *str, unsigned int term)
+{
+   _pndman_search_doc *doc;
+   _pndman_search_token *token;
+   size_t i, w, len = strlen(str);
+   unsigned int match, score;
+
+   for (i = 0; i != object->ncand; ++i) {
+      doc = object->cand[i];
+      for (w = 0; w != doc->count; ++w) {
+         token = doc->word[w].token;
+         if (!strncmp(token->str, str, len))
+            match = (token->len == len ? SEARCH_MATCH_EXACT : SEARCH_MATCH_PREFIX);
+         else if (len >= 3 && strstr(token->str, str))
+            match = SEARCH_MATCH_SUBSTRING;
+         else continue;
+
+         if (doc->term != term) {
+            doc->term = term;
+            doc->best = 0;
+         }
+         score = doc->word[w].weight * match;
+         if (score > doc->best) doc->best = score;
+      }
+   }
+}
+
+/* \brief rarest query words first, so candidates stay few */
+static int _pndman_search_query_cmp(const void *a, const void *b)
+{
+   const _pndman_search_word *wa = a, *wb = b;
+   return (wa->weight < wb->weight ? -1 : (wa->weight > wb->weight));
+}
+
+/* \brief best score first, then by id */
+static int _pndman_search_result_cmp(const void *a, const void *b)
+{
+   const _pndman_search_doc *da = *(_pndman_search_doc**)a, *db = *(_pndman_search_doc**)b;
+   int r;
+   if (da->score != db->score) return (da->score > db->score ? -1 : 1);
+   if (da->pnd->id && db->pnd->id && (r = strcmp(da->pnd->id, db->pnd->id))) return r;
+   return (da->pnd < db->pnd ? -1 : (da->pnd > db->pnd));
+}
+
+/* API */
+
+/* \brief create search index of repository list */
+PNDMANAPI pndman_search* pndman_search_new(pndman_repository *list)
+{
+   pndman_search *object;
+   pndman_repository *r;
+   pndman_package *p, *pi;
+   CHECKUSEP(list);
+
+   if (!(object = calloc(1, sizeof(pndman_search))))
+      goto fail;
+
+   object->list = _pndman_repository_first(list);
+   if (!(object->token   = _pndman_hash_new()) ||
+       !(object->trigram = _pndman_hash_new()) ||
+       !(object->doc     = _pndman_hash_new()))
+      goto fail;
+
+   for (r = object->list; r; r = r->next)
+      for (p = r->pnd; p; p = p->next)
+         for (pi = p; pi; pi = pi->next_installed)
+            _pndman_search_add(object, pi);
+
+   if (_pndman_package_observe(_pndman_search_observer, object) != RETURN_OK)
+      goto fail;
+
+   return object;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "pndman_search");
+   if (object) {
+      _pndman_hash_free(object->token, _pndman_search_token_free);
+      _pndman_hash_free(object->trigram, _pndman_search_trigram_free);
+      _pndman_hash_free(object->doc, _pndman_search_doc_free);
+      free(object);
+   }
+   return NULL;
+}
+
+/* \brief search packages matching every word of query */
+PNDMANAPI int pndman_search_query(pndman_search *search, const char *query,
+      pndman_package **result, int max)
+{
+   _pndman_search_words words;
+   _pndman_search_doc *doc;
+   size_t i, j, found = 0;
+   unsigned int term;
+   CHECKUSE(search);
+   CHECKUSE(query);
+   if (max > 0) CHECKUSE(result);
+
+   memset(&words, 0, sizeof(_pndman_search_words));
+   _pndman_search_split(&words, query, 0);
+   if (!words.count || _pndman_search_sort(search) != RETURN_OK)
+      goto out;
+
+   for (i = 0; i != words.count; ++i)
+      words.word[i].weight = _pndman_search_estimate(search, words.word[i].str);
+   qsort(words.word, words.count, sizeof(_pndman_search_word), _pndman_search_query_cmp);
+
+   ++search->gen;
+   search->ncand = 0;
+   for (term = 0; term != words.count; ++term) {
+      if (term && search->ncand * SEARCH_DOC_WORDS < words.word[term].weight)
+         _pndman_search_term_docs(search, words.word[term].str, term);
+      else
+         _pndman_search_term(search, words.word[term].str, term);
+
+      /* drop packages that missed this word */
+      for (i = 0, found = 0; i != search->ncand; ++i) {
+         doc = search->cand[i];
+         if (doc->term != term) continue;
+         doc->score += doc->best;
+         doc->hits++;
+         search->cand[found++] = doc;
+      }
+      if (!(search->ncand = found)) break;
+   }
+
+   if (max < 0) max = 0;
+   if (found > (size_t)max && max) {
+      /* only best max are wanted, keep them sorted at front */
+      qsort(search->cand, max, sizeof(_pndman_search_doc*), _pndman_search_result_cmp);
+      for (i = max; i != found; ++i) {
+         if (_pndman_search_result_cmp(&search->cand[i], &search->cand[max-1]) >= 0) continue;
+         doc = search->cand[i];
+         for (j = max-1; j && _pndman_search_result_cmp(&doc, &search->cand[j-1]) < 0; --j)
+            search->cand[j] = search->cand[j-1];
+         search->cand[j] = doc;
+      }
+   } else qsort(search->cand, found, sizeof(_pndman_search_doc*), _pndman_search_result_cmp);
+
+   if (found > (size_t)max) found = max;
+   for (i = 0; i != found; ++i)
+      result[i] = search->cand[i]->pnd;
+
+out:
+   IFDO(free, words.word);
+   return found;
+}
+
+/* \brief free search index */
+PNDMANAPI void pndman_search_free(pndman_search *search)
+{
+   CHECKUSEV(search);
+   _pndman_package_unobserve(_pndman_search_observer, search);
+   _pndman_hash_free(search->token, _pndman_search_token_free);
+   _pndman_hash_free(search->trigram, _pndman_search_trigram_free);
+   _pndman_hash_free(search->doc, _pndman_search_doc_free);
+   IFDO(free, search->sorted);
+   IFDO(free, search->cand);
+   free(search);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,84 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <assert.h>
+
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+static pthread_mutex_t _pndman_share_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define SHARE_LOCK()   pthread_mutex_lock(&_pndman_share_mutex)
+#  define SHARE_UNLOCK() pthread_mutex_unlock(&_pndman_share_mutex)
+#else
+#  define SHARE_LOCK()
+#  define SHARE_UNLOCK()
+#endif
+
+/* \brief first node of list -> number of owners.
+ * only lists with more than one owner are here,
+ * crawl workers copy and free packages in parallel so table is locked */
+static _pndman_hash *_pndman_share_table = NULL;
+
+/* INTERNAL API */
+
+/* \brief take another reference to list, returns list */
+void* _pndman_share(void *list)
+{
+   size_t refs;
+
+   if (!list) return NULL;
+
+   SHARE_LOCK();
+   if (!_pndman_share_table && !(_pndman_share_table = _pndman_hash_new()))
+      goto fail;
+
+   refs = (size_t)_pndman_hash_get(_pndman_share_table, &list, sizeof(list));
+   if (_pndman_hash_set(_pndman_share_table, &list, sizeof(list), (void*)(refs ? refs + 1 : 2)) != RETURN_OK)
+      goto fail;
+   SHARE_UNLOCK();
+   return list;
+
+fail:
+   SHARE_UNLOCK();
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "shared list");
+   return NULL;
+}
+
+/* \brief drop reference to list,
+ * returns 1 when caller was the last owner and should free it */
+int _pndman_share_release(void *list)
+{
+   size_t refs;
+
+   if (!list) return RETURN_FALSE;
+
+   SHARE_LOCK();
+   if (!_pndman_share_table ||
+       !(refs = (size_t)_pndman_hash_get(_pndman_share_table, &list, sizeof(list)))) {
+      SHARE_UNLOCK();
+      return RETURN_TRUE;
+   }
+
+   if (refs == 2) _pndman_hash_remove(_pndman_share_table, &list, sizeof(list));
+   else _pndman_hash_set(_pndman_share_table, &list, sizeof(list), (void*)(refs - 1));
+
+   if (!_pndman_hash_count(_pndman_share_table)) {
+      _pndman_hash_free(_pndman_share_table, NULL);
+      _pndman_share_table = NULL;
+   }
+   SHARE_UNLOCK();
+   return RETURN_FALSE;
+}
+
+/* \brief does list have other owners? */
+int _pndman_shared(void *list)
+{
+   int shared;
+
+   if (!list) return RETURN_FALSE;
+
+   SHARE_LOCK();
+   shared = (_pndman_share_table && _pndman_hash_get(_pndman_share_table, &list, sizeof(list)));
+   SHARE_UNLOCK();
+   return shared;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
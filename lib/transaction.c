@@ -0,0 +1,396 @@
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+/* \brief state of transaction operation */
+typedef enum _pndman_transaction_state
+{
+   PNDMAN_TRANSACTION_QUEUED,
+   PNDMAN_TRANSACTION_RUNNING,
+   PNDMAN_TRANSACTION_DONE,
+   PNDMAN_TRANSACTION_FAIL,
+} _pndman_transaction_state;
+
+/* \brief rename done by transaction, undone on rollback */
+typedef struct _pndman_journal
+{
+   char *from, *to;
+   int discard;  /* to is removed once transaction is done */
+   int exchange; /* files were swapped, from holds what was at to */
+   struct _pndman_journal *next; /* newest first */
+} _pndman_journal;
+
+/* \brief single operation of transaction */
+typedef struct _pndman_transaction_op
+{
+   pndman_package_handle handle; /* first, callbacks cast back from it */
+   pndman_package_handle_callback callback; /* set by user */
+   _pndman_install_plan plan;
+   _pndman_transaction_state state;
+   char *mount; /* device operation touched */
+   struct _pndman_transaction_op *next;
+} _pndman_transaction_op;
+
+/* \brief batch of package operations committed together */
+struct pndman_transaction
+{
+   pndman_repository *local;
+   pndman_device *device;
+   _pndman_transaction_op *op, *last;
+   _pndman_journal *journal;
+   char committed;
+};
+
+/* \brief does operation touch pnd */
+static int _pndman_transaction_op_has(_pndman_transaction_op *op, pndman_package *pnd)
+{
+   pndman_package *p = op->handle.pnd;
+   if (p == pnd) return RETURN_TRUE;
+   if (p->update && (p->update == pnd || p->update == pnd->update)) return RETURN_TRUE;
+   if (pnd->update && pnd->update == p) return RETURN_TRUE;
+   return RETURN_FALSE;
+}
+
+/* \brief callback of every operation handle */
+static void _pndman_transaction_callback(pndman_curl_code code, pndman_package_handle *handle)
+{
+   _pndman_transaction_op *op = (_pndman_transaction_op*)handle;
+
+   if (code == PNDMAN_CURL_DONE) op->state = PNDMAN_TRANSACTION_DONE;
+   else if (code == PNDMAN_CURL_FAIL) op->state = PNDMAN_TRANSACTION_FAIL;
+   if (op->callback) op->callback(code, handle);
+}
+
+/* \brief move or swap file and record it to journal */
+static int _pndman_transaction_journal(pndman_transaction *object, const char *from, const char *to,
+      int discard, int exchange)
+{
+   _pndman_journal *j;
+   assert(object && from && to);
+
+   if (!(j = calloc(1, sizeof(_pndman_journal))))
+      goto fail;
+   if (!(j->from = strdup(from)) || !(j->to = strdup(to)))
+      goto fail;
+
+   if (exchange) {
+      /* quiet, caller falls back to move */
+      if (_pndman_file_exchange(from, to) != RETURN_OK)
+         goto fail;
+      DEBUG(PNDMAN_LEVEL_CRAP, "exchange: %s <-> %s", from, to);
+   } else {
+      DEBUG(PNDMAN_LEVEL_CRAP, "move: %s -> %s", from, to);
+      if (_pndman_file_move(from, to, 0) != RETURN_OK)
+         goto mv_fail;
+   }
+
+   j->discard  = discard;
+   j->exchange = exchange;
+   j->next = object->journal;
+   object->journal = j;
+   return RETURN_OK;
+
+mv_fail:
+   DEBFAIL(HANDLE_MV_FAIL, from, to);
+fail:
+   if (j) {
+      IFDO(free, j->from);
+      IFDO(free, j->to);
+      free(j);
+   }
+   return RETURN_FAIL;
+}
+
+/* \brief move file and record it to journal */
+static int _pndman_transaction_move(pndman_transaction *object, const char *from, const char *to, int discard)
+{
+   return _pndman_transaction_journal(object, from, to, discard, 0);
+}
+
+/* \brief move file aside, it's removed when transaction is done */
+static int _pndman_transaction_discard(pndman_transaction *object, const char *path)
+{
+   char *aside;
+   int ret;
+
+   int size = snprintf(NULL, 0, "%s.old", path)+1;
+   if (!(aside = malloc(size))) return RETURN_FAIL;
+   sprintf(aside, "%s.old", path);
+   ret = _pndman_transaction_move(object, path, aside, 1);
+   free(aside);
+   return ret;
+}
+
+/* \brief forget journal, removing discarded files */
+static void _pndman_transaction_journal_free(pndman_transaction *object, int finish)
+{
+   _pndman_journal *j, *jn;
+   for (j = object->journal; j; j = jn) {
+      jn = j->next;
+      if (finish && j->discard) unlink(j->exchange ? j->from : j->to);
+      free(j->from);
+      free(j->to);
+      free(j);
+   }
+   object->journal = NULL;
+}
+
+/* \brief undo every rename of journal, newest first */
+static void _pndman_transaction_rollback(pndman_transaction *object)
+{
+   _pndman_journal *j;
+   for (j = object->journal; j; j = j->next) {
+      DEBUG(PNDMAN_LEVEL_CRAP, "rollback: %s -> %s", j->to, j->from);
+      if (j->exchange ? _pndman_file_exchange(j->to, j->from) != RETURN_OK :
+                        _pndman_file_move(j->to, j->from, 0) != RETURN_OK)
+         DEBFAIL(HANDLE_MV_FAIL, j->to, j->from);
+   }
+   _pndman_transaction_journal_free(object, 0);
+}
+
+/* \brief move files of install operation in place */
+static int _pndman_transaction_install(pndman_transaction *object, _pndman_transaction_op *op)
+{
+   pndman_curl_handle *handle = (pndman_curl_handle*)op->handle.data;
+
+   if (_pndman_package_handle_plan(&op->handle, object->local, &op->plan) != RETURN_OK)
+      return RETURN_FAIL;
+
+   if (op->plan.old && op->plan.backup) {
+      if (_pndman_transaction_move(object, op->plan.old, op->plan.backup, 0) != RETURN_OK)
+         return RETURN_FAIL;
+   } else if (op->plan.old && strcmp(op->plan.old, op->plan.install) &&
+              access(op->plan.old, F_OK) == 0) {
+      if (_pndman_transaction_discard(object, op->plan.old) != RETURN_OK)
+         return RETURN_FAIL;
+   }
+
+   if (!(op->mount = strdup(op->handle.device->mount)))
+      return RETURN_FAIL;
+
+   /* whatever is at install path now is replaced,
+    * swapped in one step when filesystem can do it */
+   if (access(op->plan.install, F_OK) == 0) {
+      if (_pndman_transaction_journal(object, handle->path, op->plan.install, 1, 1) == RETURN_OK)
+         return RETURN_OK;
+      if (_pndman_transaction_discard(object, op->plan.install) != RETURN_OK)
+         return RETURN_FAIL;
+   }
+
+   return _pndman_transaction_move(object, handle->path, op->plan.install, 0);
+}
+
+/* \brief move file of removal operation aside */
+static int _pndman_transaction_remove(pndman_transaction *object, _pndman_transaction_op *op)
+{
+   char *path;
+   int ret;
+
+   if (!(path = _pndman_pnd_get_path(op->handle.pnd)))
+      return RETURN_FAIL;
+
+   if (access(path, F_OK) != 0) {
+      DEBFAIL(READ_FAIL, path);
+      free(path);
+      return RETURN_FAIL;
+   }
+
+   ret = _pndman_transaction_discard(object, path);
+   free(path);
+   if (ret != RETURN_OK) return ret;
+   return ((op->mount = strdup(op->handle.pnd->mount)) ? RETURN_OK : RETURN_FAIL);
+}
+
+/* \brief free operation */
+static void _pndman_transaction_op_free(_pndman_transaction_op *op)
+{
+   pndman_package_handle_free(&op->handle);
+   _pndman_install_plan_free(&op->plan);
+   IFDO(free, op->mount);
+   free(op);
+}
+
+/* \brief write database of every device transaction touched, once */
+static int _pndman_transaction_db_commit(pndman_transaction *object)
+{
+   pndman_device *d;
+   _pndman_transaction_op *op;
+   int ret = RETURN_OK;
+
+   for (d = _pndman_device_first(object->device); d; d = d->next) {
+      for (op = object->op; op && (!op->mount || !d->mount || strcmp(op->mount, d->mount)); op = op->next);
+      if (op && _pndman_db_commit(object->local, d) != RETURN_OK)
+         ret = RETURN_FAIL;
+   }
+   return ret;
+}
+
+/* API */
+
+/* \brief create new transaction */
+PNDMANAPI pndman_transaction* pndman_transaction_new(pndman_repository *list, pndman_device *device)
+{
+   pndman_transaction *object;
+   CHECKUSEP(list);
+   CHECKUSEP(device);
+
+   if (!(object = calloc(1, sizeof(pndman_transaction))))
+      goto fail;
+
+   object->local  = _pndman_repository_first(list);
+   object->device = device;
+   return object;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "pndman_transaction");
+   return NULL;
+}
+
+/* \brief add operation to transaction */
+PNDMANAPI pndman_package_handle* pndman_transaction_add(pndman_transaction *transaction,
+      pndman_package *pnd, pndman_device *device, unsigned int flags)
+{
+   _pndman_transaction_op *op;
+   CHECKUSEP(transaction);
+   CHECKUSEP(pnd);
+   CHECKUSEP(flags);
+
+   for (op = transaction->op; op; op = op->next)
+      if (_pndman_transaction_op_has(op, pnd)) goto duplicate_fail;
+
+   if (!(op = calloc(1, sizeof(_pndman_transaction_op))))
+      goto fail;
+
+   if (pndman_package_handle_init(pnd->id, &op->handle) != RETURN_OK) {
+      free(op);
+      goto fail;
+   }
+
+   op->handle.pnd    = pnd;
+   op->handle.device = device;
+   op->handle.flags  = flags;
+   op->state = PNDMAN_TRANSACTION_QUEUED;
+
+   if (transaction->last) transaction->last->next = op;
+   else transaction->op = op;
+   transaction->last = op;
+   return &op->handle;
+
+duplicate_fail:
+   DEBFAIL(TRANSACTION_DUPLICATE, pnd->id);
+   return NULL;
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "transaction operation");
+   return NULL;
+}
+
+/* \brief start downloads of transaction */
+PNDMANAPI int pndman_transaction_perform(pndman_transaction *transaction)
+{
+   _pndman_transaction_op *op;
+   int ret = RETURN_OK;
+   CHECKUSE(transaction);
+
+   for (op = transaction->op; op; op = op->next) {
+      if (op->state != PNDMAN_TRANSACTION_QUEUED)
+         continue;
+
+      if (!(op->handle.flags & PNDMAN_PACKAGE_INSTALL)) {
+         op->state = PNDMAN_TRANSACTION_DONE;
+         continue;
+      }
+
+      op->callback = op->handle.callback;
+      op->handle.callback = _pndman_transaction_callback;
+      op->state = PNDMAN_TRANSACTION_RUNNING;
+      if (pndman_package_handle_perform(&op->handle) != RETURN_OK) {
+         op->state = PNDMAN_TRANSACTION_FAIL;
+         ret = RETURN_FAIL;
+      }
+   }
+
+   return ret;
+}
+
+/* \brief apply whole transaction */
+PNDMANAPI int pndman_transaction_commit(pndman_transaction *transaction)
+{
+   _pndman_transaction_op *op;
+   uint64_t now = _pndman_metrics_now();
+   CHECKUSE(transaction);
+
+   if (transaction->committed)
+      return RETURN_OK;
+
+   /* every download must have succeeded */
+   for (op = transaction->op; op; op = op->next) {
+      if (op->state == PNDMAN_TRANSACTION_FAIL) goto op_fail;
+      if (op->state != PNDMAN_TRANSACTION_DONE &&
+          (op->handle.flags & PNDMAN_PACKAGE_INSTALL)) goto busy_fail;
+   }
+
+   /* verify everything before touching anything */
+   for (op = transaction->op; op; op = op->next)
+      if ((op->handle.flags & PNDMAN_PACKAGE_INSTALL) &&
+          _pndman_package_handle_verify(&op->handle) != RETURN_OK)
+         goto op_fail;
+
+   /* filesystem, journaled */
+   for (op = transaction->op; op; op = op->next) {
+      if ((op->handle.flags & PNDMAN_PACKAGE_REMOVE) &&
+          _pndman_transaction_remove(transaction, op) != RETURN_OK)
+         goto rollback;
+      if ((op->handle.flags & PNDMAN_PACKAGE_INSTALL) &&
+          _pndman_transaction_install(transaction, op) != RETURN_OK)
+         goto rollback;
+   }
+
+   /* files are in place, now repositories */
+   for (op = transaction->op; op; op = op->next) {
+      if (op->handle.flags & PNDMAN_PACKAGE_REMOVE)
+         _pndman_package_handle_forget(&op->handle, transaction->local);
+      if (op->handle.flags & PNDMAN_PACKAGE_INSTALL)
+         _pndman_package_handle_apply(&op->handle, transaction->local, &op->plan);
+      op->handle.pnd = NULL;
+   }
+
+   _pndman_transaction_journal_free(transaction, 1);
+   transaction->committed = 1;
+
+   DEBUG(PNDMAN_LEVEL_CRAP, "Transaction commit took %.2f seconds", (_pndman_metrics_now()-now)/1000000.0);
+   return _pndman_transaction_db_commit(transaction);
+
+op_fail:
+   DEBFAIL(TRANSACTION_FAILED, op->handle.name);
+   return RETURN_FAIL;
+busy_fail:
+   DEBFAIL(TRANSACTION_BUSY);
+   return RETURN_FAIL;
+rollback:
+   DEBFAIL(TRANSACTION_ROLLBACK, op->handle.name);
+   _pndman_transaction_rollback(transaction);
+   for (op = transaction->op; op; op = op->next) {
+      _pndman_install_plan_free(&op->plan);
+      IFDO(free, op->mount);
+   }
+   return RETURN_FAIL;
+}
+
+/* \brief free transaction, cancels unfinished downloads */
+PNDMANAPI void pndman_transaction_free(pndman_transaction *transaction)
+{
+   _pndman_transaction_op *op, *next;
+   CHECKUSEV(transaction);
+
+   for (op = transaction->op; op; op = next) {
+      next = op->next;
+      _pndman_transaction_op_free(op);
+   }
+   _pndman_transaction_journal_free(transaction, 0);
+   free(transaction);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
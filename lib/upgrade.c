@@ -0,0 +1,304 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* \brief sync of one remote repository */
+typedef struct _pndman_upgrade_sync
+{
+   pndman_sync_handle handle; /* first, callbacks cast back from it */
+   struct pndman_upgrade *upgrade;
+   char running;
+   struct _pndman_upgrade_sync *next;
+} _pndman_upgrade_sync;
+
+/* \brief download and install of one update */
+typedef struct _pndman_upgrade_op
+{
+   pndman_package_handle handle; /* first, callbacks cast back from it */
+   struct pndman_upgrade *upgrade;
+   pndman_package *local; /* package being upgraded, NULL once finished */
+   char running;
+   struct _pndman_upgrade_op *next;
+} _pndman_upgrade_op;
+
+/* \brief pipelined sync -> check -> download -> install */
+struct pndman_upgrade
+{
+   pndman_repository *local;
+   pndman_device *device;
+   unsigned int sync_flags, flags;
+   pndman_upgrade_callback callback;
+   void *user_data;
+   _pndman_upgrade_sync *sync;
+   _pndman_upgrade_op *op;
+   int pending, installed, failed;
+   char performed;
+};
+
+/* \brief operation upgrading local pnd */
+static _pndman_upgrade_op* _pndman_upgrade_op_for(pndman_upgrade *object, pndman_package *lp)
+{
+   _pndman_upgrade_op *op;
+   for (op = object->op; op && op->local != lp; op = op->next);
+   return op;
+}
+
+/* \brief stop running operation, its update was replaced */
+static void _pndman_upgrade_op_cancel(_pndman_upgrade_op *op)
+{
+   assert(op);
+   if (!op->running) return;
+   DEBUG(PNDMAN_LEVEL_CRAP, "upgrade: cancel %s, newer update found", op->handle.name);
+   pndman_package_handle_free(&op->handle);
+   op->running = 0;
+   op->local = NULL;
+   op->upgrade->pending--;
+}
+
+/* \brief callback of every package handle,
+ * verified downloads are installed right away */
+static void _pndman_upgrade_op_callback(pndman_curl_code code, pndman_package_handle *handle)
+{
+   _pndman_upgrade_op *op = (_pndman_upgrade_op*)handle;
+   pndman_upgrade *object = op->upgrade;
+
+   if (code == PNDMAN_CURL_DONE) {
+      if (pndman_package_handle_commit(handle, object->local) != RETURN_OK) {
+         IFDO(free, handle->error);
+         handle->error = strdup(UPGRADE_INSTALL_FAIL);
+         code = PNDMAN_CURL_FAIL;
+      }
+   }
+
+   if (code == PNDMAN_CURL_DONE || code == PNDMAN_CURL_FAIL) {
+      if (code == PNDMAN_CURL_DONE) object->installed++;
+      else object->failed++;
+      op->running = 0;
+      op->local = NULL; /* replaced on install */
+      object->pending--;
+   }
+
+   if (object->callback) object->callback(code, NULL, handle, object->user_data);
+}
+
+/* \brief start download of update to lp */
+static int _pndman_upgrade_op_start(pndman_upgrade *object, pndman_package *lp, pndman_context *context)
+{
+   _pndman_upgrade_op *op;
+   assert(object && lp && lp->update);
+
+   if (!(op = calloc(1, sizeof(_pndman_upgrade_op))))
+      goto fail;
+
+   if (pndman_package_handle_init(lp->update->id, &op->handle) != RETURN_OK) {
+      free(op);
+      goto fail;
+   }
+
+   op->handle.pnd      = lp->update;
+   op->handle.device   = object->device;
+   op->handle.flags    = PNDMAN_PACKAGE_INSTALL | object->flags;
+   op->handle.callback = _pndman_upgrade_op_callback;
+   op->handle.context  = context;
+   op->upgrade = object;
+   op->local   = lp;
+   op->next    = object->op;
+   object->op  = op;
+
+   if (pndman_package_handle_perform(&op->handle) != RETURN_OK) {
+      object->failed++;
+      op->local = NULL;
+      return RETURN_FAIL;
+   }
+
+   op->running = 1;
+   object->pending++;
+   return RETURN_OK;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "upgrade operation");
+   return RETURN_FAIL;
+}
+
+/* \brief check local packages against freshly synced repository,
+ * and start downloads of updates it provides */
+static void _pndman_upgrade_check(pndman_upgrade *object, pndman_repository *repo)
+{
+   pndman_package *lp, *rp;
+   _pndman_upgrade_op *op;
+   _pndman_scan *scan;
+   uint32_t hash;
+   size_t i;
+
+   /* flat table of synced repository,
+    * so every local pnd is a linear pass over hashes */
+   if (!(scan = _pndman_scan_new(repo->pnd))) {
+      DEBFAIL(PNDMAN_ALLOC_FAIL, "upgrade check");
+      return;
+   }
+
+   for (lp = object->local->pnd; lp; lp = lp->next) {
+      if (!lp->id) continue;
+      hash = _pndman_scan_hash(lp->id);
+      for (i = 0; (rp = _pndman_scan_find(scan, lp->id, hash, &i)); ++i)
+         _pndman_version_check(lp, rp);
+   }
+   _pndman_scan_free(scan);
+
+   for (lp = object->local->pnd; lp; lp = lp->next) {
+      if (!lp->update || lp->update->repositoryptr != repo)
+         continue;
+
+      /* already downloading this one? */
+      if ((op = _pndman_upgrade_op_for(object, lp))) {
+         if (op->handle.pnd == lp->update) continue;
+         _pndman_upgrade_op_cancel(op);
+      }
+
+      _pndman_upgrade_op_start(object, lp, repo->context);
+   }
+}
+
+/* \brief callback of every sync handle */
+static void _pndman_upgrade_sync_callback(pndman_curl_code code, pndman_sync_handle *handle)
+{
+   _pndman_upgrade_sync *sync = (_pndman_upgrade_sync*)handle;
+   pndman_upgrade *object = sync->upgrade;
+
+   if (code == PNDMAN_CURL_DONE || code == PNDMAN_CURL_FAIL) {
+      sync->running = 0;
+      object->pending--;
+   }
+
+   if (code == PNDMAN_CURL_DONE)
+      _pndman_upgrade_check(object, handle->repository);
+
+   if (object->callback) object->callback(code, handle, NULL, object->user_data);
+}
+
+/* API */
+
+/* \brief create new upgrade */
+PNDMANAPI pndman_upgrade* pndman_upgrade_new(pndman_repository *list, pndman_device *device,
+      unsigned int sync_flags, unsigned int flags)
+{
+   pndman_upgrade *object;
+   CHECKUSEP(list);
+   CHECKUSEP(device);
+
+   if (!(object = calloc(1, sizeof(pndman_upgrade))))
+      goto fail;
+
+   object->local      = _pndman_repository_first(list);
+   object->device     = device;
+   object->sync_flags = sync_flags;
+   object->flags      = flags & ~(PNDMAN_PACKAGE_INSTALL|PNDMAN_PACKAGE_REMOVE);
+   return object;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "pndman_upgrade");
+   return NULL;
+}
+
+/* \brief set callback of upgrade */
+PNDMANAPI void pndman_upgrade_set_callback(pndman_upgrade *upgrade,
+      pndman_upgrade_callback callback, void *user_data)
+{
+   CHECKUSEV(upgrade);
+   upgrade->callback  = callback;
+   upgrade->user_data = user_data;
+}
+
+/* \brief start syncs of upgrade */
+PNDMANAPI int pndman_upgrade_perform(pndman_upgrade *upgrade)
+{
+   _pndman_upgrade_sync *sync;
+   pndman_repository *r;
+   int ret = RETURN_OK;
+   CHECKUSE(upgrade);
+
+   if (upgrade->performed)
+      return RETURN_OK;
+   upgrade->performed = 1;
+
+   for (r = upgrade->local->next; r; r = r->next) {
+      if (!(sync = calloc(1, sizeof(_pndman_upgrade_sync))))
+         goto fail;
+
+      pndman_sync_handle_init(&sync->handle);
+      sync->handle.repository = r;
+      sync->handle.flags      = upgrade->sync_flags;
+      sync->handle.callback   = _pndman_upgrade_sync_callback;
+      sync->handle.context    = r->context;
+      sync->upgrade = upgrade;
+      sync->next    = upgrade->sync;
+      upgrade->sync = sync;
+
+      if (pndman_sync_handle_perform(&sync->handle) != RETURN_OK) {
+         ret = RETURN_FAIL;
+         continue;
+      }
+
+      sync->running = 1;
+      upgrade->pending++;
+   }
+
+   return ret;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "upgrade sync");
+   return RETURN_FAIL;
+}
+
+/* \brief number of syncs and downloads still running */
+PNDMANAPI int pndman_upgrade_pending(pndman_upgrade *upgrade)
+{
+   CHECKUSE(upgrade);
+   return upgrade->pending;
+}
+
+/* \brief get number of installed and failed packages */
+PNDMANAPI void pndman_upgrade_get_stats(pndman_upgrade *upgrade, int *installed, int *failed)
+{
+   CHECKUSEV(upgrade);
+   if (installed) *installed = upgrade->installed;
+   if (failed)    *failed    = upgrade->failed;
+}
+
+/* \brief write database once upgrade is done */
+PNDMANAPI int pndman_upgrade_commit(pndman_upgrade *upgrade)
+{
+   CHECKUSE(upgrade);
+
+   if (upgrade->pending)
+      goto busy_fail;
+
+   return _pndman_db_commit(upgrade->local, upgrade->device);
+
+busy_fail:
+   DEBFAIL(UPGRADE_BUSY);
+   return RETURN_FAIL;
+}
+
+/* \brief free upgrade, cancels unfinished syncs and downloads */
+PNDMANAPI void pndman_upgrade_free(pndman_upgrade *upgrade)
+{
+   _pndman_upgrade_sync *sync, *snext;
+   _pndman_upgrade_op *op, *onext;
+   CHECKUSEV(upgrade);
+
+   for (sync = upgrade->sync; sync; sync = snext) {
+      snext = sync->next;
+      pndman_sync_handle_free(&sync->handle);
+      free(sync);
+   }
+   for (op = upgrade->op; op; op = onext) {
+      onext = op->next;
+      pndman_package_handle_free(&op->handle);
+      free(op);
+   }
+   free(upgrade);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
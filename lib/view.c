@@ -0,0 +1,394 @@
+#include "internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+/* \brief package in view, with copy of its sort key,
+ * packages change under us and entry must still be found */
+typedef struct _pndman_view_entry
+{
+   pndman_package *pnd; /* NULL when removed, until view is flushed */
+   char *key;
+   char *id;
+   uint64_t number;
+   size_t pending; /* index in pending, (size_t)-1 when sorted */
+} _pndman_view_entry;
+
+/* \brief sorted view of repository list */
+struct pndman_view
+{
+   pndman_repository *list;
+   pndman_view_sort sort;
+   int descending;
+   pndman_view_filter filter;
+   void *user_data;
+   _pndman_hash *pnd; /* pndman_package* -> _pndman_view_entry */
+   _pndman_view_entry **entry; /* sorted */
+   size_t count, dead;
+   _pndman_view_entry **pending; /* not yet sorted */
+   size_t npending, apending;
+   unsigned int locale_serial; /* of title keys */
+};
+
+/* \brief free entry */
+static void _pndman_view_entry_free(void *ptr)
+{
+   _pndman_view_entry *entry = ptr;
+   IFDO(free, entry->key);
+   IFDO(free, entry->id);
+   free(entry);
+}
+
+/* \brief create entry with sort key of package */
+static _pndman_view_entry* _pndman_view_entry_new(pndman_view *object, pndman_package *pnd)
+{
+   _pndman_view_entry *entry;
+   const char *key = NULL;
+
+   if (!(entry = calloc(1, sizeof(_pndman_view_entry))))
+      return NULL;
+
+   entry->pnd = pnd;
+   switch (object->sort) {
+      case PNDMAN_VIEW_SORT_TITLE:    key = pndman_package_get_title(pnd); break;
+      case PNDMAN_VIEW_SORT_MODIFIED: entry->number = pnd->modified_time; break;
+      case PNDMAN_VIEW_SORT_SIZE:     entry->number = pnd->size; break;
+      case PNDMAN_VIEW_SORT_RATING:   entry->number = pnd->rating; break;
+      default: break;
+   }
+
+   if ((key && !(entry->key = strdup(key))) ||
+       (pnd->id && !(entry->id = strdup(pnd->id)))) {
+      _pndman_view_entry_free(entry);
+      return NULL;
+   }
+   return entry;
+}
+
+/* \brief compare entries by sort key, then id, so order is total */
+static int _pndman_view_cmp(pndman_view *object, const _pndman_view_entry *a, const _pndman_view_entry *b)
+{
+   int r = 0;
+
+   if (object->sort == PNDMAN_VIEW_SORT_TITLE) {
+      if (a->key && b->key) r = _strupord(a->key, b->key);
+      else r = (a->key ? -1 : (b->key ? 1 : 0)); /* untitled last */
+   } else if (object->sort != PNDMAN_VIEW_SORT_ID) {
+      r = (a->number < b->number ? -1 : (a->number > b->number));
+   }
+   if (r) return (object->descending ? -r : r);
+
+   if (a->id && b->id && (r = strcmp(a->id, b->id))) return r;
+   return (a->pnd < b->pnd ? -1 : (a->pnd > b->pnd));
+}
+
+/* \brief merge sort entries, qsort can't pass view to compare */
+static void _pndman_view_sort(pndman_view *object, _pndman_view_entry **entry, _pndman_view_entry **tmp, size_t count)
+{
+   size_t i, j, n, half = count / 2;
+
+   if (count < 2) return;
+   _pndman_view_sort(object, entry, tmp, half);
+   _pndman_view_sort(object, entry + half, tmp, count - half);
+
+   memcpy(tmp, entry, half * sizeof(_pndman_view_entry*));
+   for (i = 0, j = half, n = 0; i != half;) {
+      if (j == count || _pndman_view_cmp(object, tmp[i], entry[j]) <= 0)
+         entry[n++] = tmp[i++];
+      else
+         entry[n++] = entry[j++];
+   }
+}
+
+/* \brief grow array to hold count+n items */
+static int _pndman_view_grow(_pndman_view_entry ***array, size_t *alloc, size_t count, size_t n)
+{
+   _pndman_view_entry **tmp;
+   size_t size = (*alloc ? *alloc : 16);
+
+   if (count + n <= *alloc) return RETURN_OK;
+   while (size < count + n) size *= 2;
+   if (!(tmp = realloc(*array, size * sizeof(_pndman_view_entry*))))
+      return RETURN_FAIL;
+   *array = tmp;
+   *alloc = size;
+   return RETURN_OK;
+}
+
+/* \brief take package out of view */
+static void _pndman_view_remove(pndman_view *object, pndman_package *pnd)
+{
+   _pndman_view_entry *entry;
+
+   if (!(entry = _pndman_hash_remove(object->pnd, &pnd, sizeof(pndman_package*))))
+      return;
+
+   if (entry->pending != (size_t)-1) {
+      object->pending[entry->pending] = object->pending[--object->npending];
+      object->pending[entry->pending]->pending = entry->pending;
+      _pndman_view_entry_free(entry);
+   } else {
+      /* stays in sorted array until flush */
+      entry->pnd = NULL;
+      ++object->dead;
+   }
+}
+
+/* \brief (re)add package to view, it is filtered and sorted in on next access.
+ * this runs inside observer lock, so user filter is not called here */
+static void _pndman_view_add(pndman_view *object, pndman_package *pnd)
+{
+   _pndman_view_entry *entry;
+
+   _pndman_view_remove(object, pnd);
+   if (!(entry = _pndman_view_entry_new(object, pnd)))
+      goto fail;
+   if (_pndman_view_grow(&object->pending, &object->apending, object->npending, 1) != RETURN_OK)
+      goto fail;
+   if (_pndman_hash_set(object->pnd, &pnd, sizeof(pndman_package*), entry) != RETURN_OK)
+      goto fail;
+
+   entry->pending = object->npending;
+   object->pending[object->npending++] = entry;
+   return;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "view entry");
+   if (entry) _pndman_view_entry_free(entry);
+}
+
+/* \brief free every entry of view */
+static void _pndman_view_clear(pndman_view *object)
+{
+   size_t i;
+   for (i = 0; i != object->count; ++i)
+      _pndman_view_entry_free(object->entry[i]);
+   for (i = 0; i != object->npending; ++i)
+      _pndman_view_entry_free(object->pending[i]);
+   object->count = object->npending = object->dead = 0;
+}
+
+/* \brief add every package of repository list to view,
+ * observers of other contexts may be looking at the view,
+ * so it's rebuilt with them held back */
+static int _pndman_view_fill(pndman_view *object)
+{
+   pndman_repository *r;
+   pndman_package *p, *pi;
+   _pndman_hash *hash;
+
+   if (!(hash = _pndman_hash_new()))
+      return RETURN_FAIL;
+
+   _pndman_package_observe_lock();
+   _pndman_view_clear(object);
+   _pndman_hash_free(object->pnd, NULL);
+   object->pnd = hash;
+   object->locale_serial = _pndman_locale_serial_get();
+
+   for (r = object->list; r; r = r->next)
+      for (p = r->pnd; p; p = p->next)
+         for (pi = p; pi; pi = pi->next_installed)
+            _pndman_view_add(object, pi);
+   _pndman_package_observe_unlock();
+   return RETURN_OK;
+}
+
+/* \brief sort pending packages in and drop removed ones,
+ * O(n + k log k) for k changed packages */
+static int _pndman_view_flush(pndman_view *object)
+{
+   _pndman_view_entry **merged = NULL, *e;
+   pndman_package **drop = NULL;
+   size_t i, j, n, total;
+
+   /* title keys are in preferred locale, rebuild them when it changes */
+   if (object->sort == PNDMAN_VIEW_SORT_TITLE &&
+       object->locale_serial != _pndman_locale_serial_get() &&
+       _pndman_view_fill(object) != RETURN_OK)
+      goto fail;
+
+   /* filter packages that changed on thread of the caller,
+    * hash is shared with observers so they're dropped under lock */
+   if (object->filter && object->npending) {
+      if (!(drop = malloc(object->npending * sizeof(pndman_package*))))
+         goto fail;
+      for (i = 0, n = 0; i != object->npending; ++i)
+         if (!object->filter(object->pending[i]->pnd, object->user_data))
+            drop[n++] = object->pending[i]->pnd;
+      _pndman_package_observe_lock();
+      for (i = 0; i != n; ++i)
+         _pndman_view_remove(object, drop[i]);
+      _pndman_package_observe_unlock();
+      NULLDO(free, drop);
+   }
+
+   if (!object->npending && !object->dead)
+      return RETURN_OK;
+
+   total = object->count - object->dead + object->npending;
+   if (!(merged = malloc((total ? total : 1) * sizeof(_pndman_view_entry*))))
+      goto fail;
+
+   /* first half of merged is free while sorting */
+   _pndman_view_sort(object, object->pending, merged, object->npending);
+
+   for (i = 0, j = 0, n = 0; i != object->count || j != object->npending;) {
+      if (i != object->count && !object->entry[i]->pnd) {
+         _pndman_view_entry_free(object->entry[i++]);
+         continue;
+      }
+      if (j == object->npending ||
+         (i != object->count && _pndman_view_cmp(object, object->entry[i], object->pending[j]) < 0)) {
+         merged[n++] = object->entry[i++];
+      } else {
+         e = object->pending[j++];
+         e->pending = (size_t)-1;
+         merged[n++] = e;
+      }
+   }
+
+   IFDO(free, object->entry);
+   object->entry = merged;
+   object->count = total;
+   object->npending = object->dead = 0;
+   return RETURN_OK;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "view");
+   return RETURN_FAIL;
+}
+
+/* \brief follow packages of repositories */
+static void _pndman_view_observer(_pndman_package_event event, pndman_package *pnd, void *user_data)
+{
+   pndman_view *object = user_data;
+
+   if (event == PNDMAN_PACKAGE_FREED)
+      _pndman_view_remove(object, pnd);
+   else if (_pndman_repository_first(pnd->repositoryptr) == object->list)
+      _pndman_view_add(object, pnd);
+}
+
+/* API */
+
+/* \brief create sorted view of repository list */
+PNDMANAPI pndman_view* pndman_view_new(pndman_repository *list,
+      pndman_view_sort sort, int descending)
+{
+   pndman_view *object;
+   CHECKUSEP(list);
+
+   if (!(object = calloc(1, sizeof(pndman_view))))
+      goto fail;
+
+   object->list       = _pndman_repository_first(list);
+   object->sort       = sort;
+   object->descending = descending;
+   if (_pndman_view_fill(object) != RETURN_OK)
+      goto fail;
+
+   if (_pndman_package_observe(_pndman_view_observer, object) != RETURN_OK)
+      goto fail;
+
+   return object;
+
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "pndman_view");
+   if (object) {
+      _pndman_view_clear(object);
+      _pndman_hash_free(object->pnd, NULL);
+      IFDO(free, object->entry);
+      IFDO(free, object->pending);
+      free(object);
+   }
+   return NULL;
+}
+
+/* \brief change sort of view */
+PNDMANAPI int pndman_view_set_sort(pndman_view *view, pndman_view_sort sort, int descending)
+{
+   pndman_view_sort old_sort;
+   int old_descending;
+   CHECKUSE(view);
+
+   if (view->sort == sort && view->descending == descending)
+      return RETURN_OK;
+
+   old_sort = view->sort; old_descending = view->descending;
+   view->sort       = sort;
+   view->descending = descending;
+   if (_pndman_view_fill(view) != RETURN_OK) {
+      view->sort       = old_sort;
+      view->descending = old_descending;
+      return RETURN_FAIL;
+   }
+   return RETURN_OK;
+}
+
+/* \brief set filter of view */
+PNDMANAPI int pndman_view_set_filter(pndman_view *view,
+      pndman_view_filter filter, void *user_data)
+{
+   CHECKUSE(view);
+   view->filter    = filter;
+   view->user_data = user_data;
+   return _pndman_view_fill(view);
+}
+
+/* \brief number of packages in view */
+PNDMANAPI int pndman_view_count(pndman_view *view)
+{
+   CHECKUSE(view);
+   if (_pndman_view_flush(view) != RETURN_OK)
+      return RETURN_FAIL;
+   return view->count;
+}
+
+/* \brief package at index of view */
+PNDMANAPI pndman_package* pndman_view_get(pndman_view *view, int index)
+{
+   CHECKUSEP(view);
+   if (_pndman_view_flush(view) != RETURN_OK)
+      return NULL;
+   if (index < 0 || (size_t)index >= view->count)
+      return NULL;
+   return view->entry[index]->pnd;
+}
+
+/* \brief index of package in view */
+PNDMANAPI int pndman_view_find(pndman_view *view, pndman_package *pnd)
+{
+   _pndman_view_entry *entry;
+   size_t lo, hi, mid;
+   int r;
+   CHECKUSE(view);
+   CHECKUSE(pnd);
+
+   if (_pndman_view_flush(view) != RETURN_OK)
+      return RETURN_FAIL;
+   if (!(entry = _pndman_hash_get(view->pnd, &pnd, sizeof(pndman_package*))))
+      return RETURN_FAIL;
+
+   for (lo = 0, hi = view->count; lo < hi;) {
+      mid = (lo + hi) / 2;
+      if (!(r = _pndman_view_cmp(view, view->entry[mid], entry))) return mid;
+      if (r < 0) lo = mid + 1;
+      else hi = mid;
+   }
+   return RETURN_FAIL;
+}
+
+/* \brief free view */
+PNDMANAPI void pndman_view_free(pndman_view *view)
+{
+   CHECKUSEV(view);
+   _pndman_package_unobserve(_pndman_view_observer, view);
+   _pndman_view_clear(view);
+   _pndman_hash_free(view->pnd, NULL);
+   IFDO(free, view->entry);
+   IFDO(free, view->pending);
+   free(view);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
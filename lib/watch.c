@@ -0,0 +1,540 @@
+#include "internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <errno.h>
+
+#ifdef __linux__
+#  define PNDMAN_WATCH_INOTIFY
+#  include <dirent.h>
+#  include <sys/inotify.h>
+#endif
+
+/* \brief watched directory */
+typedef struct _pndman_watch_dir
+{
+   int wd;
+   pndman_device *device;
+   char *relative; /* from device mount, "" for mount itself */
+   int pending;    /* ancestor of missing root, only waits for it to appear */
+   struct _pndman_watch_dir *next;
+} _pndman_watch_dir;
+
+/* \brief watcher of local repository */
+struct pndman_watch
+{
+   int fd;
+   int full;
+   pndman_device *device;
+   pndman_repository *local;
+   pndman_watch_callback callback;
+   void *user_data;
+   _pndman_watch_dir *dir;
+};
+
+#ifdef PNDMAN_WATCH_INOTIFY
+/* \brief events we care about, files are picked up once fully written */
+#define PNDMAN_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+                           IN_CREATE | IN_DELETE | IN_DELETE_SELF)
+
+/* \brief events of ancestor directories, when root doesn't exist yet */
+#define PNDMAN_WATCH_PENDING_MASK (IN_CREATE | IN_MOVED_TO)
+
+/* \brief directories PNDs are crawled from */
+static const char *_pndman_watch_roots[] = {
+   "pandora/desktop",
+   "pandora/menu",
+   "pandora/apps",
+   NULL
+};
+
+/* \brief join relative path and name, free it */
+static char* _pndman_watch_path(const char *relative, const char *name)
+{
+   char *path;
+   int size = snprintf(NULL, 0, "%s/%s", relative, name)+1;
+   if (!(path = malloc(size))) return NULL;
+   sprintf(path, "%s/%s", relative, name);
+   return path;
+}
+
+/* \brief is root at or below relative directory */
+static int _pndman_watch_below(const char *root, const char *relative)
+{
+   size_t len = strlen(relative);
+   if (!len) return RETURN_TRUE;
+   return (!strncmp(root, relative, len) && (root[len] == '/' || root[len] == 0));
+}
+
+/* \brief is relative one of the root directories */
+static int _pndman_watch_is_root(const char *relative)
+{
+   int i;
+   for (i = 0; _pndman_watch_roots[i]; ++i)
+      if (!strcmp(_pndman_watch_roots[i], relative)) return RETURN_TRUE;
+   return RETURN_FALSE;
+}
+
+/* \brief tell application about change */
+static void _pndman_watch_notify(pndman_watch *object, pndman_watch_event event, pndman_package *pnd)
+{
+   if (object->callback) object->callback(event, pnd, object->user_data);
+}
+
+/* \brief find pnd installed at path of mount */
+static pndman_package* _pndman_watch_find(pndman_watch *object, const char *mount, const char *relative)
+{
+   pndman_package *p, *pi;
+   for (p = object->local->pnd; p; p = p->next)
+      for (pi = p; pi; pi = pi->next_installed)
+         if (pi->mount && pi->path && !strcmp(pi->mount, mount) && !strcmp(pi->path, relative))
+            return pi;
+   return NULL;
+}
+
+/* \brief remove pnd from local repository */
+static void _pndman_watch_forget(pndman_watch *object, pndman_package *pnd)
+{
+   assert(object && pnd);
+   DEBUG(PNDMAN_LEVEL_CRAP, "watch: removed %s", pnd->path);
+   _pndman_watch_notify(object, PNDMAN_WATCH_REMOVED, pnd);
+   _pndman_repository_free_pnd(pnd, object->local);
+}
+
+/* \brief remove every pnd under relative directory of mount */
+static int _pndman_watch_forget_dir(pndman_watch *object, const char *mount, const char *relative)
+{
+   pndman_package *p, *pi;
+   size_t len = strlen(relative);
+   int ret = 0;
+
+   /* freeing may relink the lists, start over after each */
+again:
+   for (p = object->local->pnd; p; p = p->next)
+      for (pi = p; pi; pi = pi->next_installed)
+         if (pi->mount && pi->path && !strcmp(pi->mount, mount) &&
+             !strncmp(pi->path, relative, len) && pi->path[len] == '/') {
+            _pndman_watch_forget(object, pi);
+            ++ret; goto again;
+         }
+   return ret;
+}
+
+/* \brief file was written or moved in, (re)parse it */
+static int _pndman_watch_file(pndman_watch *object, pndman_device *device, const char *relative)
+{
+   pndman_package *old, *pnd;
+   assert(object && device && relative);
+
+   old = _pndman_watch_find(object, device->mount, relative);
+   pnd = _pndman_crawl_file(object->full, device, relative, object->local);
+
+   /* file at this path is not the package it was anymore */
+   if (old && old != pnd) {
+      _pndman_watch_forget(object, old);
+      if (!pnd) return 1;
+   }
+   if (!pnd) return 0;
+
+   DEBUG(PNDMAN_LEVEL_CRAP, "watch: %s %s", (old == pnd ? "changed" : "added"), relative);
+   _pndman_watch_notify(object, (old == pnd ? PNDMAN_WATCH_CHANGED : PNDMAN_WATCH_ADDED), pnd);
+   return 1;
+}
+
+/* \brief get watched directory by descriptor */
+static _pndman_watch_dir* _pndman_watch_dir_get(pndman_watch *object, int wd)
+{
+   _pndman_watch_dir *d;
+   for (d = object->dir; d && d->wd != wd; d = d->next);
+   return d;
+}
+
+/* \brief forget watched directory */
+static void _pndman_watch_dir_free(pndman_watch *object, _pndman_watch_dir *dir)
+{
+   _pndman_watch_dir *d, *prev = NULL;
+   for (d = object->dir; d && d != dir; prev = d, d = d->next);
+   if (!d) return;
+   if (prev) prev->next = d->next;
+   else object->dir = d->next;
+   IFDO(free, d->relative);
+   free(d);
+}
+
+/* \brief stop watching directory and its subdirectories,
+ * used when they are moved away */
+static void _pndman_watch_dir_remove(pndman_watch *object, pndman_device *device, const char *relative)
+{
+   _pndman_watch_dir *d, *next;
+   size_t len = strlen(relative);
+
+   for (d = object->dir; d; d = next) {
+      next = d->next;
+      if (d->device != device || strncmp(d->relative, relative, len) ||
+          (d->relative[len] != '/' && d->relative[len] != 0))
+         continue;
+      inotify_rm_watch(object->fd, d->wd);
+      _pndman_watch_dir_free(object, d);
+   }
+}
+
+/* \brief stop watching every directory of device,
+ * rm is 0 when kernel dropped the watches already */
+static void _pndman_watch_device_drop(pndman_watch *object, pndman_device *device, int rm)
+{
+   _pndman_watch_dir *d, *next;
+   for (d = object->dir; d; d = next) {
+      next = d->next;
+      if (d->device != device) continue;
+      if (rm) inotify_rm_watch(object->fd, d->wd);
+      _pndman_watch_dir_free(object, d);
+   }
+}
+
+/* \brief watch nearest existing ancestor of missing root,
+ * root is watched when it's created (fresh card has no pandora/menu) */
+static void _pndman_watch_pending_add(pndman_watch *object, pndman_device *device, const char *relative)
+{
+   _pndman_watch_dir *d;
+   char *parent, *slash, *path;
+   int wd;
+
+   if (!(parent = strdup(relative)))
+      return;
+   if ((slash = strrchr(parent, '/'))) *slash = 0;
+   else *parent = 0;
+
+   if (!(path = (*parent ? _pndman_watch_path(device->mount, parent) : strdup(device->mount)))) {
+      free(parent);
+      return;
+   }
+
+   if ((wd = inotify_add_watch(object->fd, path, PNDMAN_WATCH_PENDING_MASK | IN_ONLYDIR)) == -1) {
+      if (errno == ENOENT && *parent) _pndman_watch_pending_add(object, device, parent);
+      else DEBFAIL(WATCH_ADD_FAIL, path, strerror(errno));
+      free(parent);
+      free(path);
+      return;
+   }
+
+   DEBUG(PNDMAN_LEVEL_CRAP, "watch: waiting for %s in %s", relative, path);
+   free(path);
+
+   /* other missing roots may wait in same directory */
+   if ((d = _pndman_watch_dir_get(object, wd))) {
+      free(parent);
+      return;
+   }
+
+   if (!(d = calloc(1, sizeof(_pndman_watch_dir)))) {
+      free(parent);
+      return;
+   }
+   d->wd       = wd;
+   d->device   = device;
+   d->relative = parent;
+   d->pending  = 1;
+   d->next     = object->dir;
+   object->dir = d;
+}
+
+/* \brief watch directory and its subdirectories,
+ * with scan PNDs already in them are added */
+static int _pndman_watch_dir_add(pndman_watch *object, pndman_device *device, const char *relative, int scan)
+{
+   _pndman_watch_dir *d;
+   char *path, *sub;
+   DIR *dp;
+   struct dirent *ep;
+   int wd, ret = 0;
+
+   if (!(path = _pndman_watch_path(device->mount, relative)))
+      return 0;
+
+   if ((wd = inotify_add_watch(object->fd, path, PNDMAN_WATCH_MASK | IN_ONLYDIR)) == -1) {
+      if (errno != ENOENT) DEBFAIL(WATCH_ADD_FAIL, path, strerror(errno));
+      else if (_pndman_watch_is_root(relative)) _pndman_watch_pending_add(object, device, relative);
+      free(path);
+      return 0;
+   }
+
+   /* same inode can be returned again */
+   if (!(d = _pndman_watch_dir_get(object, wd))) {
+      if (!(d = calloc(1, sizeof(_pndman_watch_dir))))
+         goto fail;
+      d->wd = wd;
+      d->next = object->dir;
+      object->dir = d;
+   }
+   IFDO(free, d->relative);
+   d->relative = strdup(relative);
+   d->device = device;
+
+   if (!(dp = opendir(path)))
+      goto fail;
+
+   while ((ep = readdir(dp))) {
+      if (!strcmp(ep->d_name, ".") || !strcmp(ep->d_name, "..")) continue;
+      if (ep->d_type != DT_DIR && !scan) continue;
+      if (!(sub = _pndman_watch_path(relative, ep->d_name))) continue;
+      if (ep->d_type == DT_DIR) ret += _pndman_watch_dir_add(object, device, sub, scan);
+      else ret += _pndman_watch_file(object, device, sub);
+      free(sub);
+   }
+   closedir(dp);
+
+   free(path);
+   return ret;
+
+fail:
+   free(path);
+   return ret;
+}
+
+/* \brief directory appeared or went away,
+ * watch roots at or below it again */
+static int _pndman_watch_roots_add(pndman_watch *object, pndman_device *device, const char *relative)
+{
+   int i, ret = 0;
+   for (i = 0; _pndman_watch_roots[i]; ++i)
+      if (_pndman_watch_below(_pndman_watch_roots[i], relative))
+         ret += _pndman_watch_dir_add(object, device, _pndman_watch_roots[i], 1);
+   return ret;
+}
+
+/* \brief handle single inotify event */
+static int _pndman_watch_event(pndman_watch *object, struct inotify_event *ev)
+{
+   _pndman_watch_dir *d;
+   pndman_device *device;
+   pndman_package *pnd;
+   char *relative;
+   int ret = 0;
+
+   if (!(d = _pndman_watch_dir_get(object, ev->wd)))
+      return 0;
+
+   /* filesystem of device went away and its watches with it,
+    * device is watched again when it's added back */
+   if (ev->mask & IN_UNMOUNT) {
+      DEBUG(PNDMAN_LEVEL_CRAP, "watch: unmounted %s", d->device->mount);
+      _pndman_watch_device_drop(object, d->device, 0);
+      return 0;
+   }
+
+   /* watch is gone with its directory,
+    * roots in it are waited for again */
+   if (ev->mask & IN_IGNORED) {
+      device   = d->device;
+      relative = d->relative;
+      d->relative = NULL;
+      _pndman_watch_dir_free(object, d);
+      if (relative) {
+         ret = _pndman_watch_roots_add(object, device, relative);
+         free(relative);
+      }
+      return ret;
+   }
+
+   if (!ev->len)
+      return 0;
+   if (!(relative = (*d->relative ? _pndman_watch_path(d->relative, ev->name) : strdup(ev->name))))
+      return 0;
+
+   if (d->pending) {
+      if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+         ret = _pndman_watch_roots_add(object, d->device, relative);
+      free(relative);
+      return ret;
+   }
+
+   if (ev->mask & IN_ISDIR) {
+      if (ev->mask & (IN_CREATE | IN_MOVED_TO)) {
+         ret = _pndman_watch_dir_add(object, d->device, relative, 1);
+      } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+         _pndman_watch_dir_remove(object, d->device, relative);
+         ret = _pndman_watch_forget_dir(object, d->device->mount, relative);
+      }
+   } else if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+      ret = _pndman_watch_file(object, d->device, relative);
+   } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+      if ((pnd = _pndman_watch_find(object, d->device->mount, relative))) {
+         _pndman_watch_forget(object, pnd);
+         ret = 1;
+      }
+   }
+
+   free(relative);
+   return ret;
+}
+
+/* \brief events were lost, bring local repository up to date the slow way */
+static void _pndman_watch_rescan(pndman_watch *object)
+{
+   pndman_device *d;
+   pndman_package *p, *pi;
+   char *path;
+   int gone;
+
+   DEBUG(PNDMAN_LEVEL_WARN, WATCH_OVERFLOW);
+
+   /* forget what is not there anymore */
+again:
+   for (p = object->local->pnd; p; p = p->next)
+      for (pi = p; pi; pi = pi->next_installed) {
+         for (d = object->device; d && (!d->mount || !pi->mount || strcmp(d->mount, pi->mount)); d = d->next);
+         if (!d || !(path = _pndman_pnd_get_path(pi))) continue;
+         gone = (access(path, F_OK) != 0);
+         free(path);
+         if (gone) {
+            _pndman_watch_forget(object, pi);
+            goto again;
+         }
+      }
+
+   for (d = object->device; d; d = d->next)
+      pndman_package_crawl(object->full, d, object->local);
+   _pndman_watch_notify(object, PNDMAN_WATCH_RESCAN, NULL);
+}
+#endif
+
+/* API */
+
+/* \brief create watcher for PND directories of every device */
+PNDMANAPI pndman_watch* pndman_watch_new(pndman_device *device, pndman_repository *local, int full_crawl)
+{
+#ifdef PNDMAN_WATCH_INOTIFY
+   pndman_watch *object;
+   pndman_device *d;
+   int i;
+   CHECKUSEP(device);
+   CHECKUSEP(local);
+
+   if (!(object = calloc(1, sizeof(pndman_watch))))
+      goto fail;
+
+   object->device = _pndman_device_first(device);
+   object->local  = _pndman_repository_first(local);
+   object->full   = full_crawl;
+
+   if ((object->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)
+      goto init_fail;
+
+   for (d = object->device; d; d = d->next) {
+      if (!d->mount) continue;
+      for (i = 0; _pndman_watch_roots[i]; ++i)
+         _pndman_watch_dir_add(object, d, _pndman_watch_roots[i], 0);
+   }
+
+   return object;
+
+init_fail:
+   DEBFAIL(WATCH_INIT_FAIL, strerror(errno));
+   free(object);
+   return NULL;
+fail:
+   DEBFAIL(PNDMAN_ALLOC_FAIL, "pndman_watch");
+   return NULL;
+#else
+   (void)device; (void)local; (void)full_crawl;
+   DEBFAIL(WATCH_NOT_SUPPORTED);
+   return NULL;
+#endif
+}
+
+/* \brief watch device added to list after pndman_watch_new */
+PNDMANAPI int pndman_watch_add_device(pndman_watch *watch, pndman_device *device)
+{
+#ifdef PNDMAN_WATCH_INOTIFY
+   int i;
+   CHECKUSE(watch);
+   CHECKUSE(device);
+
+   if (!watch->device) watch->device = _pndman_device_first(device);
+   if (!device->mount) return RETURN_OK;
+
+   _pndman_watch_device_drop(watch, device, 1);
+   for (i = 0; _pndman_watch_roots[i]; ++i)
+      _pndman_watch_dir_add(watch, device, _pndman_watch_roots[i], 0);
+   return RETURN_OK;
+#else
+   (void)watch; (void)device;
+   return RETURN_FAIL;
+#endif
+}
+
+/* \brief stop watching device, before it's freed */
+PNDMANAPI void pndman_watch_remove_device(pndman_watch *watch, pndman_device *device)
+{
+   CHECKUSEV(watch);
+   CHECKUSEV(device);
+#ifdef PNDMAN_WATCH_INOTIFY
+   _pndman_watch_device_drop(watch, device, 1);
+#endif
+   if (watch->device == device) watch->device = device->next;
+}
+
+/* \brief set callback of watcher */
+PNDMANAPI void pndman_watch_set_callback(pndman_watch *watch,
+      pndman_watch_callback callback, void *user_data)
+{
+   CHECKUSEV(watch);
+   watch->callback  = callback;
+   watch->user_data = user_data;
+}
+
+/* \brief fd that becomes readable when there are changes */
+PNDMANAPI int pndman_watch_get_fd(pndman_watch *watch)
+{
+   CHECKUSE(watch);
+   return watch->fd;
+}
+
+/* \brief apply pending changes to local repository */
+PNDMANAPI int pndman_watch_dispatch(pndman_watch *watch)
+{
+#ifdef PNDMAN_WATCH_INOTIFY
+   char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+   struct inotify_event *ev;
+   ssize_t len;
+   char *ptr;
+   int ret = 0;
+   CHECKUSE(watch);
+
+   while ((len = read(watch->fd, buffer, sizeof(buffer))) > 0) {
+      for (ptr = buffer; ptr < buffer + len; ptr += sizeof(struct inotify_event) + ev->len) {
+         ev = (struct inotify_event*)ptr;
+         if (ev->mask & IN_Q_OVERFLOW) {
+            _pndman_watch_rescan(watch);
+            ++ret;
+            continue;
+         }
+         ret += _pndman_watch_event(watch, ev);
+      }
+   }
+
+   return ret;
+#else
+   (void)watch;
+   return 0;
+#endif
+}
+
+/* \brief free watcher */
+PNDMANAPI void pndman_watch_free(pndman_watch *watch)
+{
+   _pndman_watch_dir *d, *next;
+   CHECKUSEV(watch);
+
+   for (d = watch->dir; d; d = next) {
+      next = d->next;
+      free(d->relative);
+      free(d);
+   }
+   if (watch->fd != -1) close(watch->fd);
+   free(watch);
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,62 @@
+#include "pndman.h"
+#include "common.h"
+#include <pthread.h>
+
+/* context example,
+ * every thread syncs its own repository list
+ * on its own context, no locking needed.
+ * Compare with the big lock in pthread.c */
+
+#define THREAD_COUNT 4
+
+static void* sync_thread(void *ptr)
+{
+   pndman_context *context;
+   pndman_repository *repository, *repo;
+   pndman_sync_handle handle;
+   size_t id = (size_t)ptr;
+
+   if (!(context = pndman_context_new()))
+      err("failed to create context");
+
+   repository = pndman_repository_init();
+   if (!(repo = pndman_repository_add(REPOSITORY_URL, repository)))
+      err("failed to add repository "REPOSITORY_URL", :/");
+   repo->context = context;
+
+   if (pndman_sync_handle_init(&handle) != 0)
+      err("pndman_sync_handle_init failed");
+   handle.repository = repo;
+   handle.flags      = PNDMAN_SYNC_FULL;
+   handle.callback   = common_sync_cb;
+   handle.context    = context;
+   pndman_sync_handle_perform(&handle);
+
+   while (pndman_context_curl_process(context, 0, 1000) > 0);
+
+   printf("thread %zu : %s\n", id, (repo->pnd ? "got packages" : "no packages"));
+   pndman_repository_free_all(repository);
+   pndman_context_free(context);
+   return NULL;
+}
+
+int main(int argc, char **argv)
+{
+   pthread_t thread[THREAD_COUNT];
+   size_t i;
+
+   puts("-!- TEST context");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_WARN);
+   for (i = 0; i != THREAD_COUNT; ++i)
+      pthread_create(&thread[i], NULL, sync_thread, (void*)i);
+   for (i = 0; i != THREAD_COUNT; ++i)
+      pthread_join(thread[i], NULL);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,83 @@
+#include "pndman.h"
+#include "common.h"
+
+/* duplicate package example,
+ * writes repository database where same id is listed twice
+ * and checks that it is merged into one package. */
+
+#define DUPLICATE_URL "http://example.org/duplicate"
+
+#define DUPLICATE_PND(id, title) \
+   "{\"id\":\""id"\",\"version\":{\"major\":\"1\",\"minor\":\"0\",\"release\":\"0\",\"build\":\"0\"}," \
+   "\"localizations\":{\"en_US\":{\"title\":\""title"\",\"description\":\"\"}}}"
+
+static void write_database(pndman_device *device)
+{
+   char path[PATH_MAX];
+   FILE *f;
+
+   snprintf(path, PATH_MAX-1, "%s/repo.db", device->appdata);
+   if (!(f = fopen(path, "w")))
+      err("failed to write repository database");
+
+   fprintf(f, "[%s]\n", DUPLICATE_URL);
+   fprintf(f, "{\"repository\":{\"name\":\"duplicate\",\"version\":\"1.0\"},\n");
+   fprintf(f, "\"packages\":[\n%s,\n%s,\n%s\n]}\n",
+         DUPLICATE_PND("duplicate", "first"),
+         DUPLICATE_PND("other", "other"),
+         DUPLICATE_PND("duplicate", "second"));
+   fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+   pndman_repository *repository, *remote;
+   pndman_device *device;
+   pndman_package *pnd;
+   int count = 0, duplicates = 0;
+   char *cwd;
+
+   puts("-!- TEST duplicate");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_CRAP);
+   cwd = common_get_path_to_fake_device();
+   if (!(device = pndman_device_add(cwd, NULL)))
+      err("failed to add device, check that it exists");
+
+   repository = pndman_repository_init();
+   if (!(remote = pndman_repository_add(DUPLICATE_URL, repository)))
+      err("failed to add "DUPLICATE_URL);
+
+   /* creates appdata for the database */
+   pndman_repository_commit_all(repository, device);
+   write_database(device);
+
+   pndman_device_read_repository(remote, device);
+   for (pnd = remote->pnd; pnd; pnd = pnd->next) {
+      printf("%s : %s\n", pnd->id, pnd->title ? pnd->title->string : "-");
+      if (!strcmp(pnd->id, "duplicate")) ++duplicates;
+      ++count;
+   }
+
+   if (count != 2 || duplicates != 1)
+      err("duplicate package was not merged");
+   if (strcmp(remote->pnd->title->string, "second"))
+      err("duplicate package was not replaced by later one");
+
+   /* scan table must find ids of packages added above */
+   pndman_device_read_repository(remote, device);
+   for (count = 0, pnd = remote->pnd; pnd; pnd = pnd->next) ++count;
+   if (count != 2)
+      err("reading repository again duplicated packages");
+
+   pndman_repository_free_all(repository);
+   pndman_device_free_all(device);
+   free(cwd);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
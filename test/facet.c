@@ -0,0 +1,54 @@
+#include "pndman.h"
+#include "common.h"
+
+/* facet example,
+ * crawls fake device and prints
+ * category menu with package counts. */
+
+int main(int argc, char **argv)
+{
+   pndman_device *device, *d;
+   pndman_repository *repository;
+   pndman_facet *facet;
+   const char *category[32], *sub[32];
+   char *cwd;
+   int i, j, count, subcount;
+
+   puts("-!- TEST facet");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_CRAP);
+   cwd = common_get_path_to_fake_device();
+   if (!(device = pndman_device_add(cwd, NULL)))
+      err("failed to add device, check that it exists");
+
+   repository = pndman_repository_init();
+   if (!(facet = pndman_facet_new(repository)))
+      err("failed to create facet index");
+
+   /* index follows the repository */
+   for (d = device; d; d = d->next) pndman_package_crawl(0, d, repository);
+
+   if ((count = pndman_facet_values(facet, PNDMAN_FACET_CATEGORY, NULL, category, 32)) == -1)
+      err("failed to get categories");
+
+   for (i = 0; i != count && i != 32; ++i) {
+      printf("%s (%d)\n", category[i],
+            pndman_facet_count(facet, PNDMAN_FACET_CATEGORY, NULL, category[i]));
+      subcount = pndman_facet_values(facet, PNDMAN_FACET_SUBCATEGORY, category[i], sub, 32);
+      for (j = 0; j < subcount && j != 32; ++j)
+         printf("   %s (%d)\n", sub[j],
+               pndman_facet_count(facet, PNDMAN_FACET_SUBCATEGORY, category[i], sub[j]));
+   }
+
+   pndman_facet_free(facet);
+   pndman_repository_free_all(repository);
+   pndman_device_free_all(device);
+   free(cwd);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,58 @@
+#include "pndman.h"
+#include "common.h"
+#include <poll.h>
+
+/* IO thread example,
+ * transfers run on their own thread while this one
+ * waits on the context fd like an UI main loop would.
+ * Callbacks are called from pndman_context_dispatch here. */
+
+int main(int argc, char **argv)
+{
+   pndman_context *context;
+   pndman_repository *repository, *repo;
+   pndman_sync_handle handle;
+   struct pollfd pfd;
+   int frames = 0;
+
+   puts("-!- TEST iothread");
+   puts("");
+
+   if (!(context = pndman_context_new()))
+      err("failed to create context");
+
+   if (pndman_context_start_thread(context) != 0)
+      err("failed to start IO thread");
+
+   repository = pndman_repository_init();
+   if (!(repo = pndman_repository_add(REPOSITORY_URL, repository)))
+      err("failed to add repository "REPOSITORY_URL", :/");
+   repo->context = context;
+
+   if (pndman_sync_handle_init(&handle) != 0)
+      err("pndman_sync_handle_init failed");
+   handle.repository = repo;
+   handle.flags      = PNDMAN_SYNC_FULL;
+   handle.callback   = common_sync_cb;
+   handle.context    = context;
+   if (pndman_sync_handle_perform(&handle) != 0)
+      err("pndman_sync_handle_perform failed");
+
+   /* main loop, draws a frame every 100ms or when events arrive */
+   pfd.fd     = pndman_context_get_fd(context);
+   pfd.events = POLLIN;
+   while (pndman_context_curl_process(context, 0, 0) > 0) {
+      if (poll(&pfd, 1, 100) > 0) pndman_context_dispatch(context);
+      ++frames;
+   }
+
+   printf("\n%d frames, %s\n", frames, (repo->pnd ? "got packages" : "no packages"));
+   pndman_repository_free_all(repository);
+   pndman_context_free(context);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,67 @@
+#include "pndman.h"
+#include "common.h"
+
+/* lazy loading example,
+ * crawls fake device, commits it and
+ * reads database back with lazy loading. */
+
+static int count_translated(pndman_translated *t)
+{
+   int count = 0;
+   for (; t; t = t->next) ++count;
+   return count;
+}
+
+static void print_pnd(pndman_package *pnd)
+{
+   printf("%s : %s (%d titles, %d descriptions)\n", pnd->id,
+         pnd->title ? pnd->title->string : "-",
+         count_translated(pnd->title), count_translated(pnd->description));
+}
+
+int main(int argc, char **argv)
+{
+   pndman_device *device, *d;
+   pndman_repository *repository;
+   pndman_package *pnd;
+   char *cwd;
+
+   puts("-!- TEST lazy");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_CRAP);
+   cwd = common_get_path_to_fake_device();
+   if (!(device = pndman_device_add(cwd, NULL)))
+      err("failed to add device, check that it exists");
+
+   repository = pndman_repository_init();
+   for (d = device; d; d = d->next) pndman_package_crawl(0, d, repository);
+   for (d = device; d; d = d->next) pndman_repository_commit_all(repository, d);
+   pndman_repository_free_all(repository);
+
+   /* read back, leaving heavy fields in database */
+   pndman_set_lazy_load(1);
+   repository = pndman_repository_init();
+   for (d = device; d; d = d->next) pndman_device_read_repository(repository, d);
+
+   for (pnd = repository->pnd; pnd; pnd = pnd->next) {
+      print_pnd(pnd);
+      if (pndman_package_load(pnd) != 0)
+         err("failed to load package");
+      print_pnd(pnd);
+      pndman_package_unload(pnd);
+   }
+
+   /* commit decodes lazy packages by itself */
+   for (d = device; d; d = d->next) pndman_repository_commit_all(repository, d);
+
+   pndman_repository_free_all(repository);
+   pndman_device_free_all(device);
+   free(cwd);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,51 @@
+#include "pndman.h"
+#include "common.h"
+
+/* preferred locale example,
+ * crawls fake device and lists titles
+ * in finnish, falling back to english. */
+
+static void print_titles(pndman_repository *repository)
+{
+   pndman_package *pnd;
+   for (pnd = repository->pnd; pnd; pnd = pnd->next)
+      printf("%s : %s\n", pnd->id,
+            pndman_package_get_title(pnd) ? pndman_package_get_title(pnd) : "-");
+}
+
+int main(int argc, char **argv)
+{
+   pndman_device *device, *d;
+   pndman_repository *repository;
+   char *cwd;
+
+   puts("-!- TEST locale");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_CRAP);
+   cwd = common_get_path_to_fake_device();
+   if (!(device = pndman_device_add(cwd, NULL)))
+      err("failed to add device, check that it exists");
+
+   if (pndman_set_locale("fi_FI.UTF-8:en_US") != 0)
+      err("failed to set locale");
+
+   repository = pndman_repository_init();
+   for (d = device; d; d = d->next) pndman_package_crawl(0, d, repository);
+   print_titles(repository);
+
+   /* cached titles follow the locale */
+   puts("");
+   pndman_set_locale(NULL);
+   print_titles(repository);
+
+   pndman_repository_free_all(repository);
+   pndman_device_free_all(device);
+   free(cwd);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,54 @@
+#include "pndman.h"
+#include "common.h"
+#include <poll.h>
+
+/* monitor example,
+ * adds and removes devices while
+ * cards are inserted and ejected. */
+
+static void monitor_cb(pndman_device_event event, pndman_device *device, void *user_data)
+{
+   (void)user_data;
+   printf("%s : %s (%s)\n", event==PNDMAN_DEVICE_ADDED?"ADDED":"REMOVED",
+         device->mount, device->device);
+}
+
+int main(int argc, char **argv)
+{
+   pndman_device_monitor *monitor;
+   pndman_repository *repository;
+   pndman_device *d;
+   struct pollfd pfd;
+
+   puts("-!- TEST monitor");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_CRAP);
+   repository = pndman_repository_init();
+
+   if (!(monitor = pndman_device_monitor_new(NULL)))
+      err("failed to create monitor");
+   pndman_device_monitor_set_callback(monitor, monitor_cb, NULL);
+   pndman_device_monitor_set_crawl(monitor, repository, 0);
+
+   /* set_crawl crawled devices that were already mounted */
+   for (d = pndman_device_monitor_get_devices(monitor); d; d = d->next)
+      printf("%s : %s\n", d->mount, d->device);
+
+   puts("insert or eject cards, monitoring for 30 seconds");
+   pfd.fd     = pndman_device_monitor_get_fd(monitor);
+   pfd.events = POLLPRI;
+   while (poll(&pfd, 1, 30000) > 0)
+      pndman_device_monitor_dispatch(monitor);
+
+   if ((d = pndman_device_monitor_get_devices(monitor)))
+      pndman_device_free_all(d);
+   pndman_device_monitor_free(monitor);
+   pndman_repository_free_all(repository);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
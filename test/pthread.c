@@ -18,6 +18,10 @@
  * Any other calls should be ok.
  * Generally you should not thread
  * any other call than pndman_curl_process();
+ *
+ * All of this applies to single context,
+ * see context.c for running independent
+ * contexts from different threads without lock.
  */
 
 /* quit mutex */
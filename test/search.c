@@ -0,0 +1,51 @@
+#include "pndman.h"
+#include "common.h"
+
+/* search example,
+ * crawls fake device and searches
+ * local repository with given words. */
+
+int main(int argc, char **argv)
+{
+   pndman_device *device, *d;
+   pndman_repository *repository;
+   pndman_search *search;
+   pndman_package *result[10];
+   const char *query = (argc > 1 ? argv[1] : "pnd");
+   char *cwd;
+   int i, count;
+
+   puts("-!- TEST search");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_CRAP);
+   cwd = common_get_path_to_fake_device();
+   if (!(device = pndman_device_add(cwd, NULL)))
+      err("failed to add device, check that it exists");
+
+   repository = pndman_repository_init();
+   if (!(search = pndman_search_new(repository)))
+      err("failed to create search index");
+
+   /* index follows the repository */
+   for (d = device; d; d = d->next) pndman_package_crawl(0, d, repository);
+
+   if ((count = pndman_search_query(search, query, result, 10)) == -1)
+      err("search failed");
+
+   printf("%d results for \"%s\"\n", count, query);
+   for (i = 0; i != count; ++i)
+      printf("%d. %s : %s\n", i + 1, result[i]->id,
+            result[i]->title ? result[i]->title->string : "-");
+
+   pndman_search_free(search);
+   pndman_repository_free_all(repository);
+   pndman_device_free_all(device);
+   free(cwd);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
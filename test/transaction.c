@@ -0,0 +1,86 @@
+#include "pndman.h"
+#include "common.h"
+
+/* transaction example,
+ * installs packages together and writes
+ * the database once, when all of them are in place. */
+
+#define PACKAGE_COUNT 4
+
+/* handles belong to transaction, so no commit or free here */
+static void package_cb(pndman_curl_code code, pndman_package_handle *handle)
+{
+   if (code == PNDMAN_CURL_DONE ||
+       code == PNDMAN_CURL_FAIL)
+      printf("%s : %s!\n", handle->name,
+            code==PNDMAN_CURL_DONE?"DONE":handle->error);
+}
+
+int main(int argc, char **argv)
+{
+   pndman_device *device;
+   pndman_package *pnd;
+   pndman_repository *repository, *repo;
+   pndman_transaction *transaction;
+   pndman_package_handle *handle;
+   pndman_sync_handle shandle[1];
+   size_t i;
+   char *cwd;
+
+   puts("-!- TEST transaction");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_CRAP);
+   cwd = common_get_path_to_fake_device();
+   if (!(device = pndman_device_add(cwd, NULL)))
+      err("failed to add device, check that it exists");
+
+   repository = pndman_repository_init();
+   if (!(repo = pndman_repository_add(REPOSITORY_URL, repository)))
+      err("failed to add repository "REPOSITORY_URL", :/");
+
+   common_create_sync_handles(shandle, 1, repository, common_sync_cb,
+         PNDMAN_SYNC_FULL);
+
+   puts("");
+   while (pndman_curl_process(0, 1000) > 0);
+   puts("");
+
+   /* check that we actually got pnd's */
+   if (!(pnd = repo->pnd))
+      err("no PND's retivied from "REPOSITORY_URL", maybe it's down?");
+
+   if (!(transaction = pndman_transaction_new(repository, device)))
+      err("failed to create transaction");
+
+   for (i = 0; i != PACKAGE_COUNT && pnd; ++i, pnd = pnd->next) {
+      if (!(handle = pndman_transaction_add(transaction, pnd, device,
+                  PNDMAN_PACKAGE_INSTALL | PNDMAN_PACKAGE_INSTALL_MENU)))
+         err("failed to add package to transaction");
+      handle->callback = package_cb;
+   }
+
+   if (pndman_transaction_perform(transaction) != 0)
+      puts("some downloads failed to start");
+
+   puts("");
+   while (pndman_curl_process(0, 1000) > 0);
+   puts("");
+
+   /* installs everything and writes database, or nothing at all */
+   if (pndman_transaction_commit(transaction) != 0)
+      puts("transaction failed, nothing was installed");
+   else
+      puts("transaction committed");
+
+   pndman_transaction_free(transaction);
+   pndman_repository_free_all(repository);
+   pndman_device_free_all(device);
+   free(cwd);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,72 @@
+#include "pndman.h"
+#include "common.h"
+
+/* upgrade example,
+ * syncs repositories and installs updates
+ * while the remaining transfers still run. */
+
+static void upgrade_cb(pndman_curl_code code, pndman_sync_handle *sync,
+      pndman_package_handle *package, void *user_data)
+{
+   if (code != PNDMAN_CURL_DONE && code != PNDMAN_CURL_FAIL)
+      return;
+
+   if (sync)
+      printf("%s : %s!\n", sync->repository->url,
+            code==PNDMAN_CURL_DONE?"SYNCED":sync->error);
+   else
+      printf("%s : %s!\n", package->name,
+            code==PNDMAN_CURL_DONE?"INSTALLED":package->error);
+}
+
+int main(int argc, char **argv)
+{
+   pndman_device *device, *d;
+   pndman_repository *repository;
+   pndman_upgrade *upgrade;
+   int installed, failed;
+   char *cwd;
+
+   puts("-!- TEST upgrade");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_CRAP);
+   cwd = common_get_path_to_fake_device();
+   if (!(device = pndman_device_add(cwd, NULL)))
+      err("failed to add device, check that it exists");
+
+   repository = pndman_repository_init();
+   if (!pndman_repository_add(REPOSITORY_URL, repository))
+      err("failed to add repository "REPOSITORY_URL", :/");
+
+   common_read_repositories_from_device(repository, device);
+   for (d = device; d; d = d->next) pndman_package_crawl(0, d, repository);
+
+   if (!(upgrade = pndman_upgrade_new(repository, device, 0, PNDMAN_PACKAGE_BACKUP)))
+      err("failed to create upgrade");
+   pndman_upgrade_set_callback(upgrade, upgrade_cb, NULL);
+
+   if (pndman_upgrade_perform(upgrade) != 0)
+      puts("some repositories failed to sync");
+
+   puts("");
+   while (pndman_curl_process(0, 1000) > 0);
+   puts("");
+
+   pndman_upgrade_get_stats(upgrade, &installed, &failed);
+   printf("%d installed, %d failed\n", installed, failed);
+
+   if (pndman_upgrade_commit(upgrade) != 0)
+      puts("failed to write database");
+
+   pndman_upgrade_free(upgrade);
+   pndman_repository_free_all(repository);
+   pndman_device_free_all(device);
+   free(cwd);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
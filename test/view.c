@@ -0,0 +1,54 @@
+#include "pndman.h"
+#include "common.h"
+
+/* view example,
+ * crawls fake device and lists
+ * packages sorted by title. */
+
+int main(int argc, char **argv)
+{
+   pndman_device *device, *d;
+   pndman_repository *repository;
+   pndman_package *pnd;
+   pndman_view *view;
+   char *cwd;
+   int i, count;
+
+   puts("-!- TEST view");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_CRAP);
+   cwd = common_get_path_to_fake_device();
+   if (!(device = pndman_device_add(cwd, NULL)))
+      err("failed to add device, check that it exists");
+
+   repository = pndman_repository_init();
+   if (!(view = pndman_view_new(repository, PNDMAN_VIEW_SORT_TITLE, 0)))
+      err("failed to create view");
+
+   /* view follows the repository */
+   for (d = device; d; d = d->next) pndman_package_crawl(0, d, repository);
+
+   count = pndman_view_count(view);
+   for (i = 0; i < count; ++i) {
+      pnd = pndman_view_get(view, i);
+      printf("%d. %s : %s\n", i + 1, pnd->id,
+            pnd->title ? pnd->title->string : "-");
+   }
+
+   /* same packages, biggest first */
+   pndman_view_set_sort(view, PNDMAN_VIEW_SORT_SIZE, 1);
+   if ((pnd = pndman_view_get(view, 0)))
+      printf("biggest: %s (%lu bytes)\n", pnd->id, (unsigned long)pnd->size);
+
+   pndman_view_free(view);
+   pndman_repository_free_all(repository);
+   pndman_device_free_all(device);
+   free(cwd);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/
@@ -0,0 +1,55 @@
+#include "pndman.h"
+#include "common.h"
+#include <poll.h>
+
+/* watch example,
+ * keeps local repository up to date while
+ * PNDs are copied to or removed from device. */
+
+static void watch_cb(pndman_watch_event event, pndman_package *pnd, void *user_data)
+{
+   const char *what[] = { "ADDED", "CHANGED", "REMOVED", "RESCAN" };
+   (void)user_data;
+   printf("%s : %s\n", what[event], pnd?pnd->id:"-");
+}
+
+int main(int argc, char **argv)
+{
+   pndman_device *device, *d;
+   pndman_repository *repository;
+   pndman_watch *watch;
+   struct pollfd pfd;
+   char *cwd;
+
+   puts("-!- TEST watch");
+   puts("");
+
+   pndman_set_verbose(PNDMAN_LEVEL_CRAP);
+   cwd = common_get_path_to_fake_device();
+   if (!(device = pndman_device_add(cwd, NULL)))
+      err("failed to add device, check that it exists");
+
+   repository = pndman_repository_init();
+   for (d = device; d; d = d->next) pndman_package_crawl(0, d, repository);
+
+   if (!(watch = pndman_watch_new(device, repository, 0)))
+      err("failed to create watch");
+   pndman_watch_set_callback(watch, watch_cb, NULL);
+
+   puts("copy PNDs to device, watching for 30 seconds");
+   pfd.fd     = pndman_watch_get_fd(watch);
+   pfd.events = POLLIN;
+   while (poll(&pfd, 1, 30000) > 0)
+      pndman_watch_dispatch(watch);
+
+   pndman_watch_free(watch);
+   pndman_repository_free_all(repository);
+   pndman_device_free_all(device);
+   free(cwd);
+
+   puts("");
+   puts("-!- DONE");
+   return EXIT_SUCCESS;
+}
+
+/* vim: set ts=8 sw=3 tw=0 :*/